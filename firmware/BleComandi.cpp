@@ -0,0 +1,45 @@
+#include "BleComandi.h"
+
+bool comandoValido(uint8_t cmd) {
+    return (cmd >= CMD_ACQUA && cmd <= CMD_THE) || cmd == CMD_ANNULLA ||
+           cmd == CMD_CONFERMA || cmd == CMD_RIFORNIMENTO || cmd == CMD_CALIBRA;
+}
+
+// Lunghezza e valori dell'argomento ammessi per il comando
+static bool argomentiValidi(const ComandoBle &c, uint8_t quantitaMax) {
+    if (c.nArgs == 0) return true;
+    if (c.cmd == CMD_CONFERMA) {
+        return c.nArgs == 1 && c.args[0] >= 1 && c.args[0] <= quantitaMax;
+    }
+    if (c.cmd == CMD_RIFORNIMENTO) {
+        if (c.nArgs != 4) return false;
+        int totale = 0;
+        for (int i = 0; i < 4; i++) {
+            if (c.args[i] > quantitaMax) return false;
+            totale += c.args[i];
+        }
+        return totale > 0;
+    }
+    if (c.cmd == CMD_CALIBRA) {
+        return c.nArgs == 1 && (c.args[0] <= CALIBRA_TAGLI || c.args[0] == CALIBRA_CANCELLA);
+    }
+    return false;
+}
+
+int lottoDecodifica(const uint8_t *tlv, uint16_t len, ComandoBle *comandi, uint8_t quantitaMax) {
+    int n = 0;
+    uint16_t i = 0;
+    while (i < len) {
+        if (n == LOTTO_MAX_COMANDI || len - i < 2) return 0;
+        ComandoBle &c = comandi[n];
+        c.cmd = tlv[i];
+        c.nArgs = tlv[i + 1];
+        i += 2;
+        if (!comandoValido(c.cmd) || c.nArgs > COMANDO_MAX_ARGS || c.nArgs > len - i) return 0;
+        for (int a = 0; a < c.nArgs; a++) c.args[a] = tlv[i + a];
+        i += c.nArgs;
+        if (!argomentiValidi(c, quantitaMax)) return 0;
+        n++;
+    }
+    return n;
+}
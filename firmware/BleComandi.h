@@ -0,0 +1,68 @@
+#ifndef BLECOMANDI_H
+#define BLECOMANDI_H
+
+#include <cstdint>
+
+/**
+ * @brief Formati di scrittura sulla caratteristica CMD (0xA004)
+ *
+ *   [cmd]                   comando singolo (app esistenti), nessun esito
+ *   [cmd, seq]              comando singolo, esito [seq, cmd, esito] su RESULT
+ *   [CMD_LOTTO, seq, TLV…]  più comandi in una sola scrittura ATT:
+ *                           TLV = tipo (codice comando), lunghezza, valore
+ *
+ * Il lotto è validato per intero prima di eseguire qualsiasi comando (tipi noti,
+ * lunghezze e argomenti ammessi); valido → comandi accodati insieme alla FSM ed
+ * eseguiti in sequenza senza eventi estranei in mezzo, altrimenti nessuno. Il primo
+ * comando rifiutato (stato, credito, scorte) ferma il lotto: i successivi hanno esito
+ * SALTATO e non sono eseguiti.
+ * Il comando i-esimo del lotto ha esito con sequenza seq + i; un lotto malformato
+ * o senza spazio in coda ha un solo esito [seq, CMD_LOTTO, motivo].
+ *
+ * Argomenti (lunghezza 0 = comportamento del comando singolo):
+ *   CMD_CONFERMA      1 byte: pezzi da erogare (1..quantitaMax)
+ *   CMD_RIFORNIMENTO  4 byte: pezzi da aggiungere a ACQUA, SNACK, CAFFE, THE
+ *                     (0..quantitaMax ciascuno, almeno uno > 0)
+ *   CMD_CALIBRA       1 byte: 1-3 raccoglie le monete seguenti come 0.50/1/2 EUR,
+ *                     CALIBRA_ANNULLA chiude la raccolta senza salvare,
+ *                     CALIBRA_CANCELLA cancella la calibrazione in flash;
+ *                     senza argomento (anche [12] e [12, seq]) calcola e salva il modello
+ */
+
+enum CodiceComando {
+    CMD_ACQUA = 1,
+    CMD_SNACK = 2,
+    CMD_CAFFE = 3,
+    CMD_THE = 4,
+    CMD_ANNULLA = 9,
+    CMD_CONFERMA = 10,
+    CMD_RIFORNIMENTO = 11,
+    CMD_CALIBRA = 12,
+    CMD_LOTTO = 0x80
+};
+
+#define CMD_MAX_LEN         20      // Scrittura ATT massima (ATT_MTU 23)
+#define LOTTO_MAX_COMANDI   9       // (CMD_MAX_LEN - 2) / 2: TLV senza valore
+#define COMANDO_MAX_ARGS    4
+
+// Argomento di CMD_CALIBRA (e di EV_CALIBRA)
+#define CALIBRA_ANNULLA     0
+#define CALIBRA_SALVA       0x80    // Comando senza argomento
+#define CALIBRA_CARICATA    0x81    // Solo log: calibrazione letta dalla flash al boot
+#define CALIBRA_CANCELLA    0xFF
+#define CALIBRA_TAGLI       3       // Tagli 1..CALIBRA_TAGLI (TAGLI in CoinClassifier.h)
+
+struct ComandoBle {
+    uint8_t cmd;
+    uint8_t nArgs;
+    uint8_t args[COMANDO_MAX_ARGS];
+};
+
+// Codice di comando singolo valido (1-4, 9, 10, 11, 12)
+bool comandoValido(uint8_t cmd);
+
+// TLV del lotto (dopo CMD_LOTTO e seq) → comandi[LOTTO_MAX_COMANDI];
+// ritorna il numero di comandi, 0 se il lotto è vuoto o malformato
+int lottoDecodifica(const uint8_t *tlv, uint16_t len, ComandoBle *comandi, uint8_t quantitaMax);
+
+#endif
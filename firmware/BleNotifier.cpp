@@ -0,0 +1,150 @@
+#include "BleNotifier.h"
+#include <cstring>
+
+BleNotifier::BleNotifier(hal::BleLink &link) :
+    _link(link), _flushTask(nullptr), _flushPendente(false), _timerId(0), _timerUs(0)
+{
+    memset(_car, 0, sizeof(_car));
+}
+
+void BleNotifier::begin(hal::Task flushTask) {
+    _flushTask = flushTask;
+}
+
+void BleNotifier::intervalloMin(hal::BleCharId id, uint32_t ms) {
+    _car[id].minUs = ms * 1000;
+}
+
+void BleNotifier::timbro(hal::BleCharId id, BleTimbro fn) {
+    _car[id].timbro = fn;
+}
+
+/**
+ * @brief Nuovo valore della caratteristica (nessuna scrittura GATT immediata)
+ * Il flush è schedulato una sola volta per turno della coda eventi: i set()
+ * successivi nello stesso tick sostituiscono il valore in attesa.
+ */
+void BleNotifier::set(hal::BleCharId id, const void *data, uint16_t len) {
+    Caratteristica &c = _car[id];
+    if (len > BLE_VALORE_MAX) len = BLE_VALORE_MAX;
+    c.stats.richieste++;
+
+    if (c.sporco) c.stats.accorpati++;     // Il valore in attesa non sarà mai inviato
+    memcpy(c.valore, data, len);
+    c.len = len;
+
+    if (c.inviatoValido && len == c.lenInviato && memcmp(c.valore, c.inviato, len) == 0) {
+        c.sporco = false;
+        c.stats.invariati++;
+        return;
+    }
+    if (!c.sottoscritta) {
+        c.sporco = false;                   // Inviato alla sottoscrizione
+        c.stats.nonSottoscritti++;
+        return;
+    }
+    c.sporco = true;
+    schedula();
+}
+
+/**
+ * @brief Record per una caratteristica a eventi (nessun intervallo minimo)
+ * I record dello stesso tick viaggiano nella stessa notifica finché entrano nel payload.
+ */
+void BleNotifier::accoda(hal::BleCharId id, const void *record, uint16_t len) {
+    Caratteristica &c = _car[id];
+    c.eventi = true;
+    c.stats.richieste++;
+    if (!c.sottoscritta) {
+        c.stats.nonSottoscritti++;
+        return;
+    }
+    if (!c.sporco) c.len = 0;
+    if (c.len + len > BLE_VALORE_MAX) scrivi(id, hal::now_us());
+    else if (c.sporco) c.stats.accorpati++;
+    memcpy(c.valore + c.len, record, len);
+    c.len += len;
+    c.sporco = true;
+    schedula();
+}
+
+void BleNotifier::schedula() {
+    if (_flushPendente || !_flushTask) return;
+    _flushPendente = true;
+    if (!hal::call(_flushTask)) _flushPendente = false;    // Coda piena: riprova al prossimo valore
+}
+
+/**
+ * @brief Scrive le caratteristiche in attesa (coda eventi)
+ * Quelle ancora dentro l'intervallo minimo restano in attesa: un timer unico
+ * riprova alla prima scadenza.
+ */
+void BleNotifier::flush() {
+    uint64_t now = hal::now_us();
+    uint64_t prossimo = 0;
+    _flushPendente = false;
+    if (_timerId && now >= _timerUs) _timerId = 0;     // Timer appena scaduto (questa esecuzione)
+
+    for (int i = 0; i < hal::BLE_CHAR_COUNT; i++) {
+        Caratteristica &c = _car[i];
+        if (!c.sporco || !c.sottoscritta) continue;
+
+        uint64_t pronto = c.ultimoUs + c.minUs;
+        if (c.inviatoValido && now < pronto) {
+            if (prossimo == 0 || pronto < prossimo) prossimo = pronto;
+            continue;
+        }
+        scrivi(i, now);
+    }
+
+    if (prossimo && (!_timerId || prossimo < _timerUs)) {
+        if (_timerId) hal::cancel(_timerId);
+        _timerUs = prossimo;
+        _timerId = hal::call_in_ms((uint32_t)((prossimo - now + 999) / 1000), _flushTask);
+    }
+}
+
+void BleNotifier::scrivi(int id, uint64_t now) {
+    Caratteristica &c = _car[id];
+    if (c.timbro) {
+        uint8_t timbrato[BLE_VALORE_MAX];
+        memcpy(timbrato, c.valore, c.len);
+        c.timbro(timbrato, c.len);
+        _link.write((hal::BleCharId)id, timbrato, c.len);
+    } else {
+        _link.write((hal::BleCharId)id, c.valore, c.len);
+    }
+    memcpy(c.inviato, c.valore, c.len);
+    c.lenInviato = c.len;
+    c.inviatoValido = true;
+    c.sporco = false;
+    c.ultimoUs = now;
+    c.stats.scritture++;
+    if (c.eventi) c.len = 0;
+}
+
+/**
+ * @brief Il client ha scritto il CCCD
+ * All'abilitazione il valore corrente è inviato subito (il client non lo conosce).
+ */
+void BleNotifier::sottoscrizione(hal::BleCharId id, bool attiva) {
+    Caratteristica &c = _car[id];
+    c.sottoscritta = attiva;
+    if (!attiva) {
+        c.sporco = false;
+        return;
+    }
+    if (c.len == 0 || c.eventi) return;     // Nessun valore ancora prodotto / record già persi
+    c.inviatoValido = false;
+    c.sporco = true;
+    c.stats.sottoscrizioni++;
+    schedula();
+}
+
+void BleNotifier::disconnessione() {
+    for (int i = 0; i < hal::BLE_CHAR_COUNT; i++) {
+        _car[i].sottoscritta = false;
+        _car[i].sporco = false;
+        _car[i].inviatoValido = false;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef BLENOTIFIER_H
+#define BLENOTIFIER_H
+
+#include "hal/hal.h"
+
+/**
+ * @brief Scheduler delle notifiche GATT (TEMP, STATUS, HUM, SNAPSHOT)
+ *
+ * L'applicazione chiama set() ogni volta che un valore può essere cambiato, anche più
+ * volte nello stesso tick; la scrittura GATT avviene solo quando serve:
+ * - valore uguale all'ultimo inviato → soppresso;
+ * - nessun client sottoscritto (CCCD) → soppresso, il valore corrente è inviato
+ *   appena il client abilita le notifiche;
+ * - più set() prima del flush (stesso turno della coda eventi) → una sola scrittura
+ *   con l'ultimo valore;
+ * - intervallo minimo per caratteristica: i cambi ravvicinati sono rimandati e
+ *   inviati (solo l'ultimo) allo scadere dell'intervallo.
+ *
+ * Caratteristiche a eventi (accoda(), es. esiti dei comandi): i record si sommano nel
+ * valore in attesa invece di sostituirlo, mai soppressi come invariati né reinviati
+ * alla sottoscrizione; a valore pieno (BLE_VALORE_MAX) il pendente è scritto subito.
+ *
+ * Timbro (opzionale, per caratteristica): funzione applicata a una copia del valore
+ * appena prima della scrittura (es. seq + istante di invio dello SNAPSHOT). Il
+ * confronto con l'ultimo inviato usa il valore senza timbro.
+ *
+ * Tutti i metodi vanno chiamati dalla coda eventi (FSM, task periodici, callback BLE).
+ */
+
+#define BLE_VALORE_MAX  20      // Payload massimo di una notifica (ATT_MTU 23)
+
+struct BleNotificaStats {
+    uint32_t richieste;         // Chiamate a set()
+    uint32_t scritture;         // Scritture GATT eseguite
+    uint32_t sottoscrizioni;    // ...di cui valore iniziale all'abilitazione del CCCD
+    uint32_t invariati;         // Soppresse: valore uguale all'ultimo inviato
+    uint32_t nonSottoscritti;   // Soppresse: nessun client in ascolto
+    uint32_t accorpati;         // Sostituite da un set() successivo prima dell'invio
+};
+
+typedef void (*BleTimbro)(uint8_t *valore, uint16_t len);
+
+class BleNotifier {
+public:
+    BleNotifier(hal::BleLink &link);
+
+    // flushTask: funzione che chiama flush(), schedulata con hal::call()/call_in_ms()
+    void begin(hal::Task flushTask);
+    void intervalloMin(hal::BleCharId id, uint32_t ms);
+    void timbro(hal::BleCharId id, BleTimbro fn);
+
+    void set(hal::BleCharId id, const void *data, uint16_t len);
+    void accoda(hal::BleCharId id, const void *record, uint16_t len);  // Caratteristica a eventi
+    void flush();
+
+    void sottoscrizione(hal::BleCharId id, bool attiva);   // BleListener::onSubscription
+    void disconnessione();                                  // BleListener::onDisconnect
+
+    const BleNotificaStats &stats(hal::BleCharId id) const { return _car[id].stats; }
+
+private:
+    struct Caratteristica {
+        uint8_t valore[BLE_VALORE_MAX];     // Ultimo valore richiesto
+        uint16_t len;
+        uint8_t inviato[BLE_VALORE_MAX];    // Ultimo valore scritto
+        uint16_t lenInviato;
+        bool inviatoValido;                 // false: il client non ha ancora il valore
+        bool sporco;                        // Valore da scrivere
+        bool sottoscritta;
+        uint64_t ultimoUs;                  // Istante dell'ultima scrittura
+        uint32_t minUs;
+        BleTimbro timbro;
+        bool eventi;                        // Valore = record accodati (accoda())
+        BleNotificaStats stats;
+    };
+
+    hal::BleLink &_link;
+    hal::Task _flushTask;
+    Caratteristica _car[hal::BLE_CHAR_COUNT];
+    bool _flushPendente;
+    int _timerId;
+    uint64_t _timerUs;                      // Scadenza del timer di intervallo minimo
+
+    void schedula();
+    void scrivi(int id, uint64_t now);
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "BleSnapshot.h"
+
+static void scriviU16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void scriviU32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t leggiU16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t leggiU32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int snapshotCodifica(const Snapshot &s, uint8_t *buf) {
+    buf[0] = SNAPSHOT_VERSIONE;
+    snapshotTimbra(buf, s.seq, s.t_ms);
+    scriviU16(buf + 7, s.credito);
+    buf[9] = s.stato;
+    buf[10] = s.prodotto;
+    for (int i = 0; i < 4; i++) buf[11 + i] = s.scorte[i];
+    buf[15] = (uint8_t)s.temp;
+    buf[16] = s.hum;
+    buf[17] = s.flag;
+    scriviU16(buf + 18, s.centesimi);
+    return SNAPSHOT_LEN;
+}
+
+void snapshotTimbra(uint8_t *buf, uint16_t seq, uint32_t t_ms) {
+    scriviU16(buf + 1, seq);
+    scriviU32(buf + 3, t_ms);
+}
+
+bool snapshotDecodifica(const uint8_t *buf, int len, Snapshot &s) {
+    if (len < SNAPSHOT_LEN_V1 || buf[0] < 1) return false;     // Versioni successive: campi noti + coda
+    bool v2 = (buf[0] >= 2 && len >= SNAPSHOT_LEN);
+    s.seq = leggiU16(buf + 1);
+    s.t_ms = leggiU32(buf + 3);
+    s.credito = leggiU16(buf + 7);
+    s.stato = buf[9];
+    s.prodotto = buf[10];
+    for (int i = 0; i < 4; i++) s.scorte[i] = buf[11 + i];
+    s.temp = (int8_t)buf[15];
+    s.hum = buf[16];
+    s.flag = buf[17];
+    s.centesimi = v2 ? leggiU16(buf + 18) : (uint16_t)(s.credito * 100);
+    return true;
+}
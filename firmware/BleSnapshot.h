@@ -0,0 +1,56 @@
+#ifndef BLESNAPSHOT_H
+#define BLESNAPSHOT_H
+
+#include <cstdint>
+
+/**
+ * @brief Caratteristica SNAPSHOT (0xA005): tutti i campi in una sola notifica
+ *
+ * Sostituisce, per i client che la conoscono, le tre notifiche TEMP/HUM/STATUS:
+ * un solo pacchetto ATT invece di tre, con numero di sequenza (notifiche perse)
+ * e istante di invio. TEMP, HUM e STATUS restano per i client esistenti.
+ *
+ * Formato v2, 20 byte little-endian (v1: i primi 18):
+ *   [0]      versione (1)          [9]      stato FSM
+ *   [1..2]   seq (uint16)          [10]     prodotto selezionato (1..4)
+ *   [3..6]   t_ms (uint32)         [11..14] scorte[1..4]
+ *   [7..8]   credito EUR (uint16)  [15]     temperatura °C (int8)
+ *                                  [16]     umidità % (uint8)
+ *                                  [17]     flag (SNAPSHOT_FLAG_*)
+ *   [18..19] credito in centesimi (uint16, v2): [7..8] resta in EUR interi per i client v1
+ *
+ * seq e t_ms sono scritti da snapshotTimbra() al momento dell'invio: seq cresce di
+ * uno per notifica, così il client vede i buchi. Versioni future possono solo
+ * aggiungere byte in coda: un client v1 legge i primi 18 e ignora il resto.
+ */
+
+#define SNAPSHOT_VERSIONE   2
+#define SNAPSHOT_LEN        20
+#define SNAPSHOT_LEN_V1     18
+
+#define SNAPSHOT_FLAG_DHT       0x01    // Temperatura/umidità da lettura DHT11 valida
+#define SNAPSHOT_FLAG_PRESENZA  0x02    // Utente davanti alla macchina (sonar)
+
+struct Snapshot {
+    uint16_t seq;
+    uint32_t t_ms;
+    uint16_t credito;       // EUR interi
+    uint8_t stato;
+    uint8_t prodotto;
+    uint8_t scorte[4];
+    int8_t temp;
+    uint8_t hum;
+    uint8_t flag;
+    uint16_t centesimi;     // v2 (da un client v1: credito × 100)
+};
+
+// Serializza s (seq e t_ms compresi) in buf[SNAPSHOT_LEN]; ritorna SNAPSHOT_LEN
+int snapshotCodifica(const Snapshot &s, uint8_t *buf);
+
+// Scrive seq e t_ms in un buffer già codificato (appena prima della notifica)
+void snapshotTimbra(uint8_t *buf, uint16_t seq, uint32_t t_ms);
+
+// false se versione non valida (0) o lunghezza insufficiente; versioni successive accettate
+bool snapshotDecodifica(const uint8_t *buf, int len, Snapshot &s);
+
+#endif
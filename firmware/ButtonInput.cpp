@@ -0,0 +1,53 @@
+#include "ButtonInput.h"
+
+ButtonInput::ButtonInput(hal::EdgeIn &pin, hal::Timeout &timeout, int livelloPremuto, uint32_t debounceUs) :
+    _pin(pin), _timeout(timeout), _livelloPremuto(livelloPremuto), _debounceUs(debounceUs),
+    _finestraIsr(nullptr), _callback(nullptr), _premuto(false), _finestra(false), _fronteUs(0),
+    _pressioni(0), _rimbalzi(0)
+{
+}
+
+void ButtonInput::start(hal::Isr fronteIsr, hal::Isr finestraIsr, PressioneCallback premuto) {
+    _finestraIsr = finestraIsr;
+    _callback = premuto;
+    hal::critical_enter();
+    _premuto = (_pin.read() == _livelloPremuto);    // Tasto già premuto all'avvio: nessun evento
+    hal::critical_exit();
+    _pin.fall(fronteIsr);
+    _pin.rise(fronteIsr);
+}
+
+/**
+ * @brief Interrupt Service Routine - fronte del pulsante (salita o discesa)
+ * Fuori dalla finestra di debounce il fronte conta se cambia lo stato stabile.
+ */
+void ButtonInput::onFronte() {
+    uint64_t t = hal::now_us();
+    _fronteUs = t;
+    if (_finestra) {
+        _rimbalzi = _rimbalzi + 1;
+        return;
+    }
+    bool premuto = (_pin.read() == _livelloPremuto);
+    if (premuto != _premuto) accetta(premuto, t);   // Altrimenti disturbo già rientrato
+}
+
+/**
+ * @brief Interrupt Service Routine - fine della finestra di debounce (hal::Timeout)
+ * Un cambio di livello coperto dai rimbalzi è accettato adesso, con l'istante
+ * dell'ultimo fronte (quando il pin si è assestato).
+ */
+void ButtonInput::onFinestra() {
+    _finestra = false;
+    bool premuto = (_pin.read() == _livelloPremuto);
+    if (premuto != _premuto) accetta(premuto, _fronteUs);
+}
+
+void ButtonInput::accetta(bool premuto, uint64_t t) {
+    _premuto = premuto;
+    _finestra = true;
+    _timeout.attach_us(_finestraIsr, _debounceUs);
+    if (!premuto) return;
+    _pressioni = _pressioni + 1;
+    if (_callback) _callback(t);
+}
@@ -0,0 +1,63 @@
+#ifndef BUTTONINPUT_H
+#define BUTTONINPUT_H
+
+#include "hal/hal.h"
+
+/**
+ * @brief Pulsante su interrupt (hal::EdgeIn) con debounce sui fronti
+ *
+ * Sostituisce la lettura a 100ms nel tick: la pressione è segnalata dall'ISR del primo
+ * fronte con il suo istante (hal::now_us()), senza attendere la fine dei rimbalzi.
+ *
+ *   fronte → livello letto nell'ISR → cambia lo stato stabile? → accettato (premuto:
+ *            callback), parte la finestra di debounce
+ *   fronti nella finestra → rimbalzi, ignorati
+ *   fine finestra (hal::Timeout) → livello diverso dallo stato? → cambio accettato
+ *                                  con l'istante dell'ultimo fronte visto
+ *
+ * Il livello è riletto nell'ISR: un disturbo più breve della latenza dell'interrupt
+ * trova il pin già tornato a riposo e non conta. La verifica a fine finestra recupera
+ * i cambi nascosti dai rimbalzi (es. tocco più breve della finestra).
+ *
+ * Un solo pin per istanza; le ISR sono funzioni libere (hal::Isr) che il chiamante
+ * inoltra a onFronte() (entrambi i fronti) e onFinestra() (Timeout). Le due ISR vanno
+ * alla stessa priorità (default Mbed per EXTI e ticker): non si interrompono a vicenda.
+ */
+
+typedef void (*PressioneCallback)(uint64_t t_us);   // Contesto ISR
+
+class ButtonInput {
+public:
+    static const uint32_t DEBOUNCE_US = 30000;      // Rimbalzi tipici dei tasti: 1-10ms
+
+    ButtonInput(hal::EdgeIn &pin, hal::Timeout &timeout, int livelloPremuto = 0,
+                uint32_t debounceUs = DEBOUNCE_US);
+
+    void start(hal::Isr fronteIsr, hal::Isr finestraIsr, PressioneCallback premuto);
+
+    bool premuto() const { return _premuto; }       // Stato stabile
+    uint32_t pressioni() const { return _pressioni; }
+    uint32_t rimbalzi() const { return _rimbalzi; } // Fronti scartati nella finestra di debounce
+
+    // --- Contesto ISR ---
+    void onFronte();
+    void onFinestra();
+
+private:
+    hal::EdgeIn &_pin;
+    hal::Timeout &_timeout;
+    int _livelloPremuto;
+    uint32_t _debounceUs;
+    hal::Isr _finestraIsr;
+    PressioneCallback _callback;
+
+    volatile bool _premuto;
+    volatile bool _finestra;        // Debounce in corso (Timeout armato)
+    volatile uint64_t _fronteUs;    // Ultimo fronte visto, anche se scartato
+    volatile uint32_t _pressioni;
+    volatile uint32_t _rimbalzi;
+
+    void accetta(bool premuto, uint64_t t);
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "CoinClassifier.h"
+#include <cstdio>
+#include <cstring>
+
+const uint16_t centesimiTaglio[TAGLI] = {50, 100, 200};
+
+const char *formatoEuro(int32_t centesimi, char buf[EURO_LEN]) {
+    const char *segno = (centesimi < 0) ? "-" : "";
+    int32_t c = (centesimi < 0) ? -centesimi : centesimi;
+    if (c % 100 == 0) snprintf(buf, EURO_LEN, "%s%d", segno, (int)(c / 100));
+    else snprintf(buf, EURO_LEN, "%s%d.%02d", segno, (int)(c / 100), (int)(c % 100));
+    return buf;
+}
+
+void caratteristicheMoneta(const EventoLdr &uscita, int32_t f[MONETA_CARATTERISTICHE]) {
+    f[0] = (int32_t)uscita.durata_us;
+    f[1] = (int32_t)uscita.profondita;
+    f[2] = (int32_t)uscita.area;
+}
+
+// ======================================================================================
+// CLASSIFICAZIONE (coda eventi, una volta per moneta)
+// ======================================================================================
+
+uint8_t classificaMoneta(const CalibrazioneMonete &cal, const int32_t f[MONETA_CARATTERISTICHE],
+                         uint32_t *distanza) {
+    uint8_t migliore = TAGLIO_IGNOTO;
+    uint64_t minima = UINT64_MAX;
+
+    for (int t = 0; t < TAGLI; t++) {
+        if (!(cal.tagli & (1u << t))) continue;
+        const ModelloTaglio &m = cal.taglio[t];
+        uint64_t d = 0;
+        for (int i = 0; i < MONETA_CARATTERISTICHE; i++) {
+            int64_t z = ((int64_t)(f[i] - m.media[i]) * m.inv[i]) >> 16;   // σ in Q8
+            if (z > 0xFFFF) z = 0xFFFF;
+            if (z < -0xFFFF) z = -0xFFFF;
+            d += (uint64_t)(z * z);
+        }
+        if (d < minima) {
+            minima = d;
+            migliore = (uint8_t)t;
+        }
+    }
+
+    uint64_t soglia = (uint64_t)(CALIB_RIFIUTO_SIGMA << 8) * (CALIB_RIFIUTO_SIGMA << 8);
+    if (distanza) *distanza = (minima > UINT32_MAX) ? UINT32_MAX : (uint32_t)minima;
+    return (minima <= soglia) ? migliore : (uint8_t)TAGLIO_IGNOTO;
+}
+
+static uint32_t radice(uint64_t x) {
+    uint64_t r = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (bit > x) bit >>= 2;
+    while (bit) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+uint32_t distanzaSigma10(uint32_t distanzaQ16) {
+    return (radice(distanzaQ16) * 10 + 128) >> 8;
+}
+
+// ======================================================================================
+// ADDESTRAMENTO
+// ======================================================================================
+
+void addestramentoAzzera(AddestramentoMonete &a) {
+    memset(&a, 0, sizeof(a));
+}
+
+bool addestramentoAggiungi(AddestramentoMonete &a, uint8_t taglio, const int32_t f[MONETA_CARATTERISTICHE]) {
+    if (taglio >= TAGLI || a.monete[taglio] >= CALIB_MAX_MONETE) return false;
+    if (a.monete[taglio] == 0) {
+        for (int i = 0; i < MONETA_CARATTERISTICHE; i++) a.rif[taglio][i] = f[i];
+    }
+    for (int i = 0; i < MONETA_CARATTERISTICHE; i++) {
+        int64_t d = (int64_t)f[i] - a.rif[taglio][i];
+        a.somma[taglio][i] += d;
+        a.quadrati[taglio][i] += (uint64_t)(d * d);
+    }
+    a.monete[taglio]++;
+    return true;
+}
+
+/**
+ * @brief Media e σ per taglio; σ ha un minimo dell'1% della media (e 1 unità) perché
+ *        poche monete troppo simili non rendano il modello intollerante al rumore
+ */
+bool addestramentoCalcola(const AddestramentoMonete &a, uint16_t minMonete, CalibrazioneMonete &cal) {
+    memset(&cal, 0, sizeof(cal));
+    for (int t = 0; t < TAGLI; t++) {
+        int64_t n = a.monete[t];
+        if (n == 0 || n < minMonete) continue;
+        ModelloTaglio &m = cal.taglio[t];
+        for (int i = 0; i < MONETA_CARATTERISTICHE; i++) {
+            int64_t s = a.somma[t][i];
+            int64_t media = a.rif[t][i] + s / n;
+            uint64_t varianza = (a.quadrati[t][i] - (uint64_t)(s * s / n)) / n;
+            uint32_t sigma = radice(varianza);
+            uint32_t minimo = (uint32_t)((media < 0 ? -media : media) / 100) + 1;
+            if (sigma < minimo) sigma = minimo;
+            m.media[i] = (int32_t)media;
+            m.inv[i] = (1u << 24) / sigma;
+        }
+        m.monete = (uint16_t)n;
+        cal.tagli |= (uint16_t)(1u << t);
+    }
+    return cal.tagli != 0;
+}
+
+// ======================================================================================
+// INTEGRITÀ (calibrazione salvata nel giornale in flash)
+// ======================================================================================
+
+static uint32_t crc32(const uint8_t *p, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    return ~crc;
+}
+
+static uint32_t crcCalibrazione(const CalibrazioneMonete &cal) {
+    return crc32((const uint8_t *)&cal, offsetof(CalibrazioneMonete, crc));
+}
+
+bool calibrazioneValida(const CalibrazioneMonete &cal) {
+    return cal.magic == CALIB_MAGIC && cal.versione == CALIB_VERSIONE && cal.tagli != 0 &&
+           cal.crc == crcCalibrazione(cal);
+}
+
+void calibrazioneSigilla(CalibrazioneMonete &cal) {
+    cal.magic = CALIB_MAGIC;
+    cal.versione = CALIB_VERSIONE;
+    cal.crc = crcCalibrazione(cal);
+}
@@ -0,0 +1,89 @@
+#ifndef COINCLASSIFIER_H
+#define COINCLASSIFIER_H
+
+#include "CoinDetector.h"
+
+/**
+ * @brief Riconoscimento del taglio dalla forma dell'impulso LDR (CoinDetector)
+ *
+ * Tre caratteristiche per moneta: durata, profondità (Δ massimo) e area dell'impulso.
+ * Modello a centroidi per taglio in virgola fissa: media e 2^24/σ per caratteristica;
+ * la distanza è Σ z² con z = (x - media)/σ in Q8 (solo moltiplicazioni intere, nessuna
+ * divisione per moneta). Vince il taglio più vicino; oltre CALIB_RIFIUTO_SIGMA la
+ * moneta non è riconosciuta e non dà credito.
+ *
+ * La calibrazione si fa sulla macchina (stessa illuminazione, stessa guida): N monete
+ * per taglio raccolte da addestramentoAggiungi(), poi addestramentoCalcola() e
+ * calibrazioneSigilla(); il chiamante la salva nel giornale in flash (FlashJournal).
+ * Senza calibrazione valida ogni moneta vale 1 EUR (TAGLIO_NON_CALIBRATO, come nelle
+ * versioni precedenti).
+ *
+ * Con un solo LDR la durata dipende dalla velocità della moneta: il modello vale per
+ * una guida a velocità costante (scivolo/rotaia), non per una caduta libera.
+ */
+
+enum TaglioMoneta {
+    TAGLIO_50C = 0,
+    TAGLIO_1E,
+    TAGLIO_2E,
+    TAGLI
+};
+
+#define TAGLIO_IGNOTO           0xFF
+#define TAGLIO_NON_CALIBRATO    TAGLIO_1E   // Ogni moneta senza calibrazione (come fino alla v8.29)
+#define MONETA_CARATTERISTICHE  3       // Durata (μs), profondità (scala LDR), area (scala × ms)
+
+#define CALIB_MAGIC             0x434F494Eu     // "COIN"
+#define CALIB_VERSIONE          1
+#define CALIB_MIN_MONETE        8       // Monete per taglio perché il taglio sia calibrato
+#define CALIB_MAX_MONETE        100     // Oltre, le monete raccolte sono ignorate
+#define CALIB_RIFIUTO_SIGMA     5       // Distanza massima dal centroide (in σ)
+
+extern const uint16_t centesimiTaglio[TAGLI];   // 50, 100, 200
+
+// Importo in EUR per LCD e log: "2" per gli euro interi (come prima dei centesimi), "1.50" altrimenti
+#define EURO_LEN 12
+const char *formatoEuro(int32_t centesimi, char buf[EURO_LEN]);
+
+struct ModelloTaglio {
+    int32_t media[MONETA_CARATTERISTICHE];
+    uint32_t inv[MONETA_CARATTERISTICHE];   // 2^24 / σ (σ fino a 2^24 unità)
+    uint16_t monete;                        // Monete usate in calibrazione
+    uint16_t riservato;
+};
+
+// Blob salvato in flash così com'è (stesso firmware in scrittura e lettura)
+struct CalibrazioneMonete {
+    uint32_t magic;
+    uint16_t versione;
+    uint16_t tagli;                         // Bit t: taglio t calibrato
+    ModelloTaglio taglio[TAGLI];
+    uint32_t crc;                           // CRC-32 dei byte precedenti
+};
+
+// Accumulatori della calibrazione: somme relative alla prima moneta di ogni taglio
+// (valori piccoli, nessun overflow dei quadrati su 64 bit)
+struct AddestramentoMonete {
+    uint16_t monete[TAGLI];
+    int32_t rif[TAGLI][MONETA_CARATTERISTICHE];
+    int64_t somma[TAGLI][MONETA_CARATTERISTICHE];
+    uint64_t quadrati[TAGLI][MONETA_CARATTERISTICHE];
+};
+
+void caratteristicheMoneta(const EventoLdr &uscita, int32_t f[MONETA_CARATTERISTICHE]);
+
+// Taglio più vicino (TAGLIO_IGNOTO oltre la soglia o senza tagli calibrati);
+// distanza: Σ z² in Q16 (σ² × 65536) del taglio scelto, se non nullo
+uint8_t classificaMoneta(const CalibrazioneMonete &cal, const int32_t f[MONETA_CARATTERISTICHE],
+                         uint32_t *distanza);
+uint32_t distanzaSigma10(uint32_t distanzaQ16);     // Distanza in decimi di σ (log)
+
+void addestramentoAzzera(AddestramentoMonete &a);
+bool addestramentoAggiungi(AddestramentoMonete &a, uint8_t taglio, const int32_t f[MONETA_CARATTERISTICHE]);
+// Modello dai tagli con almeno minMonete monete; false se nessuno
+bool addestramentoCalcola(const AddestramentoMonete &a, uint16_t minMonete, CalibrazioneMonete &cal);
+
+bool calibrazioneValida(const CalibrazioneMonete &cal);
+void calibrazioneSigilla(CalibrazioneMonete &cal);     // magic/versione/crc prima del salvataggio
+
+#endif
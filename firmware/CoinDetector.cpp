@@ -0,0 +1,63 @@
+#include "CoinDetector.h"
+
+CoinDetector::CoinDetector(const CoinDetectorConfig &config, CoinCallback callback) :
+    _cfg(config), _callback(callback), _base(config.alphaShift),
+    _sopra(config.sogliaScatto, config.sogliaReset), _moneta(config.minCampioni, config.minUs, 1, 0),
+    _ultimo(0), _inizioUs(0), _picco(0), _areaUs(0), _monete(0), _scartati(0)
+{
+}
+
+void CoinDetector::reset() {
+    _base.reset();
+    _sopra.reset();
+    _moneta.reset();
+}
+
+/**
+ * @brief Elabora un blocco di campioni consecutivi (t0_us = istante del primo)
+ * Le fasi sono quelle del vecchio tick: baseline, Δ, scatto con debounce, reset.
+ */
+void CoinDetector::processa(const uint16_t *campioni, int n, uint64_t t0_us) {
+    for (int i = 0; i < n; i++) {
+        uint16_t x = campioni[i];
+        uint64_t t = t0_us + (uint64_t)i * _cfg.periodo_us;
+        _ultimo = x;
+
+        // FASE 1: baseline EMA (solo senza moneta), primo campione = baseline
+        bool moneta = _moneta.valore();
+        if (!moneta || !_base.pronto()) _base.filtra(x);
+
+        // FASE 2: spike rispetto alla baseline
+        uint16_t base = baseline();
+        int32_t delta = (int32_t)x - base;
+
+        // Forma dell'impulso: Δ positivi dal primo campione sopra soglia
+        bool sopra = _sopra.valore();
+        if (sopra && delta > 0) {
+            if (delta > _picco) _picco = (uint16_t)delta;
+            _areaUs += (uint64_t)delta * _cfg.periodo_us;
+        }
+
+        // FASE 3: isteresi sulla soglia, poi debounce (campioni consecutivi + durata minima)
+        bool inAttesa = _moneta.inAttesa();
+        if (_sopra.filtra(delta) && !sopra) {
+            _inizioUs = t;
+            _picco = (uint16_t)delta;
+            _areaUs = (uint64_t)delta * _cfg.periodo_us;
+        }
+        bool confermata = _moneta.filtra(_sopra.valore(), t);
+
+        if (confermata && !moneta) {
+            _monete++;
+            if (_callback) _callback(EventoLdr{true, _inizioUs, t, x, base, 0, 0, 0});
+        }
+        // FASE 4: rientro sotto la soglia minima
+        else if (!confermata && moneta) {
+            EventoLdr uscita = {false, t, t, x, base, (uint32_t)(t - _inizioUs), _picco,
+                                (uint32_t)(_areaUs / 1000)};
+            if (_callback) _callback(uscita);
+        } else if (inAttesa && !_moneta.inAttesa() && !confermata) {
+            _scartati++;        // Tornata sotto prima del debounce
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef COINDETECTOR_H
+#define COINDETECTOR_H
+
+#include "hal/hal.h"
+#include "SensorFilter.h"
+
+/**
+ * @brief Rilevatore di monete sul LDR a blocchi di campioni (spike sopra baseline)
+ *
+ * Stesso algoritmo del campionamento a 100ms della v8.28, riscritto per campione con
+ * gli stadi di SensorFilter.h:
+ * - baseline FiltroEma (α = 2^-alphaShift per campione), aggiornata solo senza moneta
+ *   davanti al sensore;
+ * - FiltroIsteresi su Δ = valore - baseline: sopra da sogliaScatto, sotto da sogliaReset;
+ * - FiltroDebounce: moneta in ingresso dopo minCampioni campioni consecutivi sopra e
+ *   minUs di tempo, uscita al primo campione sotto sogliaReset.
+ *
+ * L'evento di uscita porta la forma dell'impulso, dal primo campione sopra soglia al
+ * rientro: durata, profondità (Δ massimo) e area (Σ Δ nel tempo). Sono le
+ * caratteristiche usate da CoinClassifier per riconoscere il taglio.
+ *
+ * processa() riceve un blocco (es. metà del doppio buffer DMA) con l'istante del
+ * primo campione: ogni moneta è segnalata con l'istante del primo campione sopra
+ * soglia, non con quello in cui il blocco è stato elaborato.
+ *
+ * Campioni e soglie in scala 0-65535 (AnalogIn::read_u16, ADC allineato a sinistra).
+ * Va usato da un solo contesto (coda eventi).
+ */
+
+#define LDR_SCALA 65535u                            // Fondo scala dei campioni
+#define LDR_PERCENTO(p) ((uint16_t)((p) * LDR_SCALA / 100))
+
+struct CoinDetectorConfig {
+    uint32_t periodo_us;    // Intervallo tra due campioni
+    uint8_t alphaShift;     // Baseline: α = 1/2^alphaShift per campione
+    uint16_t sogliaScatto;  // Δ sopra baseline per una moneta in ingresso
+    uint16_t sogliaReset;   // Δ sotto cui la moneta è uscita
+    uint8_t minCampioni;    // Campioni consecutivi sopra soglia
+    uint32_t minUs;         // Durata minima sopra soglia (primo → ultimo campione)
+};
+
+struct EventoLdr {
+    bool moneta;            // true: moneta confermata, false: moneta uscita (reset)
+    uint64_t t_us;          // Moneta: primo campione sopra soglia; reset: campione di rientro
+    uint64_t conferma_us;   // Campione che ha confermato l'evento
+    uint16_t valore;        // Campione di conferma
+    uint16_t base;          // Baseline in quel momento
+    // Solo all'uscita: forma dell'impulso dal primo campione sopra soglia al rientro
+    uint32_t durata_us;
+    uint16_t profondita;    // Δ massimo
+    uint32_t area;          // Σ Δ · periodo, in unità di scala × ms
+};
+
+typedef void (*CoinCallback)(const EventoLdr &ev);
+
+class CoinDetector {
+public:
+    CoinDetector(const CoinDetectorConfig &config, CoinCallback callback);
+
+    void processa(const uint16_t *campioni, int n, uint64_t t0_us);
+    void reset();                                   // Baseline da reinizializzare al prossimo campione
+
+    uint16_t ultimo() const { return _ultimo; }
+    uint16_t baseline() const { return (uint16_t)_base.valore(); }
+    bool monetaPresente() const { return _moneta.valore(); }
+    uint32_t monete() const { return _monete; }
+    uint32_t scartati() const { return _scartati; } // Spike più brevi di minCampioni/minUs
+    const CoinDetectorConfig &config() const { return _cfg; }
+
+private:
+    CoinDetectorConfig _cfg;
+    CoinCallback _callback;
+    FiltroEma _base;
+    FiltroIsteresi _sopra;  // Δ sopra soglia (con isteresi)
+    FiltroDebounce _moneta; // Moneta confermata
+    uint16_t _ultimo;
+    uint64_t _inizioUs;     // Primo campione sopra soglia
+    uint16_t _picco;        // Forma dell'impulso in corso (dal primo campione sopra soglia)
+    uint64_t _areaUs;       // Σ Δ · periodo_us
+    uint32_t _monete;
+    uint32_t _scartati;
+};
+
+#endif
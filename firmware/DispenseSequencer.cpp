@@ -0,0 +1,99 @@
+#include "DispenseSequencer.h"
+
+// Rampa 120ms, 380ms aperto, rampa di chiusura 200ms, 400ms di caduta: 1.06s a pezzo
+// (durataMs: il primo passo di ogni rampa è immediato)
+const ProfiloServo PROFILO_RAMPA = {2, {{2000, 120, 380}, {1000, 200, 400}}};
+const ProfiloServo PROFILO_SCATTO = {2, {{2000, 0, 1000}, {1000, 0, 1000}}};
+
+uint32_t DispenseSequencer::durataMs(const ProfiloServo &p) {
+    uint32_t ms = 0;
+    for (int i = 0; i < p.tratti; i++) {
+        uint32_t passi = ((uint32_t)p.tratto[i].rampaMs * 1000 + PASSO_US - 1) / PASSO_US;
+        ms += (passi ? passi - 1 : 0) * (PASSO_US / 1000) + p.tratto[i].sostaMs;
+    }
+    return ms;
+}
+
+DispenseSequencer::DispenseSequencer(hal::PwmOut &servo, hal::Timeout &timeout, uint16_t riposoUs) :
+    _servo(servo), _timeout(timeout), _riposoUs(riposoUs), _passoIsr(nullptr), _fine(nullptr),
+    _profilo(nullptr), _attivo(false), _avvii(0), _posizione(riposoUs), _tratto(0), _da(riposoUs),
+    _passi(0), _passo(0)
+{
+}
+
+void DispenseSequencer::start(hal::Isr passoIsr, FineErogazione fine) {
+    _passoIsr = passoIsr;
+    _fine = fine;
+    scrivi(_riposoUs);
+}
+
+uint16_t DispenseSequencer::avvia(const ProfiloServo &profilo) {
+    hal::critical_enter();
+    _timeout.detach();
+    _profilo = &profilo;
+    _avvii = _avvii + 1;
+    _attivo = true;
+    _tratto = 0;
+    iniziaTratto();
+    uint16_t avvio = _avvii;
+    hal::critical_exit();
+    return avvio;
+}
+
+void DispenseSequencer::ferma() {
+    hal::critical_enter();
+    _timeout.detach();
+    _attivo = false;
+    scrivi(_riposoUs);
+    hal::critical_exit();
+}
+
+void DispenseSequencer::scrivi(uint16_t us) {
+    _posizione = us;
+    _servo.pulsewidth_us(us);
+}
+
+/**
+ * @brief Primo passo del tratto corrente: salto (rampa 0) o Timeout del primo passo
+ */
+void DispenseSequencer::iniziaTratto() {
+    const TrattoServo &t = _profilo->tratto[_tratto];
+    _da = _posizione;
+    _passi = (uint16_t)(((uint32_t)t.rampaMs * 1000 + PASSO_US - 1) / PASSO_US);
+    _passo = 0;
+    if (_passi == 0) _passi = 1;
+    onPasso();
+}
+
+/**
+ * @brief Interrupt Service Routine - passo di rampa o fine sosta (hal::Timeout)
+ */
+void DispenseSequencer::onPasso() {
+    if (!_attivo) return;
+    const TrattoServo &t = _profilo->tratto[_tratto];
+
+    if (_passo < _passi) {
+        _passo++;
+        int32_t delta = (int32_t)t.posizioneUs - _da;
+        scrivi((uint16_t)(_da + delta * _passo / _passi));
+        if (_passo < _passi) {
+            _timeout.attach_us(_passoIsr, PASSO_US);
+            return;
+        }
+        if (t.sostaMs) {
+            _timeout.attach_us(_passoIsr, (uint32_t)t.sostaMs * 1000);
+            return;
+        }
+    }
+    fineTratto();
+}
+
+void DispenseSequencer::fineTratto() {
+    _tratto++;
+    if (_tratto < _profilo->tratti) {
+        iniziaTratto();
+        return;
+    }
+    _attivo = false;
+    if (_fine) _fine(_avvii);
+}
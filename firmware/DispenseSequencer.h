@@ -0,0 +1,82 @@
+#ifndef DISPENSESEQUENCER_H
+#define DISPENSESEQUENCER_H
+
+#include "hal/hal.h"
+
+/**
+ * @brief Sequenze del servo di erogazione in background (hal::Timeout)
+ *
+ * Un profilo è una lista di tratti: rampa lineare verso una posizione, poi sosta.
+ *
+ *   riposo ──rampa──▶ aperto ──sosta── ──rampa──▶ riposo ──sosta (caduta)── fine
+ *
+ * Nelle rampe la posizione avanza di un passo per periodo PWM (20ms, il servo non ne
+ * vede di più fini); le soste sono un solo Timeout. Alla fine del profilo la callback
+ * (contesto ISR) riceve il numero dell'avvio: il chiamante lo accoda come evento e la
+ * FSM scarta i completamenti di un'erogazione già interrotta (come la generazione dei
+ * timer).
+ *
+ * Posizioni in μs di impulso (SG90: 1000 chiuso, 2000 aperto), solo aritmetica intera
+ * nell'ISR. avvia() e ferma() dalla coda eventi, in sezione critica rispetto all'ISR.
+ */
+
+#define PROFILO_MAX_TRATTI 6
+
+struct TrattoServo {
+    uint16_t posizioneUs;   // Impulso di arrivo
+    uint16_t rampaMs;       // 0 = salto
+    uint16_t sostaMs;       // Attesa dopo l'arrivo
+};
+
+struct ProfiloServo {
+    uint8_t tratti;
+    TrattoServo tratto[PROFILO_MAX_TRATTI];
+};
+
+extern const ProfiloServo PROFILO_RAMPA;    // Apertura e chiusura in rampa (default)
+extern const ProfiloServo PROFILO_SCATTO;   // Salti con 1s aperto + 1s di caduta (fino alla v8.36)
+
+typedef void (*FineErogazione)(uint16_t avvio);     // Contesto ISR
+
+class DispenseSequencer {
+public:
+    static const uint32_t PASSO_US = 20000;         // Un passo di rampa per periodo PWM (50Hz)
+
+    static uint32_t durataMs(const ProfiloServo &p);   // Durata nominale del profilo
+
+    DispenseSequencer(hal::PwmOut &servo, hal::Timeout &timeout, uint16_t riposoUs);
+
+    // Servo a riposo; passoIsr inoltra a onPasso(), fine (opzionale) a fine profilo
+    void start(hal::Isr passoIsr, FineErogazione fine);
+    uint16_t avvia(const ProfiloServo &profilo);    // Dalla posizione attuale; numero dell'avvio
+    void ferma();                                   // Interrompe e torna a riposo di scatto
+
+    bool attivo() const { return _attivo; }
+    uint16_t avvii() const { return _avvii; }
+    uint16_t posizione() const { return _posizione; }
+
+    // --- Contesto ISR ---
+    void onPasso();
+
+private:
+    hal::PwmOut &_servo;
+    hal::Timeout &_timeout;
+    uint16_t _riposoUs;
+    hal::Isr _passoIsr;
+    FineErogazione _fine;
+
+    const ProfiloServo *_profilo;
+    volatile bool _attivo;
+    volatile uint16_t _avvii;
+    volatile uint16_t _posizione;
+    uint8_t _tratto;            // Tratto in corso
+    uint16_t _da;               // Posizione all'inizio della rampa
+    uint16_t _passi;            // Passi della rampa
+    uint16_t _passo;            // Passi già fatti (== _passi: in sosta)
+
+    void scrivi(uint16_t us);
+    void iniziaTratto();
+    void fineTratto();
+};
+
+#endif
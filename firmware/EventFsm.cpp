@@ -0,0 +1,159 @@
+#include "EventFsm.h"
+#include <cstring>
+
+EventFsm::EventFsm(const FsmStato *stati, int nStati,
+                   const FsmTransizione *tabella, int nRighe, int iniziale) :
+    _stati(stati), _nStati(nStati), _tabella(tabella), _nRighe(nRighe), _stato(iniziale),
+    _dispatchTask(nullptr), _cambio(nullptr), _esito(nullptr), _motivo(0), _testa(0), _fondo(0), _dispatchPendente(false),
+    _lotti(0), _lottoRifiutato(0), _transizioni(0), _persi(0), _saltati(0)
+{
+    memset(_latenza, 0, sizeof(_latenza));
+}
+
+void EventFsm::begin(hal::Task dispatchTask) {
+    _dispatchTask = dispatchTask;
+    if (_stati[_stato].ingresso) {
+        Evento avvio = {0, 0, 0, 0, 0, hal::now_us()};
+        _stati[_stato].ingresso(avvio);
+    }
+    // Eventi accodati prima dell'avvio (es. sensori già attivi)
+    hal::critical_enter();
+    bool pendenti = (_testa != _fondo);
+    hal::critical_exit();
+    if (pendenti) hal::call(_dispatchTask);
+}
+
+void EventFsm::onCambio(void (*cambio)(int da, int a)) {
+    _cambio = cambio;
+}
+
+void EventFsm::onEsito(void (*esito)(const Evento &ev, uint8_t motivo)) {
+    _esito = esito;
+}
+
+const char *EventFsm::nome(int stato) const {
+    return (stato >= 0 && stato < _nStati) ? _stati[stato].nome : "?";
+}
+
+/**
+ * @brief Accoda un evento (ISR, thread DHT, coda eventi)
+ * La coda è multi-produttore: l'inserimento avviene in sezione critica (pochi cicli).
+ * Il dispatch è schedulato una sola volta finché non viene eseguito (o finché
+ * hal::call() non lo rifiuta per coda piena: allora lo schedula il post successivo).
+ */
+bool EventFsm::post(uint8_t tipo, uint8_t arg, uint16_t gen, uint16_t rif) {
+    Evento ev = {tipo, arg, gen, rif, 0, 0};
+    return postLotto(&ev, 1);
+}
+
+/**
+ * @brief Accoda un evento d'ingresso con l'istante in cui è avvenuto (ISR, coda eventi)
+ * La latenza misurata comprende il tempo tra l'ingresso e il post (es. blocco DMA,
+ * debounce della presenza).
+ */
+bool EventFsm::postIngresso(uint8_t tipo, uint8_t arg, uint64_t t_us) {
+    Evento ev = {tipo, arg, 0, 0, 0, t_us};
+    return postLotto(&ev, 1);
+}
+
+/**
+ * @brief Accoda n eventi in un'unica sezione critica
+ * Con spazio insufficiente non ne accoda nessuno; altrimenti sono contigui e
+ * dispatch() li elabora di seguito (es. lotto di comandi BLE). Con n > 1 condividono
+ * un identificativo di lotto: dopo il primo rifiutato gli altri sono saltati. Gli
+ * eventi con t_us = 0 prendono l'istante del post.
+ */
+bool EventFsm::postLotto(const Evento *eventi, int n) {
+    uint64_t t = hal::now_us();
+    bool schedula = false;
+
+    hal::critical_enter();
+    if (_testa - _fondo + n > CODA_LEN) {
+        hal::critical_exit();
+        _persi = _persi + n;
+        return false;
+    }
+    uint16_t lotto = 0;
+    if (n > 1) {
+        if (++_lotti == 0) _lotti = 1;
+        lotto = _lotti;
+    }
+    for (int i = 0; i < n; i++) {
+        Evento &ev = _coda[_testa & (CODA_LEN - 1)];
+        ev = eventi[i];
+        ev.lotto = lotto;
+        if (ev.t_us == 0) ev.t_us = t;
+        _testa++;
+    }
+    if (!_dispatchPendente) {
+        _dispatchPendente = true;
+        schedula = true;
+    }
+    hal::critical_exit();
+
+    if (schedula && _dispatchTask && !hal::call(_dispatchTask)) {
+        // Coda eventi piena: il prossimo post riprova (gli eventi restano in coda)
+        hal::critical_enter();
+        _dispatchPendente = false;
+        hal::critical_exit();
+    }
+    return true;
+}
+
+bool EventFsm::estrai(Evento &ev) {
+    hal::critical_enter();
+    if (_fondo == _testa) {
+        _dispatchPendente = false;
+        hal::critical_exit();
+        return false;
+    }
+    ev = _coda[_fondo & (CODA_LEN - 1)];
+    _fondo++;
+    hal::critical_exit();
+    return true;
+}
+
+void EventFsm::dispatch() {
+    Evento ev;
+    while (estrai(ev)) processa(ev);
+}
+
+void EventFsm::processa(const Evento &ev) {
+    FsmLatenza &lat = _latenza[ev.tipo % FSM_MAX_EVENTI];
+    _motivo = 0;
+    if (ev.lotto && ev.lotto == _lottoRifiutato) {
+        _saltati++;
+        if (ev.rif && _esito) _esito(ev, FSM_SALTATO);
+        return;
+    }
+
+    for (int i = 0; i < _nRighe; i++) {
+        const FsmTransizione &t = _tabella[i];
+        if (t.evento != ev.tipo) continue;
+        if (t.da != FSM_QUALSIASI && t.da != _stato) continue;
+        if (t.guardia && !t.guardia(ev)) continue;
+
+        int da = _stato;
+        if (t.a == FSM_INTERNA) {
+            if (t.azione) t.azione(ev);
+        } else {
+            if (_stati[da].uscita) _stati[da].uscita(ev);
+            if (t.azione) t.azione(ev);
+            _stato = t.a;
+            _transizioni++;
+            if (_cambio) _cambio(da, t.a);
+            if (_stati[t.a].ingresso) _stati[t.a].ingresso(ev);
+        }
+
+        uint64_t latenza = hal::now_us() - ev.t_us;
+        lat.eventi++;
+        lat.somma_us += latenza;
+        if (latenza > lat.max_us) lat.max_us = latenza;
+        if (_motivo && ev.lotto) _lottoRifiutato = ev.lotto;
+        if (ev.rif && _esito) _esito(ev, _motivo);
+        return;
+    }
+    lat.ignorati++;
+    if (ev.lotto) _lottoRifiutato = ev.lotto;
+    if (ev.rif && _esito) _esito(ev, FSM_IGNORATO);
+}
@@ -0,0 +1,123 @@
+#ifndef EVENTFSM_H
+#define EVENTFSM_H
+
+#include "hal/hal.h"
+
+/**
+ * @brief Motore FSM a tabella guidato da eventi
+ *
+ * Gli eventi sono accodati da qualsiasi contesto (ISR, thread DHT, callback BLE,
+ * timer) con post() e consumati da dispatch() sulla coda eventi principale, che
+ * viene svegliata solo quando c'è almeno un evento: niente polling periodico.
+ *
+ * Per ogni evento la tabella è scandita in ordine e scatta la prima riga con
+ * stato (o FSM_QUALSIASI), tipo evento e guardia soddisfatti:
+ *   uscita(stato) → azione(evento) → cambio(da, a) → ingresso(a)
+ * Con destinazione FSM_INTERNA si esegue solo l'azione (nessuna uscita/ingresso).
+ *
+ * Per ogni tipo di evento è misurata la latenza post → fine transizione. Gli eventi
+ * d'ingresso (pulsante, moneta, presenza) sono accodati con postIngresso() e l'istante
+ * del fronte o della misura: per loro la latenza è ingresso fisico → fine transizione.
+ *
+ * Esito: un evento con riferimento (rif != 0, es. comando BLE con numero di sequenza)
+ * è notificato a onEsito() dopo l'elaborazione con motivo 0 (accettato), il motivo
+ * impostato da rifiuta() durante l'azione, o FSM_IGNORATO se nessuna riga è scattata.
+ *
+ * Lotto: gli eventi di postLotto() condividono un identificativo. Al primo evento del
+ * lotto rifiutato (rifiuta() o nessuna riga) i successivi non sono elaborati ed escono
+ * con FSM_SALTATO: un comando non parte sullo stato lasciato da uno fallito.
+ */
+
+#define FSM_QUALSIASI  -1   // Riga valida in ogni stato
+#define FSM_INTERNA    -1   // Transizione interna: resta nello stato corrente
+#define FSM_MAX_EVENTI 16   // Tipi di evento con statistiche
+#define FSM_IGNORATO   0xFF // Esito: nessuna riga applicabile nello stato corrente
+#define FSM_SALTATO    0xFE // Esito: evento di un lotto dopo un rifiuto, non elaborato
+
+struct Evento {
+    uint8_t tipo;
+    uint8_t arg;
+    uint16_t gen;           // Generazione timer (timeout obsoleti scartati dalla guardia)
+    uint16_t rif;           // Riferimento del mittente per l'esito (0 = nessuno)
+    uint16_t lotto;         // Assegnato da postLotto() (0 = evento singolo)
+    uint64_t t_us;          // Istante dell'ingresso (postIngresso) o di post
+};
+
+typedef bool (*FsmGuardia)(const Evento &ev);
+typedef void (*FsmAzione)(const Evento &ev);
+
+struct FsmTransizione {
+    int8_t da;              // Stato di partenza o FSM_QUALSIASI
+    uint8_t evento;
+    FsmGuardia guardia;     // nullptr = sempre vera
+    FsmAzione azione;       // nullptr = nessuna azione
+    int8_t a;               // Stato di arrivo o FSM_INTERNA
+};
+
+struct FsmStato {
+    const char *nome;
+    FsmAzione ingresso;     // nullptr = nessuna
+    FsmAzione uscita;
+};
+
+struct FsmLatenza {
+    uint32_t eventi;        // Eventi che hanno fatto scattare una riga
+    uint32_t ignorati;      // Nessuna riga applicabile nello stato corrente
+    uint64_t somma_us;
+    uint64_t max_us;
+};
+
+class EventFsm {
+public:
+    static const uint32_t CODA_LEN = 16;    // Potenza di 2
+
+    EventFsm(const FsmStato *stati, int nStati,
+             const FsmTransizione *tabella, int nRighe, int iniziale);
+
+    // dispatchTask: funzione che chiama dispatch(), schedulata con hal::call() al primo post
+    void begin(hal::Task dispatchTask);
+    void onCambio(void (*cambio)(int da, int a));
+    void onEsito(void (*esito)(const Evento &ev, uint8_t motivo));
+
+    bool post(uint8_t tipo, uint8_t arg = 0, uint16_t gen = 0, uint16_t rif = 0);  // ISR/thread-safe
+    bool postIngresso(uint8_t tipo, uint8_t arg, uint64_t t_us);                    // t_us: fronte/misura
+    bool postLotto(const Evento *eventi, int n);    // Tutti (contigui in coda) o nessuno; stop al primo rifiuto
+    void dispatch();                                                               // Coda eventi principale
+    void rifiuta(uint8_t motivo) { _motivo = motivo; }  // Da guardie/azioni: esito dell'evento corrente
+
+    int stato() const { return _stato; }
+    const char *nome(int stato) const;
+    const FsmLatenza &latenza(uint8_t tipo) const { return _latenza[tipo % FSM_MAX_EVENTI]; }
+    uint32_t transizioni() const { return _transizioni; }
+    uint32_t persi() const { return _persi; }   // Coda piena
+    uint32_t saltati() const { return _saltati; }   // Eventi di lotti dopo un rifiuto
+
+private:
+    const FsmStato *_stati;
+    int _nStati;
+    const FsmTransizione *_tabella;
+    int _nRighe;
+    volatile int _stato;
+
+    hal::Task _dispatchTask;
+    void (*_cambio)(int da, int a);
+    void (*_esito)(const Evento &ev, uint8_t motivo);
+    uint8_t _motivo;
+
+    Evento _coda[CODA_LEN];
+    uint32_t _testa;
+    uint32_t _fondo;
+    bool _dispatchPendente;
+    uint16_t _lotti;            // Ultimo identificativo di lotto assegnato
+    uint16_t _lottoRifiutato;   // Lotto con un evento rifiutato: i successivi sono saltati
+
+    FsmLatenza _latenza[FSM_MAX_EVENTI];
+    uint32_t _transizioni;
+    volatile uint32_t _persi;
+    uint32_t _saltati;
+
+    bool estrai(Evento &ev);
+    void processa(const Evento &ev);
+};
+
+#endif
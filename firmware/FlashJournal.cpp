@@ -0,0 +1,358 @@
+#include "FlashJournal.h"
+#include <cstring>
+
+enum TipoRecord : uint8_t {
+    GIORNALE_CHECKPOINT = 0x01,
+    GIORNALE_DELTA      = 0x02,
+    GIORNALE_BLOB       = 0x03,
+    GIORNALE_VUOTO      = 0xFF
+};
+
+// Maschera DELTA: bit 0-3 scorte dei prodotti 1-4
+#define DELTA_CREDITO   0x10
+#define DELTA_INCASSATO 0x20
+
+#define RECORD_MAX  (255 + 3)
+
+// CRC-8 (poly 0x07): un record interrotto dal reset non passa per buono
+static uint8_t crc8(const uint8_t *p, uint32_t len) {
+    uint8_t crc = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int b = 0; b < 8; b++) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+static uint8_t scriviVarint(uint8_t *p, uint32_t v) {
+    uint8_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static bool leggiVarint(const uint8_t *p, uint8_t len, uint8_t &i, int32_t &valore) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35 && i < len; shift += 7) {
+        uint8_t b = p[i++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            valore = (int32_t)v;
+            return true;
+        }
+    }
+    return false;
+}
+
+FlashJournal::FlashJournal(hal::Flash &flash) :
+    _flash(flash), _dimBanco(0), _banchi(0), _banco(0), _generazione(0), _pos(0),
+    _bloccoChiuso(false), _prossimoPronto(false), _stato(), _cambiati(0), _blobLen(0), _stats()
+{
+}
+
+// ======================================================================================
+// RECUPERO (boot)
+// ======================================================================================
+
+bool FlashJournal::recupera(const StatoGiornale &iniziale) {
+    _stato = iniziale;
+    _cambiati = 0;
+    _blobLen = 0;
+    _bloccoChiuso = false;
+    _prossimoPronto = false;
+    _stats.recuperoRecord = 0;
+    _stats.recuperoByte = 0;
+
+    _dimBanco = _flash.eraseSize();
+    uint32_t banchi = _dimBanco ? _flash.size() / _dimBanco : 0;
+    if (banchi < 2 || _dimBanco < GIORNALE_BLOCCO || _dimBanco % GIORNALE_BLOCCO) {
+        _banchi = 0;        // Area non adatta: nessuna persistenza, scritture rifiutate
+        return false;
+    }
+    _banchi = banchi > 255 ? 255 : (uint8_t)banchi;
+
+    // Banco attivo: checkpoint integro in testa con la generazione più recente
+    int attivo = -1;
+    for (uint8_t b = 0; b < _banchi; b++) {
+        uint32_t g;
+        if (checkpointValido(b, g) && (attivo < 0 || (int32_t)(g - _generazione) > 0)) {
+            attivo = b;
+            _generazione = g;
+        }
+    }
+    if (attivo < 0) {
+        // Primo avvio (o area illeggibile): banco 0 con lo stato iniziale
+        _banco = 0;
+        _generazione = 1;
+        _pos = 0;
+        if (!bancoVuoto(0)) {
+            if (!_flash.erase(0, _dimBanco)) _stats.errori++;
+            _stats.erase++;
+        }
+        scriviCheckpoint();
+        return false;
+    }
+    _banco = (uint8_t)attivo;
+    uint32_t base = _banco * _dimBanco;
+
+    // Ultimo blocco scritto: i blocchi si riempiono in ordine, quelli usati sono un prefisso
+    uint32_t basso = 0, alto = _dimBanco / GIORNALE_BLOCCO - 1;
+    while (basso < alto) {
+        uint32_t medio = (basso + alto + 1) / 2;
+        uint8_t tipo = GIORNALE_VUOTO;
+        _flash.read(base + medio * GIORNALE_BLOCCO, &tipo, 1);
+        _stats.recuperoByte++;
+        if (tipo != GIORNALE_VUOTO) basso = medio;
+        else alto = medio - 1;
+    }
+
+    // Checkpoint del blocco e suoi delta; checkpoint interrotto dal reset: blocco prima
+    static uint8_t blocco[GIORNALE_BLOCCO];
+    uint32_t b = basso;
+    uint32_t off;
+    for (;;) {
+        _flash.read(base + b * GIORNALE_BLOCCO, blocco, GIORNALE_BLOCCO);
+        _stats.recuperoByte += GIORNALE_BLOCCO;
+        _stats.recuperoRecord = 0;
+        off = 0;
+        while (off + 3 <= GIORNALE_BLOCCO && blocco[off] != GIORNALE_VUOTO) {
+            uint8_t tipo = blocco[off], len = blocco[off + 1];
+            if (off + len + 3u > GIORNALE_BLOCCO || crc8(&blocco[off], len + 2u) != blocco[off + len + 2] ||
+                (off == 0 && tipo != GIORNALE_CHECKPOINT) || !applica(tipo, &blocco[off + 2], len)) {
+                _bloccoChiuso = true;       // Record interrotto: si riprende dal blocco successivo
+                break;
+            }
+            off += len + 3u;
+            _stats.recuperoRecord++;
+        }
+        if (_stats.recuperoRecord > 0 || b == 0) break;
+        b--;
+    }
+    _pos = base + b * GIORNALE_BLOCCO + off;
+    if (b < basso) {
+        _pos = base + basso * GIORNALE_BLOCCO;  // Il blocco col checkpoint interrotto non si riusa
+        _bloccoChiuso = true;
+    }
+    return true;
+}
+
+bool FlashJournal::checkpointValido(uint8_t banco, uint32_t &generazione) {
+    uint8_t rec[RECORD_MAX];
+    uint32_t base = banco * _dimBanco;
+    if (!_flash.read(base, rec, 2)) return false;
+    _stats.recuperoByte += 2;
+    if (rec[0] != GIORNALE_CHECKPOINT || rec[1] < 4) return false;
+    if (!_flash.read(base + 2, &rec[2], rec[1] + 1u)) return false;
+    _stats.recuperoByte += rec[1] + 1u;
+    if (crc8(rec, rec[1] + 2u) != rec[rec[1] + 2]) return false;
+    memcpy(&generazione, &rec[2], 4);
+    return true;
+}
+
+bool FlashJournal::applica(uint8_t tipo, const uint8_t *p, uint8_t len) {
+    uint8_t i = 0;
+    StatoGiornale s = _stato;
+    if (tipo == GIORNALE_CHECKPOINT) {
+        uint32_t g;
+        if (len < 4 + GIORNALE_PRODOTTI) return false;
+        memcpy(&g, p, 4);
+        if (g != _generazione) return false;    // Resto di un giro precedente del banco
+        i = 4;
+        for (int k = 0; k < GIORNALE_PRODOTTI; k++) s.scorte[k] = p[i++];
+        if (!leggiVarint(p, len, i, s.credito) || !leggiVarint(p, len, i, s.incassato) || i >= len) return false;
+        uint8_t n = p[i++];
+        if (n > GIORNALE_BLOB_MAX || i + n != len) return false;
+        memcpy(_blob, &p[i], n);
+        _blobLen = n;
+    } else if (tipo == GIORNALE_DELTA) {
+        if (len < 1) return false;
+        uint8_t maschera = p[i++];
+        for (int k = 0; k < GIORNALE_PRODOTTI; k++) {
+            if (!(maschera & (1 << k))) continue;
+            if (i >= len) return false;
+            s.scorte[k] = p[i++];
+        }
+        if ((maschera & DELTA_CREDITO) && !leggiVarint(p, len, i, s.credito)) return false;
+        if ((maschera & DELTA_INCASSATO) && !leggiVarint(p, len, i, s.incassato)) return false;
+        if (i != len) return false;
+    } else if (tipo == GIORNALE_BLOB) {
+        if (len > GIORNALE_BLOB_MAX) return false;
+        memcpy(_blob, p, len);
+        _blobLen = len;
+    } else {
+        return false;
+    }
+    _stato = s;
+    return true;
+}
+
+// ======================================================================================
+// SCRITTURA
+// ======================================================================================
+
+void FlashJournal::aggiorna(const StatoGiornale &s) {
+    for (int k = 0; k < GIORNALE_PRODOTTI; k++) {
+        if (s.scorte[k] == _stato.scorte[k]) continue;
+        _cambiati |= (uint8_t)(1 << k);
+        _stats.byteLogici += sizeof(s.scorte[k]);
+    }
+    if (s.credito != _stato.credito) {
+        _cambiati |= DELTA_CREDITO;
+        _stats.byteLogici += sizeof(s.credito);
+    }
+    if (s.incassato != _stato.incassato) {
+        _cambiati |= DELTA_INCASSATO;
+        _stats.byteLogici += sizeof(s.incassato);
+    }
+    _stato = s;
+}
+
+bool FlashJournal::scrivi() {
+    if (!_cambiati) return true;
+    if (!_banchi) return false;
+
+    uint8_t p[1 + GIORNALE_PRODOTTI + 2 * 5];
+    uint8_t n = 0;
+    p[n++] = _cambiati;
+    for (int k = 0; k < GIORNALE_PRODOTTI; k++) {
+        if (_cambiati & (1 << k)) p[n++] = _stato.scorte[k];
+    }
+    if (_cambiati & DELTA_CREDITO) n += scriviVarint(&p[n], (uint32_t)_stato.credito);
+    if (_cambiati & DELTA_INCASSATO) n += scriviVarint(&p[n], (uint32_t)_stato.incassato);
+
+    uint32_t inBlocco = _pos % GIORNALE_BLOCCO;
+    if (_bloccoChiuso || inBlocco == 0 || inBlocco + n + 3u > GIORNALE_BLOCCO) {
+        return nuovoBlocco();       // Il checkpoint contiene già i campi cambiati
+    }
+    if (!appendi(GIORNALE_DELTA, p, n)) return false;
+    _cambiati = 0;
+    _stats.record++;
+    return true;
+}
+
+bool FlashJournal::scriviBlob(const void *dati, uint8_t len) {
+    if (len > GIORNALE_BLOB_MAX) return false;
+    if (len) memcpy(_blob, dati, len);
+    _blobLen = len;
+    _stats.byteLogici += len;
+    if (!_banchi) return false;
+
+    uint32_t inBlocco = _pos % GIORNALE_BLOCCO;
+    if (_bloccoChiuso || inBlocco == 0 || inBlocco + len + 3u > GIORNALE_BLOCCO) return nuovoBlocco();
+    if (!appendi(GIORNALE_BLOB, _blob, len)) return false;
+    _stats.record++;
+    return true;
+}
+
+uint8_t FlashJournal::blob(void *dati, uint8_t max) const {
+    uint8_t n = _blobLen < max ? _blobLen : max;
+    memcpy(dati, _blob, n);
+    return n;
+}
+
+bool FlashJournal::nuovoBlocco() {
+    // Blocco appena riempito esattamente: _pos è già l'inizio del successivo
+    uint32_t prossimo = (_pos % GIORNALE_BLOCCO == 0 && !_bloccoChiuso) ?
+                        _pos : (_pos / GIORNALE_BLOCCO + 1) * GIORNALE_BLOCCO;
+    if (prossimo >= (_banco + 1u) * _dimBanco) return cambiaBanco();
+    _pos = prossimo;
+    _bloccoChiuso = false;
+    return scriviCheckpoint();
+}
+
+bool FlashJournal::cambiaBanco() {
+    if (!_prossimoPronto) {
+        uint32_t erase = _stats.erase;
+        if (!preparaBanco()) return false;
+        _stats.eraseSincroni += _stats.erase - erase;
+    }
+    uint8_t vecchio = _banco;
+    uint32_t fine = _pos;
+    _banco = (uint8_t)((_banco + 1) % _banchi);
+    _generazione++;
+    _pos = _banco * _dimBanco;
+    _bloccoChiuso = false;
+    _prossimoPronto = false;    // Il successivo è (con due banchi) quello appena lasciato
+    if (!scriviCheckpoint()) {
+        // Banco nuovo senza checkpoint valido: resta attivo il vecchio, al prossimo
+        // tentativo il nuovo si cancella di nuovo prima dell'uso
+        _banco = vecchio;
+        _generazione--;
+        _pos = fine;
+        _bloccoChiuso = true;
+        return false;
+    }
+    _stats.cambiBanco++;
+    return true;
+}
+
+bool FlashJournal::scriviCheckpoint() {
+    uint8_t p[4 + GIORNALE_PRODOTTI + 2 * 5 + 1 + GIORNALE_BLOB_MAX];
+    uint8_t n = 0;
+    memcpy(p, &_generazione, 4);
+    n = 4;
+    for (int k = 0; k < GIORNALE_PRODOTTI; k++) p[n++] = _stato.scorte[k];
+    n += scriviVarint(&p[n], (uint32_t)_stato.credito);
+    n += scriviVarint(&p[n], (uint32_t)_stato.incassato);
+    p[n++] = _blobLen;
+    memcpy(&p[n], _blob, _blobLen);
+    n += _blobLen;
+
+    if (!appendi(GIORNALE_CHECKPOINT, p, n)) return false;
+    _cambiati = 0;
+    _stats.checkpoint++;
+    return true;
+}
+
+bool FlashJournal::appendi(uint8_t tipo, const uint8_t *payload, uint8_t len) {
+    uint8_t rec[RECORD_MAX];
+    rec[0] = tipo;
+    rec[1] = len;
+    memcpy(&rec[2], payload, len);
+    rec[len + 2] = crc8(rec, len + 2u);
+    if (!_flash.program(_pos, rec, len + 3u)) {
+        _stats.errori++;
+        _bloccoChiuso = true;   // Byte forse già azzerati: il blocco non si completa
+        return false;
+    }
+    _pos += len + 3u;
+    _stats.byteScritti += len + 3u;
+    return true;
+}
+
+// ======================================================================================
+// BANCO SUCCESSIVO (erase fuori dai percorsi a tempo)
+// ======================================================================================
+
+bool FlashJournal::preparaBanco() {
+    if (!_banchi) return false;
+    uint8_t b = (uint8_t)((_banco + 1) % _banchi);
+    if (!bancoVuoto(b)) {
+        if (!_flash.erase(b * _dimBanco, _dimBanco)) {
+            _stats.errori++;
+            return false;
+        }
+        _stats.erase++;
+    }
+    _prossimoPronto = true;
+    return true;
+}
+
+bool FlashJournal::bancoDaAnticipare() const {
+    if (!_banchi || _prossimoPronto) return false;
+    return (uint64_t)(_pos - _banco * _dimBanco) * 100 >= (uint64_t)_dimBanco * GIORNALE_SOGLIA_PREPARA;
+}
+
+bool FlashJournal::bancoVuoto(uint8_t banco) {
+    uint8_t buf[256];
+    for (uint32_t off = 0; off < _dimBanco; off += sizeof(buf)) {
+        if (!_flash.read(banco * _dimBanco + off, buf, sizeof(buf))) return false;
+        for (uint32_t i = 0; i < sizeof(buf); i++) {
+            if (buf[i] != 0xFF) return false;
+        }
+    }
+    return true;
+}
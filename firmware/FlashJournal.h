@@ -0,0 +1,113 @@
+#ifndef FLASHJOURNAL_H
+#define FLASHJOURNAL_H
+
+#include <cstdint>
+#include "hal/hal.h"
+
+/**
+ * @brief Giornale in flash interna: scorte, denaro e calibrazione sopravvivono al reset
+ *
+ * Append-only su hal::Flash a banchi (un banco = un'unità di erase, almeno due):
+ * nessun dato è riscritto sul posto, ogni modifica è un record accodato nel banco
+ * attivo. Quando il banco è pieno si passa al successivo (già cancellato) con un
+ * checkpoint e generazione + 1; il banco vecchio si cancella più tardi, con la
+ * macchina ferma (preparaBanco()): in idle profondo o, oltre GIORNALE_SOGLIA_PREPARA,
+ * alla prima pausa tra due clienti (bancoDaAnticipare()). L'erase nel percorso di
+ * scrittura resta l'ultima risorsa (eraseSincroni). Ogni settore è cancellato una volta ogni
+ * dimensione-banco byte di giornale: l'usura si distribuisce su tutti i banchi.
+ *
+ * Record: [tipo][len][payload (len byte)][crc8 di tipo, len e payload]; 0xFF = vuoto.
+ *   CHECKPOINT  generazione u32, scorte[4], credito e incassato (varint), calibrazione
+ *   DELTA       maschera dei campi cambiati, poi solo quei campi (scorte u8, varint)
+ *   BLOB        calibrazione monete (len 0: cancellata)
+ *
+ * Il banco è diviso in blocchi da GIORNALE_BLOCCO byte, ognuno aperto da un
+ * checkpoint: al boot recupera() cerca l'ultimo blocco scritto per bisezione (un byte
+ * letto per passo), legge il suo checkpoint e riapplica al massimo un blocco di delta.
+ * Un record interrotto da un reset (crc errato) chiude il blocco: si riprende dal
+ * successivo, lo stato è quello dell'ultimo record integro.
+ *
+ * aggiorna() confronta lo stato e segna i campi cambiati solo in RAM; scrivi() li
+ * accorpa in un record (pochi byte, decine di μs di program): il chiamante decide la
+ * finestra di accorpamento. scriviBlob() scrive subito (calibrazione, rara).
+ *
+ * Solo dalla coda eventi, nessuna sezione critica. Le letture di recupera() e
+ * preparaBanco() e l'erase di quest'ultimo vanno fuori dai percorsi a tempo.
+ */
+
+#define GIORNALE_BLOCCO     2048    // Byte rigiocati al massimo in recupera()
+#define GIORNALE_BLOB_MAX   128     // Calibrazione monete (96 byte)
+#define GIORNALE_PRODOTTI   4
+#define GIORNALE_SOGLIA_PREPARA 75  // % del banco attivo: oltre, il successivo va cancellato alla prima pausa
+
+struct StatoGiornale {
+    uint8_t scorte[GIORNALE_PRODOTTI];  // Prodotti 1-4
+    int32_t credito;                    // Denaro dei clienti in macchina (centesimi)
+    int32_t incassato;                  // Pezzi erogati, totale (centesimi)
+};
+
+struct GiornaleStats {
+    uint32_t record;            // DELTA e BLOB scritti
+    uint32_t checkpoint;
+    uint64_t byteLogici;        // Campi cambiati passati ad aggiorna()/scriviBlob() (dimensione in RAM)
+    uint64_t byteScritti;       // Programmati in flash, checkpoint compresi
+    uint32_t cambiBanco;
+    uint32_t erase;             // Banchi cancellati (preparaBanco())
+    uint32_t eraseSincroni;     // Banco successivo non pronto al cambio: erase nel percorso di scrittura
+    uint32_t errori;            // program() fallito
+    // Ultimo recupera()
+    uint32_t recuperoRecord;    // Record rigiocati (checkpoint compreso)
+    uint32_t recuperoByte;      // Byte letti dalla flash
+};
+
+class FlashJournal {
+public:
+    explicit FlashJournal(hal::Flash &flash);
+
+    // true: stato dalla flash; false: area vuota o illeggibile, formattata con `iniziale`
+    bool recupera(const StatoGiornale &iniziale);
+
+    const StatoGiornale &stato() const { return _stato; }
+    void aggiorna(const StatoGiornale &s);      // Solo RAM
+    bool inAttesa() const { return _cambiati != 0; }
+    bool scrivi();                              // Campi cambiati in un record DELTA
+
+    bool scriviBlob(const void *dati, uint8_t len);
+    uint8_t blob(void *dati, uint8_t max) const;    // Byte copiati (0: nessun blob)
+
+    bool bancoDaPreparare() const { return !_prossimoPronto; }
+    bool bancoDaAnticipare() const;             // Successivo non pronto e attivo oltre GIORNALE_SOGLIA_PREPARA
+    bool preparaBanco();                        // Verifica e, se serve, cancella il banco successivo
+
+    uint8_t banco() const { return _banco; }
+    uint8_t banchi() const { return _banchi; }      // 0: area non adatta, nessuna persistenza
+    uint32_t generazione() const { return _generazione; }
+    uint32_t posizione() const { return _pos; }     // Prossimo byte libero (dall'inizio dell'area)
+    const GiornaleStats &stats() const { return _stats; }
+
+private:
+    hal::Flash &_flash;
+    uint32_t _dimBanco;
+    uint8_t _banchi;
+    uint8_t _banco;
+    uint32_t _generazione;
+    uint32_t _pos;
+    bool _bloccoChiuso;         // Record interrotto o program() fallito: il prossimo va nel blocco dopo
+    bool _prossimoPronto;       // Banco successivo verificato vuoto
+
+    StatoGiornale _stato;
+    uint8_t _cambiati;          // Maschera DELTA dei campi non ancora in flash
+    uint8_t _blob[GIORNALE_BLOB_MAX];
+    uint8_t _blobLen;
+    GiornaleStats _stats;
+
+    bool checkpointValido(uint8_t banco, uint32_t &generazione);
+    bool applica(uint8_t tipo, const uint8_t *p, uint8_t len);
+    bool nuovoBlocco();
+    bool cambiaBanco();
+    bool scriviCheckpoint();
+    bool appendi(uint8_t tipo, const uint8_t *payload, uint8_t len);
+    bool bancoVuoto(uint8_t banco);
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "LcdRenderer.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+static void fillLine(char *dst, const char *src) {
+    size_t n = src ? strlen(src) : 0;
+    if (n > LCD_COLS) n = LCD_COLS;
+    memcpy(dst, src, n);
+    memset(dst + n, ' ', LCD_COLS - n);
+}
+
+LcdRenderer::LcdRenderer(TextLCD &lcd) :
+    _lcd(lcd), _committedValid(false), _col(0), _row(0), _dropped(0),
+    _backlightOn(true), _baseDirty(false), _holding(false), _holdUntil(0), _backlightApplied(true)
+{
+    memset(_draft.text, ' ', sizeof(_draft.text));
+    _draft.holdMs = 0;
+    _committed = _draft;
+    _base = _draft;
+}
+
+// ======================================================================================
+// PRODUTTORE
+// ======================================================================================
+
+void LcdRenderer::clear() {
+    memset(_draft.text, ' ', sizeof(_draft.text));
+    _col = 0;
+    _row = 0;
+}
+
+void LcdRenderer::setCursor(uint8_t col, uint8_t row) {
+    if (row > LCD_ROWS - 1) row = LCD_ROWS - 1;
+    _col = col;
+    _row = row;
+}
+
+void LcdRenderer::printf(const char *format, ...) {
+    char buffer[32];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    print(buffer);
+}
+
+void LcdRenderer::print(const char *str) {
+    // Stessa semantica di TextLCD: oltre la colonna 16 il testo è scartato
+    while (*str) {
+        if (_col < LCD_COLS) _draft.text[_row][_col] = *str;
+        if (_col < 0xFF) _col++;
+        str++;
+    }
+}
+
+void LcdRenderer::commit() {
+    if (_committedValid && memcmp(_draft.text, _committed.text, sizeof(_draft.text)) == 0) return;
+    if (_queue.push(_draft)) {
+        _committed = _draft;
+        _committedValid = true;
+    }
+}
+
+bool LcdRenderer::message(const char *line0, const char *line1, uint32_t ms) {
+    LcdScreen screen;
+    fillLine(screen.text[0], line0);
+    fillLine(screen.text[1], line1);
+    screen.holdMs = ms ? ms : 1;
+    if (!_queue.push(screen)) {
+        _dropped = _dropped + 1;
+        return false;
+    }
+    return true;
+}
+
+void LcdRenderer::backlight(bool on) {
+    _backlightOn.store(on, std::memory_order_release);
+}
+
+// ======================================================================================
+// CONSUMATORE (thread display)
+// ======================================================================================
+
+/**
+ * @brief Passo del thread display
+ * Finché un messaggio temporaneo è a schermo la coda non avanza; alla scadenza
+ * consuma le schermate base (tiene la più recente) fino al messaggio successivo.
+ */
+void LcdRenderer::render() {
+    bool on = _backlightOn.load(std::memory_order_acquire);
+    if (on != _backlightApplied) {
+        if (on) _lcd.backlight();
+        else _lcd.noBacklight();
+        _backlightApplied = on;
+    }
+
+    uint64_t now = hal::now_us();
+    if (_holding && now < _holdUntil) return;
+    _holding = false;
+
+    LcdScreen screen;
+    while (_queue.pop(screen)) {
+        if (screen.holdMs == 0) {
+            _base = screen;
+            _baseDirty = true;
+            continue;
+        }
+        draw(screen);
+        _holding = true;
+        _holdUntil = now + (uint64_t)screen.holdMs * 1000;
+        _baseDirty = true;      // Alla scadenza si torna alla schermata base
+        return;
+    }
+
+    if (_baseDirty) {
+        draw(_base);
+        _baseDirty = false;
+    }
+}
+
+void LcdRenderer::draw(const LcdScreen &screen) {
+    // TextLCD invia solo le celle che differiscono da quanto già a schermo
+    for (int r = 0; r < LCD_ROWS; r++) {
+        _lcd.setCursor(0, r);
+        for (int c = 0; c < LCD_COLS; c++) _lcd.putc(screen.text[r][c]);
+    }
+    _lcd.flush();
+}
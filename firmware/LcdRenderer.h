@@ -0,0 +1,76 @@
+#ifndef LCDRENDERER_H
+#define LCDRENDERER_H
+
+#include <atomic>
+#include "SpscRing.h"
+#include "TextLCD.h"
+
+/**
+ * @brief Schermata LCD 2x16 scambiata tra produttori e thread display
+ */
+struct LcdScreen {
+    char text[LCD_ROWS][LCD_COLS];
+    uint32_t holdMs;            // 0 = schermata base (FSM), > 0 = messaggio temporaneo
+};
+
+/**
+ * @brief Rendering LCD asincrono: i produttori accodano schermate, il thread display
+ *        (bassa priorità) le disegna su TextLCD e ne gestisce la durata.
+ *
+ * - Schermata base: la FSM disegna con clear/setCursor/printf come su TextLCD e chiama
+ *   commit() a fine tick; la schermata è accodata solo se cambiata.
+ * - Messaggi temporanei: message(riga1, riga2, ms) mostra le due righe per ms
+ *   millisecondi, poi il display torna alla schermata base più recente.
+ *   Le schermate base accodate dietro un messaggio attendono la sua scadenza.
+ *
+ * Nessun produttore attende: con coda piena commit() riprova al tick successivo,
+ * message() scarta il messaggio (contatore dropped()).
+ *
+ * Coda lock-free SpscRing a singolo produttore (thread coda eventi: FSM e callback BLE)
+ * e singolo consumatore (thread display).
+ */
+class LcdRenderer {
+public:
+    static const uint32_t QUEUE_LEN = 8;    // Potenza di 2
+
+    LcdRenderer(TextLCD &lcd);
+
+    // --- Produttore (thread coda eventi) ---
+    void clear();
+    void setCursor(uint8_t col, uint8_t row);
+    void printf(const char *format, ...);
+    void print(const char *str);
+    void commit();                                              // Accoda la schermata base se cambiata
+    bool message(const char *line0, const char *line1, uint32_t ms); // Messaggio temporaneo
+    void backlight(bool on);                                    // Applicata al prossimo render()
+
+    // --- Consumatore (thread display) ---
+    void render();
+
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    TextLCD &_lcd;
+
+    SpscRing<LcdScreen, QUEUE_LEN> _queue;
+
+    // Lato produttore
+    LcdScreen _draft;               // Schermata base in composizione
+    LcdScreen _committed;           // Ultima schermata base accodata
+    bool _committedValid;
+    uint8_t _col;
+    uint8_t _row;
+    volatile uint32_t _dropped;
+    std::atomic<bool> _backlightOn;  // Richiesta del produttore
+
+    // Lato consumatore
+    LcdScreen _base;
+    bool _baseDirty;
+    bool _holding;
+    uint64_t _holdUntil;
+    bool _backlightApplied;
+
+    void draw(const LcdScreen &screen);
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef MACHINESTATE_H
+#define MACHINESTATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * @brief Stato della macchina pubblicato per i lettori (log, BLE, LCD), solo header
+ *
+ * Chi scrive non si blocca mai e chi legge ottiene sempre una copia coerente (mai metà
+ * vecchia e metà nuova), senza mutex: Seqlock<T> tiene due copie del valore e un
+ * contatore di sequenza (schema "latch"):
+ *
+ *   scrivi():  seq dispari → aggiorna copia 0 → seq pari → aggiorna copia 1
+ *   leggi():   s = seq → copia[s & 1] → seq ancora == s? altrimenti riprova
+ *
+ * La copia indicata da seq non è mai quella in scrittura: un lettore che interrompe lo
+ * scrittore (ISR, thread a priorità più alta) legge il valore precedente e non ripete.
+ * Ripete solo se lo scrittore completa una scrittura durante la sua copia, cioè se è lo
+ * scrittore a interrompere il lettore: lo scrittore non attende mai nessuno, quindi la
+ * lettura termina. Niente inversione di priorità (il vecchio dhtMutex poteva far
+ * attendere la coda eventi sul thread DHT a bassa priorità).
+ *
+ * Un solo scrittore per istanza (stato macchina: coda eventi; ambiente: thread DHT).
+ * T deve essere copiabile con memcpy; le copie sono parole atomiche a 32 bit (su
+ * Cortex-M4 semplici LDR/STR, barriere DMB solo attorno al contatore).
+ */
+
+// Stato dell'FSM e del distributore (scritto dalla coda eventi, pubblicaStato() in main.cpp)
+struct MachineState {
+    int32_t credito;        // Centesimi
+    int32_t prezzo;         // Prodotto selezionato, centesimi
+    uint8_t stato;          // Stato (VendingApp.h)
+    uint8_t prodotto;       // 1-4
+    uint8_t scorte[4];      // Prodotti 1-4
+    bool presente;          // Presenza filtrata dal sonar
+    bool bleConnesso;
+    uint32_t versione;      // Pubblicazioni dal boot
+};
+
+// Ultima lettura valida del DHT11 (scritta dal thread DHT)
+struct Ambiente {
+    int16_t temp;           // °C
+    uint8_t hum;            // %
+    bool valido;            // false fino alla prima lettura con checksum corretto
+};
+
+template <typename T>
+class Seqlock {
+public:
+    Seqlock() : _seq(0) {
+        T zero;
+        memset(&zero, 0, sizeof(zero));
+        scrivi(zero);
+        _seq.store(0, std::memory_order_relaxed);
+    }
+
+    // Solo dallo scrittore dell'istanza; mai bloccante
+    void scrivi(const T &valore) {
+        uint32_t parole[PAROLE] = {};
+        memcpy(parole, &valore, sizeof(T));
+        uint32_t s = _seq.load(std::memory_order_relaxed);
+
+        _seq.store(s + 1, std::memory_order_relaxed);       // Lettori sulla copia 1
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < PAROLE; i++) _copie[0][i].store(parole[i], std::memory_order_relaxed);
+
+        _seq.store(s + 2, std::memory_order_release);       // Lettori sulla copia 0 (nuova)
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < PAROLE; i++) _copie[1][i].store(parole[i], std::memory_order_relaxed);
+    }
+
+    // Da qualsiasi contesto; tentativi (opzionale): letture ripetute per uno scrittore concorrente
+    T leggi(uint32_t *tentativi = nullptr) const {
+        uint32_t parole[PAROLE];
+        uint32_t s, n = 0;
+        do {
+            s = _seq.load(std::memory_order_acquire);
+            const std::atomic<uint32_t> *copia = _copie[s & 1];
+            for (int i = 0; i < PAROLE; i++) parole[i] = copia[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            n++;
+        } while (_seq.load(std::memory_order_relaxed) != s);
+        if (tentativi) *tentativi = n - 1;
+
+        T valore;
+        memcpy(&valore, parole, sizeof(T));
+        return valore;
+    }
+
+    uint32_t pubblicazioni() const { return _seq.load(std::memory_order_relaxed) / 2; }
+
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock: T copiabile con memcpy");
+    static const int PAROLE = (sizeof(T) + 3) / 4;
+
+    std::atomic<uint32_t> _seq;
+    std::atomic<uint32_t> _copie[2][PAROLE];
+};
+
+#endif
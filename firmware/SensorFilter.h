@@ -0,0 +1,337 @@
+#ifndef SENSORFILTER_H
+#define SENSORFILTER_H
+
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * @brief Stadi di filtro per i sensori, componibili in una catena (solo header)
+ *
+ * Ogni stadio riceve un campione intero con il suo istante e ritorna l'uscita:
+ *
+ *   int32_t filtra(int32_t x, uint64_t t_us);
+ *   int32_t valore() const;        // Ultima uscita
+ *   void reset();                  // Come appena costruito
+ *
+ * Aritmetica intera (virgola fissa dove serve), stato tutto nell'oggetto, nessuna
+ * allocazione. I parametri sono argomenti di costruttori constexpr (membri const,
+ * piegati dal compilatore quando sono costanti) oppure parametri template quando
+ * dimensionano lo stato (finestra della mediana).
+ *
+ *   CatenaFiltri<FiltroIsteresi, FiltroDebounce> presenza(
+ *       FiltroIsteresi(40, 60), FiltroDebounce(1, 600000, 1, 2100000));
+ *   bool presente = presenza.filtra(distanza, hal::now_us());
+ *
+ * Gli stadi non sono thread-safe: un solo contesto per filtro (ISR o coda eventi).
+ */
+
+// ======================================================================================
+// MEDIANA DI N
+// ======================================================================================
+
+/**
+ * @brief Mediana degli ultimi N campioni (o di quelli visti dopo reset(), se meno)
+ * Numero pari di campioni: media dei due centrali. Oltre alla finestra circolare
+ * tiene una copia ordinata: ogni campione toglie il più vecchio e inserisce il nuovo
+ * (O(N) spostamenti, nessun riordino completo). Pensato per N piccoli (3-9).
+ */
+template <int N>
+class FiltroMediana {
+public:
+    constexpr FiltroMediana() : _finestra{}, _ordinati{}, _prossimo(0), _campioni(0), _uscita(0) {}
+
+    int32_t filtra(int32_t x, uint64_t t_us = 0) {
+        int n = _campioni;
+        if (n == N) {
+            // Toglie dall'ordinata il campione che esce dalla finestra
+            int32_t vecchio = _finestra[_prossimo];
+            int i = 0;
+            while (_ordinati[i] != vecchio) i++;
+            for (; i < n - 1; i++) _ordinati[i] = _ordinati[i + 1];
+            n--;
+        }
+        int j = n;
+        for (; j > 0 && _ordinati[j - 1] > x; j--) _ordinati[j] = _ordinati[j - 1];
+        _ordinati[j] = x;
+        _campioni = n + 1;
+
+        _finestra[_prossimo] = x;
+        _prossimo = (_prossimo + 1 == N) ? 0 : _prossimo + 1;
+
+        int m = _campioni / 2;
+        _uscita = (_campioni & 1) ? _ordinati[m] : (int32_t)(((int64_t)_ordinati[m - 1] + _ordinati[m]) / 2);
+        return _uscita;
+    }
+
+    int32_t valore() const { return _uscita; }
+    int campioni() const { return _campioni; }
+    void reset() { _prossimo = _campioni = 0; _uscita = 0; }
+
+private:
+    static_assert(N > 0 && N <= 32, "FiltroMediana: finestra 1-32 campioni");
+    int32_t _finestra[N];   // Ultimi campioni in ordine di arrivo
+    int32_t _ordinati[N];   // Gli stessi, ordinati
+    int _prossimo;
+    int _campioni;
+    int32_t _uscita;
+};
+
+// ======================================================================================
+// MEDIA ESPONENZIALE (EMA)
+// ======================================================================================
+
+/**
+ * @brief EMA in virgola fissa: α = 2^-shift per campione, stato = uscita << shift
+ * Il primo campione dopo reset() inizializza l'uscita. |x| < 2^(31 - shift).
+ */
+class FiltroEma {
+public:
+    constexpr explicit FiltroEma(uint8_t shift) : _shift(shift), _q(0), _pronto(false) {}
+
+    int32_t filtra(int32_t x, uint64_t t_us = 0) {
+        if (!_pronto) {
+            _q = x * ((int32_t)1 << _shift);
+            _pronto = true;
+        } else {
+            _q += x - (_q >> _shift);
+        }
+        return _q >> _shift;
+    }
+
+    int32_t valore() const { return _q >> _shift; }
+    bool pronto() const { return _pronto; }
+    void reset() { _q = 0; _pronto = false; }
+
+private:
+    const uint8_t _shift;
+    int32_t _q;
+    bool _pronto;
+};
+
+// ======================================================================================
+// ISTERESI
+// ======================================================================================
+
+/**
+ * @brief Soglia con isteresi: uscita 0/1, tra le due soglie resta com'è
+ * sogliaOn > sogliaOff: 1 quando x > sogliaOn, 0 quando x < sogliaOff (es. Δ LDR);
+ * sogliaOn < sogliaOff: 1 quando x < sogliaOn, 0 quando x > sogliaOff (es. distanza).
+ */
+class FiltroIsteresi {
+public:
+    constexpr FiltroIsteresi(int32_t sogliaOn, int32_t sogliaOff, bool iniziale = false) :
+        _on(sogliaOn), _off(sogliaOff), _iniziale(iniziale), _uscita(iniziale) {}
+
+    int32_t filtra(int32_t x, uint64_t t_us = 0) {
+        if (_on > _off) {
+            if (x > _on) _uscita = true;
+            else if (x < _off) _uscita = false;
+        } else {
+            if (x < _on) _uscita = true;
+            else if (x > _off) _uscita = false;
+        }
+        return _uscita;
+    }
+
+    int32_t valore() const { return _uscita; }
+    void reset() { _uscita = _iniziale; }
+
+private:
+    const int32_t _on;
+    const int32_t _off;
+    const bool _iniziale;
+    bool _uscita;
+};
+
+// ======================================================================================
+// LIMITATORE DI PENDENZA
+// ======================================================================================
+
+/**
+ * @brief Variazione massima dell'uscita per campione (salita e discesa separate)
+ * Il primo campione dopo reset() passa com'è.
+ */
+class FiltroLimitatore {
+public:
+    constexpr FiltroLimitatore(int32_t maxSalita, int32_t maxDiscesa) :
+        _salita(maxSalita), _discesa(maxDiscesa), _uscita(0), _pronto(false) {}
+
+    int32_t filtra(int32_t x, uint64_t t_us = 0) {
+        if (!_pronto) {
+            _uscita = x;
+            _pronto = true;
+        } else if (x > _uscita) {
+            _uscita = (x - _uscita > _salita) ? _uscita + _salita : x;
+        } else {
+            _uscita = (_uscita - x > _discesa) ? _uscita - _discesa : x;
+        }
+        return _uscita;
+    }
+
+    int32_t valore() const { return _uscita; }
+    void reset() { _uscita = 0; _pronto = false; }
+
+private:
+    const int32_t _salita;
+    const int32_t _discesa;
+    int32_t _uscita;
+    bool _pronto;
+};
+
+// ======================================================================================
+// ANTI-SPIKE
+// ======================================================================================
+
+/**
+ * @brief Scarta i salti impossibili: il campione è accettato solo entro
+ *        [uscita - maxDiscesa, uscita + maxSalita], altrimenti l'uscita resta
+ * A differenza del limitatore non insegue il salto: un valore fuori fascia non ha
+ * alcun effetto (es. eco spuria del sonar).
+ *
+ * conferme > 0: un livello fuori fascia è accettato quando altri `conferme` campioni
+ * consecutivi lo ripetono (ciascuno nella fascia del precedente). Serve a chi campiona
+ * a intervalli lunghi: un oggetto vero arrivato tra due letture non resta scartato per
+ * sempre. Con conferme = 0 (default) la fascia non si sposta mai con un salto.
+ */
+class FiltroAntiSpike {
+public:
+    constexpr FiltroAntiSpike(int32_t maxSalita, int32_t maxDiscesa, int32_t iniziale, uint8_t conferme = 0) :
+        _salita(maxSalita), _discesa(maxDiscesa), _iniziale(iniziale), _conferme(conferme),
+        _uscita(iniziale), _candidato(0), _ripetuti(0), _scartati(0) {}
+
+    int32_t filtra(int32_t x, uint64_t t_us = 0) {
+        if (inFascia(x, _uscita)) {
+            _uscita = x;
+            _ripetuti = 0;
+            return _uscita;
+        }
+        if (_conferme) {
+            bool coerente = _ripetuti && inFascia(x, _candidato);
+            if (coerente && _ripetuti >= _conferme) {
+                _uscita = x;
+                _ripetuti = 0;
+                return _uscita;
+            }
+            _ripetuti = coerente ? _ripetuti + 1 : 1;
+            _candidato = x;
+        }
+        _scartati++;
+        return _uscita;
+    }
+
+    int32_t valore() const { return _uscita; }
+    uint32_t scartati() const { return _scartati; }
+    void reset() {
+        _uscita = _iniziale;
+        _ripetuti = 0;
+    }
+
+private:
+    const int32_t _salita;
+    const int32_t _discesa;
+    const int32_t _iniziale;
+    const uint8_t _conferme;
+    int32_t _uscita;
+    int32_t _candidato;     // Ultimo campione scartato
+    uint8_t _ripetuti;      // Campioni scartati consecutivi coerenti con _candidato
+    uint32_t _scartati;
+
+    bool inFascia(int32_t x, int32_t rif) const {
+        return (int64_t)x >= (int64_t)rif - _discesa && (int64_t)x <= (int64_t)rif + _salita;
+    }
+};
+
+// ======================================================================================
+// DEBOUNCE
+// ======================================================================================
+
+/**
+ * @brief Cambio dell'uscita (0/1) confermato da campioni consecutivi e da una durata
+ * L'ingresso diverso dall'uscita apre la conferma; un ingresso uguale all'uscita la
+ * annulla. L'uscita cambia al campione che raggiunge sia i campioni sia la durata
+ * (dal primo campione diverso), separati per attivazione (0 → 1) e rilascio (1 → 0).
+ *
+ * scadenza() dice quando la durata sarà raggiunta: chi riceve campioni radi (sonar)
+ * può ripresentare l'ultimo ingresso a quell'istante invece di attendere il prossimo.
+ */
+class FiltroDebounce {
+public:
+    constexpr FiltroDebounce(uint8_t campioniOn, uint32_t usOn, uint8_t campioniOff, uint32_t usOff) :
+        _campioniOn(campioniOn), _usOn(usOn), _campioniOff(campioniOff), _usOff(usOff),
+        _uscita(false), _conta(0), _inizio(0) {}
+
+    int32_t filtra(int32_t x, uint64_t t_us) {
+        bool v = (x != 0);
+        if (v == _uscita) {
+            _conta = 0;
+            return _uscita;
+        }
+        if (_conta == 0) _inizio = t_us;
+        if (_conta < 255) _conta++;
+        if (_conta >= (_uscita ? _campioniOff : _campioniOn) && t_us - _inizio >= (_uscita ? _usOff : _usOn)) {
+            _uscita = v;
+            _conta = 0;
+        }
+        return _uscita;
+    }
+
+    int32_t valore() const { return _uscita; }
+    bool inAttesa() const { return _conta != 0; }               // Cambio aperto, non ancora confermato
+    uint64_t inizio() const { return _inizio; }                 // Primo campione del cambio in corso (o dell'ultimo)
+    uint64_t scadenza() const { return _inizio + (_uscita ? _usOff : _usOn); }
+    void reset() { _uscita = false; _conta = 0; }
+
+private:
+    const uint8_t _campioniOn;
+    const uint32_t _usOn;
+    const uint8_t _campioniOff;
+    const uint32_t _usOff;
+    bool _uscita;
+    uint8_t _conta;
+    uint64_t _inizio;
+};
+
+// ======================================================================================
+// CATENA
+// ======================================================================================
+
+/**
+ * @brief Stadi in serie: l'uscita di ciascuno è l'ingresso del successivo
+ * Gli stadi sono membri (nessun puntatore, nessuna chiamata virtuale): il compilatore
+ * vede tutta la catena e la espande in linea. stadio<I>() dà accesso allo stadio I.
+ */
+template <typename... Stadi>
+class CatenaFiltri;
+
+template <>
+class CatenaFiltri<> {
+public:
+    constexpr CatenaFiltri() {}
+    int32_t filtra(int32_t x, uint64_t) { return x; }
+    void reset() {}
+};
+
+template <typename Primo, typename... Resto>
+class CatenaFiltri<Primo, Resto...> {
+public:
+    constexpr CatenaFiltri(const Primo &primo, const Resto &...resto) : _primo(primo), _resto(resto...) {}
+
+    int32_t filtra(int32_t x, uint64_t t_us = 0) { return _resto.filtra(_primo.filtra(x, t_us), t_us); }
+    void reset() {
+        _primo.reset();
+        _resto.reset();
+    }
+
+    template <int I>
+    auto &stadio() { return stadio(std::integral_constant<int, I>()); }
+
+private:
+    Primo _primo;
+    CatenaFiltri<Resto...> _resto;
+
+    Primo &stadio(std::integral_constant<int, 0>) { return _primo; }
+    template <int I>
+    auto &stadio(std::integral_constant<int, I>) { return _resto.template stadio<I - 1>(); }
+};
+
+#endif
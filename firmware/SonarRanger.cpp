@@ -0,0 +1,194 @@
+#include "SonarRanger.h"
+
+// ======================================================================================
+// VELOCITÀ DEL SUONO (tabella constexpr, in flash)
+// ======================================================================================
+
+namespace {
+
+constexpr double radice(double x) {
+    double r = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 40; i++) r = 0.5 * (r + x / r);
+    return r;
+}
+
+// Metà della velocità del suono (l'eco fa andata e ritorno) in mm/μs, Q16
+struct TabellaSuono {
+    uint16_t mezzaQ16[SonarRanger::SUONO_T_MAX - SonarRanger::SUONO_T_MIN + 1];
+
+    constexpr TabellaSuono() : mezzaQ16{} {
+        for (int t = SonarRanger::SUONO_T_MIN; t <= SonarRanger::SUONO_T_MAX; t++) {
+            double mmUs = 0.3313 * radice(1.0 + t / 273.15);
+            mezzaQ16[t - SonarRanger::SUONO_T_MIN] = (uint16_t)(mmUs / 2 * 65536.0 + 0.5);
+        }
+    }
+};
+
+constexpr TabellaSuono tabellaSuono;
+
+static_assert(tabellaSuono.mezzaQ16[20 - SonarRanger::SUONO_T_MIN] == 11246, "343.2 m/s a 20°C");
+
+}
+
+uint16_t SonarRanger::mezzaVelocitaQ16(int gradiC) {
+    if (gradiC < SUONO_T_MIN) gradiC = SUONO_T_MIN;
+    if (gradiC > SUONO_T_MAX) gradiC = SUONO_T_MAX;
+    return tabellaSuono.mezzaQ16[gradiC - SUONO_T_MIN];
+}
+
+SonarRanger::SonarRanger(hal::DigitalOut &trig, hal::Timeout &timeout, int initialCm,
+                         const SonarCadenzaConfig &cadenza) :
+    _trig(trig), _timeout(timeout), _slotIsr(nullptr), _readingIsr(nullptr), _cadenza(cadenza), _fermo(true),
+    _ping(0), _armed(false), _echoStart(0), _echoWidth(0),
+    _mezzaQ16(mezzaVelocitaQ16(TEMPERATURA_DEFAULT)),
+    _spike(INT_MAX, MAX_AVVICINAMENTO_CM * 10, initialCm * 10, SPIKE_CONFERME),
+    _distance(initialCm), _readings(0)
+{
+}
+
+void SonarRanger::start(hal::Isr slotIsr, hal::Isr readingIsr) {
+    _slotIsr = slotIsr;
+    _readingIsr = readingIsr;
+    hal::critical_enter();
+    if (_cadenza.modo() != SONAR_PAUSA) riparti();
+    hal::critical_exit();
+}
+
+void SonarRanger::setModo(ModoSonar modo) {
+    hal::critical_enter();
+    if (modo != _cadenza.modo()) {
+        _cadenza.modo(modo);
+        if (modo == SONAR_PAUSA) {
+            // Burst in corso abbandonata: i ping già fatti non vanno mescolati alla prossima
+            _timeout.detach();
+            _armed = false;
+            _burst.reset();
+            _fermo = true;
+        } else if (_slotIsr && (_fermo || _ping == 0)) {
+            riparti();      // Da fermo o in attesa tra due letture (es. 4s di idle): burst subito
+        }
+    }
+    hal::critical_exit();
+}
+
+void SonarRanger::setCadenza(const SonarCadenzaConfig &cadenza) {
+    hal::critical_enter();
+    _cadenza.configura(cadenza);
+    hal::critical_exit();
+}
+
+void SonarRanger::riparti() {
+    _fermo = false;
+    _ping = 0;
+    _timeout.attach_us(_slotIsr, PING_SPACING_US);
+}
+
+/**
+ * @brief Interrupt Service Routine - fronte di salita echo
+ * Marca l'inizio dell'impulso echo del ping in corso
+ */
+void SonarRanger::onEchoRise() {
+    if (_armed) _echoStart = hal::now_us();
+}
+
+/**
+ * @brief Interrupt Service Routine - fronte di discesa echo
+ * Calcola la durata dell'impulso; fronti fuori finestra (ping già chiuso) ignorati
+ */
+void SonarRanger::onEchoFall() {
+    if (_armed && _echoStart != 0) {
+        _echoWidth = (uint32_t)(hal::now_us() - _echoStart);
+        _armed = false;
+    }
+}
+
+/**
+ * @brief Slot della burst (ISR hal::Timeout)
+ * Chiude il ping precedente e lancia il successivo; dopo BURST_PINGS pubblica la
+ * lettura e attende il resto dell'intervallo scelto da SonarScheduler (0: si ferma).
+ */
+void SonarRanger::onSlot() {
+    if (_ping > 0) closePing();
+
+    if (_ping < BURST_PINGS) {
+        firePing();
+        _ping++;
+        _timeout.attach_us(_slotIsr, PING_SPACING_US);
+        return;
+    }
+
+    int visto = publish();
+    _ping = 0;
+    uint32_t interval = _cadenza.lettura(visto, (uint32_t)(hal::now_us() / 1000)) * 1000;
+    if (interval == 0) {
+        _fermo = true;
+        return;
+    }
+    uint32_t burst = BURST_PINGS * PING_SPACING_US;
+    _timeout.attach_us(_slotIsr, interval > burst ? interval - burst : PING_SPACING_US);
+}
+
+void SonarRanger::firePing() {
+    // CRITICAL FIX: Azzera echo prima di ogni misura
+    // Previene uso di valori obsoleti se sensore non risponde
+    _echoStart = 0;
+    _echoWidth = 0;
+    _armed = true;
+
+    // Impulso trigger 10μs (spec HC-SR04: min 10μs)
+    _trig = 0;
+    hal::wait_us(2);        // Assicura fronte di discesa pulito
+    _trig = 1;
+    hal::wait_us(10);       // Impulso HIGH 10μs
+    _trig = 0;
+}
+
+void SonarRanger::closePing() {
+    _armed = false;
+
+    // VALIDAZIONE TIMEOUT E RANGE
+    // Timeout 30000μs = ~500cm max
+    uint32_t echoDuration = _echoWidth;
+    if (echoDuration > 0 && echoDuration < 30000) {
+        // Formula fisica: distanza = (tempo_μs * velocità_suono(T)) / 2, in mm
+        uint32_t mm = echoToMm(echoDuration, _mezzaQ16);
+
+        // Filtro range sensore: HC-SR04 affidabile solo 2-400cm
+        if (mm >= 20 && mm <= 4000) _burst.filtra((int32_t)mm);
+    }
+}
+
+/**
+ * @brief Pubblica la distanza filtrata della burst
+ *
+ * ALGORITMO (da leggiDistanza v8.7, la media è diventata mediana):
+ * 1. Nessuna lettura valida: mantiene ultima distanza nota (failsafe)
+ * 2. Mediana dei campioni validi: un'eco spuria nella burst non sposta la lettura
+ * 3. Filtro anti-spike ASIMMETRICO:
+ *    - Permette allontanamenti rapidi (es: 20cm → 200cm OK)
+ *    - Blocca avvicinamenti impossibili > 150cm (es: 200cm → 10cm BLOCCATO), salvo
+ *      conferma dalla lettura successiva (con la cadenza in backoff tra due letture
+ *      possono passare 2-4s: un cliente vero fa più di 150cm)
+ *
+ * @return Mediana della burst in cm (prima dell'anti-spike, distanza pubblicata se
+ *         nessun ping valido): è il movimento visto dal sensore, per la cadenza
+ */
+int SonarRanger::publish() {
+    int visto = _distance;
+    if (_burst.campioni() > 0) {
+        // FISICA: utente può allontanarsi rapidamente (es: 20cm → 200cm in 500ms)
+        //         ma avvicinamenti > 150cm in 500ms sono impossibili (spike sensore)
+        // ✓ 17cm → 150cm: allontanamento, nessun limite → ACCETTATO
+        // ✓ 150cm → 80cm: differenza 70cm < 150cm → ACCETTATO (avvicinamento normale)
+        // ✗ 200cm → 10cm: 10 < 200 - 150 = 50 → BLOCCATO (spike!), ACCETTATO se ripetuto
+        visto = (_burst.valore() + 5) / 10;
+        _spike.filtra(_burst.valore());
+    }
+    _burst.reset();
+
+    _distance = (_spike.valore() + 5) / 10;
+    _readings = _readings + 1;
+    _letture.push({hal::now_us(), _distance});
+    if (_readingIsr) _readingIsr();
+    return visto;
+}
@@ -0,0 +1,116 @@
+#ifndef SONARRANGER_H
+#define SONARRANGER_H
+
+#include <climits>
+#include "hal/hal.h"
+#include "SensorFilter.h"
+#include "SonarScheduler.h"
+#include "SpscRing.h"
+
+// Lettura pubblicata a fine burst (ISR → consumatore, vedi SonarRanger::lettura)
+struct LetturaSonar {
+    uint64_t t_us;          // Fine della burst
+    int32_t cm;             // Distanza filtrata (come distance())
+};
+
+/**
+ * @brief Motore di misura HC-SR04 non bloccante (interrupt + timeout)
+ *
+ * Sostituisce il vecchio leggiDistanza() che bloccava il tick per 5 x 15ms.
+ * I ping sono schedulati in background da un hal::Timeout:
+ *
+ *   |ping|--15ms--|ping|--15ms-- ... x3 --|pubblica|------ intervallo ------|ping| ...
+ *
+ * L'intervallo lo decide SonarScheduler a ogni lettura pubblicata (in ISR): più corto
+ * quando qualcuno si avvicina, in backoff esponenziale a scena ferma, nessun ping nel
+ * modo PAUSA (la burst riparte al cambio di modo).
+ *
+ * Le ISR echoRise/echoFall marcano i fronti con hal::now_us(); alla chiusura della
+ * burst la distanza filtrata (range, mediana dei ping validi, anti-spike asimmetrico,
+ * stadi di SensorFilter.h) è pubblicata in una variabile che l'FSM legge senza attese
+ * e accodata con il suo istante in una SpscRing: il consumatore (coda eventi) vede ogni
+ * lettura anche se ne arrivano più d'una prima che giri.
+ *
+ * Conversione eco → distanza in virgola fissa e compensata in temperatura: la velocità
+ * del suono (331.3·√(1 + T/273.15) m/s, +0.17%/°C) è in una tabella constexpr per grado
+ * da SUONO_T_MIN a SUONO_T_MAX, già scalata in mm/μs Q16 (una moltiplicazione e uno
+ * shift per ping, nessun float nell'ISR). La temperatura arriva dal DHT11
+ * (setTemperatura, 20°C fino alla prima lettura valida); a 0°C o 40°C il vecchio
+ * 0.0343 cm/μs sbagliava del 3.5%.
+ *
+ * Le ISR sono funzioni libere (hal::Isr): il chiamante le inoltra a onEchoRise(),
+ * onEchoFall() e onSlot() dell'unica istanza.
+ */
+class SonarRanger {
+public:
+    static const int BURST_PINGS = 3;               // Campioni per lettura (mediana)
+    static const uint32_t PING_SPACING_US = 15000;  // Attesa echo per ping (~250cm)
+    static const int MAX_AVVICINAMENTO_CM = 150;    // Salto verso il sensore impossibile tra due letture
+    static const int SPIKE_CONFERME = 1;            // Letture coerenti che confermano un salto scartato
+    static const int SUONO_T_MIN = -20;             // Tabella velocità del suono (°C, estremi saturati)
+    static const int SUONO_T_MAX = 60;
+    static const int TEMPERATURA_DEFAULT = 20;
+    static const uint32_t LETTURE_CODA = 8;         // Letture in attesa del consumatore (potenza di 2)
+
+    // Metà della velocità del suono a gradiC in mm/μs Q16 (tabella, estremi saturati)
+    static uint16_t mezzaVelocitaQ16(int gradiC);
+    // Distanza (mm) dalla durata dell'eco (μs, andata e ritorno): una moltiplicazione.
+    // echo < 30000μs (< 2^15) × k (< 2^14): nessun overflow su 32 bit
+    static uint32_t echoToMm(uint32_t echoUs, uint16_t mezzaQ16) { return (echoUs * mezzaQ16 + 0x8000) >> 16; }
+
+    SonarRanger(hal::DigitalOut &trig, hal::Timeout &timeout, int initialCm = 100,
+                const SonarCadenzaConfig &cadenza = CADENZA_ADATTIVA);
+
+    // Avvia i ping in background; readingIsr (opzionale) è chiamata a ogni nuova lettura
+    void start(hal::Isr slotIsr, hal::Isr readingIsr = nullptr);
+    // Modo della cadenza (stato della macchina); fuori da PAUSA una burst parte subito
+    // se il sonar era fermo o in attesa tra due letture
+    void setModo(ModoSonar modo);
+    void setCadenza(const SonarCadenzaConfig &cadenza);
+    void setTemperatura(int gradiC) { _mezzaQ16 = mezzaVelocitaQ16(gradiC); }  // Aria davanti al sensore (DHT11)
+
+    int distance() const { return _distance; }   // Ultima distanza filtrata (cm)
+    uint32_t readings() const { return _readings; }
+    // Consumatore unico delle letture accodate (in ordine); false se non ce ne sono
+    bool lettura(LetturaSonar &l) { return _letture.pop(l); }
+    uint32_t letturePerse() const { return _letture.persi(); }   // Coda piena: consumatore fermo
+    uint32_t spikes() const { return _spike.scartati(); }  // Letture scartate dall'anti-spike
+    const SonarScheduler &cadenza() const { return _cadenza; }
+
+    // --- Contesto ISR ---
+    void onEchoRise();
+    void onEchoFall();
+    void onSlot();
+
+private:
+    hal::DigitalOut &_trig;
+    hal::Timeout &_timeout;
+    hal::Isr _slotIsr;
+    hal::Isr _readingIsr;
+    SonarScheduler _cadenza;
+    volatile bool _fermo;       // Nessun Timeout armato (PAUSA o non avviato)
+
+    // Ping in corso
+    int _ping;
+    volatile bool _armed;
+    volatile uint64_t _echoStart;
+    volatile uint32_t _echoWidth;
+
+    volatile uint16_t _mezzaQ16;   // Velocità del suono alla temperatura corrente (vedi echoToMm)
+
+    // Filtri (mm): ping validi della burst → mediana → anti-spike tra una lettura e l'altra
+    FiltroMediana<BURST_PINGS> _burst;
+    FiltroAntiSpike _spike;
+
+    // Uscita
+    volatile int _distance;
+    volatile uint32_t _readings;
+    SpscRing<LetturaSonar, LETTURE_CODA> _letture;
+
+    void riparti();
+    void firePing();
+    void closePing();
+    int publish();
+};
+
+#endif
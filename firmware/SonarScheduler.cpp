@@ -0,0 +1,58 @@
+#include "SonarScheduler.h"
+
+// Minimo 150ms (la burst ne dura 45). Massimo 2s: a 1 m/s un cliente impiega 2.2s dalla
+// parete (250cm) al banco, almeno una lettura cade durante l'avvicinamento e porta la
+// cadenza al minimo prima che arrivi sotto DISTANZA_ATTIVA ("vending_sim traffico")
+const SonarCadenzaConfig CADENZA_ADATTIVA = {
+    {{150, 500, 2000}, {250, 1000, 2000}, {150, 1000, 2000}},
+    4, 20
+};
+
+const SonarCadenzaConfig CADENZA_FISSA = {
+    {{500, 500, 500}, {5000, 5000, 5000}, {1000, 1000, 1000}},
+    4, 20
+};
+
+SonarScheduler::SonarScheduler(const SonarCadenzaConfig &config) :
+    _cfg(&config), _modo(SONAR_RIPOSO), _intervallo(config.modo[SONAR_RIPOSO].baseMs),
+    _riferimento(false), _cm(0), _t(0), _rapide(0)
+{
+}
+
+void SonarScheduler::configura(const SonarCadenzaConfig &config) {
+    _cfg = &config;
+    modo(_modo);
+}
+
+void SonarScheduler::modo(ModoSonar m) {
+    _modo = m;
+    _riferimento = false;
+    if (m != SONAR_PAUSA) _intervallo = _cfg->modo[m].baseMs;
+}
+
+uint32_t SonarScheduler::lettura(int cm, uint32_t t_ms) {
+    if (_modo == SONAR_PAUSA) return 0;
+    const CadenzaModo &c = _cfg->modo[_modo];
+
+    if (_riferimento) {
+        int delta = cm - _cm;
+        uint32_t dt = (t_ms - _t) ? t_ms - _t : 1;
+        int32_t velocita = (int32_t)(delta * 1000 / (int32_t)dt);     // cm/s, < 0 in avvicinamento
+        bool interessa = (_modo == SONAR_CLIENTE) ? (velocita >= (int32_t)_cfg->velocitaCmS)
+                                                  : (velocita <= -(int32_t)_cfg->velocitaCmS);
+        int ampiezza = (delta < 0) ? -delta : delta;
+
+        if (ampiezza > _cfg->rumoreCm && interessa) {
+            _intervallo = c.minMs;
+            _rapide++;
+        } else if (ampiezza > _cfg->rumoreCm) {
+            _intervallo = c.baseMs;
+        } else {
+            _intervallo = (_intervallo * 2 > c.maxMs) ? c.maxMs : _intervallo * 2;
+        }
+    }
+    _riferimento = true;
+    _cm = cm;
+    _t = t_ms;
+    return _intervallo;
+}
@@ -0,0 +1,70 @@
+#ifndef SONARSCHEDULER_H
+#define SONARSCHEDULER_H
+
+#include <cstdint>
+
+/**
+ * @brief Cadenza adattiva delle letture sonar (quanto attendere tra una burst e l'altra)
+ *
+ * Ogni lettura pubblicata da SonarRanger decide l'intervallo fino alla successiva:
+ * - scena ferma (|Δ| <= rumoreCm dalla lettura precedente): intervallo raddoppiato,
+ *   fino al massimo del modo (backoff esponenziale, es. notte);
+ * - qualcosa si muove: intervallo base del modo;
+ * - movimento nella direzione che interessa oltre velocitaCmS: intervallo minimo.
+ *   In RIPOSO/IDLE interessa chi si avvicina (arrivo di un cliente), con il cliente
+ *   davanti chi si allontana (uscita).
+ *
+ * Il modo segue lo stato della macchina: in PAUSA (erogazione, resto) il sonar non
+ * invia ping. Al cambio di modo l'intervallo riparte dalla base del modo.
+ *
+ * Logica pura (nessun accesso all'hardware): lettura() è chiamata dall'ISR di
+ * SonarRanger, modo() dal chiamante con gli interrupt disabilitati.
+ */
+
+enum ModoSonar {
+    SONAR_RIPOSO = 0,   // Nessun cliente, macchina sveglia
+    SONAR_CLIENTE,      // Cliente davanti (ATTESA_MONETA, ERRORE)
+    SONAR_IDLE,         // Idle profondo
+    SONAR_PAUSA,        // Erogazione e resto: nessun ping
+    SONAR_MODI
+};
+
+struct CadenzaModo {
+    uint16_t minMs;     // Movimento nella direzione che interessa
+    uint16_t baseMs;    // Movimento qualsiasi / ingresso nel modo
+    uint16_t maxMs;     // Limite del backoff a scena ferma
+};
+
+struct SonarCadenzaConfig {
+    CadenzaModo modo[SONAR_PAUSA];  // RIPOSO, CLIENTE, IDLE
+    uint8_t rumoreCm;               // Variazione sotto cui la scena è ferma
+    uint16_t velocitaCmS;           // Avvicinamento/allontanamento per la cadenza minima
+};
+
+extern const SonarCadenzaConfig CADENZA_ADATTIVA;
+extern const SonarCadenzaConfig CADENZA_FISSA;     // 500ms RIPOSO, 5s con cliente, 1s idle (fino alla v8.32)
+
+class SonarScheduler {
+public:
+    explicit SonarScheduler(const SonarCadenzaConfig &config);
+
+    void configura(const SonarCadenzaConfig &config);
+    void modo(ModoSonar m);
+    // Nuova lettura (cm, istante in ms): intervallo fino alla prossima burst, 0 = pausa
+    uint32_t lettura(int cm, uint32_t t_ms);
+
+    ModoSonar modo() const { return _modo; }
+    uint32_t intervallo() const { return (_modo == SONAR_PAUSA) ? 0 : _intervallo; }
+    uint32_t rapide() const { return _rapide; }     // Letture che hanno portato alla cadenza minima
+
+private:
+    const SonarCadenzaConfig *_cfg;
+    ModoSonar _modo;
+    uint32_t _intervallo;
+    bool _riferimento;      // _cm/_t validi (prima lettura del modo: solo riferimento)
+    int _cm;
+    uint32_t _t;
+    uint32_t _rapide;
+};
+
+#endif
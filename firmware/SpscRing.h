@@ -0,0 +1,86 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * @brief Coda circolare lock-free a un produttore e un consumatore, solo header
+ *
+ * Passa dati con timestamp da un'ISR (o thread) produttore a un consumatore (coda
+ * eventi, thread) senza perderli tra una lettura e l'altra e senza sezioni critiche:
+ *
+ *   push():  copia in _celle[testa] → testa + 1 (release)
+ *   pop():   coda != testa (acquire) → copia da _celle[coda] → coda + 1 (release)
+ *
+ * Wait-free: push() e pop() non ripetono mai e non attendono l'altro lato; con coda
+ * piena push() rifiuta l'elemento (contatore persi()), il produttore decide se tenerlo.
+ * Gli indici sono contatori a 32 bit liberi (mai azzerati): testa - coda è il numero
+ * di elementi anche dopo il giro a 2^32, per questo N deve essere potenza di 2.
+ *
+ * Su Cortex-M4 gli indici sono semplici LDR/STR a 32 bit, acquire/release diventano
+ * DMB: la copia dell'elemento è visibile prima dell'indice che la pubblica anche col
+ * consumatore su un altro thread.
+ *
+ * Usata da SonarRanger (letture, ISR → coda eventi) e LcdRenderer (schermate).
+ *
+ * Un solo produttore e un solo consumatore per istanza: due ISR produttrici vanno
+ * alla stessa priorità (non si interrompono a vicenda), altrimenti due code.
+ */
+template <typename T, uint32_t N>
+class SpscRing {
+public:
+    static const uint32_t CAPACITA = N;
+
+    SpscRing() : _testa(0), _coda(0), _persi(0) {}
+
+    // --- Produttore ---
+    bool push(const T &valore) {
+        uint32_t testa = _testa.load(std::memory_order_relaxed);
+        if (testa - _coda.load(std::memory_order_acquire) >= N) {
+            _persi.store(_persi.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        _celle[testa & (N - 1)] = valore;
+        _testa.store(testa + 1, std::memory_order_release);
+        return true;
+    }
+
+    // --- Consumatore ---
+    bool pop(T &valore) {
+        uint32_t coda = _coda.load(std::memory_order_relaxed);
+        if (coda == _testa.load(std::memory_order_acquire)) return false;
+        valore = _celle[coda & (N - 1)];
+        _coda.store(coda + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Fino a max elementi in un solo passo (una barriera per lato): quanti copiati
+    uint32_t pop(T *valori, uint32_t max) {
+        uint32_t coda = _coda.load(std::memory_order_relaxed);
+        uint32_t n = _testa.load(std::memory_order_acquire) - coda;
+        if (n > max) n = max;
+        for (uint32_t i = 0; i < n; i++) valori[i] = _celle[(coda + i) & (N - 1)];
+        if (n) _coda.store(coda + n, std::memory_order_release);
+        return n;
+    }
+
+    // Da qualsiasi contesto: valori indicativi se l'altro lato è in corso
+    uint32_t occupati() const {
+        return _testa.load(std::memory_order_acquire) - _coda.load(std::memory_order_acquire);
+    }
+    bool vuota() const { return occupati() == 0; }
+    uint32_t persi() const { return _persi.load(std::memory_order_relaxed); }
+
+private:
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing: N potenza di 2");
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRing: T copiabile con memcpy");
+
+    T _celle[N];
+    std::atomic<uint32_t> _testa;   // Scritto solo dal produttore
+    std::atomic<uint32_t> _coda;    // Scritto solo dal consumatore
+    std::atomic<uint32_t> _persi;   // Scritto solo dal produttore
+};
+
+#endif
@@ -0,0 +1,445 @@
+#include "Telemetry.h"
+#include "VendingApp.h"
+#include "BleComandi.h"
+#include <cstdio>
+#include <cstring>
+
+// ======================================================================================
+// FORMATO TESTO (righe storiche del log seriale)
+// ======================================================================================
+
+static const char *const nomiStati[] = {"RIPOSO", "ATTESA_MONETA", "EROGAZIONE", "RESTO", "ERRORE"};
+static const char *const msgSelezione[] = {"", "ACQUA selezionata", "SNACK selezionato", "CAFFE selezionato", "THE selezionato"};
+static const char *const msgEsaurito[] = {"", "ACQUA esaurita", "SNACK esaurito", "CAFFE esaurito", "THE esaurito"};
+
+static const char *nomeStato(int32_t s) {
+    return (s >= RIPOSO && s <= ERRORE) ? nomiStati[s] : "?";
+}
+
+int telemetriaTesto(uint8_t tipo, const int32_t *args, int nArgs, char *buf, int size) {
+    int32_t a[TLM_MAX_ARGS];
+    for (int i = 0; i < TLM_MAX_ARGS; i++) a[i] = (i < nArgs) ? args[i] : 0;
+    bool prodottoValido = (a[0] >= 1 && a[0] <= 4);
+    char e1[EURO_LEN], e2[EURO_LEN];    // Importi in centesimi → "2", "1.50"
+    int n = 0;
+
+    switch (tipo) {
+        case TLM_SYNC:
+            if (a[1] == 0) return 0;
+            n = snprintf(buf, size, "[TLM] %d record persi (buffer seriale pieno)\n", (int)a[1]);
+            break;
+        case TLM_STATUS:
+            n = snprintf(buf, size, "[STATUS] %s | %-14s | €%-2s | P%d@%sEUR | LDR:%2d%%(B:%2d Δ:%+3d) | DIST:%3dcm | T:%2d°C H:%2d%% | A%d S%d C%d T%d\n",
+                         a[0] ? "BLE:ON " : "BLE:OFF", nomeStato(a[1]), formatoEuro(a[2], e1), (int)a[3], formatoEuro(a[4], e2),
+                         (int)a[5], (int)a[6], (int)(a[5] - a[6]), (int)a[7], (int)a[8], (int)a[9],
+                         (int)a[10], (int)a[11], (int)a[12], (int)a[13]);
+            break;
+        case TLM_FSM:
+            n = snprintf(buf, size, "[FSM] %s -> %s | Credito: %sE | Prodotto: %d\n",
+                         nomeStato(a[0]), nomeStato(a[1]), formatoEuro(a[2], e1), (int)a[3]);
+            break;
+        case TLM_LDR_MONETA:
+            if (nArgs < 4) {
+                n = snprintf(buf, size, "[LDR] Moneta rilevata! (val=%d%%, base=%d%%, Δ=+%d%%)\n",
+                             (int)a[0], (int)a[1], (int)a[2]);
+            } else {
+                n = snprintf(buf, size, "[LDR] Moneta rilevata! (val=%d%%, base=%d%%, Δ=+%d%%, ingresso %dms fa)\n",
+                             (int)a[0], (int)a[1], (int)a[2], (int)a[3]);
+            }
+            break;
+        case TLM_LDR_RESET:
+            n = snprintf(buf, size, "[LDR] Reset moneta (val=%d%%, base=%d%%, Δ=%+d%%)\n",
+                         (int)a[0], (int)a[1], (int)a[2]);
+            break;
+        case TLM_CREDITO:
+            n = snprintf(buf, size, "[CREDITO] Moneta accettata: credito=%s EUR\n", formatoEuro(a[0], e1));
+            break;
+        case TLM_BLE_CONNESSO:
+            n = snprintf(buf, size, "[BLE] ✓ Dispositivo CONNESSO\n");
+            break;
+        case TLM_BLE_DISCONNESSO:
+            n = snprintf(buf, size, "[BLE] ✗ Dispositivo DISCONNESSO\n");
+            break;
+        case TLM_BLE_INVALIDO:
+            n = snprintf(buf, size, "[SECURITY] Comando BLE invalido: 0x%02X\n", (unsigned)a[0]);
+            break;
+        case TLM_STOCK_ESAURITO:
+            n = snprintf(buf, size, "[STOCK] %s\n", prodottoValido ? msgEsaurito[a[0]] : "Prodotto invalido");
+            break;
+        case TLM_SELEZIONE:
+            n = snprintf(buf, size, "[BLE] %s (scorte=%d)\n", prodottoValido ? msgSelezione[a[0]] : "?", (int)a[1]);
+            break;
+        case TLM_RIFIUTO_CREDITO:
+            n = snprintf(buf, size, "[BLE] Rifiutata: credito insufficiente (credito=%s, prezzo=%s)\n",
+                         formatoEuro(a[0], e1), formatoEuro(a[1], e2));
+            break;
+        case TLM_RIFIUTO_STATO:
+            n = snprintf(buf, size, "[BLE] Rifiutata: stato invalido (%s)\n", nomeStato(a[0]));
+            break;
+        case TLM_ACCETTA:
+            n = snprintf(buf, size, "[BLE] Accettata: avvio erogazione (credito=%s, prezzo=%s)\n",
+                         formatoEuro(a[0], e1), formatoEuro(a[1], e2));
+            break;
+        case TLM_ERRORE_SCORTE:
+            n = snprintf(buf, size, "[ERRORE] Tentativo erogazione con scorte=0 (prodotto %d)\n", (int)a[0]);
+            break;
+        case TLM_ANNULLA:
+            if (a[0] == ANNULLA_PULSANTE) n = snprintf(buf, size, "[ANNULLA] Pulsante - Resto: %sE\n", formatoEuro(a[1], e1));
+            else if (a[0] == ANNULLA_APP) n = snprintf(buf, size, "[ANNULLA] App - Resto: %sE\n", formatoEuro(a[1], e1));
+            else                          n = snprintf(buf, size, "[BLE] Resto automatico per disconnessione: %sE\n", formatoEuro(a[1], e1));
+            break;
+        case TLM_TIMEOUT_RESTO:
+            n = snprintf(buf, size, "[TIMEOUT] Resto automatico - Credito: %sE\n", formatoEuro(a[0], e1));
+            break;
+        case TLM_EROGATO:
+            n = snprintf(buf, size, "[EROGAZIONE] Prodotto %d erogato. Scorte rimanenti: %d\n",
+                         (int)a[0], (int)a[1]);
+            break;
+        case TLM_RESTO:
+            n = snprintf(buf, size, "[RESTO] Restituito: %sE\n", formatoEuro(a[0], e1));
+            break;
+        case TLM_ALLARME:
+            n = snprintf(buf, size, "[ALLARME] Temperatura: %d°C (soglia: %d°C)\n", (int)a[0], (int)a[1]);
+            break;
+        case TLM_RIFORNIMENTO:
+            n = snprintf(buf, size, "[STOCK] Rifornimento completato: %d pezzi/prodotto\n", (int)a[0]);
+            break;
+        case TLM_IDLE_ON:
+            n = snprintf(buf, size, "[POWER] Idle profondo: tick sospeso, retroilluminazione spenta\n");
+            break;
+        case TLM_IDLE_OFF:
+            n = snprintf(buf, size, "[POWER] Risveglio\n");
+            break;
+        case TLM_IDLE_LDR:
+            n = snprintf(buf, size, "[POWER] Soglia LDR superata (val=%d%%, base=%d%%)\n", (int)a[0], (int)a[1]);
+            break;
+        case TLM_LOTTO:
+            n = snprintf(buf, size, "[BLE] Lotto seq=%d: %d comandi, %d eventi\n", (int)a[0], (int)a[1], (int)a[2]);
+            break;
+        case TLM_RIFIUTO_PEZZI:
+            n = snprintf(buf, size, "[BLE] Rifiutata: scorte insufficienti (pezzi=%d, scorte=%d)\n",
+                         (int)a[0], (int)a[1]);
+            break;
+        case TLM_RIFORNIMENTO_PRODOTTO:
+            n = snprintf(buf, size, "[STOCK] Rifornimento prodotto %d: +%d pezzi (scorte=%d)\n",
+                         (int)a[0], (int)a[1], (int)a[2]);
+            break;
+        case TLM_MONETA_TAGLIO:
+            if (a[0] == 0) {
+                n = snprintf(buf, size, "[MONETA] Non riconosciuta, nessun credito (durata %dms, Δmax %d%%, area %d, d=%d.%dσ)\n",
+                             (int)a[1], (int)a[2], (int)a[3], (int)(a[4] / 10), (int)(a[4] % 10));
+            } else {
+                n = snprintf(buf, size, "[MONETA] %s EUR (durata %dms, Δmax %d%%, area %d, d=%d.%dσ)\n",
+                             formatoEuro(a[0], e1), (int)a[1], (int)a[2], (int)a[3], (int)(a[4] / 10), (int)(a[4] % 10));
+            }
+            break;
+        case TLM_CALIBRA:
+            if (a[0] >= 1 && a[0] <= TAGLI)
+                n = snprintf(buf, size, "[CALIB] Raccolta monete da %s EUR (%d già raccolte)\n",
+                             formatoEuro(centesimiTaglio[a[0] - 1], e1), (int)a[1]);
+            else if (a[0] == CALIBRA_SALVA)
+                n = snprintf(buf, size, "[CALIB] Calibrazione salvata in flash (tagli 0x%X)\n", (unsigned)a[1]);
+            else if (a[0] == CALIBRA_CARICATA)
+                n = snprintf(buf, size, "[CALIB] Calibrazione caricata dalla flash (tagli 0x%X)\n", (unsigned)a[1]);
+            else if (a[0] == CALIBRA_CANCELLA)
+                n = snprintf(buf, size, "[CALIB] Calibrazione cancellata: ogni moneta vale 1 EUR\n");
+            else
+                n = snprintf(buf, size, "[CALIB] Raccolta annullata\n");
+            break;
+        case TLM_CALIBRA_MONETA:
+            n = snprintf(buf, size, "[CALIB] Moneta %d da %s EUR (durata %dms, Δmax %d%%, area %d)\n",
+                         (int)a[1], formatoEuro(a[0], e1), (int)a[2], (int)a[3], (int)a[4]);
+            break;
+        case TLM_ORDINE_CODA:
+            n = snprintf(buf, size, "[BLE] Accettata in coda: %d ordini (credito=%s, prezzo=%s)\n",
+                         (int)a[2], formatoEuro(a[0], e1), formatoEuro(a[1], e2));
+            break;
+        case TLM_CASSA_ERRATA:
+            n = snprintf(buf, size, "[ERRORE] Cassa incoerente: inserito %d != credito %d + impegnato %d"
+                         " + incassato %d + resto %d + restituito %d\n",
+                         (int)a[0], (int)a[1], (int)a[2], (int)a[3], (int)a[4], (int)a[5]);
+            break;
+        case TLM_GIORNALE:
+            if (a[0])
+                n = snprintf(buf, size, "[FLASH] Giornale recuperato: scorte %d/%d/%d/%d, credito=%s, incassato=%s"
+                             " (%d record, %d byte letti, banco %d gen %d)\n",
+                             (int)a[3], (int)a[4], (int)a[5], (int)a[6], formatoEuro(a[1], e1), formatoEuro(a[2], e2),
+                             (int)a[7], (int)a[8], (int)a[9], (int)a[10]);
+            else
+                n = snprintf(buf, size, "[FLASH] Giornale vuoto: formattato con scorte %d/%d/%d/%d (banco %d)\n",
+                             (int)a[3], (int)a[4], (int)a[5], (int)a[6], (int)a[9]);
+            break;
+        case TLM_GIORNALE_BANCO:
+            n = snprintf(buf, size, "[FLASH] Banco %d del giornale pronto (%s, %dms)\n",
+                         (int)a[0], a[1] ? "cancellato" : "già vuoto", (int)a[2]);
+            break;
+        case TLM_GIORNALE_ERRORE:
+            n = snprintf(buf, size, "[ERRORE] Scrittura del giornale fallita (posizione %d, %d errori)\n",
+                         (int)a[0], (int)a[1]);
+            break;
+        default:
+            return 0;
+    }
+    return (n < 0) ? 0 : (n >= size ? size - 1 : n);
+}
+
+// ======================================================================================
+// CODIFICA
+// ======================================================================================
+
+static uint8_t crc8(uint8_t crc, uint8_t byte) {
+    crc ^= byte;
+    for (int i = 0; i < 8; i++) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    return crc;
+}
+
+#if TELEMETRIA_BINARIA
+static int scriviVarint(uint8_t *dst, uint64_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        dst[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    dst[n++] = (uint8_t)v;
+    return n;
+}
+
+static uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+// Frame binario completo (sync, len, tipo, Δt, argomenti, CRC); ritorna la lunghezza
+static int codificaFrame(uint8_t tipo, const int32_t *args, int nArgs, uint64_t dt_ms, uint8_t *frame) {
+    int len = 2;
+    frame[len++] = tipo;
+    len += scriviVarint(frame + len, dt_ms);
+    for (int i = 0; i < nArgs; i++) len += scriviVarint(frame + len, zigzag(args[i]));
+    frame[0] = TLM_SYNC_BYTE;
+    frame[1] = (uint8_t)(len - 2);
+
+    uint8_t crc = 0;
+    for (int i = 1; i < len; i++) crc = crc8(crc, frame[i]);
+    frame[len++] = crc;
+    return len;
+}
+#endif
+
+Telemetria::Telemetria() :
+    _testa(0), _fondo(0), _sveglia(false), _threadId(0),
+    _persiPeriodici(0), _persiEventi(0), _occupazioneMax(0),
+    _uscitaLen(0), _uscitaPos(0), _ultimoMs(0), _sincronizzato(false), _persiSegnalati(0), _scritti(0)
+{
+    for (uint32_t i = 0; i < CODA_LEN; i++) _coda[i].seq.store(i, std::memory_order_relaxed);
+}
+
+void Telemetria::begin(int threadId) {
+    _threadId = threadId;
+    // Record accodati prima dell'avvio
+    if (_testa.load(std::memory_order_acquire) != _fondo.load(std::memory_order_relaxed)) {
+        _sveglia.store(true);
+        hal::background_wake(_threadId);
+    }
+}
+
+// ======================================================================================
+// PRODUTTORI
+// ======================================================================================
+
+/**
+ * @brief Accoda un record grezzo (nessuna codifica, nessuna sezione critica)
+ * Prenota uno slot con CAS su _testa, copia gli argomenti e lo pubblica con seq.
+ * Con coda piena (o STATUS oltre la soglia) il record è scartato e contato.
+ */
+void Telemetria::record(uint8_t tipo, std::initializer_list<int32_t> args) {
+    bool periodico = (tipo == TLM_STATUS);
+
+    uint32_t pos = _testa.load(std::memory_order_relaxed);
+    VoceLog *voce;
+    while (true) {
+        uint32_t occupati = pos - _fondo.load(std::memory_order_acquire);
+        if (periodico && occupati >= SOGLIA_PERIODICI) {
+            _persiPeriodici.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        voce = &_coda[pos & (CODA_LEN - 1)];
+        int32_t diff = (int32_t)(voce->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (_testa.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            _persiEventi.fetch_add(1, std::memory_order_relaxed);   // Coda piena
+            return;
+        } else {
+            pos = _testa.load(std::memory_order_relaxed);           // Slot preso da un altro produttore
+        }
+    }
+
+    // Timestamp preso dopo la prenotazione: l'ordine di coda segue quello dei tempi
+    // salvo un produttore prelazionato tra CAS e lettura (gestito in prepara())
+    voce->tipo = tipo;
+    voce->t_ms = (uint32_t)(hal::now_us() / 1000);
+    int n = 0;
+    for (int32_t v : args) {
+        if (n == TLM_MAX_ARGS) break;
+        voce->args[n++] = v;
+    }
+    voce->nArgs = (uint8_t)n;
+    voce->seq.store(pos + 1, std::memory_order_release);
+
+    // Statistica: occupazione massima vista dai produttori
+    uint32_t occupati = pos + 1 - _fondo.load(std::memory_order_relaxed);
+    uint32_t max = _occupazioneMax.load(std::memory_order_relaxed);
+    while (occupati > max && !_occupazioneMax.compare_exchange_weak(max, occupati, std::memory_order_relaxed)) {}
+
+    if (!_sveglia.exchange(true) && _threadId) hal::background_wake(_threadId);
+}
+
+// ======================================================================================
+// CONSUMATORE (thread di drain)
+// ======================================================================================
+
+bool Telemetria::estrai(VoceLog &voce) {
+    uint32_t fondo = _fondo.load(std::memory_order_relaxed);
+    VoceLog &slot = _coda[fondo & (CODA_LEN - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != fondo + 1) return false;  // Vuota o non pubblicata
+
+    voce.tipo = slot.tipo;
+    voce.t_ms = slot.t_ms;
+    voce.nArgs = slot.nArgs;
+    for (int i = 0; i < slot.nArgs; i++) voce.args[i] = slot.args[i];
+    slot.seq.store(fondo + CODA_LEN, std::memory_order_release);
+    _fondo.store(fondo + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Codifica il prossimo record in _uscita (preceduto da TLM_SYNC se serve)
+ * @return false se la coda è vuota
+ */
+bool Telemetria::prepara() {
+    VoceLog voce;
+    if (!estrai(voce)) return false;
+
+    _uscitaLen = 0;
+    _uscitaPos = 0;
+    uint32_t persi = _persiPeriodici.load(std::memory_order_relaxed) + _persiEventi.load(std::memory_order_relaxed);
+    bool sync = !_sincronizzato || persi != _persiSegnalati;
+
+    if (sync) {
+        // TLM_SYNC porta il tempo assoluto negli argomenti: Δt = 0
+        int32_t argSync[2] = {(int32_t)voce.t_ms, (int32_t)(persi - _persiSegnalati)};
+#if TELEMETRIA_BINARIA
+        _uscitaLen = codificaFrame(TLM_SYNC, argSync, 2, 0, _uscita);
+#else
+        _uscitaLen = telemetriaTesto(TLM_SYNC, argSync, 2, (char *)_uscita, TLM_MAX_TESTO);
+#endif
+        _sincronizzato = true;
+        _persiSegnalati = persi;
+        _ultimoMs = voce.t_ms;
+    }
+
+    // Un produttore prelazionato può pubblicare un tempo precedente al record
+    // già emesso: Δt negativo forzato a 0 invece di avvolgere a ~2^32
+    if ((int32_t)(voce.t_ms - _ultimoMs) < 0) voce.t_ms = _ultimoMs;
+
+#if TELEMETRIA_BINARIA
+    _uscitaLen += codificaFrame(voce.tipo, voce.args, voce.nArgs, voce.t_ms - _ultimoMs, _uscita + _uscitaLen);
+#else
+    _uscitaLen += telemetriaTesto(voce.tipo, voce.args, voce.nArgs, (char *)_uscita + _uscitaLen, TLM_MAX_TESTO);
+#endif
+    _ultimoMs = voce.t_ms;
+    return true;
+}
+
+/**
+ * @brief Svuota la coda sul buffer TX della seriale senza bloccare
+ * Se il driver non accetta tutto, il thread riprova dopo TLM_RETRY_MS; a coda vuota
+ * dorme TLM_ATTESA_MS o fino al prossimo record().
+ */
+void Telemetria::drain() {
+    _sveglia.store(false);
+    while (true) {
+        if (_uscitaPos == _uscitaLen && !prepara()) break;
+
+        int scritti = hal::serial_write(_uscita + _uscitaPos, _uscitaLen - _uscitaPos);
+        _uscitaPos += scritti;
+        _scritti += scritti;
+        if (_uscitaPos < _uscitaLen) {
+            hal::background_period_ms(_threadId, TLM_RETRY_MS);
+            return;
+        }
+    }
+    hal::background_period_ms(_threadId, TLM_ATTESA_MS);
+}
+
+// ======================================================================================
+// DECODIFICA (host)
+// ======================================================================================
+
+TelemetriaDecoder::TelemetriaDecoder() :
+    tipo(0), t_ms(0), nArgs(0), testo(0), errori(0),
+    _fase(SYNC), _len(0), _ricevuti(0), _crc(0)
+{
+}
+
+TelemetriaDecoder::Esito TelemetriaDecoder::feed(uint8_t byte) {
+    switch (_fase) {
+        case SYNC:
+            if (byte == TLM_SYNC_BYTE) {
+                _fase = LEN;
+                return NIENTE;
+            }
+            testo = byte;
+            return TESTO;
+        case LEN:
+            _len = byte;
+            _crc = crc8(0, byte);
+            _ricevuti = 0;
+            _fase = (_len > 0) ? CORPO : SYNC;
+            return NIENTE;
+        case CORPO:
+            _corpo[_ricevuti++] = byte;
+            _crc = crc8(_crc, byte);
+            if (_ricevuti == _len) _fase = CRC;
+            return NIENTE;
+        case CRC:
+            _fase = SYNC;
+            if (byte != _crc || !decodifica()) {
+                errori++;
+                return CRC_ERRATO;
+            }
+            return RECORD;
+    }
+    return NIENTE;
+}
+
+bool TelemetriaDecoder::decodifica() {
+    int pos = 0;
+    uint64_t valori[TLM_MAX_ARGS + 1];
+    int n = 0;
+
+    tipo = _corpo[pos++];
+    while (pos < _len) {
+        if (n == TLM_MAX_ARGS + 1) return false;
+        uint64_t v = 0;
+        int shift = 0;
+        while (true) {
+            if (pos >= _len || shift > 63) return false;
+            uint8_t b = _corpo[pos++];
+            v |= (uint64_t)(b & 0x7F) << shift;
+            shift += 7;
+            if (!(b & 0x80)) break;
+        }
+        valori[n++] = v;
+    }
+    if (n == 0) return false;
+
+    nArgs = n - 1;
+    for (int i = 0; i < nArgs; i++) {
+        uint32_t z = (uint32_t)valori[i + 1];
+        args[i] = (int32_t)((z >> 1) ^ (~(z & 1) + 1));
+    }
+    // Stesso orologio a 32 bit del firmware: Δt sommato in aritmetica modulo 2^32
+    if (tipo == TLM_SYNC) t_ms = (uint32_t)args[0];
+    else t_ms += (uint32_t)valori[0];
+    return true;
+}
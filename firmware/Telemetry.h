@@ -0,0 +1,171 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <initializer_list>
+#include "hal/hal.h"
+
+/**
+ * @brief Telemetria seriale compatta (sostituisce le righe printf a 9600 baud)
+ *
+ * Ogni riga di log è un record: tipo + argomenti interi. Il produttore (ISR, callback
+ * BLE, tick FSM) copia solo tipo, istante e argomenti grezzi in una coda lock-free e
+ * ritorna: mai attese, mai formattazione. Un thread a bassa priorità codifica i record
+ * e li invia sulla seriale con scritture non bloccanti.
+ *
+ * Politica di scarto (il produttore non attende mai):
+ * - TLM_STATUS (periodico, ridondante) è scartato con coda oltre SOGLIA_PERIODICI;
+ * - gli altri record (eventi) solo con coda piena.
+ * Entrambi i casi sono contati; il primo record inviato dopo una perdita è
+ * preceduto da TLM_SYNC con il numero di record persi.
+ *
+ * Frame:  0xA5 | len | tipo | Δt ms (varint) | argomenti (varint zigzag) | CRC-8
+ *   len = byte da tipo a fine argomenti, CRC-8 (poly 0x07) su len..argomenti.
+ *   Δt è relativo al record precedente; TLM_SYNC porta il tempo assoluto e i record
+ *   persi ed è emesso al primo record e dopo ogni perdita.
+ *
+ * Il testo leggibile (stesso formato delle vecchie printf) è ricostruito da
+ * telemetriaTesto(): usato dal decoder host (host/tlm_decode) e dal firmware con
+ * TELEMETRIA_BINARIA = 0, che formatta le righe di testo nel thread di drain.
+ */
+
+#ifndef TELEMETRIA_BINARIA
+#define TELEMETRIA_BINARIA  1       // 0: righe di testo (terminale seriale senza decoder)
+#endif
+
+#define TLM_SYNC_BYTE       0xA5
+#define TLM_MAX_ARGS        14
+#define TLM_MAX_FRAME       (3 + 5 + TLM_MAX_ARGS * 5 + 1)
+#define TLM_MAX_TESTO       160     // Riga di testo più lunga (UTF-8 incluso)
+#define TLM_RETRY_MS        20      // Buffer TX seriale pieno: nuovo tentativo (~20 byte a 9600)
+#define TLM_ATTESA_MS       5000    // Thread di drain senza record (svegliato da record())
+
+enum TipoRecord {
+    TLM_SYNC = 0,           // t_ms assoluto, record persi
+    TLM_STATUS,             // ble, stato, credito, prodotto, prezzo, ldr, base, dist, T, H, scorte x4
+    TLM_FSM,                // da, a, credito, prodotto (importi in centesimi, anche sotto)
+    TLM_LDR_MONETA,         // val, base, delta[, ms dal primo campione sopra soglia]
+    TLM_LDR_RESET,          // val, base, delta
+    TLM_CREDITO,            // credito
+    TLM_BLE_CONNESSO,
+    TLM_BLE_DISCONNESSO,
+    TLM_BLE_INVALIDO,       // comando
+    TLM_STOCK_ESAURITO,     // prodotto (0 = invalido)
+    TLM_SELEZIONE,          // prodotto, scorte
+    TLM_RIFIUTO_CREDITO,    // credito, prezzo
+    TLM_RIFIUTO_STATO,      // stato
+    TLM_ACCETTA,            // credito, prezzo
+    TLM_ERRORE_SCORTE,      // prodotto
+    TLM_ANNULLA,            // origine (OrigineAnnulla), credito
+    TLM_TIMEOUT_RESTO,      // credito
+    TLM_EROGATO,            // prodotto, scorte
+    TLM_RESTO,              // credito
+    TLM_ALLARME,            // temperatura, soglia
+    TLM_RIFORNIMENTO,       // pezzi
+    TLM_IDLE_ON,
+    TLM_IDLE_OFF,
+    TLM_IDLE_LDR,           // val, base
+    TLM_LOTTO,              // seq, comandi, eventi
+    TLM_RIFIUTO_PEZZI,      // pezzi richiesti, scorte
+    TLM_RIFORNIMENTO_PRODOTTO,  // prodotto, pezzi aggiunti, scorte
+    TLM_MONETA_TAGLIO,      // centesimi (0 = non riconosciuta), durata ms, Δmax %, area %·ms, distanza σ/10
+    TLM_CALIBRA,            // azione (taglio 1-3 o CALIBRA_*), monete raccolte o tagli calibrati (bit)
+    TLM_CALIBRA_MONETA,     // centesimi, monete raccolte, durata ms, Δmax %, area %·ms
+    TLM_ORDINE_CODA,        // credito, prezzo, ordini (conferma durante l'erogazione)
+    TLM_CASSA_ERRATA,       // inserito, credito, impegnato, incassato, resto, restituito
+    TLM_GIORNALE,           // esito (1 recuperato, 0 formattato), credito, incassato, scorte 1-4, record, byte letti, banco, generazione
+    TLM_GIORNALE_BANCO,     // banco, cancellato (0 già vuoto), ms
+    TLM_GIORNALE_ERRORE,    // posizione, errori
+    TLM_TIPI
+};
+
+// Riga di testo del record (con '\n'); ritorna la lunghezza, 0 se tipo sconosciuto
+int telemetriaTesto(uint8_t tipo, const int32_t *args, int nArgs, char *buf, int size);
+
+/**
+ * @brief Voce della coda: record grezzo (nessuna codifica nel contesto del produttore)
+ * seq segue lo schema a sequenza per slot: == posizione → libera per il produttore,
+ * == posizione + 1 → pubblicata, pronta per il consumatore.
+ */
+struct VoceLog {
+    std::atomic<uint32_t> seq;
+    uint8_t tipo;
+    uint8_t nArgs;
+    uint32_t t_ms;
+    int32_t args[TLM_MAX_ARGS];
+};
+
+class Telemetria {
+public:
+    static const uint32_t CODA_LEN = 32;                    // Potenza di 2
+    static const uint32_t SOGLIA_PERIODICI = CODA_LEN * 3 / 4;  // Oltre: record periodici scartati
+
+    Telemetria();
+
+    // threadId: thread background che chiama drain(), svegliato al primo record
+    void begin(int threadId);
+
+    void record(uint8_t tipo, std::initializer_list<int32_t> args = {});  // ISR/thread-safe, lock-free
+    void drain();                                                         // Thread background
+
+    uint32_t persi() const { return _persiPeriodici + _persiEventi; }
+    uint32_t persiPeriodici() const { return _persiPeriodici; }  // STATUS scartati oltre la soglia
+    uint32_t persiEventi() const { return _persiEventi; }        // Coda piena
+    uint32_t occupazioneMax() const { return _occupazioneMax; }
+    uint32_t byteScritti() const { return _scritti; }
+
+private:
+    // Coda MPSC: produttori in qualsiasi contesto, consumatore il thread di drain
+    VoceLog _coda[CODA_LEN];
+    std::atomic<uint32_t> _testa;   // Prenotata dai produttori (CAS)
+    std::atomic<uint32_t> _fondo;   // Scritto solo dal consumatore
+    std::atomic<bool> _sveglia;     // Thread già svegliato, drain non ancora iniziato
+    int _threadId;
+
+    std::atomic<uint32_t> _persiPeriodici;
+    std::atomic<uint32_t> _persiEventi;
+    std::atomic<uint32_t> _occupazioneMax;
+
+    // Lato consumatore: frame (o testo) in uscita non ancora accettato dalla seriale
+    uint8_t _uscita[2 * TLM_MAX_TESTO];
+    int _uscitaLen;
+    int _uscitaPos;
+    uint32_t _ultimoMs;
+    bool _sincronizzato;            // TLM_SYNC già emesso
+    uint32_t _persiSegnalati;
+    uint32_t _scritti;
+
+    bool estrai(VoceLog &voce);
+    bool prepara();
+};
+
+/**
+ * @brief Decoder del flusso seriale (host): frame → record, byte fuori frame → testo
+ */
+class TelemetriaDecoder {
+public:
+    enum Esito { NIENTE = 0, RECORD, TESTO, CRC_ERRATO };
+
+    TelemetriaDecoder();
+    Esito feed(uint8_t byte);
+
+    // Ultimo record (valido dopo RECORD)
+    uint8_t tipo;
+    uint32_t t_ms;                  // ms a 32 bit, avvolge come hal::now_us()/1000
+    int32_t args[TLM_MAX_ARGS];
+    int nArgs;
+    uint8_t testo;                  // Ultimo byte di testo (valido dopo TESTO)
+    uint32_t errori;
+
+private:
+    enum Fase { SYNC, LEN, CORPO, CRC };
+    Fase _fase;
+    uint8_t _len;
+    uint8_t _corpo[255];
+    int _ricevuti;
+    uint8_t _crc;
+
+    bool decodifica();
+};
+
+#endif
@@ -1,12 +1,26 @@
 #include "TextLCD.h"
+#include <cstdio>
+#include <cstring>
 
-TextLCD::TextLCD(PinName sda, PinName scl, int i2cAddress) : _i2c(sda, scl) {
+static const uint8_t row_offsets[] = { 0x00, 0x40 };
+
+TextLCD::TextLCD(hal::I2CBus &i2c, int i2cAddress) : _i2c(i2c) {
     _i2cAddress = i2cAddress; 
     _backlightVal = LCD_BACKLIGHT;
     _i2c.frequency(100000); // 100 kHz standard
     // begin() viene chiamata dopo nel main o esplicitamente, 
     // ma per sicurezza inizializziamo variabili base
     _displayfunction = LCD_4BITMODE | LCD_2LINE | LCD_5x8DOTS;
+    memset(_fb, ' ', sizeof(_fb));
+    memset(_shadow, ' ', sizeof(_shadow));
+    _col = 0;
+    _row = 0;
+    _ddramAddr = -1;
+    _transport = LCD_TX_BATCH;
+    _txDoneIsr = nullptr;
+    _txBuf = 0;
+    _txLen = 0;
+    _txBusy = false;
 }
 
 void TextLCD::begin() {
@@ -14,27 +28,34 @@ void TextLCD::begin() {
 
     // Sequenza di inizializzazione speciale HD44780
     // Attesa iniziale > 40ms dopo accensione
-    ThisThread::sleep_for(50ms); 
+    // Con trasporto batch ogni attesa è preceduta da txFlush(): i tempi valgono dal
+    // momento in cui i byte sono effettivamente sul bus.
+    hal::sleep_ms(50); 
     
     expanderWrite(_backlightVal);
-    ThisThread::sleep_for(1000ms); // Stabilizzazione
+    txFlush();
+    hal::sleep_ms(1000); // Stabilizzazione
 
     // 1. Primo comando 0x03
     write4bits(0x03 << 4);
-    ThisThread::sleep_for(5ms); // > 4.1ms
+    txFlush();
+    hal::sleep_ms(5); // > 4.1ms
     
     // 2. Secondo comando 0x03
     write4bits(0x03 << 4);
-    ThisThread::sleep_for(5ms); // > 100us
+    txFlush();
+    hal::sleep_ms(5); // > 100us
     
     // 3. Terzo comando 0x03
     write4bits(0x03 << 4); 
+    txFlush();
     // CORREZIONE QUI SOTTO: Usiamo wait_us invece di sleep_for
-    wait_us(150); // > 100us, sleep_for non gestisce microsecondi
+    hal::wait_us(150); // > 100us, sleep_ms non gestisce microsecondi
     
     // 4. Set a 4-bit mode (0x02)
     write4bits(0x02 << 4); 
-    ThisThread::sleep_for(1ms);
+    txFlush();
+    hal::sleep_ms(1);
 
     // Configurazione finale
     command(LCD_FUNCTIONSET | _displayfunction);
@@ -42,38 +63,83 @@ void TextLCD::begin() {
     _displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
     command(LCD_DISPLAYCONTROL | _displaycontrol);
     
-    clear();
+    // Clear hardware: unico punto in cui si usa LCD_CLEARDISPLAY (display e ombra a spazi)
+    command(LCD_CLEARDISPLAY);
+    txFlush();
+    hal::sleep_ms(2); // Clear richiede tempo
+    memset(_shadow, ' ', sizeof(_shadow));
     
     _displaymode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
     command(LCD_ENTRYMODESET | _displaymode);
     
-    home();
+    command(LCD_RETURNHOME);
+    txFlush();
+    hal::sleep_ms(2); // Home richiede tempo
+    _ddramAddr = 0;
+
+    clear();
 }
 
 void TextLCD::clear() {
-    command(LCD_CLEARDISPLAY);
-    ThisThread::sleep_for(2ms); // Clear richiede tempo
+    memset(_fb, ' ', sizeof(_fb));
+    _col = 0;
+    _row = 0;
 }
 
 void TextLCD::home() {
-    command(LCD_RETURNHOME);
-    ThisThread::sleep_for(2ms); // Home richiede tempo
+    _col = 0;
+    _row = 0;
 }
 
 void TextLCD::setCursor(uint8_t col, uint8_t row) {
-    int row_offsets[] = { 0x00, 0x40, 0x14, 0x54 };
-    if (row > 1) row = 1; 
-    command(LCD_SETDDRAMADDR | (col + row_offsets[row]));
+    if (row > LCD_ROWS - 1) row = LCD_ROWS - 1;
+    _col = col;
+    _row = row;
+}
+
+void TextLCD::flush() {
+    for (int r = 0; r < LCD_ROWS; r++) {
+        for (int c = 0; c < LCD_COLS; c++) {
+            if (_fb[r][c] == _shadow[r][c]) continue;
+
+            // Posiziona il cursore solo se non è già sulla cella (auto-incremento HD44780)
+            int addr = row_offsets[r] + c;
+            if (_ddramAddr != addr) command(LCD_SETDDRAMADDR | addr);
+            write(_fb[r][c]);
+            _shadow[r][c] = _fb[r][c];
+            _ddramAddr = addr + 1;
+        }
+    }
+    txFlush();
+}
+
+void TextLCD::setTransport(LcdTransport mode, int hz, hal::Isr txDoneIsr) {
+    txFlush();
+    waitIdle();
+    if (mode == LCD_TX_ASYNC && txDoneIsr == nullptr) mode = LCD_TX_BATCH;
+    _transport = mode;
+    _txDoneIsr = txDoneIsr;
+    _i2c.frequency(hz);
+}
+
+void TextLCD::waitIdle() {
+    while (_txBusy) hal::wait_us(10);
+}
+
+void TextLCD::onTxDone() {
+    _txBusy = false;
 }
 
 void TextLCD::noBacklight() {
     _backlightVal = LCD_NOBACKLIGHT;
     expanderWrite(0);
+    txFlush();
 }
 
 void TextLCD::backlight() {
     _backlightVal = LCD_BACKLIGHT;
     expanderWrite(0);
+    txFlush();
 }
 
 // Implementazione printf personalizzata
@@ -88,27 +154,57 @@ void TextLCD::printf(const char *format, ...) {
 
 void TextLCD::print(const char *str) {
     while (*str) {
-        write(*str++);
+        store(*str++);
     }
 }
 
 void TextLCD::putc(char c) {
-    write(c);
+    store(c);
+}
+
+void TextLCD::store(char c) {
+    // Oltre la colonna 16 il testo finirebbe in DDRAM non visibile: scartato
+    if (_col < LCD_COLS) _fb[_row][_col] = c;
+    if (_col < 0xFF) _col++;
 }
 
 // --- Funzioni Low Level ---
 
 void TextLCD::expanderWrite(uint8_t _data) {
-    char data_write[1];
-    data_write[0] = _data | _backlightVal;
-    _i2c.write(_i2cAddress, data_write, 1);
+    if (_transport == LCD_TX_BYTE) {
+        char data_write[1];
+        data_write[0] = _data | _backlightVal;
+        _i2c.write(_i2cAddress, data_write, 1);
+        return;
+    }
+    if (_txLen == LCD_TX_MAX) txFlush();
+    _tx[_txBuf][_txLen++] = (char)(_data | _backlightVal);
 }
 
 void TextLCD::pulseEnable(uint8_t _data) {
+    // In batch le attese sono garantite dal bus: ogni byte dura >= 22.5us anche a 400kHz,
+    // quindi EN alto >= 450ns e tra due latch consecutivi passano 3 byte (> 37us HD44780)
     expanderWrite(_data | 0x04); // En high
-    wait_us(1); 
+    if (_transport == LCD_TX_BYTE) hal::wait_us(1); 
     expanderWrite(_data & ~0x04); // En low
-    wait_us(50); 
+    if (_transport == LCD_TX_BYTE) hal::wait_us(50); 
+}
+
+void TextLCD::txFlush() {
+    if (_txLen == 0) return;
+
+    if (_transport == LCD_TX_ASYNC) {
+        // Il buffer precedente deve essere sul bus prima di riusarlo
+        waitIdle();
+        _txBusy = true;
+        if (_i2c.write_async(_i2cAddress, _tx[_txBuf], _txLen, _txDoneIsr) != 0) {
+            _txBusy = false;
+        }
+        _txBuf ^= 1;
+    } else {
+        _i2c.write(_i2cAddress, _tx[_txBuf], _txLen);
+    }
+    _txLen = 0;
 }
 
 void TextLCD::write4bits(uint8_t value) {
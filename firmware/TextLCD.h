@@ -1,7 +1,7 @@
 #ifndef TEXTLCD_H
 #define TEXTLCD_H
 
-#include "mbed.h"
+#include "hal/hal.h"
 #include <cstdarg>
 
 // Comandi standard HD44780
@@ -40,15 +40,44 @@
 #define LCD_BACKLIGHT 0x08
 #define LCD_NOBACKLIGHT 0x00
 
+// Geometria display (framebuffer)
+#define LCD_COLS 16
+#define LCD_ROWS 2
+
+// Buffer di trasmissione: schermata completa (32 celle + 2 posizionamenti) x 6 byte expander
+#define LCD_TX_MAX (6 * (LCD_COLS * LCD_ROWS + LCD_ROWS))
+
+// Trasporto verso il PCF8574
+enum LcdTransport {
+    LCD_TX_BYTE = 0,    // Una transazione I2C per stato expander + wait_us (percorso originale)
+    LCD_TX_BATCH,       // Sequenze nibble accodate: una transazione I2C per flush
+    LCD_TX_ASYNC        // Come BATCH, trasferimento in background (doppio buffer)
+};
+
+/**
+ * @brief LCD HD44780 16x2 su expander PCF8574 con framebuffer
+ *
+ * clear/home/setCursor/printf/print/putc disegnano in un framebuffer 2x16 in RAM,
+ * senza traffico I2C. flush() confronta il framebuffer con la copia ombra di
+ * quanto già presente sul display e invia solo le celle cambiate, saltando il
+ * comando SETDDRAMADDR quando le celle modificate sono consecutive.
+ */
 class TextLCD {
 public:
-    // Costruttore: pin SDA, pin SCL, indirizzo I2C (es. 0x27 << 1)
-    TextLCD(PinName sda, PinName scl, int i2cAddress = 0x4E);
+    // Costruttore: bus I2C della HAL, indirizzo I2C (es. 0x27 << 1)
+    TextLCD(hal::I2CBus &i2c, int i2cAddress = 0x4E);
 
     void begin();
-    void clear();
+    void clear();                               // Framebuffer a spazi, cursore (0,0)
     void home();
     void setCursor(uint8_t col, uint8_t row);
+    void flush();                               // Invia al display solo le celle cambiate
+
+    // Trasporto e frequenza bus (default: LCD_TX_BATCH a 100kHz).
+    // LCD_TX_ASYNC richiede la ISR di fine trasferimento che inoltra a onTxDone().
+    void setTransport(LcdTransport mode, int hz, hal::Isr txDoneIsr = nullptr);
+    void waitIdle();                            // Attende la fine del trasferimento in corso
+    void onTxDone();                            // Contesto ISR
     void noBacklight();
     void backlight();
     
@@ -58,19 +87,36 @@ public:
     void putc(char c);
 
 private:
-    I2C _i2c;
+    hal::I2CBus &_i2c;
     int _i2cAddress;
     uint8_t _backlightVal;
     uint8_t _displayfunction;
     uint8_t _displaycontrol;
     uint8_t _displaymode;
 
+    // Framebuffer: _fb è il contenuto desiderato, _shadow quello già sul display
+    char _fb[LCD_ROWS][LCD_COLS];
+    char _shadow[LCD_ROWS][LCD_COLS];
+    uint8_t _col;
+    uint8_t _row;
+    int _ddramAddr;             // Posizione cursore hardware (-1 = sconosciuta)
+
+    // Trasmissione
+    LcdTransport _transport;
+    hal::Isr _txDoneIsr;
+    char _tx[2][LCD_TX_MAX];    // Doppio buffer: uno in riempimento, uno sul bus (ASYNC)
+    int _txBuf;
+    int _txLen;
+    volatile bool _txBusy;
+
     void expanderWrite(uint8_t _data);
     void pulseEnable(uint8_t _data);
     void write4bits(uint8_t value);
     void send(uint8_t value, uint8_t mode);
     void command(uint8_t value);
     void write(uint8_t value);
+    void store(char c);         // Scrive un carattere nel framebuffer
+    void txFlush();             // Invia i byte expander accodati
 };
 
 #endif
\ No newline at end of file
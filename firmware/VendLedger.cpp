@@ -0,0 +1,84 @@
+#include "VendLedger.h"
+
+VendLedger::VendLedger(int &credito) :
+    _credito(credito), _ordini(0), _inserito(0), _impegnato(0), _incassato(0), _resto(0),
+    _restituito(0), _accettati(0), _completati(0)
+{
+}
+
+void VendLedger::moneta(int32_t centesimi) {
+    _inserito += centesimi;
+    _credito += centesimi;
+}
+
+bool VendLedger::accetta(uint8_t prodotto, uint8_t pezzi, int32_t prezzo) {
+    int32_t importo = prezzo * pezzi;
+    if (codaPiena() || pezzi == 0 || importo > _credito) return false;
+    _coda[_ordini++] = {prodotto, pezzi, prezzo};
+    _credito -= importo;
+    _impegnato += importo;
+    _accettati++;
+    return true;
+}
+
+bool VendLedger::pezzoErogato() {
+    if (_ordini == 0) return false;
+    Ordine &o = _coda[0];
+    _impegnato -= o.prezzo;
+    _incassato += o.prezzo;
+    if (--o.pezzi > 0) return false;
+
+    for (int i = 1; i < _ordini; i++) _coda[i - 1] = _coda[i];
+    _ordini--;
+    _completati++;
+    return true;
+}
+
+int32_t VendLedger::avviaResto() {
+    _resto += _credito;
+    _credito = 0;
+    return _resto;
+}
+
+void VendLedger::restoReso() {
+    _restituito += _resto;
+    _resto = 0;
+}
+
+int32_t VendLedger::interrompi() {
+    int32_t importo = _impegnato + _resto;
+    _credito += importo;
+    _impegnato = 0;
+    _resto = 0;
+    _ordini = 0;
+    return importo;
+}
+
+void VendLedger::ripristina(int32_t credito, int32_t incassato) {
+    _credito = credito;
+    _incassato = incassato;
+    _inserito = credito + incassato;
+    _impegnato = _resto = _restituito = 0;
+    _ordini = 0;
+}
+
+int VendLedger::pezziImpegnati(int prodotto) const {
+    int n = 0;
+    for (int i = 0; i < _ordini; i++) {
+        if (_coda[i].prodotto == prodotto) n += _coda[i].pezzi;
+    }
+    return n;
+}
+
+int VendLedger::pezziDaErogare() const {
+    int n = 0;
+    for (int i = 0; i < _ordini; i++) n += _coda[i].pezzi;
+    return n;
+}
+
+bool VendLedger::coerente() const {
+    int32_t impegnato = 0;
+    for (int i = 0; i < _ordini; i++) impegnato += _coda[i].prezzo * _coda[i].pezzi;
+    return _credito >= 0 && impegnato == _impegnato &&
+           _inserito == _credito + _impegnato + _incassato + _resto + _restituito;
+}
@@ -0,0 +1,80 @@
+#ifndef VENDLEDGER_H
+#define VENDLEDGER_H
+
+#include <cstdint>
+
+/**
+ * @brief Cassa del distributore: conti del denaro e ordini confermati in pipeline
+ *
+ * Con la pipeline il cliente successivo inserisce monete, sceglie e conferma mentre il
+ * servo eroga l'ordine precedente (o mentre la macchina rende un resto): il denaro di
+ * due transazioni convive nella macchina. Ogni centesimo inserito sta in uno e un solo
+ * conto e passa da un conto all'altro solo con le operazioni della cassa:
+ *
+ *   moneta()         → credito
+ *   accetta()          credito   → impegnato   (prezzo x pezzi, ordine in coda)
+ *   pezzoErogato()     impegnato → incassato   (un pezzo dell'ordine in testa)
+ *   avviaResto()       credito   → resto       (importo fissato all'ingresso in RESTO)
+ *   restoReso()        resto     → restituito
+ *   interrompi()       impegnato, resto → credito (allarme: pezzi non dati, resto non reso)
+ *   ripristina()     → credito, incassato    (boot: conti dal giornale in flash)
+ *
+ * coerente(): inserito == credito + impegnato + incassato + resto + restituito.
+ * Il credito disponibile resta la variabile globale di main.cpp (guardie, display, BLE):
+ * la cassa la riceve per riferimento e la modifica solo con queste operazioni.
+ * Le scorte prenotate dagli ordini (pezziImpegnati()) non sono ancora scalate: il
+ * magazzino fisico cala a ogni pezzo erogato.
+ *
+ * Solo dalla coda eventi (azioni della FSM), nessuna sezione critica.
+ */
+
+#define ORDINI_MAX 2    // In erogazione + uno confermato in attesa del servo
+
+struct Ordine {
+    uint8_t prodotto;       // 1-4
+    uint8_t pezzi;          // Ancora da erogare, compreso quello in corso
+    int32_t prezzo;         // Per pezzo, centesimi
+};
+
+class VendLedger {
+public:
+    explicit VendLedger(int &credito);
+
+    void moneta(int32_t centesimi);
+    bool accetta(uint8_t prodotto, uint8_t pezzi, int32_t prezzo);  // false: coda piena o credito insufficiente
+    bool pezzoErogato();            // true: ordine in testa completato e tolto dalla coda
+    int32_t avviaResto();           // Importo da rendere (tutto il credito)
+    void restoReso();
+    int32_t interrompi();           // Importo tornato a credito
+    void ripristina(int32_t credito, int32_t incassato);    // Solo al boot, coda vuota
+
+    const Ordine *ordineInCorso() const { return _ordini ? &_coda[0] : nullptr; }
+    int ordini() const { return _ordini; }
+    bool codaPiena() const { return _ordini >= ORDINI_MAX; }
+    int pezziImpegnati(int prodotto) const;
+    int pezziDaErogare() const;     // Tutti gli ordini in coda
+
+    int32_t inserito() const { return _inserito; }
+    int32_t impegnato() const { return _impegnato; }
+    int32_t incassato() const { return _incassato; }
+    int32_t resto() const { return _resto; }
+    int32_t restituito() const { return _restituito; }
+    bool coerente() const;
+
+    uint32_t ordiniAccettati() const { return _accettati; }
+    uint32_t ordiniCompletati() const { return _completati; }
+
+private:
+    int &_credito;
+    Ordine _coda[ORDINI_MAX];
+    int _ordini;
+    int32_t _inserito;
+    int32_t _impegnato;
+    int32_t _incassato;
+    int32_t _resto;
+    int32_t _restituito;
+    uint32_t _accettati;
+    uint32_t _completati;
+};
+
+#endif
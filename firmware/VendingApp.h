@@ -0,0 +1,103 @@
+#ifndef VENDING_APP_H
+#define VENDING_APP_H
+
+/*
+ * Punti di ingresso e stato pubblico dell'applicazione distributore (main.cpp).
+ * Usato dal firmware e dal simulatore host (host/sim_main.cpp).
+ */
+
+#include "EventFsm.h"
+#include "Telemetry.h"
+#include "BleNotifier.h"
+#include "CoinClassifier.h"
+#include "SonarRanger.h"
+#include "ButtonInput.h"
+#include "DispenseSequencer.h"
+#include "VendLedger.h"
+#include "FlashJournal.h"
+#include "MachineState.h"
+
+// ======================================================================================
+// MACCHINA A STATI FINITI (FSM - Finite State Machine)
+// ======================================================================================
+// Gestisce il flusso operativo del distributore automatico
+// Transizioni: RIPOSO ↔ ATTESA_MONETA → EROGAZIONE → RESTO → RIPOSO
+//              └─────────────────────→ ERRORE (temperatura alta)
+
+enum Stato {
+    RIPOSO,         // Utente lontano, distributore in idle (verde)
+    ATTESA_MONETA,  // Utente vicino, attende inserimento monete (ciano/magenta/giallo)
+    EROGAZIONE,     // Dispensing prodotto in corso (servo attivo)
+    RESTO,          // Restituzione resto/credito residuo
+    ERRORE          // Errore sistema (temperatura > soglia, blocco operazioni)
+};
+
+// Eventi della FSM (unica coda, vedi EventFsm)
+enum TipoEvento {
+    EV_MONETA = 0,      // CoinInserted: moneta uscita dal LDR, arg = taglio (TaglioMoneta)
+    EV_PRODOTTO,        // ProductSelected: arg = id prodotto 1-4 (BLE cmd 1-4)
+    EV_CONFERMA,        // Confirm: BLE cmd 10
+    EV_ANNULLA,         // Cancel: arg = ANNULLA_* (pulsante, app cmd 9, disconnessione)
+    EV_TIMEOUT,         // Timeout: arg = TIMER_* della FSM, gen = generazione timer
+    EV_PRESENZA,        // PresenceChanged: arg = 1 utente presente, 0 assente (sonar filtrato)
+    EV_SOVRATEMP,       // OverTemp: arg = 1 temperatura >= soglia, 0 rientrata (isteresi 2°C)
+    EV_RIFORNIMENTO,    // Rifornimento scorte: BLE cmd 11
+    EV_CALIBRA,         // Calibrazione monete: BLE cmd 12, arg = taglio 1-3 o CALIBRA_*
+    EV_EROGATO,         // DispenseDone: profilo del servo completato, gen = numero dell'avvio
+    EV_COUNT
+};
+
+enum OrigineAnnulla {
+    ANNULLA_PULSANTE = 0,
+    ANNULLA_APP,
+    ANNULLA_DISCONNESSIONE
+};
+
+// Esito di un comando BLE con numero di sequenza ([cmd, seq] su CMD 0xA004), notificato
+// su RESULT 0xA006 come record [seq, cmd, esito]; più record per notifica
+enum EsitoComando {
+    ESITO_ACCETTATO = 0,
+    ESITO_SCONOSCIUTO,      // Codice comando non valido
+    ESITO_CODA_PIENA,       // Coda eventi FSM piena: comando non eseguito
+    ESITO_STATO,            // Non ammesso nello stato corrente
+    ESITO_CREDITO,          // Conferma con credito insufficiente
+    ESITO_ESAURITO,         // Prodotto esaurito o scorte inferiori ai pezzi richiesti
+    ESITO_FORMATO,          // Lotto TLV malformato: nessun comando eseguito
+    ESITO_CALIBRAZIONE,     // Calibrazione: monete insufficienti o scrittura flash fallita
+    ESITO_SALTATO,          // Lotto: un comando precedente è stato rifiutato, questo non è eseguito
+    ESITO_COUNT
+};
+
+#define ESITO_LEN   3       // Byte per record: seq, cmd, esito
+
+extern EventFsm fsm;
+extern Telemetria tlm;     // Log seriale (record binari)
+extern BleNotifier notifiche;
+extern CoinDetector rilevatore;             // Monete sul LDR (blocchi DMA)
+extern uint32_t ldrBlocchi;
+extern volatile uint32_t ldrBlocchiPersi;
+extern CalibrazioneMonete calibrazione;     // Modello dei tagli in uso (tagli == 0: non calibrata)
+extern uint32_t moneteTaglio[TAGLI + 1];    // Monete accreditate per taglio, [TAGLI] = non riconosciute
+
+extern SonarRanger sonar;                   // Cadenza configurabile (setCadenza) prima di setupMachine()
+extern bool utentePresente;                 // Presenza filtrata (isteresi + debounce)
+extern ButtonInput tastoAnnulla;            // Pulsante annulla (interrupt, debounce sui fronti)
+extern DispenseSequencer erogatore;         // Servo di erogazione (profili in background)
+extern const ProfiloServo *profiloErogazione; // Profilo dei prossimi pezzi (default PROFILO_RAMPA)
+
+extern Seqlock<MachineState> statoMacchina; // Copia coerente dello stato (scritta dalla coda eventi)
+extern Seqlock<Ambiente> ambiente;          // Ultima lettura DHT11 valida (scritta dal thread DHT)
+
+extern Stato statoCorrente;
+extern int credito;                 // Centesimi, disponibile (non impegnato in ordini)
+extern VendLedger cassa;            // Conti del denaro e ordini confermati
+extern bool erogazioneInPipeline;   // Ingressi del cliente successivo durante EROGAZIONE e RESTO
+extern FlashJournal giornale;       // Scorte, denaro e calibrazione in flash (recuperati al boot)
+extern int idProdotto;
+extern int scorte[5];
+extern bool bleConnesso;
+
+void setupMachine();   // Boot: periferiche, thread DHT, watchdog, stack BLE
+void updateMachine();  // Solo kick del watchdog (ogni WATCHDOG_KICK_MS = 1s sulla coda eventi; pulsante in ISR)
+
+#endif
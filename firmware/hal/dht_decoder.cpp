@@ -0,0 +1,41 @@
+#include "dht_decoder.h"
+
+namespace hal {
+
+DhtDecoder::DhtDecoder() : _tSalita(0), _alto(false), _n(0) {
+}
+
+void DhtDecoder::reset() {
+    _alto = false;
+    _n = 0;
+}
+
+void DhtDecoder::edge(int level, uint64_t t_us) {
+    if (level) {
+        _tSalita = t_us;
+        _alto = true;
+        return;
+    }
+    if (!_alto) return;     // Discesa senza salita vista (es. risposta del sensore)
+    _alto = false;
+
+    uint64_t width = t_us - _tSalita;
+    _larghezza[_n % MAX_IMPULSI] = (uint16_t)(width > 0xFFFF ? 0xFFFF : width);
+    _n = _n + 1;
+}
+
+bool DhtDecoder::result(uint8_t frame[5]) const {
+    int n = _n;
+    for (int i = 0; i < 5; i++) frame[i] = 0;
+    if (n < DHT_BITS) return false;
+
+    int primo = n - DHT_BITS;
+    for (int i = 0; i < DHT_BITS; i++) {
+        uint16_t width = _larghezza[(primo + i) % MAX_IMPULSI];
+        if (width > DHT_ALTO_MAX_US) return false;
+        if (width > DHT_SOGLIA_UNO_US) frame[i / 8] |= (1 << (7 - (i % 8)));
+    }
+    return true;
+}
+
+} // namespace hal
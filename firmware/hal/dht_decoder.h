@@ -0,0 +1,49 @@
+#ifndef VENDING_DHT_DECODER_H
+#define VENDING_DHT_DECODER_H
+
+/*
+ * ======================================================================================
+ * DHT11 - Decodifica del frame da timestamp dei fronti
+ * ======================================================================================
+ * Usato dalle implementazioni HAL di DhtSensor: i fronti arrivano da ISR (InterruptIn
+ * su target, timeline su host) con interrupt abilitati, niente polling a 1μs.
+ *
+ * Protocollo dopo lo start (linea bassa 18ms, poi rilasciata):
+ *   risposta sensore: basso 80μs, alto 80μs (preambolo)
+ *   40 bit:           basso 50μs, alto 26-28μs (bit 0) oppure 70μs (bit 1)
+ *
+ * Il decoder misura la durata di ogni livello alto (fronte salita → discesa) e usa
+ * gli ULTIMI 40 impulsi: impulsi spuri in testa (rilascio della linea, preambolo)
+ * non spostano i bit. Soglia a metà tra 28μs e 70μs: tollera ±20μs di latenza ISR.
+ */
+
+#include <cstdint>
+
+namespace hal {
+
+#define DHT_BITS            40
+#define DHT_SOGLIA_UNO_US   48      // Alto più lungo = bit 1
+#define DHT_ALTO_MAX_US     200     // Oltre: non è un bit (linea a riposo, fronte perso)
+#define DHT_FRAME_MS        8       // Fronti attivi dopo il rilascio: risposta 160μs + 40 bit x max 120μs ≈ 5ms
+
+class DhtDecoder {
+public:
+    static const int MAX_IMPULSI = 48;  // 40 bit + preambolo + margine
+
+    DhtDecoder();
+
+    void reset();                           // Prima di rilasciare la linea
+    void edge(int level, uint64_t t_us);    // ISR: livello dopo il fronte, istante del fronte
+    bool result(uint8_t frame[5]) const;    // false: meno di 40 impulsi o impulso fuori range
+    int impulsi() const { return _n; }
+
+private:
+    uint64_t _tSalita;
+    bool _alto;
+    uint16_t _larghezza[MAX_IMPULSI];   // Circolare: conta solo la coda
+    volatile int _n;
+};
+
+} // namespace hal
+
+#endif
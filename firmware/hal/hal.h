@@ -0,0 +1,262 @@
+#ifndef VENDING_HAL_H
+#define VENDING_HAL_H
+
+/*
+ * ======================================================================================
+ * HAL - Hardware Abstraction Layer del distributore
+ * ======================================================================================
+ *
+ * Interfaccia unica tra la logica applicativa (FSM, spike detection LDR, filtri sonar,
+ * servizio BLE) e l'hardware. L'applicazione NON include mai mbed.h: vede solo i tipi
+ * dichiarati qui.
+ *
+ * Implementazioni disponibili:
+ * - hal/hal_mbed.cpp  → Nucleo F401RE + shield IDB05A2 (Mbed OS 6, compilato da mbed-cli)
+ * - host/hal_host.cpp → simulatore Linux con sensori/attuatori simulati e GATT finto
+ *                       (compilato con -DVENDING_HOST, vedi host/CMakeLists.txt)
+ */
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(VENDING_HOST)
+#include <mutex>
+#else
+#include "rtos/Mutex.h"
+#endif
+
+namespace hal {
+
+// ======================================================================================
+// TEMPO
+// ======================================================================================
+
+uint64_t now_us();              // Tempo monotono dall'avvio in microsecondi (ISR-safe)
+void wait_us(uint32_t us);      // Attesa attiva (equivalente mbed wait_us)
+void sleep_ms(uint32_t ms);     // Sospende il contesto corrente (equivalente thread_sleep_for)
+
+/**
+ * @brief Cronometro con la stessa semantica di mbed::Timer
+ * start() su timer già avviato non ha effetto, reset() azzera senza fermare.
+ */
+class Timer {
+public:
+    Timer() : _running(false), _start(0), _accum(0) {}
+
+    void start() {
+        if (!_running) { _start = now_us(); _running = true; }
+    }
+    void stop() {
+        if (_running) { _accum += now_us() - _start; _running = false; }
+    }
+    void reset() {
+        _accum = 0;
+        _start = now_us();
+    }
+    uint64_t elapsed_us() const {
+        return _accum + (_running ? now_us() - _start : 0);
+    }
+
+private:
+    bool _running;
+    uint64_t _start;
+    uint64_t _accum;
+};
+
+// ======================================================================================
+// SCHEDULER (coda eventi principale)
+// ======================================================================================
+
+typedef void (*Task)();
+
+int  call_every_ms(uint32_t period_ms, Task task);  // Task periodico sulla coda eventi
+int  call_in_ms(uint32_t delay_ms, Task task);      // Task one-shot dopo delay_ms (0 = coda piena)
+void cancel(int id);                                // Annulla call_every_ms/call_in_ms non ancora eseguito
+int  call(Task task);                               // Esecuzione differita sulla coda eventi (ISR-safe, 0 = coda piena)
+int  start_background(Task body, uint32_t period_ms);  // Thread bassa priorità: body() ogni period_ms
+void background_period_ms(int id, uint32_t period_ms); // Nuova cadenza del thread (dalla prossima attesa)
+void background_wake(int id);                       // Interrompe l'attesa del thread: body() subito (ISR-safe)
+void dispatch_forever();                            // Loop della coda eventi (non ritorna)
+
+// ======================================================================================
+// WATCHDOG
+// ======================================================================================
+
+void watchdog_start(uint32_t timeout_ms);
+void watchdog_kick();
+
+// ======================================================================================
+// SERIALE USB
+// ======================================================================================
+
+// Scrittura non bloccante sul buffer TX della seriale: ritorna i byte accettati
+// (anche 0 con buffer pieno). printf() resta bloccante e va evitato nei percorsi caldi.
+int serial_write(const uint8_t *data, int len);
+
+// ======================================================================================
+// MUTUA ESCLUSIONE
+// ======================================================================================
+
+// Sezione critica breve (interrupt disabilitati su target): strutture condivise con ISR
+void critical_enter();
+void critical_exit();
+
+#if defined(VENDING_HOST)
+typedef std::mutex Mutex;
+#else
+typedef rtos::Mutex Mutex;
+#endif
+
+// ======================================================================================
+// PERIFERICHE
+// ======================================================================================
+
+typedef void (*Isr)();
+
+class DigitalOut {
+public:
+    virtual ~DigitalOut() {}
+    virtual void write(int value) = 0;
+    virtual int read() const = 0;
+
+    DigitalOut &operator=(int value) { write(value); return *this; }
+    operator int() const { return read(); }
+};
+
+class AnalogIn {
+public:
+    virtual ~AnalogIn() {}
+    virtual float read() = 0;   // Valore normalizzato 0.0-1.0
+};
+
+// Campionamento continuo a cadenza fissa (timer → ADC → DMA) in un doppio buffer:
+// buf[0..len) è riempito in ciclo e a ogni metà piena blocco() è chiamata in contesto
+// ISR con i len/2 campioni appena acquisiti (scala 0-65535 come read_u16). La metà
+// resta valida per len/2 periodi, finché l'acquisizione non ci riscrive sopra.
+typedef void (*AdcBlocco)(const uint16_t *campioni, int n);
+
+class AdcStream {
+public:
+    virtual ~AdcStream() {}
+    virtual bool start(uint32_t rate_hz, uint16_t *buf, int len, AdcBlocco blocco) = 0;
+    virtual void stop() = 0;   // Dopo stop() l'ADC torna disponibile ad AnalogIn::read()
+};
+
+class PwmOut {
+public:
+    virtual ~PwmOut() {}
+    virtual void period_ms(int ms) = 0;
+    virtual void write(float duty) = 0;
+    virtual void pulsewidth_us(int us) = 0;     // Impulso assoluto (servo), anche da ISR
+};
+
+class EdgeIn {  // InterruptIn
+public:
+    virtual ~EdgeIn() {}
+    virtual void rise(Isr isr) = 0;
+    virtual void fall(Isr isr) = 0;
+    virtual int read() = 0;     // Livello attuale (anche dalle ISR dei fronti)
+};
+
+class Timeout {  // mbed::Timeout: callback one-shot in contesto ISR
+public:
+    virtual ~Timeout() {}
+    virtual void attach_us(Isr isr, uint32_t delay_us) = 0;  // Riarmabile anche dalla ISR stessa
+    virtual void detach() = 0;
+};
+
+class I2CBus {
+public:
+    virtual ~I2CBus() {}
+    virtual void frequency(int hz) = 0;
+    virtual int write(int address, const char *data, int length) = 0;  // 0 = ACK
+    // Scrittura in background: ritorna subito, done() in contesto ISR a fine trasferimento.
+    // data deve restare valido fino a done(). Ritorna != 0 se il trasferimento non parte.
+    virtual int write_async(int address, const char *data, int length, Isr done) = 0;
+};
+
+class DhtSensor {
+public:
+    virtual ~DhtSensor() {}
+    // Legge il frame grezzo DHT11 (40 bit: hum, hum_dec, temp, temp_dec, checksum).
+    // Ritorna false su timeout di protocollo; il checksum è verificato dal chiamante.
+    virtual bool read(uint8_t frame[5]) = 0;
+};
+
+// Area dati in flash interna (ultimi due settori, fuori dal firmware) con semantica NOR:
+// erase() riporta i byte a 0xFF, program() può solo azzerare bit. Indirizzi relativi
+// all'inizio dell'area, erase a multipli di eraseSize() (un settore). Le operazioni
+// bloccano la CPU (sul target un settore da 128KB si cancella in 1-2s, una word si
+// programma in ~16μs): erase solo fuori dai percorsi caldi.
+class Flash {
+public:
+    virtual ~Flash() {}
+    virtual uint32_t size() = 0;
+    virtual uint32_t eraseSize() = 0;
+    virtual bool read(uint32_t addr, void *buf, uint32_t len) = 0;
+    virtual bool program(uint32_t addr, const void *data, uint32_t len) = 0;
+    virtual bool erase(uint32_t addr, uint32_t len) = 0;
+};
+
+// ======================================================================================
+// BLUETOOTH LOW ENERGY
+// ======================================================================================
+// Il servizio GATT 0xA000 è costruito dall'implementazione HAL; l'applicazione
+// scrive i valori per identificativo e riceve comandi/connessioni tramite BleListener.
+
+enum BleCharId {
+    BLE_CHAR_TEMP = 0,      // 0xA001 int32 temperatura (notify)
+    BLE_CHAR_STATUS,        // 0xA002 6 byte [credito, stato, scorte[4]] (notify)
+    BLE_CHAR_HUM,           // 0xA003 int32 umidità (notify)
+    BLE_CHAR_SNAPSHOT,      // 0xA005 snapshot versionato di tutti i campi (notify, vedi BleSnapshot.h)
+    BLE_CHAR_RESULT,        // 0xA006 esiti dei comandi con sequenza, 3 byte ciascuno (notify)
+    BLE_CHAR_COUNT
+};
+
+class BleListener {
+public:
+    virtual ~BleListener() {}
+    virtual void onReady() {}                                    // Stack pronto, advertising avviato
+    virtual void onConnect() {}
+    virtual void onDisconnect() {}
+    virtual void onCommand(const uint8_t *data, uint16_t len) {} // Scrittura su CMD 0xA004 (vedi BleComandi.h)
+    virtual void onSubscription(BleCharId id, bool enabled) {}   // CCCD: notifiche abilitate/disabilitate dal client
+};
+
+class BleLink {
+public:
+    virtual ~BleLink() {}
+    virtual void begin(BleListener &listener) = 0;
+    virtual void write(BleCharId id, const void *data, uint16_t len) = 0;
+    virtual void startAdvertising() = 0;
+};
+
+// ======================================================================================
+// SCHEDA
+// ======================================================================================
+
+struct Board {
+    I2CBus &i2c;            // LCD 16x2 (PCF8574)
+    DigitalOut &trig;       // HC-SR04 trigger
+    EdgeIn &echo;           // HC-SR04 echo
+    Timeout &sonarTimeout;  // Cadenza ping HC-SR04
+    DhtSensor &dht;         // DHT11
+    PwmOut &servo;          // SG90
+    Timeout &servoTimeout;  // Passi dei profili di erogazione
+    AnalogIn &ldr;          // Fotoresistenza monete (lettura singola)
+    AdcStream &ldrStream;   // Stessa fotoresistenza a cadenza fissa (rilevamento monete)
+    DigitalOut &buzzer;
+    EdgeIn &tastoAnnulla;   // Pulsante PC_13 (attivo basso)
+    Timeout &tastoTimeout;  // Finestra di debounce del pulsante
+    DigitalOut &ledR;
+    DigitalOut &ledG;
+    DigitalOut &ledB;
+    BleLink &ble;
+    Flash &flash;           // Dati persistenti (giornale: scorte, credito, calibrazione monete)
+};
+
+Board &board();
+
+} // namespace hal
+
+#endif
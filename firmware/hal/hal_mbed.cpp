@@ -0,0 +1,671 @@
+/*
+ * ======================================================================================
+ * HAL - Implementazione Mbed OS (Nucleo F401RE + Shield BLE IDB05A2)
+ * ======================================================================================
+ * Unico file del firmware che parla direttamente con gli oggetti driver Mbed.
+ */
+
+#include "mbed.h"
+#include "ble/BLE.h"
+#include "ble/Gap.h"
+#include "ble/GattServer.h"
+#include "hal.h"
+#include "dht_decoder.h"
+
+// ======================================================================================
+// CONFIGURAZIONE PIN HARDWARE
+// ======================================================================================
+// Mappa tutti i pin utilizzati sul microcontrollore STM32 Nucleo F401RE
+// Questa configurazione è ottimizzata per raggruppare i dispositivi vicini fisicamente
+
+// --- Sensore Ultrasuoni HC-SR04 (rilevamento presenza utente) ---
+#define PIN_TRIG    A1          // Trigger: invia impulso ultrasuoni
+#define PIN_ECHO    D9          // Echo: riceve risposta ultrasuoni (InterruptIn per precisione timing)
+
+// --- Sensore Fotoresistenza LDR (rilevamento monete) ---
+#define PIN_LDR     A2          // Ingresso analogico: valore aumenta quando moneta blocca luce
+
+// --- Sensore Temperatura/Umidità DHT11 ---
+#define PIN_DHT     D4          // Pin bidirezionale: lettura temp/hum tramite protocollo proprietario DHT
+
+// --- Attuatori ---
+#define PIN_SERVO   D5          // Servomotore SG90: dispensa prodotti (PWM 1-2ms)
+#define PIN_BUZZER  D2          // Buzzer piezoelettrico: feedback sonoro
+
+// --- Display LCD 16x2 I2C (interfaccia utente) ---
+#define PIN_LCD_SDA D14         // I2C Data (pin hardware fisso)
+#define PIN_LCD_SCL D15         // I2C Clock (pin hardware fisso)
+                                // Indirizzo I2C: 0x4E (adapter PCF8574)
+
+// --- LED RGB e pulsante ---
+#define PIN_LED_R   D6
+#define PIN_LED_G   D8
+#define PIN_LED_B   A3
+#define PIN_ANNULLA PC_13       // Pulsante onboard Nucleo (pull-up interno)
+
+// ======================================================================================
+// CONFIGURAZIONE BLUETOOTH LOW ENERGY (BLE)
+// ======================================================================================
+// UUID identificativi univoci per servizio e caratteristiche GATT
+// Permette comunicazione wireless con app Android/iOS
+
+const UUID VENDING_SERVICE_UUID((uint16_t)0xA000);  // Servizio principale distributore
+const UUID TEMP_CHAR_UUID((uint16_t)0xA001);        // Caratteristica temperatura (notify)
+const UUID STATUS_CHAR_UUID((uint16_t)0xA002);      // Caratteristica stato (6 byte): [credito, stato, scorte[4]]
+const UUID HUM_CHAR_UUID((uint16_t)0xA003);         // Caratteristica umidità (notify)
+const UUID CMD_CHAR_UUID((uint16_t)0xA004);         // Caratteristica comandi (write): [cmd], [cmd, seq], lotto TLV
+                                                    // 1-4=selezione prodotto, 9=annulla, 10=conferma, 11=rifornimento
+const UUID SNAPSHOT_CHAR_UUID((uint16_t)0xA005);    // Snapshot versionato (notify): stato + T/H + seq + timestamp
+const UUID RESULT_CHAR_UUID((uint16_t)0xA006);      // Esiti comandi (notify): [seq, cmd, esito] x N
+
+// ======================================================================================
+// SERIALE USB (debug e logging)
+// ======================================================================================
+static BufferedSerial pc(USBTX, USBRX, 9600);  // Comunicazione seriale USB @ 9600 baud
+FileHandle *mbed::mbed_override_console(int fd) { return &pc; }  // Redirige printf() su USB
+
+static EventQueue event_queue(32 * EVENTS_EVENT_SIZE);  // Task periodici, timer FSM, eventi BLE
+
+namespace hal {
+
+// ======================================================================================
+// TEMPO
+// ======================================================================================
+
+static mbed::Timer &systemTimer() {
+    static mbed::Timer timer;
+    static bool started = false;
+    if (!started) {
+        timer.start();
+        started = true;
+    }
+    return timer;
+}
+
+uint64_t now_us() { return systemTimer().elapsed_time().count(); }
+void wait_us(uint32_t us) { ::wait_us(us); }
+void sleep_ms(uint32_t ms) { thread_sleep_for(ms); }
+
+// ======================================================================================
+// SCHEDULER
+// ======================================================================================
+
+int call_every_ms(uint32_t period_ms, Task task) {
+    return event_queue.call_every(std::chrono::milliseconds(period_ms), task);
+}
+
+int call_in_ms(uint32_t delay_ms, Task task) {
+    return event_queue.call_in(std::chrono::milliseconds(delay_ms), task);
+}
+
+void cancel(int id) { event_queue.cancel(id); }
+
+int call(Task task) { return event_queue.call(task); }
+
+struct BackgroundTask {
+    Task body;
+    volatile uint32_t period_ms;
+    Thread *thread;
+};
+
+#define BACKGROUND_WAKE_FLAG 0x1
+
+#define MAX_BACKGROUND 4
+static BackgroundTask *background[MAX_BACKGROUND];
+static int backgroundCount = 0;
+
+static void runBackground(BackgroundTask *bg) {
+    while (true) {
+        bg->body();
+        // Attesa interrotta da background_wake() (thread flag, impostabile da ISR)
+        ThisThread::flags_wait_any_for(BACKGROUND_WAKE_FLAG, std::chrono::milliseconds(bg->period_ms));
+    }
+}
+
+int start_background(Task body, uint32_t period_ms) {
+    MBED_ASSERT(backgroundCount < MAX_BACKGROUND);
+    BackgroundTask *bg = new BackgroundTask{body, period_ms, new Thread(osPriorityLow)};
+    background[backgroundCount] = bg;
+    bg->thread->start(callback(runBackground, bg));
+    return ++backgroundCount;
+}
+
+void background_period_ms(int id, uint32_t period_ms) {
+    if (id >= 1 && id <= backgroundCount) background[id - 1]->period_ms = period_ms;
+}
+
+void background_wake(int id) {
+    if (id >= 1 && id <= backgroundCount) background[id - 1]->thread->flags_set(BACKGROUND_WAKE_FLAG);
+}
+
+void dispatch_forever() { event_queue.dispatch_forever(); }
+
+// ======================================================================================
+// WATCHDOG
+// ======================================================================================
+// Resetta microcontrollore se loop principale non esegue kick() entro il timeout
+// Protezione contro blocchi software critici
+
+void watchdog_start(uint32_t timeout_ms) { Watchdog::get_instance().start(timeout_ms); }
+void watchdog_kick() { Watchdog::get_instance().kick(); }
+
+// ======================================================================================
+// SERIALE USB
+// ======================================================================================
+// BufferedSerial non bloccante: write() copia nel buffer TX software (drenato in ISR)
+// e ritorna -EAGAIN se pieno. Le printf() residue (avvio) restano bloccanti solo se
+// il buffer è già pieno, quindi la modalità è impostata alla prima scrittura.
+
+int serial_write(const uint8_t *data, int len) {
+    static bool nonBloccante = false;
+    if (!nonBloccante) {
+        pc.set_blocking(false);
+        nonBloccante = true;
+    }
+    ssize_t n = pc.write(data, len);
+    return (n > 0) ? (int)n : 0;
+}
+
+// ======================================================================================
+// SEZIONE CRITICA
+// ======================================================================================
+
+void critical_enter() { core_util_critical_section_enter(); }
+void critical_exit() { core_util_critical_section_exit(); }
+
+// ======================================================================================
+// PERIFERICHE
+// ======================================================================================
+
+class MbedDigitalOut : public DigitalOut {
+public:
+    MbedDigitalOut(PinName pin) : _pin(pin) {}
+    void write(int value) override { _pin = value; }
+    int read() const override { return _pin.read(); }
+private:
+    mutable mbed::DigitalOut _pin;
+};
+
+class MbedAnalogIn : public AnalogIn {
+public:
+    MbedAnalogIn(PinName pin) : _pin(pin) {}
+    float read() override { return _pin.read(); }
+private:
+    mbed::AnalogIn _pin;
+};
+
+#if defined(TARGET_STM32F4)
+/**
+ * @brief Campionamento LDR senza CPU: TIM2 (TRGO) → ADC1 → DMA2 Stream0 circolare
+ * Un solo interrupt per metà buffer (half/complete transfer del DMA). Durante lo
+ * stream l'ADC1 è a trigger esterno: mbed::AnalogIn sullo stesso ADC non va letto
+ * finché stop() non lo riporta al trigger software.
+ */
+class MbedAdcStream;
+static MbedAdcStream *adcStreamAttivo = nullptr;
+
+class MbedAdcStream : public AdcStream {
+public:
+    MbedAdcStream(PinName pin) : _pin(pin), _buf(nullptr), _len(0), _blocco(nullptr), _attivo(false) {}
+
+    bool start(uint32_t rate_hz, uint16_t *buf, int len, AdcBlocco blocco) override {
+        if (len < 2 || (len & 1) || rate_hz == 0 || rate_hz > 100000) return false;
+        stop();
+        _buf = buf;
+        _len = len;
+        _blocco = blocco;
+
+        __HAL_RCC_TIM2_CLK_ENABLE();
+        __HAL_RCC_DMA2_CLK_ENABLE();
+        __HAL_RCC_ADC1_CLK_ENABLE();
+        pinmap_pinout(_pin, PinMap_ADC);
+
+        // DMA2 Stream0 Channel0 = ADC1: periferica → memoria a mezze parole, circolare
+        _dma.Instance = DMA2_Stream0;
+        _dma.Init.Channel = DMA_CHANNEL_0;
+        _dma.Init.Direction = DMA_PERIPH_TO_MEMORY;
+        _dma.Init.PeriphInc = DMA_PINC_DISABLE;
+        _dma.Init.MemInc = DMA_MINC_ENABLE;
+        _dma.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+        _dma.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+        _dma.Init.Mode = DMA_CIRCULAR;
+        _dma.Init.Priority = DMA_PRIORITY_LOW;
+        _dma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+        if (HAL_DMA_Init(&_dma) != HAL_OK) return false;
+
+        // ADC1: una conversione per fronte TRGO; 12 bit allineati a sinistra = scala read_u16
+        configuraAdc(ADC_EXTERNALTRIGCONVEDGE_RISING, ADC_EXTERNALTRIGCONV_T2_TRGO, ADC_DATAALIGN_LEFT, ENABLE);
+        __HAL_LINKDMA(&_adc, DMA_Handle, _dma);
+
+        // TIM2 a 1MHz, update (TRGO) ogni 1/rate_hz
+        uint32_t clk = HAL_RCC_GetPCLK1Freq();
+        if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) clk *= 2;   // Timer APB1 a 2x PCLK1
+        _tim.Instance = TIM2;
+        _tim.Init.Prescaler = clk / 1000000 - 1;
+        _tim.Init.CounterMode = TIM_COUNTERMODE_UP;
+        _tim.Init.Period = 1000000 / rate_hz - 1;
+        _tim.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+        _tim.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+        if (HAL_TIM_Base_Init(&_tim) != HAL_OK) return false;
+        TIM_MasterConfigTypeDef master = {};
+        master.MasterOutputTrigger = TIM_TRGO_UPDATE;
+        master.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+        HAL_TIMEx_MasterConfigSynchronization(&_tim, &master);
+
+        adcStreamAttivo = this;
+        NVIC_SetVector(DMA2_Stream0_IRQn, (uint32_t)&dmaIrq);
+        HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+        if (HAL_ADC_Start_DMA(&_adc, (uint32_t *)_buf, _len) != HAL_OK) return false;
+        HAL_TIM_Base_Start(&_tim);
+        _attivo = true;
+        return true;
+    }
+
+    void stop() override {
+        if (!_attivo) return;
+        _attivo = false;
+        HAL_TIM_Base_Stop(&_tim);
+        HAL_ADC_Stop_DMA(&_adc);
+        HAL_NVIC_DisableIRQ(DMA2_Stream0_IRQn);
+        // Trigger software e allineamento a destra: la configurazione attesa da mbed::AnalogIn
+        configuraAdc(ADC_EXTERNALTRIGCONVEDGE_NONE, ADC_SOFTWARE_START, ADC_DATAALIGN_RIGHT, DISABLE);
+    }
+
+    // --- Contesto ISR (callback HAL del DMA) ---
+    void onMeta(bool seconda) {
+        if (_blocco) _blocco(_buf + (seconda ? _len / 2 : 0), _len / 2);
+    }
+    ADC_HandleTypeDef *handle() { return &_adc; }
+
+private:
+    PinName _pin;
+    uint16_t *_buf;
+    int _len;
+    AdcBlocco _blocco;
+    volatile bool _attivo;
+    ADC_HandleTypeDef _adc = {};
+    DMA_HandleTypeDef _dma = {};
+    TIM_HandleTypeDef _tim = {};
+
+    void configuraAdc(uint32_t fronte, uint32_t trigger, uint32_t allineamento, FunctionalState dma) {
+        _adc.Instance = ADC1;
+        _adc.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4;
+        _adc.Init.Resolution = ADC_RESOLUTION_12B;
+        _adc.Init.ScanConvMode = DISABLE;
+        _adc.Init.ContinuousConvMode = DISABLE;
+        _adc.Init.DiscontinuousConvMode = DISABLE;
+        _adc.Init.NbrOfDiscConversion = 0;
+        _adc.Init.ExternalTrigConvEdge = fronte;
+        _adc.Init.ExternalTrigConv = trigger;
+        _adc.Init.DataAlign = allineamento;
+        _adc.Init.NbrOfConversion = 1;
+        _adc.Init.DMAContinuousRequests = dma;
+        _adc.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
+        HAL_ADC_Init(&_adc);
+
+        ADC_ChannelConfTypeDef canale = {};
+        canale.Channel = STM_PIN_CHANNEL(pinmap_function(_pin, PinMap_ADC));
+        canale.Rank = 1;
+        canale.SamplingTime = ADC_SAMPLETIME_480CYCLES;    // LDR in partitore ad alta impedenza
+        HAL_ADC_ConfigChannel(&_adc, &canale);
+    }
+
+    static void dmaIrq() {
+        if (adcStreamAttivo) HAL_DMA_IRQHandler(&adcStreamAttivo->_dma);
+    }
+};
+
+extern "C" void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc) {
+    if (adcStreamAttivo && hadc == adcStreamAttivo->handle()) adcStreamAttivo->onMeta(false);
+}
+
+extern "C" void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc) {
+    if (adcStreamAttivo && hadc == adcStreamAttivo->handle()) adcStreamAttivo->onMeta(true);
+}
+#else
+/**
+ * @brief Target senza percorso TIM+DMA: campioni presi da un Ticker (una ISR per
+ * campione), stessi blocchi a metà buffer verso l'applicazione
+ */
+class MbedAdcStream : public AdcStream {
+public:
+    MbedAdcStream(PinName pin) : _pin(pin), _buf(nullptr), _len(0), _pos(0), _blocco(nullptr) {}
+
+    bool start(uint32_t rate_hz, uint16_t *buf, int len, AdcBlocco blocco) override {
+        if (len < 2 || (len & 1) || rate_hz == 0) return false;
+        stop();
+        _buf = buf;
+        _len = len;
+        _pos = 0;
+        _blocco = blocco;
+        _ticker.attach(mbed::callback(this, &MbedAdcStream::campiona),
+                       std::chrono::microseconds(1000000 / rate_hz));
+        return true;
+    }
+    void stop() override { _ticker.detach(); }
+
+private:
+    mbed::AnalogIn _pin;
+    mbed::Ticker _ticker;
+    uint16_t *_buf;
+    int _len;
+    int _pos;
+    AdcBlocco _blocco;
+
+    void campiona() {
+        _buf[_pos++] = _pin.read_u16();
+        if (_pos == _len / 2) {
+            if (_blocco) _blocco(_buf, _len / 2);
+        } else if (_pos == _len) {
+            _pos = 0;
+            if (_blocco) _blocco(_buf + _len / 2, _len / 2);
+        }
+    }
+};
+#endif
+
+class MbedPwmOut : public PwmOut {
+public:
+    MbedPwmOut(PinName pin) : _pin(pin) {}
+    void period_ms(int ms) override { _pin.period_ms(ms); }
+    void write(float duty) override { _pin.write(duty); }
+    void pulsewidth_us(int us) override { _pin.pulsewidth_us(us); }
+private:
+    mbed::PwmOut _pin;
+};
+
+class MbedEdgeIn : public EdgeIn {
+public:
+    MbedEdgeIn(PinName pin) : _pin(pin) {}
+    void rise(Isr isr) override { _pin.rise(isr); }
+    void fall(Isr isr) override { _pin.fall(isr); }
+    int read() override { return _pin.read(); }
+private:
+    mbed::InterruptIn _pin;
+};
+
+class MbedTimeout : public Timeout {
+public:
+    void attach_us(Isr isr, uint32_t delay_us) override {
+        _timeout.attach(isr, std::chrono::microseconds(delay_us));
+    }
+    void detach() override { _timeout.detach(); }
+private:
+    mbed::Timeout _timeout;
+};
+
+class MbedI2C : public I2CBus {
+public:
+    MbedI2C(PinName sda, PinName scl) : _i2c(sda, scl) {}
+    void frequency(int hz) override { _i2c.frequency(hz); }
+    int write(int address, const char *data, int length) override {
+        return _i2c.write(address, data, length);
+    }
+    int write_async(int address, const char *data, int length, Isr done) override {
+#if DEVICE_I2CASYNCH
+        _done = done;
+        return _i2c.transfer(address, data, length, nullptr, 0,
+                             mbed::callback(this, &MbedI2C::onEvent), I2C_EVENT_ALL);
+#else
+        // Target senza I2C asincrono: scrittura bloccante, completamento immediato
+        int ret = _i2c.write(address, data, length);
+        if (done) done();
+        return ret;
+#endif
+    }
+private:
+    mbed::I2C _i2c;
+#if DEVICE_I2CASYNCH
+    Isr _done = nullptr;
+    void onEvent(int event) { if (_done) _done(); }
+#endif
+};
+
+/**
+ * @brief DHT11 a fronti: start 18ms, poi i 40 bit sono decodificati da DhtDecoder
+ * con i timestamp dei fronti presi in ISR (InterruptIn sullo stesso pin).
+ * Nessuna sezione con interrupt disabilitati: BLE, sonar e tick restano attivi;
+ * la latenza ISR (pochi μs) è assorbita dal margine di ±20μs della soglia.
+ */
+class MbedDht : public DhtSensor {
+public:
+    MbedDht(PinName pin) : _pin(pin), _edges(pin) {
+        _edges.rise(callback(this, &MbedDht::onRise));
+        _edges.fall(callback(this, &MbedDht::onFall));
+        _edges.disable_irq();
+    }
+
+    bool read(uint8_t frame[5]) override {
+        _pin.output();
+        _pin = 0;
+        thread_sleep_for(18);
+
+        // Fronti attivi prima del rilascio: il sensore risponde dopo 20-40μs
+        _decoder.reset();
+        _edges.enable_irq();
+        _pin.input();
+        thread_sleep_for(DHT_FRAME_MS);
+        _edges.disable_irq();
+
+        return _decoder.result(frame);
+    }
+
+private:
+    mbed::DigitalInOut _pin;
+    mbed::InterruptIn _edges;
+    DhtDecoder _decoder;
+
+    void onRise() { _decoder.edge(1, now_us()); }
+    void onFall() { _decoder.edge(0, now_us()); }
+};
+
+// ======================================================================================
+// FLASH DATI (FlashIAP)
+// ======================================================================================
+/**
+ * @brief Ultimi due settori della flash interna come area dati (banchi del giornale)
+ * F401RE: settori 6-7, 2 x 128KB a 0x08040000. Il firmware resta sotto: mbed_rom_size
+ * 0x40000 in mbed_app.json lo impone al link, apri() rifiuta un'area che parta prima
+ * della fine dell'immagine (il primo recupera() la formatterebbe).
+ * Cancellazione 1-2s da datasheet con la CPU ferma sul bus flash: eseguita solo con la
+ * macchina ferma (banco del giornale, calibrazione), mai nei percorsi a tempo.
+ */
+class MbedFlash : public Flash {
+public:
+    MbedFlash() : _pronta(false), _base(0), _size(0), _settore(0) {}
+
+    uint32_t size() override { return apri() ? _size : 0; }
+    uint32_t eraseSize() override { return apri() ? _settore : 0; }
+
+    bool read(uint32_t addr, void *buf, uint32_t len) override {
+        return dentro(addr, len) && _iap.read(buf, _base + addr, len) == 0;
+    }
+    bool program(uint32_t addr, const void *data, uint32_t len) override {
+        return dentro(addr, len) && _iap.program(data, _base + addr, len) == 0;
+    }
+    bool erase(uint32_t addr, uint32_t len) override {
+        return dentro(addr, len) && _iap.erase(_base + addr, len) == 0;
+    }
+
+private:
+    mbed::FlashIAP _iap;
+    bool _pronta;
+    uint32_t _base;
+    uint32_t _size;
+    uint32_t _settore;
+
+    bool apri() {
+        if (_pronta) return true;
+        if (_iap.init() != 0) return false;
+        uint32_t fine = _iap.get_flash_start() + _iap.get_flash_size();
+        _settore = _iap.get_sector_size(fine - 1);
+        // Settori della stessa dimensione (sulla F401RE i due da 128KB in fondo)
+        if (_iap.get_sector_size(fine - _settore - 1) != _settore) return false;
+        _size = 2 * _settore;
+        _base = fine - _size;
+        // Fine dell'immagine dai simboli del linker (testo + dati inizializzati)
+        if (_base < FLASHIAP_APP_ROM_END_ADDR) return false;
+        _pronta = true;
+        return true;
+    }
+    bool dentro(uint32_t addr, uint32_t len) {
+        return apri() && addr <= _size && len <= _size - addr;
+    }
+};
+
+// ======================================================================================
+// BLE - Servizio GATT 0xA000
+// ======================================================================================
+
+class MbedBleLink : public BleLink,
+                    public ble::Gap::EventHandler,
+                    public ble::GattServer::EventHandler {
+public:
+    MbedBleLink() :
+        _listener(nullptr),
+        _tempValue(0), _humValue(0),
+        _tempChar(TEMP_CHAR_UUID, &_tempValue, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        _humChar(HUM_CHAR_UUID, &_humValue, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        _cmdChar(CMD_CHAR_UUID, _cmdValue, 1, 20, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE),
+        _statusChar(STATUS_CHAR_UUID, _statusValue, 6, 6, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        _snapshotChar(SNAPSHOT_CHAR_UUID, _snapshotValue, 18, 20,
+                      GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        _resultChar(RESULT_CHAR_UUID, _resultValue, 0, 18, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY)
+    {
+        for (int i = 0; i < 6; i++) _statusValue[i] = 0;
+        for (int i = 0; i < 20; i++) _snapshotValue[i] = 0;
+        for (int i = 0; i < 20; i++) _cmdValue[i] = 0;
+        for (int i = 0; i < 18; i++) _resultValue[i] = 0;
+    }
+
+    void begin(BleListener &listener) override {
+        _listener = &listener;
+        BLE &ble = BLE::Instance();
+        ble.onEventsToProcess(scheduleBleEventsProcessing);
+        ble.init(this, &MbedBleLink::onInitComplete);
+    }
+
+    void write(BleCharId id, const void *data, uint16_t len) override {
+        GattAttribute::Handle_t handle;
+        switch (id) {
+            case BLE_CHAR_TEMP:   handle = _tempChar.getValueHandle(); break;
+            case BLE_CHAR_STATUS: handle = _statusChar.getValueHandle(); break;
+            case BLE_CHAR_HUM:    handle = _humChar.getValueHandle(); break;
+            case BLE_CHAR_SNAPSHOT: handle = _snapshotChar.getValueHandle(); break;
+            case BLE_CHAR_RESULT: handle = _resultChar.getValueHandle(); break;
+            default: return;
+        }
+        BLE::Instance().gattServer().write(handle, (const uint8_t *)data, len);
+    }
+
+    void startAdvertising() override {
+        BLE::Instance().gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+    }
+
+private:
+    BleListener *_listener;
+    int _tempValue;
+    int _humValue;
+    uint8_t _cmdValue[20];          // Lunghezza variabile: [cmd], [cmd, seq] o lotto TLV
+    uint8_t _statusValue[6];
+    uint8_t _snapshotValue[20];     // v1 = 18 byte, margine per versioni future
+    uint8_t _resultValue[18];       // Fino a 6 esiti da 3 byte per notifica
+    ReadOnlyGattCharacteristic<int> _tempChar;
+    ReadOnlyGattCharacteristic<int> _humChar;
+    GattCharacteristic _cmdChar;
+    GattCharacteristic _statusChar;
+    GattCharacteristic _snapshotChar;
+    GattCharacteristic _resultChar;
+
+    static void scheduleBleEventsProcessing(BLE::OnEventsToProcessCallbackContext *context) {
+        event_queue.call(Callback<void()>(&context->ble, &BLE::processEvents));
+    }
+
+    void onInitComplete(BLE::InitializationCompleteCallbackContext *params) {
+        BLE &ble = params->ble;
+        if (params->error != BLE_ERROR_NONE) return;
+
+        GattCharacteristic *charTable[] = {&_tempChar, &_humChar, &_statusChar, &_cmdChar, &_snapshotChar, &_resultChar};
+        GattService vendingService(VENDING_SERVICE_UUID, charTable, 6);
+        ble.gattServer().addService(vendingService);
+
+        ble.gap().setEventHandler(this);
+        ble.gattServer().setEventHandler(this);
+
+        static uint8_t _adv_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
+        ble::AdvertisingDataBuilder _adv_data_builder(_adv_buffer);
+        _adv_data_builder.setFlags();
+        _adv_data_builder.setName("VendingM");
+        ble.gap().setAdvertisingPayload(ble::LEGACY_ADVERTISING_HANDLE, _adv_data_builder.getAdvertisingData());
+        ble::AdvertisingParameters adv_parameters(ble::advertising_type_t::CONNECTABLE_UNDIRECTED, ble::adv_interval_t(ble::millisecond_t(1000)));
+        ble.gap().setAdvertisingParameters(ble::LEGACY_ADVERTISING_HANDLE, adv_parameters);
+        ble.gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+
+        _listener->onReady();
+    }
+
+    // Handle valore → caratteristica (BLE_CHAR_COUNT se non notificabile)
+    BleCharId charId(GattAttribute::Handle_t handle) {
+        if (handle == _tempChar.getValueHandle())   return BLE_CHAR_TEMP;
+        if (handle == _statusChar.getValueHandle()) return BLE_CHAR_STATUS;
+        if (handle == _humChar.getValueHandle())    return BLE_CHAR_HUM;
+        if (handle == _snapshotChar.getValueHandle()) return BLE_CHAR_SNAPSHOT;
+        if (handle == _resultChar.getValueHandle())   return BLE_CHAR_RESULT;
+        return BLE_CHAR_COUNT;
+    }
+
+    // Scrittura del CCCD da parte del client (notifiche on/off)
+    void onUpdatesEnabled(const GattUpdatesEnabledCallbackParams &params) override {
+        BleCharId id = charId(params.attHandle);
+        if (id != BLE_CHAR_COUNT) _listener->onSubscription(id, true);
+    }
+
+    void onUpdatesDisabled(const GattUpdatesDisabledCallbackParams &params) override {
+        BleCharId id = charId(params.attHandle);
+        if (id != BLE_CHAR_COUNT) _listener->onSubscription(id, false);
+    }
+
+    void onDataWritten(const GattWriteCallbackParams &params) override {
+        if (params.handle == _cmdChar.getValueHandle() && params.len > 0) {
+            _listener->onCommand(params.data, params.len);
+        }
+    }
+
+    void onConnectionComplete(const ble::ConnectionCompleteEvent &event) override {
+        if (event.getStatus() == BLE_ERROR_NONE) _listener->onConnect();
+    }
+
+    void onDisconnectionComplete(const ble::DisconnectionCompleteEvent &event) override {
+        _listener->onDisconnect();
+    }
+};
+
+// ======================================================================================
+// SCHEDA
+// ======================================================================================
+
+Board &board() {
+    static MbedI2C i2c(PIN_LCD_SDA, PIN_LCD_SCL);
+    static MbedDigitalOut trig(PIN_TRIG);
+    static MbedEdgeIn echo(PIN_ECHO);
+    static MbedTimeout sonarTimeout;
+    static MbedDht dht(PIN_DHT);
+    static MbedPwmOut servo(PIN_SERVO);
+    static MbedTimeout servoTimeout;
+    static MbedAnalogIn ldr(PIN_LDR);
+    static MbedAdcStream ldrStream(PIN_LDR);
+    static MbedDigitalOut buzzer(PIN_BUZZER);
+    static MbedEdgeIn tastoAnnulla(PIN_ANNULLA);
+    static MbedTimeout tastoTimeout;
+    static MbedDigitalOut ledR(PIN_LED_R);
+    static MbedDigitalOut ledG(PIN_LED_G);
+    static MbedDigitalOut ledB(PIN_LED_B);
+    static MbedBleLink ble;
+    static MbedFlash flash;
+
+    static Board b = {i2c, trig, echo, sonarTimeout, dht, servo, servoTimeout, ldr, ldrStream, buzzer,
+                      tastoAnnulla, tastoTimeout, ledR, ledG, ledB, ble, flash};
+    return b;
+}
+
+} // namespace hal
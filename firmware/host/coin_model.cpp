@@ -0,0 +1,84 @@
+#include "coin_model.h"
+#include <algorithm>
+#include <cmath>
+
+// Finestra di 26mm (poco più della moneta più grande), luce diffusa: base 40%, buio 85%
+const ModelloLdr MODELLO_GUIDA = {0.40f, 0.85f, 5000.0f, 26.0f, 0.02f, 0.01f, 0.25f, 0.02f};
+
+const float diametroTaglio_mm[TAGLI] = {24.25f, 23.25f, 25.75f};
+
+// Frazione della finestra (raggio rf) coperta da un disco di raggio rm a distanza x
+static double copertura(double x, double rm, double rf) {
+    if (x >= rm + rf) return 0.0;
+    if (x <= fabs(rm - rf)) return std::min(rm, rf) * std::min(rm, rf) / (rf * rf);
+    double a = rm * rm * acos((x * x + rm * rm - rf * rf) / (2 * x * rm)) +
+               rf * rf * acos((x * x + rf * rf - rm * rm) / (2 * x * rf)) -
+               0.5 * sqrt((-x + rm + rf) * (x + rm - rf) * (x - rm + rf) * (x + rm + rf));
+    return a / (M_PI * rf * rf);
+}
+
+static uint32_t prossimo(uint32_t &seed) {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+// Normale standard (Box-Muller) dal generatore deterministico
+static double gauss(uint32_t &seed) {
+    double u1 = (prossimo(seed) % 1000000 + 1) / 1000001.0;
+    double u2 = (prossimo(seed) % 1000000) / 1000000.0;
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+CanaleMonete::CanaleMonete(const ModelloLdr &modello, uint32_t seed) : _m(modello), _seed(seed) {}
+
+uint64_t CanaleMonete::aggiungi(uint64_t t_us, uint8_t taglio, float v_ms) {
+    if (v_ms <= 0) v_ms = (float)(_m.velocita_ms * (1.0 + _m.dispersione * gauss(_seed)));
+    double rm = diametroTaglio_mm[taglio] / 2.0, rf = _m.finestra_mm / 2.0;
+    double corsa_mm = 2 * (rm + rf);                    // Dal primo contatto all'uscita
+    double transito_us = corsa_mm / v_ms * 1000.0;      // mm / (m/s) = ms
+
+    Impulso imp;
+    imp.t0 = t_us;
+    double y = 0, k = PASSO_US / _m.tau_us;
+    for (double t = 0; t < transito_us || y > 1e-3; t += PASSO_US) {
+        double x = fabs(rm + rf - t / 1000.0 * v_ms);    // Distanza tra i centri
+        double occ = (t < transito_us) ? copertura(x, rm, rf) : 0.0;
+        y += (occ - y) * k;
+        imp.y.push_back((float)y);
+    }
+    uint64_t fine = t_us + (uint64_t)imp.y.size() * PASSO_US;
+    _impulsi.push_back(imp);
+    return fine;
+}
+
+float CanaleMonete::livello(uint64_t t) const {
+    float y = 0;
+    for (const Impulso &imp : _impulsi) {
+        if (t < imp.t0) continue;
+        uint64_t i = (t - imp.t0) / PASSO_US;
+        if (i < imp.y.size()) y += imp.y[i];
+    }
+    if (y > 1) y = 1;
+    float v = _m.base + (_m.scuro - _m.base) * y;
+    uint32_t h = (uint32_t)(t / 100) * 2654435761u ^ _seed;     // Rumore deterministico per istante
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    v += ((h % 4001) / 2000.0f - 1.0f) * _m.rumore;
+    v += _m.flicker * (float)sin(2.0 * M_PI * 100.0 * t / 1e6);
+    return v;
+}
+
+std::vector<uint16_t> tracciaMoneta(const ModelloLdr &m, uint8_t taglio, uint32_t periodo_us,
+                                    int preroll, uint32_t &seed) {
+    CanaleMonete canale(m, prossimo(seed));
+    uint64_t t0 = (uint64_t)preroll * periodo_us + prossimo(seed) % 10000;     // Fase del flicker casuale
+    uint64_t fine = canale.aggiungi(t0, taglio) + 20 * (uint64_t)periodo_us;
+    std::vector<uint16_t> campioni;
+    for (uint64_t t = 0; t < fine; t += periodo_us) {
+        float v = canale.livello(t);
+        v = std::min(1.0f, std::max(0.0f, v));
+        campioni.push_back((uint16_t)(v * 65535.0f + 0.5f));
+    }
+    return campioni;
+}
@@ -0,0 +1,63 @@
+#ifndef VENDING_COIN_MODEL_H
+#define VENDING_COIN_MODEL_H
+
+/*
+ * ======================================================================================
+ * MODELLO MONETE SU GUIDA (impulsi LDR per taglio)
+ * ======================================================================================
+ * Il LDR vede la luce attraverso una finestra circolare; la moneta, un disco che
+ * scorre sulla guida a velocità quasi costante, la copre in parte: l'occlusione è
+ * l'area di sovrapposizione dei due cerchi divisa per l'area della finestra.
+ * Tagli più grandi danno impulsi più lunghi e, sotto il diametro della finestra,
+ * anche più profondi. La fotoresistenza segue l'occlusione con costante τ; rumore
+ * ADC e flicker della luce ambiente sono deterministici per istante (stessa traccia
+ * a ogni lettura, AnalogIn e DMA compresi).
+ *
+ * Usato da vending_sim (scenario "calib") e da coin_train (tracce sintetiche).
+ */
+
+#include <cstdint>
+#include <vector>
+#include "CoinClassifier.h"
+
+struct ModelloLdr {
+    float base;             // Livello senza moneta (0-1)
+    float scuro;            // Livello con finestra tutta coperta
+    float tau_us;           // Risposta della fotoresistenza
+    float finestra_mm;      // Diametro della finestra davanti al LDR
+    float rumore;           // Rumore uniforme ± (fondo scala 1)
+    float flicker;          // Ampiezza a 100 Hz
+    float velocita_ms;      // Velocità media sulla guida
+    float dispersione;      // σ relativa della velocità tra una moneta e l'altra
+};
+
+extern const ModelloLdr MODELLO_GUIDA;
+extern const float diametroTaglio_mm[TAGLI];    // 0.50: 24.25, 1: 23.25, 2: 25.75 mm
+
+class CanaleMonete {
+public:
+    CanaleMonete(const ModelloLdr &modello, uint32_t seed);
+
+    // Moneta che tocca la finestra a t_us; velocità estratta dal modello se v_ms <= 0.
+    // Ritorna l'istante in cui il segnale è tornato alla base (fine della coda τ).
+    uint64_t aggiungi(uint64_t t_us, uint8_t taglio, float v_ms = 0);
+    float livello(uint64_t t_us) const;     // Lettura 0-1 (rumore e flicker compresi)
+    const ModelloLdr &modello() const { return _m; }
+
+private:
+    struct Impulso {
+        uint64_t t0;
+        std::vector<float> y;   // Risposta del LDR (0-1) a passi di PASSO_US
+    };
+    static const uint32_t PASSO_US = 50;
+
+    ModelloLdr _m;
+    uint32_t _seed;
+    std::vector<Impulso> _impulsi;
+};
+
+// Traccia campionata di una moneta (preroll campioni di base prima, coda fino al rientro)
+std::vector<uint16_t> tracciaMoneta(const ModelloLdr &m, uint8_t taglio, uint32_t periodo_us,
+                                    int preroll, uint32_t &seed);
+
+#endif
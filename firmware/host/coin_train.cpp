@@ -0,0 +1,258 @@
+/*
+ * ======================================================================================
+ * COIN_TRAIN - Addestramento e valutazione offline del riconoscimento tagli
+ * ======================================================================================
+ * Ogni traccia (una moneta) passa dallo stesso CoinDetector del firmware (config di
+ * main.cpp); le caratteristiche dell'impulso addestrano CoinClassifier con gli stessi
+ * accumulatori della calibrazione sulla macchina. Valutazione a K fold: matrice di
+ * confusione sulle monete mai viste in addestramento e tempo di classificazione.
+ *
+ * Uso: coin_train genera [--monete N] [--seed S] [--velocita V] > tracce.txt
+ *      coin_train valuta FILE [--fold K]
+ *      coin_train [--monete N] [--seed S] [--velocita V] [--fold K]   (tracce sintetiche in memoria)
+ *
+ * Formato delle tracce (testo, '#' commento): una moneta per riga
+ *   <centesimi> <periodo_us> <campione> <campione> ...      (campioni 0-65535)
+ * Tracce vere: registrate dal target (LDR a 1kHz) con la moneta nota.
+ *
+ * Exit code 1 se meno del 90% delle monete di test è riconosciuto col taglio giusto.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "coin_model.h"
+#include "VendingApp.h"
+
+struct Traccia {
+    uint8_t taglio;
+    uint32_t periodo_us;
+    std::vector<uint16_t> campioni;
+};
+
+struct Moneta {
+    uint8_t taglio;
+    int uscite;                             // Impulsi completi visti dal rilevatore (1 atteso)
+    int32_t f[MONETA_CARATTERISTICHE];
+    int fold;                               // A turno per taglio: ogni fold ha tutti i tagli
+};
+
+static std::vector<EventoLdr> usciteTraccia;
+
+static void uscitaLdr(const EventoLdr &ev) {
+    if (!ev.moneta) usciteTraccia.push_back(ev);
+}
+
+static int taglioDaCentesimi(int c) {
+    for (int t = 0; t < TAGLI; t++) {
+        if (centesimiTaglio[t] == c) return t;
+    }
+    return -1;
+}
+
+// ======================================================================================
+// TRACCE
+// ======================================================================================
+
+static std::vector<Traccia> sintetiche(int perTaglio, uint32_t seed, float velocita) {
+    ModelloLdr m = MODELLO_GUIDA;
+    if (velocita > 0) m.velocita_ms = velocita;
+    std::vector<Traccia> tracce;
+    for (int n = 0; n < perTaglio; n++) {
+        for (int t = 0; t < TAGLI; t++) {
+            Traccia tr = {(uint8_t)t, rilevatore.config().periodo_us, {}};
+            tr.campioni = tracciaMoneta(m, (uint8_t)t, tr.periodo_us, 1000, seed);
+            tracce.push_back(tr);
+        }
+    }
+    return tracce;
+}
+
+static bool leggi(const char *path, std::vector<Traccia> &tracce) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return false;
+    }
+    std::string riga;
+    int c, numero = 0;
+    bool ok = true;
+    while (ok) {
+        riga.clear();
+        while ((c = fgetc(in)) != EOF && c != '\n') riga += (char)c;
+        if (riga.empty() && c == EOF) break;
+        numero++;
+        if (riga.empty() || riga[0] == '#') continue;
+
+        const char *p = riga.c_str();
+        char *fine;
+        long centesimi = strtol(p, &fine, 10);
+        long periodo = strtol(fine, &fine, 10);
+        Traccia tr = {0, (uint32_t)periodo, {}};
+        int taglio = taglioDaCentesimi((int)centesimi);
+        while (true) {
+            char *dopo;
+            long v = strtol(fine, &dopo, 10);
+            if (dopo == fine) break;
+            tr.campioni.push_back((uint16_t)((v < 0) ? 0 : (v > 65535) ? 65535 : v));
+            fine = dopo;
+        }
+        if (taglio < 0 || periodo <= 0 || tr.campioni.empty()) {
+            fprintf(stderr, "%s:%d: traccia non valida (centesimi 50/100/200, periodo, campioni)\n", path, numero);
+            ok = false;
+        }
+        tr.taglio = (uint8_t)taglio;
+        tracce.push_back(tr);
+    }
+    fclose(in);
+    return ok && !tracce.empty();
+}
+
+static void scrivi(const std::vector<Traccia> &tracce, uint32_t seed, float velocita) {
+    printf("# coin_train genera: %zu monete, seed %u, guida %.2f m/s (σ %.0f%%), finestra %.0f mm, LDR τ %.0f ms\n",
+           tracce.size(), seed, velocita > 0 ? velocita : MODELLO_GUIDA.velocita_ms,
+           MODELLO_GUIDA.dispersione * 100, MODELLO_GUIDA.finestra_mm, MODELLO_GUIDA.tau_us / 1000);
+    printf("# <centesimi> <periodo_us> <campioni 0-65535>\n");
+    for (const Traccia &tr : tracce) {
+        printf("%u %u", centesimiTaglio[tr.taglio], tr.periodo_us);
+        for (uint16_t x : tr.campioni) printf(" %u", x);
+        printf("\n");
+    }
+}
+
+// ======================================================================================
+// VALUTAZIONE
+// ======================================================================================
+
+static Moneta estrai(const Traccia &tr) {
+    CoinDetectorConfig cfg = rilevatore.config();
+    cfg.periodo_us = tr.periodo_us;
+    CoinDetector rilevatoreTraccia(cfg, uscitaLdr);
+    usciteTraccia.clear();
+    rilevatoreTraccia.processa(tr.campioni.data(), (int)tr.campioni.size(), 0);
+
+    Moneta m = {tr.taglio, (int)usciteTraccia.size(), {0, 0, 0}, 0};
+    if (m.uscite) caratteristicheMoneta(usciteTraccia[0], m.f);
+    return m;
+}
+
+static const char *nomeTaglio(int t) {
+    static const char *nomi[TAGLI + 2] = {"0.50", "1", "2", "ignota", "persa"};
+    return nomi[t];
+}
+
+static int valuta(const std::vector<Traccia> &tracce, int fold) {
+    std::vector<Moneta> monete;
+    int perse = 0, spezzate = 0;
+    int perTaglio[TAGLI] = {};
+    for (const Traccia &tr : tracce) {
+        monete.push_back(estrai(tr));
+        monete.back().fold = perTaglio[tr.taglio]++ % fold;
+        if (monete.back().uscite == 0) perse++;
+        if (monete.back().uscite > 1) spezzate++;
+    }
+
+    // Confusione: riga = taglio vero, colonna = taglio riconosciuto, ignota, persa
+    int confusione[TAGLI][TAGLI + 2] = {};
+    int corrette = 0, totale = 0;
+    for (int k = 0; k < fold; k++) {
+        AddestramentoMonete a;
+        addestramentoAzzera(a);
+        for (const Moneta &m : monete) {
+            if (m.fold != k && m.uscite == 1) addestramentoAggiungi(a, m.taglio, m.f);
+        }
+        CalibrazioneMonete cal;
+        addestramentoCalcola(a, CALIB_MIN_MONETE, cal);
+        for (const Moneta &m : monete) {
+            if (m.fold != k) continue;
+            int esito = (m.uscite == 0) ? TAGLI + 1 : classificaMoneta(cal, m.f, nullptr);
+            if (esito == TAGLIO_IGNOTO) esito = TAGLI;
+            confusione[m.taglio][esito]++;
+            if (esito == m.taglio) corrette++;
+            totale++;
+        }
+    }
+
+    // Modello finale su tutte le monete (quello che la calibrazione sulla macchina salverebbe)
+    AddestramentoMonete a;
+    addestramentoAzzera(a);
+    for (const Moneta &m : monete) {
+        if (m.uscite == 1) addestramentoAggiungi(a, m.taglio, m.f);
+    }
+    CalibrazioneMonete cal;
+    addestramentoCalcola(a, CALIB_MIN_MONETE, cal);
+
+    // Tempo di classificazione: solo classificaMoneta(), ripetuta su tutte le monete
+    const int ripetizioni = 2000;
+    uint32_t controllo = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < ripetizioni; r++) {
+        for (const Moneta &m : monete) controllo += classificaMoneta(cal, m.f, nullptr);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() /
+                ((double)ripetizioni * monete.size());
+
+    printf("=== COIN TRAIN: %zu monete, %d fold, debounce %u campioni, soglie %u/%u ===\n", monete.size(), fold,
+           rilevatore.config().minCampioni, rilevatore.config().sogliaScatto, rilevatore.config().sogliaReset);
+    printf("Rilevatore     : %d monete perse, %d spezzate in più impulsi\n", perse, spezzate);
+    printf("Modello        : %-6s %14s %18s %20s %7s\n", "taglio", "durata ms", "Δmax %", "area %·ms", "monete");
+    for (int t = 0; t < TAGLI; t++) {
+        const ModelloTaglio &m = cal.taglio[t];
+        if (!(cal.tagli & (1u << t))) continue;
+        double sd = 16777216.0 / m.inv[0] / 1000, sp = 16777216.0 / m.inv[1] * 100 / LDR_SCALA,
+               sa = 16777216.0 / m.inv[2] * 100 / LDR_SCALA;
+        printf("                 %-6s %7.1f ± %-5.1f %9.1f ± %-5.2f %11.0f ± %-6.0f %5u\n", nomeTaglio(t),
+               m.media[0] / 1000.0, sd, m.media[1] * 100.0 / LDR_SCALA, sp, m.media[2] * 100.0 / LDR_SCALA, sa,
+               m.monete);
+    }
+    printf("Confusione     : (riga = vero, colonna = riconosciuto; %d fold, monete mai viste in addestramento)\n", fold);
+    printf("                 %-6s", "");
+    for (int c = 0; c < TAGLI + 2; c++) printf(" %7s", nomeTaglio(c));
+    printf("\n");
+    for (int t = 0; t < TAGLI; t++) {
+        printf("                 %-6s", nomeTaglio(t));
+        for (int c = 0; c < TAGLI + 2; c++) printf(" %7d", confusione[t][c]);
+        printf("\n");
+    }
+    double accuratezza = totale ? 100.0 * corrette / totale : 0.0;
+    printf("Accuratezza    : %d/%d (%.1f%%), rifiuto oltre %d σ\n", corrette, totale, accuratezza, CALIB_RIFIUTO_SIGMA);
+    printf("Classificazione: %.1f ns/moneta su host (%d tagli x %d caratteristiche, solo interi; controllo %u)\n",
+           ns, TAGLI, MONETA_CARATTERISTICHE, controllo % 10);
+    return accuratezza >= 90.0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    const char *comando = nullptr, *path = nullptr;
+    int perTaglio = 200, fold = 5;
+    uint32_t seed = 11;
+    float velocita = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--monete") && i + 1 < argc) perTaglio = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--velocita") && i + 1 < argc) velocita = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--fold") && i + 1 < argc) fold = atoi(argv[++i]);
+        else if (!comando && (!strcmp(argv[i], "genera") || !strcmp(argv[i], "valuta"))) comando = argv[i];
+        else if (comando && !strcmp(comando, "valuta") && !path) path = argv[i];
+        else {
+            fprintf(stderr, "Uso: %s [genera|valuta FILE] [--monete N] [--seed S] [--velocita V] [--fold K]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (fold < 2) fold = 2;
+
+    std::vector<Traccia> tracce;
+    if (comando && !strcmp(comando, "valuta")) {
+        if (!path || !leggi(path, tracce)) return 2;
+    } else {
+        tracce = sintetiche(perTaglio, seed, velocita);
+    }
+    if (comando && !strcmp(comando, "genera")) {
+        scrivi(tracce, seed, velocita);
+        return 0;
+    }
+    return valuta(tracce, fold);
+}
@@ -0,0 +1,999 @@
+/*
+ * ======================================================================================
+ * HAL HOST - Implementazione simulata (orologio virtuale, sensori, GATT finto)
+ * ======================================================================================
+ */
+
+#include "hal_host.h"
+#include "hal/dht_decoder.h"
+#include "Telemetry.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace hal {
+namespace host {
+
+// ======================================================================================
+// TIMELINE
+// ======================================================================================
+
+struct Event {
+    Action action;
+    Task task;              // != nullptr: task periodico/differito (statistiche)
+    uint32_t period_us;     // 0: one-shot
+    uint64_t due;
+    int id;                 // != 0: annullabile con cancel()
+};
+
+typedef std::multimap<std::pair<uint64_t, uint64_t>, Event> Queue;
+
+static uint64_t g_now = 0;
+static uint64_t g_seq = 0;
+static Queue g_isr;
+static Queue g_tasks;
+static std::map<Task, TaskStats> g_stats;
+static int g_next_id = 0;
+static int g_running_id = 0;            // Task in esecuzione (cancel dall'interno)
+static bool g_running_cancelled = false;
+static uint32_t g_running_period_us = 0; // Periodo del task in esecuzione (thread background)
+static bool g_running_woken = false;     // background_wake() durante l'esecuzione
+static PowerStats g_power = {0, 0};
+static uint64_t g_awake_until = 0;
+static CriticalStats g_critical = {0, 0, 0};
+static int g_critical_depth = 0;
+static uint64_t g_critical_start = 0;
+
+static int g_call_rifiutate = 0;        // Prossime hal::call() rifiutate (call_rifiuta())
+static uint32_t g_call_rifiutate_tot = 0;
+
+void call_rifiuta(int n) { g_call_rifiutate = n; }
+uint32_t call_rifiutate() { return g_call_rifiutate_tot; }
+
+static uint32_t g_wdt_timeout_us = 0;
+static uint64_t g_wdt_last_kick = 0;
+
+static void push(Queue &q, uint64_t t, const Event &ev) {
+    q.insert(std::make_pair(std::make_pair(t, g_seq++), ev));
+}
+
+void at_isr(uint64_t t_us, Action action) {
+    push(g_isr, t_us, Event{action, nullptr, 0, t_us});
+}
+
+void at_task(uint64_t t_us, Action action) {
+    push(g_tasks, t_us, Event{action, nullptr, 0, t_us});
+}
+
+static void checkWatchdog() {
+    if (g_wdt_timeout_us && g_now - g_wdt_last_kick > g_wdt_timeout_us) {
+        outputs().watchdog_resets++;
+        g_wdt_last_kick = g_now;
+    }
+}
+
+static void awake(uint64_t start, uint64_t busy_us) {
+    uint64_t end = start + busy_us;
+    if (start >= g_awake_until) {
+        g_power.wakeups++;
+        g_power.awake_us += busy_us;
+    } else if (end > g_awake_until) {
+        g_power.awake_us += end - g_awake_until;
+    }
+    if (end > g_awake_until) g_awake_until = end;
+}
+
+static void adcAvanza(uint64_t t);
+
+// Avanza l'orologio eseguendo le ISR scadute (usato da wait_us/sleep_ms e dal bus I2C)
+static void advanceIsr(uint64_t t) {
+    while (!g_isr.empty() && g_isr.begin()->first.first <= t) {
+        Event ev = g_isr.begin()->second;
+        g_isr.erase(g_isr.begin());
+        if (ev.due > g_now) g_now = ev.due;
+        adcAvanza(g_now);   // Campioni DMA presi prima che l'ISR cambi il mondo
+        ev.action();
+    }
+    if (t > g_now) g_now = t;
+}
+
+void run_until(uint64_t t_us) {
+    while (true) {
+        bool haveIsr = !g_isr.empty() && g_isr.begin()->first.first <= t_us;
+        bool haveTask = !g_tasks.empty() && g_tasks.begin()->first.first <= t_us;
+        if (!haveIsr && !haveTask) break;
+
+        if (haveIsr && (!haveTask || g_isr.begin()->first <= g_tasks.begin()->first)) {
+            uint64_t t = g_isr.begin()->first.first;
+            advanceIsr(t);
+            awake(t, POWER_ISR_US);
+            continue;
+        }
+
+        Event ev = g_tasks.begin()->second;
+        g_tasks.erase(g_tasks.begin());
+        advanceIsr(ev.due);
+        adcAvanza(g_now);
+        checkWatchdog();
+
+        uint64_t start = g_now;
+        g_running_id = ev.id;
+        g_running_cancelled = false;
+        g_running_period_us = ev.period_us;
+        g_running_woken = false;
+        if (ev.task) ev.task(); else ev.action();
+        g_running_id = 0;
+        ev.period_us = g_running_period_us;
+        awake(start, g_now - start + POWER_TASK_US);
+
+        if (ev.task) {
+            TaskStats &st = g_stats[ev.task];
+            uint64_t busy = g_now - start;
+            st.runs++;
+            st.busy_us += busy;
+            if (busy > st.max_us) st.max_us = busy;
+            if (start - ev.due > st.late_us) st.late_us = start - ev.due;
+            if (ev.period_us && busy >= ev.period_us) st.overruns++;
+        }
+        if (ev.period_us && !g_running_cancelled) {
+            ev.due = g_running_woken ? g_now : ev.due + ev.period_us;
+            push(g_tasks, ev.due, ev);
+        }
+    }
+    advanceIsr(t_us);
+    checkWatchdog();
+}
+
+PowerStats power_stats() { return g_power; }
+
+CriticalStats critical_stats() { return g_critical; }
+
+TaskStats task_stats(Task task) {
+    std::map<Task, TaskStats>::iterator it = g_stats.find(task);
+    if (it == g_stats.end()) return TaskStats{0, 0, 0, 0, 0};
+    return it->second;
+}
+
+// ======================================================================================
+// MONDO FISICO
+// ======================================================================================
+
+World &world() {
+    static World w = {150.0f, 0.40f, 22, 45, true, false};
+    return w;
+}
+
+void coin_pulse(uint64_t t_us, uint64_t width_us, float peak) {
+    std::shared_ptr<float> base(new float(0.0f));
+    at_isr(t_us, [peak, base]() {
+        *base = world().ldr;
+        world().ldr = peak;
+    });
+    at_isr(t_us + width_us, [base]() { world().ldr = *base; });
+}
+
+static std::function<float(uint64_t)> g_ldrWaveform;
+
+void ldr_waveform(std::function<float(uint64_t t_us)> f) { g_ldrWaveform = f; }
+
+static float ldrLivello(uint64_t t_us) {
+    float v = g_ldrWaveform ? g_ldrWaveform(t_us) : world().ldr;
+    return (v < 0.0f) ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+Outputs &outputs() {
+    static Outputs o = {0.0f, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    return o;
+}
+
+I2CStats &i2c_stats() {
+    static I2CStats s = {0, 0, 0};
+    return s;
+}
+
+UartStats &uart_stats() {
+    static UartStats s = {0, 0, 0, 0, 0};
+    return s;
+}
+
+// ======================================================================================
+// UART (FIFO TX a 9600 baud + decoder telemetria)
+// ======================================================================================
+
+static const uint64_t UART_BYTE_NS = 10ull * 1000000000ull / UART_BAUD;  // 8N1: 10 bit
+static uint64_t g_uart_busy_ns = 0;     // Fine trasmissione dell'ultimo byte in FIFO
+static FILE *g_capture = nullptr;
+
+void serial_capture(FILE *f) { g_capture = f; }
+
+static void uartDecode(uint8_t byte) {
+    static TelemetriaDecoder decoder;
+    UartStats &s = uart_stats();
+    switch (decoder.feed(byte)) {
+        case TelemetriaDecoder::RECORD: {
+            char riga[TLM_MAX_TESTO];
+            int n = telemetriaTesto(decoder.tipo, decoder.args, decoder.nArgs, riga, sizeof(riga));
+            fwrite(riga, 1, n, stdout);
+            s.text_bytes += n;
+            s.records++;
+            break;
+        }
+        case TelemetriaDecoder::TESTO:
+            fputc(decoder.testo, stdout);
+            s.text_bytes++;
+            break;
+        case TelemetriaDecoder::CRC_ERRATO:
+            s.crc_errors++;
+            break;
+        default:
+            break;
+    }
+}
+
+static int uartWrite(const uint8_t *data, int len) {
+    uint64_t now_ns = g_now * 1000;
+    if (g_uart_busy_ns < now_ns) g_uart_busy_ns = now_ns;
+    uint64_t inFifo = (g_uart_busy_ns - now_ns + UART_BYTE_NS - 1) / UART_BYTE_NS;
+    int liberi = (inFifo >= UART_FIFO) ? 0 : (int)(UART_FIFO - inFifo);
+    int n = (len < liberi) ? len : liberi;
+
+    g_uart_busy_ns += n * UART_BYTE_NS;
+    uart_stats().bytes += n;
+    if (n < len) uart_stats().full++;
+    if (g_capture && n > 0) fwrite(data, 1, n, g_capture);
+    for (int i = 0; i < n; i++) uartDecode(data[i]);
+    return n;
+}
+
+GattStats &gatt_stats() {
+    static GattStats s;
+    static bool init = false;
+    if (!init) { memset(&s, 0, sizeof(s)); init = true; }
+    return s;
+}
+
+// ======================================================================================
+// EMULAZIONE HD44780 (decodifica stream PCF8574)
+// ======================================================================================
+// Bit PCF8574: P0=RS, P1=RW, P2=EN, P3=backlight, P4-P7=D4-D7.
+// Ogni fronte di discesa di EN campiona un nibble.
+
+class Hd44780Model {
+public:
+    Hd44780Model() : _last(0), _fourBit(false), _havePending(false), _pending(0),
+                     _addr(0), _backlight(false) {
+        memset(_ddram, ' ', sizeof(_ddram));
+    }
+
+    void expander(uint8_t v) {
+        _backlight = (v & 0x08) != 0;
+        if ((_last & 0x04) && !(v & 0x04)) nibble(_last & 0xF0, _last & 0x01);
+        _last = v;
+    }
+
+    std::string line(int row) const {
+        return std::string((const char *)&_ddram[row ? 0x40 : 0x00], 16);
+    }
+    bool backlight() const { return _backlight; }
+
+private:
+    uint8_t _last;
+    bool _fourBit;
+    bool _havePending;
+    uint8_t _pending;
+    uint8_t _addr;
+    bool _backlight;
+    uint8_t _ddram[0x80];
+
+    void nibble(uint8_t hi, int rs) {
+        if (!_fourBit) {
+            if (!rs && (hi & 0xF0) == 0x20) _fourBit = true;  // Function set 4-bit
+            return;
+        }
+        if (!_havePending) { _pending = hi; _havePending = true; return; }
+        _havePending = false;
+        uint8_t value = _pending | (hi >> 4);
+        if (rs) {
+            _ddram[_addr & 0x7F] = value;
+            _addr = (_addr + 1) & 0x7F;
+        } else if (value & 0x80) {
+            _addr = value & 0x7F;
+        } else if (value == 0x01) {
+            memset(_ddram, ' ', sizeof(_ddram));
+            _addr = 0;
+        } else if (value == 0x02) {
+            _addr = 0;
+        }
+    }
+};
+
+static Hd44780Model &lcdModel() {
+    static Hd44780Model model;
+    return model;
+}
+
+std::string lcd_line(int row) { return lcdModel().line(row); }
+bool lcd_backlight() { return lcdModel().backlight(); }
+
+// ======================================================================================
+// PERIFERICHE SIMULATE
+// ======================================================================================
+
+class SimDigitalOut : public DigitalOut {
+public:
+    SimDigitalOut(int *mirror = nullptr) : _value(0), _mirror(mirror), onWrite(nullptr) {}
+    void write(int value) override {
+        int old = _value;
+        _value = value ? 1 : 0;
+        if (_mirror) *_mirror = _value;
+        if (onWrite) onWrite(old, _value);
+    }
+    int read() const override { return _value; }
+private:
+    int _value;
+    int *_mirror;
+public:
+    void (*onWrite)(int oldValue, int newValue);
+};
+
+class SimAnalogIn : public AnalogIn {
+public:
+    float read() override { return ldrLivello(g_now); }
+};
+
+/**
+ * @brief TIM → ADC → DMA simulato: nessun evento per campione (il DMA non sveglia la
+ * CPU), i campioni fino all'istante corrente sono presi prima di ogni ISR/task
+ * (adcAvanza), un'ISR per metà buffer come half/complete transfer.
+ */
+class SimAdcStream : public AdcStream {
+public:
+    SimAdcStream() : _buf(nullptr), _len(0), _pos(0), _periodo(0), _prossimo(0),
+                     _blocco(nullptr), _gen(0), _attivo(false) {}
+
+    bool start(uint32_t rate_hz, uint16_t *buf, int len, AdcBlocco blocco) override {
+        if (len < 2 || (len & 1) || rate_hz == 0) return false;
+        stop();
+        _buf = buf;
+        _len = len;
+        _pos = 0;
+        _blocco = blocco;
+        _periodo = 1000000 / rate_hz;
+        _prossimo = g_now + _periodo;      // Primo fronte TRGO un periodo dopo l'avvio
+        _attivo = true;
+        armaMeta();
+        return true;
+    }
+
+    void stop() override {
+        _attivo = false;
+        ++_gen;
+    }
+
+    void avanza(uint64_t t) {
+        while (_attivo && _prossimo <= t) {
+            _buf[_pos] = (uint16_t)(ldrLivello(_prossimo) * 65535.0f + 0.5f);
+            _pos = (_pos + 1) % _len;
+            _prossimo += _periodo;
+        }
+    }
+
+private:
+    uint16_t *_buf;
+    int _len;
+    int _pos;
+    uint32_t _periodo;
+    uint64_t _prossimo;     // Istante del prossimo campione
+    AdcBlocco _blocco;
+    uint32_t _gen;
+    bool _attivo;
+
+    // Interrupt all'ultimo campione della metà in corso
+    void armaMeta() {
+        int meta = _len / 2;
+        uint64_t t = _prossimo + (uint64_t)(meta - 1 - _pos % meta) * _periodo;
+        uint32_t gen = _gen;
+        at_isr(t, [this, gen]() {
+            if (gen != _gen) return;
+            avanza(g_now);
+            const uint16_t *campioni = (_pos == _len / 2) ? _buf : _buf + _len / 2;
+            armaMeta();
+            if (_blocco) _blocco(campioni, _len / 2);
+        });
+    }
+};
+
+static SimAdcStream &adcStream() {
+    static SimAdcStream stream;
+    return stream;
+}
+
+static void adcAvanza(uint64_t t) {
+    adcStream().avanza(t);
+}
+
+/**
+ * @brief Settori dati della F401RE (2 x 128KB) in RAM con semantica NOR e tempi da datasheet:
+ * erase e program avanzano l'orologio come wait_us (CPU ferma sul bus flash)
+ */
+class SimFlash : public Flash {
+public:
+    SimFlash() : _dati(FLASH_SIM_SETTORI * FLASH_SIM_SETTORE, 0xFF), _taglio(UINT32_MAX) {}
+
+    uint32_t size() override { return _dati.size(); }
+    uint32_t eraseSize() override { return FLASH_SIM_SETTORE; }
+
+    bool read(uint32_t addr, void *buf, uint32_t len) override {
+        if (!dentro(addr, len)) return false;
+        memcpy(buf, &_dati[addr], len);
+        flash_stats().read_bytes += len;
+        return true;
+    }
+    bool program(uint32_t addr, const void *data, uint32_t len) override {
+        if (!dentro(addr, len)) return false;
+        bool completo = _taglio >= len;
+        if (!completo) len = _taglio;
+        _taglio = UINT32_MAX;
+        const uint8_t *p = (const uint8_t *)data;
+        for (uint32_t i = 0; i < len; i++) {
+            if (p[i] & ~_dati[addr + i]) flash_stats().violations++;    // 0 → 1 senza erase
+            _dati[addr + i] &= p[i];
+        }
+        flash_stats().programmed += len;
+        occupa(((uint64_t)len + 3) / 4 * FLASH_SIM_WORD_US);
+        return completo;
+    }
+    bool erase(uint32_t addr, uint32_t len) override {
+        if (!dentro(addr, len) || addr % FLASH_SIM_SETTORE || len % FLASH_SIM_SETTORE) return false;
+        memset(&_dati[addr], 0xFF, len);
+        flash_stats().erases++;
+        occupa(FLASH_SIM_ERASE_US);
+        return true;
+    }
+
+    void taglia(uint32_t byte) { _taglio = byte; }
+
+private:
+    std::vector<uint8_t> _dati;
+    uint32_t _taglio;       // Byte scritti dal prossimo program() (UINT32_MAX: tutti)
+
+    bool dentro(uint32_t addr, uint32_t len) { return addr <= _dati.size() && len <= _dati.size() - addr; }
+    void occupa(uint64_t us) {
+        flash_stats().busy_us += us;
+        advanceIsr(g_now + us);
+    }
+};
+
+FlashStats &flash_stats() {
+    static FlashStats s;
+    return s;
+}
+
+static SimFlash &simFlash() {
+    static SimFlash flash;
+    return flash;
+}
+
+void flash_cut(uint32_t byte) {
+    simFlash().taglia(byte);
+}
+
+class SimPwmOut : public PwmOut {
+public:
+    SimPwmOut() : _periodUs(20000) {}
+    void period_ms(int ms) override { _periodUs = ms * 1000; }
+    void write(float duty) override { pulsewidth_us((int)(duty * _periodUs + 0.5f)); }
+    void pulsewidth_us(int us) override {
+        Outputs &o = outputs();
+        int salto = abs(us - o.servo_us);
+        if (o.servo_writes && salto > o.servo_salto_us) o.servo_salto_us = salto;
+        o.servo_us = us;
+        o.servo_duty = (float)us / _periodUs;
+        o.servo_writes++;
+    }
+private:
+    int _periodUs;
+};
+
+class SimEdgeIn : public EdgeIn {
+public:
+    SimEdgeIn(int livello = 0) : riseIsr(nullptr), fallIsr(nullptr), level(livello) {}
+    void rise(Isr isr) override { riseIsr = isr; }
+    void fall(Isr isr) override { fallIsr = isr; }
+    int read() override { return level; }
+    // Nuovo livello e ISR del fronte, in contesto ISR simulato
+    void edge(int livello) {
+        level = livello;
+        Isr isr = livello ? riseIsr : fallIsr;
+        if (isr) isr();
+    }
+    Isr riseIsr;
+    Isr fallIsr;
+    int level;
+};
+
+class SimTimeout : public Timeout {
+public:
+    SimTimeout() : _generation(0) {}
+    void attach_us(Isr isr, uint32_t delay_us) override {
+        uint32_t gen = ++_generation;
+        at_isr(g_now + delay_us, [this, gen, isr]() { if (gen == _generation) isr(); });
+    }
+    void detach() override { ++_generation; }
+private:
+    uint32_t _generation;
+};
+
+class SimI2C : public I2CBus {
+public:
+    SimI2C() : _hz(100000), _busyUntil(0) {}
+    void frequency(int hz) override { _hz = hz; }
+    int write(int address, const char *data, int length) override {
+        uint64_t end = account(length);
+        for (int i = 0; i < length; i++) lcdModel().expander((uint8_t)data[i]);
+        advanceIsr(end);  // I2C::write è bloccante
+        (void)address;
+        return 0;
+    }
+    int write_async(int address, const char *data, int length, Isr done) override {
+        uint64_t end = account(length);
+        // Il display vede i byte a fine trasferimento, il chiamante prosegue subito
+        std::shared_ptr<std::vector<uint8_t> > bytes(
+            new std::vector<uint8_t>(data, data + length));
+        at_isr(end, [bytes, done]() {
+            for (size_t i = 0; i < bytes->size(); i++) lcdModel().expander((*bytes)[i]);
+            if (done) done();
+        });
+        (void)address;
+        return 0;
+    }
+private:
+    int _hz;
+    uint64_t _busyUntil;    // Fine dell'ultimo trasferimento accodato sul bus
+
+    // Statistiche e istante di fine trasferimento (il bus serializza le transazioni)
+    uint64_t account(int length) {
+        I2CStats &st = i2c_stats();
+        st.transactions++;
+        st.bytes += length + 1;
+        // START + (indirizzo + dati) * 9 bit (ACK incluso) + STOP
+        uint64_t bits = 2 + 9 * (uint64_t)(length + 1);
+        uint64_t us = (bits * 1000000 + _hz - 1) / _hz;
+        st.bus_us += us;
+        _busyUntil = (_busyUntil > g_now ? _busyUntil : g_now) + us;
+        return _busyUntil;
+    }
+};
+
+std::vector<DhtEdge> dht_trace(const uint8_t frame[5], uint64_t t0_us, uint32_t jitter_us, uint32_t &seed) {
+    std::vector<DhtEdge> edges;
+    uint64_t t = t0_us;
+    edges.reserve(2 * DHT_BITS + 6);
+
+    DhtEdge e;
+    e.level = 1; e.t_us = t;              // Rilascio: pull-up porta la linea alta
+    edges.push_back(e);
+    t += 30;  e.level = 0; e.t_us = t;    // Risposta: basso 80μs
+    edges.push_back(e);
+    t += 80;  e.level = 1; e.t_us = t;    // Preambolo: alto 80μs
+    edges.push_back(e);
+    t += 80;  e.level = 0; e.t_us = t;
+    edges.push_back(e);
+    for (int i = 0; i < DHT_BITS; i++) {
+        bool uno = frame[i / 8] & (1 << (7 - (i % 8)));
+        t += 50;            e.level = 1; e.t_us = t;
+        edges.push_back(e);
+        t += uno ? 70 : 27; e.level = 0; e.t_us = t;
+        edges.push_back(e);
+    }
+    t += 50;  e.level = 1; e.t_us = t;    // Fine frame: linea rilasciata
+    edges.push_back(e);
+
+    if (jitter_us) {
+        for (size_t i = 0; i < edges.size(); i++) {
+            seed = seed * 1103515245u + 12345u;
+            edges[i].t_us += (seed >> 16) % (jitter_us + 1);
+        }
+    }
+    return edges;
+}
+
+// Frame generato dal mondo simulato e decodificato dai fronti come sul target: i fronti
+// della traccia scattano come ISR di un EdgeIn alla loro ora sulla timeline, mentre il
+// thread DHT attende DHT_FRAME_MS (lo start da 18ms è un'attesa del thread: non simulato).
+// Sul target il thread cede la CPU; qui la coda eventi aspetta la fine del frame.
+// Le sezioni critiche prese dalle ISR dei fronti (decoder compreso) sono misurate.
+static SimEdgeIn &dhtPin() {
+    static SimEdgeIn pin(1);
+    return pin;
+}
+
+class SimDht : public DhtSensor {
+public:
+    SimDht() : _seed(1), _attivo(false) {
+        _istanza = this;
+        dhtPin().rise(onRise);
+        dhtPin().fall(onFall);
+    }
+
+    bool read(uint8_t frame[5]) override {
+        outputs().dht_reads++;
+        _irqOff = 0;
+        _decoder.reset();
+        if (world().dht_ok) {
+            uint8_t tx[5];
+            tx[0] = (uint8_t)world().hum_pct;
+            tx[1] = 0;
+            tx[2] = (uint8_t)world().temp_c;
+            tx[3] = 0;
+            tx[4] = (uint8_t)(tx[0] + tx[1] + tx[2] + tx[3]);
+            std::vector<DhtEdge> edges = dht_trace(tx, g_now, DHT_JITTER_US, _seed);
+            for (size_t i = 0; i < edges.size(); i++) {
+                int livello = edges[i].level;
+                at_isr(edges[i].t_us, [livello]() { dhtPin().edge(livello); });
+            }
+        }
+        _attivo = true;
+        sleep_ms(DHT_FRAME_MS);
+        _attivo = false;
+
+        bool ok = _decoder.result(frame);
+        if (!ok) outputs().dht_errors++;
+        outputs().dht_irq_off_us += _irqOff;
+        if (_irqOff > outputs().dht_irq_off_max_us) outputs().dht_irq_off_max_us = _irqOff;
+        return ok;
+    }
+
+private:
+    static SimDht *_istanza;
+    DhtDecoder _decoder;
+    uint32_t _seed;
+    bool _attivo;           // Fronti abilitati (enable_irq()/disable_irq() sul target)
+    uint64_t _irqOff;       // Tempo in sezione critica dalle ISR di questa lettura
+
+    static void onRise() { _istanza->fronte(1); }
+    static void onFall() { _istanza->fronte(0); }
+
+    void fronte(int livello) {
+        if (!_attivo) return;
+        CriticalStats prima = critical_stats();
+        outputs().dht_edges++;
+        _decoder.edge(livello, now_us());
+        CriticalStats dopo = critical_stats();
+        outputs().dht_irq_sezioni += dopo.sections - prima.sections;
+        _irqOff += dopo.total_us - prima.total_us;
+    }
+};
+
+SimDht *SimDht::_istanza = nullptr;
+
+// --- HC-SR04: il fronte di discesa del trigger genera l'eco dopo ~450μs ---
+
+static SimEdgeIn &echoPin() {
+    static SimEdgeIn pin;
+    return pin;
+}
+
+static void trigWritten(int oldValue, int newValue) {
+    if (!(oldValue == 1 && newValue == 0)) return;
+    outputs().trig_pulses++;
+    float d = world().distance_cm;
+    if (d <= 0) return;
+    // Velocità del suono alla temperatura dell'aria (la stessa vista dal DHT11)
+    double cmUs = 0.03313 * sqrt(1.0 + world().temp_c / 273.15);
+    uint64_t width = (uint64_t)(d * 2.0 / cmUs);
+    if (width > 38000) width = 38000;  // Nessun ostacolo: impulso massimo HC-SR04
+    uint64_t rise = g_now + 450;
+    at_isr(rise, []() { outputs().echo_edges++; echoPin().edge(1); });
+    at_isr(rise + width, []() { outputs().echo_edges++; echoPin().edge(0); });
+}
+
+// --- Pulsante annulla: attivo basso, fronti dalla traccia di button_edge() ---
+
+static SimEdgeIn &tastoPin() {
+    static SimEdgeIn pin(1);
+    return pin;
+}
+
+void button_edge(uint64_t t_us, bool pressed) {
+    at_isr(t_us, [pressed]() {
+        world().button_pressed = pressed;
+        tastoPin().edge(pressed ? 0 : 1);
+    });
+}
+
+// ======================================================================================
+// GATT FINTO
+// ======================================================================================
+
+static void receiveResults(const void *data, uint16_t len);
+
+class FakeBleLink : public BleLink {
+public:
+    FakeBleLink() : listener(nullptr), connected(false), connected_since(0) {
+        for (int i = 0; i < BLE_CHAR_COUNT; i++) subscribed[i] = false;
+    }
+
+    void begin(BleListener &l) override {
+        listener = &l;
+        BleListener *lp = listener;
+        at_task(g_now, [lp]() { lp->onReady(); });  // init asincrono come BLE::init()
+    }
+
+    void write(BleCharId id, const void *data, uint16_t len) override {
+        GattStats &st = gatt_stats();
+        if (len > sizeof(st.value[id])) len = sizeof(st.value[id]);
+        memcpy(st.value[id], data, len);
+        st.length[id] = len;
+        st.writes[id]++;
+        if (connected && subscribed[id]) {
+            st.notifications[id]++;
+            st.air_bytes[id] += len + BLE_OVERHEAD_ARIA;
+            if (id == BLE_CHAR_RESULT) receiveResults(data, len);
+        }
+    }
+
+    void startAdvertising() override {}
+
+    BleListener *listener;
+    bool connected;
+    uint64_t connected_since;
+    bool subscribed[BLE_CHAR_COUNT];    // CCCD (azzerati alla disconnessione)
+};
+
+static FakeBleLink &bleLink() {
+    static FakeBleLink link;
+    return link;
+}
+
+// Esegue una callback del listener misurando quanto tiene occupata la coda eventi
+static void listenerCall(const Action &call) {
+    uint64_t start = g_now;
+    call();
+    GattStats &st = gatt_stats();
+    st.callbacks++;
+    if (g_now - start > st.callback_max_us) st.callback_max_us = g_now - start;
+}
+
+void ble_connect(uint64_t t_us) {
+    at_task(t_us, []() {
+        if (bleLink().connected || !bleLink().listener) return;
+        bleLink().connected = true;
+        bleLink().connected_since = g_now;
+        listenerCall([]() { bleLink().listener->onConnect(); });
+    });
+}
+
+void ble_disconnect(uint64_t t_us) {
+    at_task(t_us, []() {
+        if (!bleLink().connected || !bleLink().listener) return;
+        bleLink().connected = false;
+        gatt_stats().connected_us += g_now - bleLink().connected_since;
+        for (int i = 0; i < BLE_CHAR_COUNT; i++) bleLink().subscribed[i] = false;
+        listenerCall([]() { bleLink().listener->onDisconnect(); });
+    });
+}
+
+void ble_command(uint64_t t_us, const uint8_t *data, uint16_t len) {
+    std::vector<uint8_t> bytes(data, data + len);
+    at_task(t_us, [bytes]() {
+        if (bleLink().connected && bleLink().listener) {
+            listenerCall([&bytes]() {
+                bleLink().listener->onCommand(bytes.data(), (uint16_t)bytes.size());
+            });
+        }
+    });
+}
+
+void ble_command(uint64_t t_us, uint8_t cmd) { ble_command(t_us, &cmd, 1); }
+
+CmdStats &cmd_stats() {
+    static CmdStats s = []() {
+        CmdStats c;
+        memset(&c, 0, sizeof(c));
+        for (int i = 0; i < 256; i++) c.esito[i] = -1;
+        return c;
+    }();
+    return s;
+}
+
+static uint64_t g_request_us[256];     // Istante di invio per sequenza
+
+void ble_request(uint64_t t_us, const uint8_t *data, uint16_t len, int acks) {
+    std::vector<uint8_t> bytes(data, data + len);
+    uint64_t evento = (t_us + BLE_CONN_INTERVAL_US - 1) / BLE_CONN_INTERVAL_US * BLE_CONN_INTERVAL_US;
+    at_task(evento, [t_us, bytes, acks]() {
+        if (!bleLink().connected || !bleLink().listener) return;
+        for (int i = 0; i < acks; i++) g_request_us[(uint8_t)(bytes[1] + i)] = t_us;
+        cmd_stats().sent++;
+        listenerCall([&bytes]() {
+            bleLink().listener->onCommand(bytes.data(), (uint16_t)bytes.size());
+        });
+    });
+}
+
+void ble_request(uint64_t t_us, uint8_t cmd, uint8_t seq) {
+    uint8_t bytes[2] = {cmd, seq};
+    ble_request(t_us, bytes, 2, 1);
+}
+
+// Notifica RESULT: ricevuta dal client al prossimo evento di connessione
+static void receiveResults(const void *data, uint16_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t arrivo = (g_now / BLE_CONN_INTERVAL_US + 1) * BLE_CONN_INTERVAL_US;
+    CmdStats &st = cmd_stats();
+    for (uint16_t i = 0; i + 3 <= len; i += 3) {
+        uint8_t seq = p[i];
+        if (st.esito[seq] >= 0) {
+            st.duplicates++;
+            continue;
+        }
+        uint64_t rtt = arrivo - g_request_us[seq];
+        st.esito[seq] = p[i + 2];
+        st.rtt_us[seq] = rtt;
+        st.acked++;
+        st.rtt_sum_us += rtt;
+        if (rtt > st.rtt_max_us) st.rtt_max_us = rtt;
+    }
+}
+
+void ble_subscribe(uint64_t t_us, BleCharId id, bool enabled) {
+    at_task(t_us, [id, enabled]() {
+        if (!bleLink().connected || !bleLink().listener || bleLink().subscribed[id] == enabled) return;
+        bleLink().subscribed[id] = enabled;
+        listenerCall([id, enabled]() { bleLink().listener->onSubscription(id, enabled); });
+    });
+}
+
+bool ble_connected() { return bleLink().connected; }
+
+} // namespace host
+
+// ======================================================================================
+// API HAL
+// ======================================================================================
+
+uint64_t now_us() { return host::g_now; }
+void wait_us(uint32_t us) { host::advanceIsr(host::g_now + us); }
+void sleep_ms(uint32_t ms) { host::advanceIsr(host::g_now + (uint64_t)ms * 1000); }
+
+int call_every_ms(uint32_t period_ms, Task task) {
+    uint32_t period = period_ms * 1000;
+    int id = ++host::g_next_id;
+    host::push(host::g_tasks, host::g_now + period,
+               host::Event{nullptr, task, period, host::g_now + period, id});
+    return id;
+}
+
+int call_in_ms(uint32_t delay_ms, Task task) {
+    uint64_t due = host::g_now + (uint64_t)delay_ms * 1000;
+    int id = ++host::g_next_id;
+    host::push(host::g_tasks, due, host::Event{nullptr, task, 0, due, id});
+    return id;
+}
+
+void cancel(int id) {
+    if (id == 0) return;
+    if (id == host::g_running_id) host::g_running_cancelled = true;
+    for (host::Queue::iterator it = host::g_tasks.begin(); it != host::g_tasks.end(); ++it) {
+        if (it->second.id == id) {
+            host::g_tasks.erase(it);
+            return;
+        }
+    }
+}
+
+int call(Task task) {
+    if (host::g_call_rifiutate > 0) {
+        host::g_call_rifiutate--;
+        host::g_call_rifiutate_tot++;
+        return 0;               // Pool eventi esaurito (EventQueue::call() sul target)
+    }
+    int id = ++host::g_next_id;
+    host::push(host::g_tasks, host::g_now, host::Event{nullptr, task, 0, host::g_now, id});
+    return id;
+}
+
+int start_background(Task body, uint32_t period_ms) {
+    // Thread bassa priorità: prima esecuzione immediata, poi ogni period_ms
+    int id = ++host::g_next_id;
+    host::push(host::g_tasks, host::g_now,
+               host::Event{nullptr, body, period_ms * 1000, host::g_now, id});
+    return id;
+}
+
+void background_period_ms(int id, uint32_t period_ms) {
+    // Come sul target: la nuova cadenza vale dalla prossima attesa del thread
+    uint32_t period = period_ms * 1000;
+    if (id == host::g_running_id) {
+        host::g_running_period_us = period;
+        return;
+    }
+    for (host::Queue::iterator it = host::g_tasks.begin(); it != host::g_tasks.end(); ++it) {
+        if (it->second.id == id) {
+            it->second.period_us = period;
+            return;
+        }
+    }
+}
+
+void background_wake(int id) {
+    // Come il thread flag sul target: sveglia subito, o appena finito il body in corso
+    if (id == host::g_running_id) {
+        host::g_running_woken = true;
+        return;
+    }
+    for (host::Queue::iterator it = host::g_tasks.begin(); it != host::g_tasks.end(); ++it) {
+        if (it->second.id == id) {
+            host::Event ev = it->second;
+            if (ev.due <= host::g_now) return;
+            host::g_tasks.erase(it);
+            ev.due = host::g_now;
+            host::push(host::g_tasks, ev.due, ev);
+            return;
+        }
+    }
+}
+
+void dispatch_forever() {
+    while (true) host::run_until(host::g_now + 1000000);
+}
+
+void watchdog_start(uint32_t timeout_ms) {
+    host::g_wdt_timeout_us = timeout_ms * 1000;
+    host::g_wdt_last_kick = host::g_now;
+}
+
+void watchdog_kick() { host::g_wdt_last_kick = host::g_now; }
+
+int serial_write(const uint8_t *data, int len) { return host::uartWrite(data, len); }
+
+// Il simulatore è single-thread (ISR e task sulla stessa timeline): il mutex protegge
+// solo eventuali thread reali del banco di prova. Il tempo virtuale trascorso dentro
+// la sezione più esterna è il tempo con interrupt disabilitati sul target.
+static std::recursive_mutex &criticalMutex() {
+    static std::recursive_mutex m;
+    return m;
+}
+
+void critical_enter() {
+    criticalMutex().lock();
+    if (host::g_critical_depth++ == 0) host::g_critical_start = host::g_now;
+}
+
+void critical_exit() {
+    if (--host::g_critical_depth == 0) {
+        uint64_t durata = host::g_now - host::g_critical_start;
+        host::g_critical.sections++;
+        host::g_critical.total_us += durata;
+        if (durata > host::g_critical.max_us) host::g_critical.max_us = durata;
+    }
+    criticalMutex().unlock();
+}
+
+Board &board() {
+    static host::SimI2C i2c;
+    static host::SimDigitalOut trig;
+    static host::SimTimeout sonarTimeout;
+    static host::SimTimeout tastoTimeout;
+    static host::SimDht dht;
+    static host::SimPwmOut servo;
+    static host::SimTimeout servoTimeout;
+    static host::SimAnalogIn ldr;
+    static host::SimDigitalOut buzzer(&host::outputs().buzzer);
+    static host::SimDigitalOut ledR(&host::outputs().led_r);
+    static host::SimDigitalOut ledG(&host::outputs().led_g);
+    static host::SimDigitalOut ledB(&host::outputs().led_b);
+    trig.onWrite = host::trigWritten;
+
+    static Board b = {i2c, trig, host::echoPin(), sonarTimeout, dht, servo, servoTimeout, ldr, host::adcStream(),
+                      buzzer, host::tastoPin(), tastoTimeout, ledR, ledG, ledB, host::bleLink(), host::simFlash()};
+    return b;
+}
+
+} // namespace hal
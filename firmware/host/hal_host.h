@@ -0,0 +1,225 @@
+#ifndef VENDING_HAL_HOST_H
+#define VENDING_HAL_HOST_H
+
+/*
+ * ======================================================================================
+ * HAL HOST - Simulatore Linux del distributore
+ * ======================================================================================
+ * Implementa hal.h su un orologio virtuale: wait_us/sleep_ms avanzano il tempo
+ * simulato invece di bloccare, quindi il tick updateMachine() gira a migliaia di
+ * cicli al secondo su workstation mantenendo i tempi "veri" del target.
+ *
+ * Due classi di eventi sulla timeline:
+ * - ISR: fronti sonar, variazioni del mondo fisico. Scattano anche durante wait_us.
+ * - Task: coda eventi (call_every, call, thread background, eventi BLE).
+ *         Scattano solo nel loop run_until(), come sulla EventQueue del target.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "hal/hal.h"
+
+namespace hal {
+namespace host {
+
+typedef std::function<void()> Action;
+
+// ======================================================================================
+// TIMELINE
+// ======================================================================================
+
+void at_isr(uint64_t t_us, Action action);   // Evento asincrono (interrupt / mondo fisico)
+void at_task(uint64_t t_us, Action action);  // Evento sulla coda eventi
+void run_until(uint64_t t_us);               // Esegue la simulazione fino a t_us
+void call_rifiuta(int n);                    // Le prossime n hal::call() trovano la coda piena (ritornano 0)
+uint32_t call_rifiutate();                   // hal::call() rifiutate finora
+
+struct TaskStats {
+    uint64_t runs;
+    uint64_t busy_us;       // Tempo virtuale totale speso nel task
+    uint64_t max_us;        // Durata massima di una singola esecuzione
+    uint64_t late_us;       // Ritardo massimo rispetto alla scadenza
+    uint64_t overruns;      // Esecuzioni più lunghe del periodo (tick fuori budget)
+};
+TaskStats task_stats(Task task);
+
+// Modello di consumo: la CPU è sveglia per ogni task (durata virtuale + costo fisso di
+// risveglio/dispatch) e per ogni gruppo di ISR simultanee. Intervalli sovrapposti
+// contano una volta sola; il resto del tempo è sleep.
+#define POWER_TASK_US   100     // Risveglio + dispatch + corpo tipico di un task
+#define POWER_ISR_US    10      // Ingresso/uscita ISR fuori da un task
+
+struct PowerStats {
+    uint64_t wakeups;       // Uscite dallo sleep
+    uint64_t awake_us;      // Tempo CPU sveglia
+};
+PowerStats power_stats();
+
+// Sezioni critiche (interrupt disabilitati sul target): tempo virtuale tra il
+// critical_enter() e il critical_exit() più esterni
+struct CriticalStats {
+    uint64_t sections;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+CriticalStats critical_stats();
+
+// ======================================================================================
+// MONDO FISICO SIMULATO
+// ======================================================================================
+
+struct World {
+    float distance_cm;      // Oggetto davanti al sonar (<= 0: nessun eco)
+    float ldr;              // Lettura LDR normalizzata 0.0-1.0
+    int temp_c;             // DHT11
+    int hum_pct;
+    bool dht_ok;            // false: il DHT non risponde
+    bool button_pressed;    // Tasto annulla PC_13 (attivo basso)
+};
+World &world();
+
+// Impulso LDR di durata width_us con livello peak (moneta che attraversa il sensore)
+void coin_pulse(uint64_t t_us, uint64_t width_us, float peak);
+
+// Fronte del tasto annulla all'istante t_us (pressed: livello basso); un rimbalzo è una
+// sequenza di fronti ravvicinati
+void button_edge(uint64_t t_us, bool pressed);
+
+// Segnale LDR continuo nel tempo (es. risposta del sensore + rumore): sostituisce
+// world().ldr per AnalogIn e per i campioni DMA finché impostato (nullptr = nessuno)
+void ldr_waveform(std::function<float(uint64_t t_us)> f);
+
+// ======================================================================================
+// DHT11: TRACCE DEI FRONTI
+// ======================================================================================
+
+struct DhtEdge {
+    int level;              // Livello dopo il fronte
+    uint64_t t_us;          // Istante visto dalla ISR
+};
+
+// Fronti del frame dal rilascio della linea (t = t0_us) con tempi da datasheet DHT11;
+// ogni fronte è ritardato di 0..jitter_us (latenza ISR) con generatore deterministico.
+#define DHT_JITTER_US 5     // Latenza ISR tipica sul target con BLE attivo
+
+std::vector<DhtEdge> dht_trace(const uint8_t frame[5], uint64_t t0_us, uint32_t jitter_us, uint32_t &seed);
+
+// ======================================================================================
+// ATTUATORI E BUS
+// ======================================================================================
+
+struct Outputs {
+    float servo_duty;
+    int servo_us;             // Impulso del servo (μs)
+    int servo_salto_us;       // Salto massimo tra due scritture (rampe: piccolo)
+    uint32_t servo_writes;
+    int buzzer;
+    int led_r, led_g, led_b;
+    uint32_t trig_pulses;
+    uint32_t echo_edges;
+    uint32_t watchdog_resets; // Kick mancati oltre il timeout
+    uint32_t dht_reads;
+    uint32_t dht_errors;      // Frame non decodificato (fronti mancanti/fuori range)
+    uint32_t dht_edges;       // Fronti consegnati in ISR al decoder
+    uint32_t dht_irq_sezioni; // Sezioni critiche prese dalle ISR dei fronti (decoder compreso)
+    uint64_t dht_irq_off_us;  // Tempo in quelle sezioni, totale
+    uint64_t dht_irq_off_max_us;  // ... massimo per lettura
+};
+Outputs &outputs();
+
+struct I2CStats {
+    uint64_t transactions;
+    uint64_t bytes;         // Byte sul bus, indirizzo incluso
+    uint64_t bus_us;        // Tempo di bus alla frequenza configurata
+};
+I2CStats &i2c_stats();
+
+// UART USB a 9600 baud con FIFO TX del driver (BufferedSerial, 256 byte): i byte
+// accettati da serial_write() sono decodificati (host/tlm_decode) e stampati su stdout
+#define UART_BAUD       9600
+#define UART_FIFO       256
+
+struct UartStats {
+    uint64_t bytes;         // Byte trasmessi sulla linea
+    uint64_t text_bytes;    // Testo equivalente (righe printf ricostruite)
+    uint32_t records;
+    uint32_t crc_errors;
+    uint32_t full;          // serial_write() con FIFO piena (scrittura parziale)
+};
+UartStats &uart_stats();
+void serial_capture(FILE *f);   // Copia grezza del flusso seriale (nullptr = nessuna)
+
+// Flash dati: settori 6-7 della F401RE, tempi tipici da datasheet (x32, 3.3V)
+#define FLASH_SIM_SETTORE   (128 * 1024)
+#define FLASH_SIM_SETTORI   2
+#define FLASH_SIM_ERASE_US  1000000     // Cancellazione settore da 128KB
+#define FLASH_SIM_WORD_US   16          // Programmazione di una word
+
+struct FlashStats {
+    uint32_t erases;
+    uint64_t programmed;    // Byte programmati
+    uint64_t busy_us;       // CPU ferma su erase/program
+    uint32_t violations;    // program() che chiede bit 0 → 1 (dato corrotto sul target)
+    uint64_t read_bytes;
+};
+FlashStats &flash_stats();
+// Mancanza di alimentazione: il prossimo program() scrive solo i primi `byte` e fallisce
+void flash_cut(uint32_t byte);
+
+std::string lcd_line(int row);  // Contenuto visibile della riga LCD (emulazione HD44780)
+bool lcd_backlight();
+
+// ======================================================================================
+// GATT FINTO (client BLE simulato)
+// ======================================================================================
+
+// Byte in aria per notifica oltre al payload: preambolo 1 + access address 4 + header LL 2
+// + CRC 3 + header L2CAP 4 + opcode/handle ATT 3 (ack del client e spazi IFS esclusi)
+static const int BLE_OVERHEAD_ARIA = 17;
+
+struct GattStats {
+    uint32_t writes[BLE_CHAR_COUNT];         // Scritture valore GATT lato server
+    uint32_t notifications[BLE_CHAR_COUNT];  // Notifiche consegnate (client connesso e sottoscritto)
+    uint64_t air_bytes[BLE_CHAR_COUNT];      // Byte in aria delle notifiche (payload + BLE_OVERHEAD_ARIA)
+    uint64_t connected_us;                   // Tempo totale con client connesso
+    uint8_t value[BLE_CHAR_COUNT][20];
+    uint16_t length[BLE_CHAR_COUNT];
+    uint32_t callbacks;                      // Callback BleListener eseguite (connect/disconnect/comandi)
+    uint64_t callback_max_us;                // Durata massima di una callback (coda eventi bloccata)
+};
+GattStats &gatt_stats();
+
+void ble_connect(uint64_t t_us);
+void ble_disconnect(uint64_t t_us);
+void ble_command(uint64_t t_us, const uint8_t *data, uint16_t len);
+void ble_command(uint64_t t_us, uint8_t cmd);
+void ble_subscribe(uint64_t t_us, BleCharId id, bool enabled);  // Scrittura CCCD del client
+bool ble_connected();
+
+// Comandi con sequenza ([cmd, seq] o lotti su CMD, esiti [seq, cmd, esito] da RESULT). Il client
+// scambia pacchetti solo agli eventi di connessione (multipli di BLE_CONN_INTERVAL_US):
+// la scrittura parte al primo evento da t_us, l'esito arriva al primo evento dopo la
+// notifica. Round-trip = arrivo dell'esito - t_us.
+static const uint64_t BLE_CONN_INTERVAL_US = 30000;
+
+struct CmdStats {
+    uint32_t sent;                  // Scritture CMD consegnate (client connesso)
+    uint32_t acked;                 // Esiti ricevuti (RESULT sottoscritta)
+    uint32_t duplicates;            // Esiti per una sequenza già confermata
+    uint64_t rtt_sum_us;
+    uint64_t rtt_max_us;
+    int16_t esito[256];             // Per sequenza: esito ricevuto, -1 = nessuno
+    uint64_t rtt_us[256];
+};
+CmdStats &cmd_stats();
+void ble_request(uint64_t t_us, uint8_t cmd, uint8_t seq);
+// Scrittura grezza (es. lotto TLV) con esiti attesi per le sequenze data[1] .. data[1] + acks - 1
+void ble_request(uint64_t t_us, const uint8_t *data, uint16_t len, int acks);
+
+} // namespace host
+} // namespace hal
+
+#endif
@@ -0,0 +1,2409 @@
+/*
+ * ======================================================================================
+ * SIMULATORE HOST - Vending Machine IoT
+ * ======================================================================================
+ * Esegue il firmware (main.cpp) sulla HAL simulata e riporta statistiche del tick.
+ *
+ * Uso: vending_sim [idle|purchase|lcd|dht|tlm|coin|filtri|sonar|stato|ring|ble|cmd|calib|traffico|tasto|
+ *                   erogazione|pipeline|giornale] [--seconds N] [--quiet] [--capture FILE] [--sonar-fisso]
+ *   idle      nessun cliente: solo RIPOSO, sonar e DHT
+ *   purchase  clienti ripetuti: arrivo, connessione app, selezione, 2 monete,
+ *             conferma, disconnessione (default)
+ *   lcd       benchmark trasporto TextLCD: caratteri/s e blocco CPU per schermata
+ *   dht       decoder DHT11 su tracce di fronti (jitter ISR, fronti mancanti) e
+ *             tempo a interrupt disabilitati per lettura
+ *   tlm       coda di telemetria: raffica di record da ISR e UART satura
+ *             (politica di scarto STATUS/eventi)
+ *   coin      monete sintetiche a velocità di caduta crescenti (risposta LDR, rumore, flicker):
+ *             rilevate, false e latenza col tick a 100ms e coi blocchi DMA a 1kHz
+ *             (exit code 1 se il DMA perde monete viste dal tick o rileva falsi)
+ *   filtri    stadi di SensorFilter.h e catene dei sensori: ns e cicli per campione
+ *             (exit code 1 se una verifica di comportamento degli stadi fallisce)
+ *   sonar     conversione eco → distanza: float a 20°C contro Q16 compensata in temperatura,
+ *             errore (0-40°C, eco rumorose e spurie) e cicli per ping
+ *             (exit code 1 se la compensata a 3 ping sbaglia più della float a 5 ping)
+ *   stato     MachineState pubblicato: 1 scrittore e 3 lettori concorrenti (thread), seqlock
+ *             contro mutex e copia senza sincronizzazione; copie spezzate e latenza di lettura
+ *             (exit code 1 se seqlock o mutex danno una copia spezzata o una versione all'indietro)
+ *   ring      SpscRing tra due thread (produttore che attende o che scarta come un'ISR):
+ *             ordine, buchi e copie spezzate, elementi/s contro una coda con mutex
+ *             (exit code 1 se un elemento manca, è duplicato o spezzato)
+ *   cmd       comandi con sequenza e lotti TLV: esiti attesi per ogni motivo, raffiche pipelined,
+ *             round-trip comando → esito col client che parla solo agli eventi di
+ *             connessione (exit code 1 se un esito non corrisponde)
+ *   calib     calibrazione dei tagli via BLE (20 monete per taglio dal modello della guida),
+ *             salvataggio in flash e clienti con monete miste: taglio vero contro accreditato
+ *             (exit code 1 se un esito non corrisponde, la flash non rilegge la calibrazione
+ *             o meno del 90% delle monete è riconosciuto)
+ *   ble       app sempre connessa, T/H variabili e acquisti: byte in aria al minuto
+ *             delle notifiche TEMP+HUM+STATUS contro la sola SNAPSHOT
+ *   traffico  giornata compressa (metà giorno, metà notte) con passanti e clienti a piedi:
+ *             ping del sonar all'ora e latenza di rilevamento di arrivi e uscite
+ *             (exit code 1 se un attraversamento non è rilevato)
+ *   tasto     pulsante annulla con rimbalzi: moneta e annullo, pressioni a vuoto e tocchi
+ *             brevi; latenza fronte → transizione (exit code 1 se una pressione è persa
+ *             o doppia, o la latenza supera il limite)
+ *   erogazione acquisti da 5 pezzi con profilo servo a scatti (prima metà) e in rampa:
+ *             conferma → fine erogazione, pezzi al minuto e salto massimo del servo
+ *             (exit code 1 se un pezzo manca o la rampa non è più veloce e più dolce)
+ *   pipeline  coda di clienti sempre piena: metà seriale (come fino alla v8.37), metà con
+ *             monete, selezione e conferma del cliente successivo durante erogazione e resto,
+ *             una hal::call() rifiutata ogni ~20s (coda eventi piena);
+ *             clienti all'ora e conti della cassa (exit code 1 se un conto non torna, un
+ *             cliente non è servito o la pipeline non serve più clienti all'ora)
+ *   giornale  FlashJournal sulla flash simulata: 40000 transazioni con reset anche a metà di
+ *             un program; write amplification, erase, usura e tempo di recupero al boot
+ *             (exit code 1 se un reset perde lo stato dell'ultimo lotto integro, c'è un
+ *             erase nel percorso di scrittura con le pause tra clienti, l'ultima risorsa
+ *             senza pause non è contata o il recupero legge oltre un blocco)
+ *   --quiet   sopprime il log seriale del firmware (solo report finale)
+ *   --sonar-fisso  cadenza sonar delle versioni fino alla v8.32 (500ms / 5s / 1s in idle)
+ *   --capture FILE  salva il flusso seriale grezzo (decodifica: tlm_decode FILE)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "hal_host.h"
+#include "coin_model.h"
+#include "TextLCD.h"
+#include "hal/dht_decoder.h"
+#include "VendingApp.h"
+#include "BleSnapshot.h"
+#include "BleComandi.h"
+#include "SensorFilter.h"
+#include "SonarRanger.h"
+#include "MachineState.h"
+#include "SpscRing.h"
+
+using namespace hal::host;
+
+static const uint64_t SEC = 1000000;
+
+// ======================================================================================
+// SCENARI
+// ======================================================================================
+
+static void scenarioPurchase(uint64_t duration) {
+    const uint64_t ciclo = 45 * SEC;
+    int cliente = 0;
+    for (uint64_t t0 = 5 * SEC; t0 + ciclo <= duration; t0 += ciclo, cliente++) {
+        uint8_t prodotto = (uint8_t)(1 + cliente % 4);
+        at_isr(t0 + 2 * SEC, []() { world().distance_cm = 30.0f; });
+        ble_connect(t0 + 4 * SEC);
+        // App: CCCD TEMP → HUM → STATUS in sequenza (100ms tra uno e l'altro); anche
+        // SNAPSHOT, così i due formati sono confrontati sulla stessa sessione
+        ble_subscribe(t0 + 4 * SEC + 300000, hal::BLE_CHAR_TEMP, true);
+        ble_subscribe(t0 + 4 * SEC + 450000, hal::BLE_CHAR_HUM, true);
+        ble_subscribe(t0 + 4 * SEC + 600000, hal::BLE_CHAR_STATUS, true);
+        ble_subscribe(t0 + 4 * SEC + 750000, hal::BLE_CHAR_SNAPSHOT, true);
+        ble_command(t0 + 6 * SEC, prodotto);
+        coin_pulse(t0 + 8 * SEC, 600000, 0.80f);
+        coin_pulse(t0 + 10 * SEC, 600000, 0.80f);
+        ble_command(t0 + 13 * SEC, 10);
+        if (cliente % 4 == 3) ble_command(t0 + 20 * SEC, 11);
+        ble_disconnect(t0 + 26 * SEC);
+        at_isr(t0 + 28 * SEC, []() { world().distance_cm = 150.0f; });
+    }
+}
+
+// ======================================================================================
+// BENCHMARK LCD
+// ======================================================================================
+// Ogni schermata cambia tutte le 32 celle (caso peggiore del flush differenziale).
+
+static TextLCD *benchLcd = nullptr;
+
+static void benchTxDone() {
+    benchLcd->onTxDone();
+}
+
+static void benchDraw(TextLCD &lcd, int n) {
+    lcd.setCursor(0, 0);
+    lcd.print((n & 1) ? "ABCDEFGHIJKLMNOP" : "abcdefghijklmnop");
+    lcd.setCursor(0, 1);
+    lcd.print((n & 1) ? "0123456789012345" : "5432109876543210");
+}
+
+static void benchmarkLcd(FILE *out) {
+    struct Config { const char *nome; LcdTransport mode; int hz; };
+    static const Config configs[] = {
+        {"BYTE  100kHz (originale)", LCD_TX_BYTE, 100000},
+        {"BATCH 100kHz", LCD_TX_BATCH, 100000},
+        {"BATCH 400kHz", LCD_TX_BATCH, 400000},
+        {"ASYNC 100kHz", LCD_TX_ASYNC, 100000},
+        {"ASYNC 400kHz", LCD_TX_ASYNC, 400000},
+    };
+    const int schermate = 200;
+
+    fprintf(out, "\n=== VENDING SIM: lcd (%d schermate x %d caratteri) ===\n",
+            schermate, LCD_COLS * LCD_ROWS);
+    fprintf(out, "%-26s %10s %12s %14s\n", "Trasporto", "car/s", "trans./car", "CPU/schermata");
+
+    for (const Config &cfg : configs) {
+        TextLCD lcd(hal::board().i2c, 0x4E);
+        benchLcd = &lcd;
+        lcd.begin();
+        lcd.setTransport(cfg.mode, cfg.hz, benchTxDone);
+        I2CStats before = i2c_stats();
+
+        // Throughput: schermate una dopo l'altra, fino a bus libero
+        uint64_t t0 = hal::now_us();
+        for (int n = 0; n < schermate; n++) {
+            benchDraw(lcd, n);
+            lcd.flush();
+        }
+        lcd.waitIdle();
+        uint64_t elapsed = hal::now_us() - t0;
+        uint64_t trans = i2c_stats().transactions - before.transactions;
+
+        // Blocco CPU: una schermata ogni 100ms come il tick, tempo speso dentro flush()
+        uint64_t cpu = 0;
+        for (int n = 0; n < schermate; n++) {
+            benchDraw(lcd, n);
+            uint64_t c0 = hal::now_us();
+            lcd.flush();
+            cpu += hal::now_us() - c0;
+            hal::sleep_ms(100);
+        }
+
+        double caratteri = (double)schermate * LCD_COLS * LCD_ROWS;
+        fprintf(out, "%-26s %10.0f %12.2f %11.2f ms\n", cfg.nome,
+                caratteri * 1e6 / elapsed, trans / caratteri, cpu / 1000.0 / schermate);
+        benchLcd = nullptr;
+    }
+}
+
+// ======================================================================================
+// DECODER DHT11
+// ======================================================================================
+// Tracce sintetiche (tempi da datasheet) passate al decoder come dalla ISR dei fronti.
+
+static bool decodifica(const std::vector<DhtEdge> &edges, size_t da, size_t a, uint8_t frame[5]) {
+    hal::DhtDecoder decoder;
+    decoder.reset();
+    for (size_t i = da; i < a && i < edges.size(); i++) decoder.edge(edges[i].level, edges[i].t_us);
+    return decoder.result(frame);
+}
+
+// Lettura bit-bang della v7.1 (dht_reader_thread) sulla linea della traccia: pulseIn() a
+// passi di wait_us(1) con interrupt disabilitati dalla risposta all'ultimo bit
+static const std::vector<DhtEdge> *bitBangTraccia = nullptr;
+
+static int bitBangLinea() {
+    uint64_t t = hal::now_us();
+    int livello = 1;        // Linea rilasciata dopo lo start
+    for (const DhtEdge &e : *bitBangTraccia) {
+        if (e.t_us > t) break;
+        livello = e.level;
+    }
+    return livello;
+}
+
+static int bitBangPulseIn(int level) {
+    int count = 0;
+    while (bitBangLinea() == level) {
+        if (count++ > 200) return -1;
+        hal::wait_us(1);
+    }
+    return count;
+}
+
+static bool letturaBitBang(const std::vector<DhtEdge> &edges, uint8_t data[5]) {
+    bitBangTraccia = &edges;
+    memset(data, 0, 5);
+    hal::wait_us(30);       // dht = 1; wait_us(30); dht.input();
+
+    hal::critical_enter();  // __disable_irq()
+    bool error = false;
+    if (bitBangPulseIn(1) == -1 || bitBangPulseIn(0) == -1 || bitBangPulseIn(1) == -1) error = true;
+    if (!error) {
+        for (int i = 0; i < 40; i++) {
+            if (bitBangPulseIn(0) == -1) { error = true; break; }
+            int width = bitBangPulseIn(1);
+            if (width == -1) { error = true; break; }
+            if (width > 45) data[i / 8] |= (1 << (7 - (i % 8)));
+        }
+    }
+    hal::critical_exit();   // __enable_irq()
+    return !error && data[4] == (uint8_t)(data[0] + data[1] + data[2] + data[3]);
+}
+
+static int benchmarkDht(FILE *out) {
+    const int letture = 2000;
+    static const uint32_t jitter[] = {0, 5, 10, 20, 25};
+    uint32_t seed = 42;
+    int falliti = 0;
+
+    fprintf(out, "\n=== VENDING SIM: dht (%d frame per caso) ===\n", letture);
+    fprintf(out, "%-34s %8s %8s %8s\n", "Caso", "corretti", "scartati", "errati");
+
+    for (uint32_t j : jitter) {
+        int corretti = 0, scartati = 0, errati = 0;
+        for (int n = 0; n < letture; n++) {
+            seed = seed * 1103515245u + 12345u;
+            uint8_t tx[5] = {(uint8_t)(20 + (seed >> 16) % 70), 0, (uint8_t)(10 + (seed >> 8) % 40), 0, 0};
+            tx[4] = (uint8_t)(tx[0] + tx[2]);
+            std::vector<DhtEdge> edges = dht_trace(tx, 0, j, seed);
+            uint8_t rx[5];
+            if (!decodifica(edges, 0, edges.size(), rx)) scartati++;
+            else if (!memcmp(rx, tx, 5)) corretti++;
+            else errati++;          // Checksum valido su bit sbagliati: valore falso accettato
+        }
+        char nome[40];
+        snprintf(nome, sizeof(nome), "latenza ISR 0-%uus%s", j, j > 20 ? " (oltre margine)" : "");
+        fprintf(out, "%-34s %8d %8d %8d\n", nome, corretti, scartati, errati);
+        if (j <= 20 && corretti != letture) falliti++;   // Margine della soglia: ±20us
+    }
+
+    // Fronti in testa persi (rilascio e risposta non visti) o frame troncato
+    uint8_t tx[5] = {45, 0, 22, 0, 67};
+    uint8_t rx[5];
+    std::vector<DhtEdge> edges = dht_trace(tx, 0, 5, seed);
+    bool okTesta = decodifica(edges, 3, edges.size(), rx) && !memcmp(rx, tx, 5);
+    bool okTronco = !decodifica(edges, 0, edges.size() - 20, rx);
+    fprintf(out, "%-34s %8s\n", "rilascio+risposta persi", okTesta ? "OK" : "ERRORE");
+    fprintf(out, "%-34s %8s\n", "frame troncato (10 bit persi)", okTronco ? "scartato" : "ERRORE");
+    if (!okTesta || !okTronco) falliti++;
+
+    // Interrupt disabilitati per lettura, dalle sezioni critiche dell'HAL (tempo virtuale)
+    const int campioni = 20;
+    int okBitBang = 0;
+    uint64_t maxBitBang = 0;
+    CriticalStats c0 = critical_stats();
+    for (int n = 0; n < campioni; n++) {
+        std::vector<DhtEdge> traccia = dht_trace(tx, hal::now_us(), DHT_JITTER_US, seed);
+        uint64_t prima = critical_stats().total_us;
+        if (letturaBitBang(traccia, rx) && !memcmp(rx, tx, 5)) okBitBang++;
+        uint64_t off = critical_stats().total_us - prima;
+        if (off > maxBitBang) maxBitBang = off;
+        hal::sleep_ms(2000);
+    }
+    CriticalStats c1 = critical_stats();
+
+    // Lettura a fronti: ISR di un EdgeIn alla loro ora sulla timeline, come sul target
+    world().hum_pct = tx[0];
+    world().temp_c = tx[2];
+    Outputs prima = outputs();
+    int okFronti = 0;
+    for (int n = 0; n < campioni; n++) {
+        if (hal::board().dht.read(rx) && !memcmp(rx, tx, 5)) okFronti++;
+        hal::sleep_ms(2000);
+    }
+    Outputs &dopo = outputs();
+    double offBitBang = (c1.total_us - c0.total_us) / 1000.0 / campioni;
+    double offFronti = (dopo.dht_irq_off_us - prima.dht_irq_off_us) / 1000.0 / campioni;
+    fprintf(out, "IRQ disabilitati/lettura (sezioni critiche misurate, %d letture per lettore):\n", campioni);
+    fprintf(out, "  bit-bang v7.1 (pulseIn, wait_us(1)) : media %.3f ms, max %.3f ms, %d/%d corretti\n",
+            offBitBang, maxBitBang / 1000.0, okBitBang, campioni);
+    fprintf(out, "  fronti (EdgeIn + DhtDecoder)        : media %.3f ms, max %.3f ms, %d/%d corretti,"
+            " %u sezioni critiche in %u ISR\n",
+            offFronti, dopo.dht_irq_off_max_us / 1000.0, okFronti, campioni,
+            dopo.dht_irq_sezioni - prima.dht_irq_sezioni, dopo.dht_edges - prima.dht_edges);
+    if (okBitBang != campioni || okFronti != campioni || offFronti >= offBitBang) falliti++;
+    return falliti;
+}
+
+// ======================================================================================
+// REPORT
+// ======================================================================================
+
+static const char *nomeStato(int s) {
+    static const char *nomi[] = {"RIPOSO", "ATTESA_MONETA", "EROGAZIONE", "RESTO", "ERRORE"};
+    return (s >= 0 && s <= 4) ? nomi[s] : "?";
+}
+
+static const char *nomeEvento(int e) {
+    static const char *nomi[] = {"MONETA", "PRODOTTO", "CONFERMA", "ANNULLA",
+                                 "TIMEOUT", "PRESENZA", "SOVRATEMP", "RIFORNIMENTO", "CALIBRA",
+                                 "EROGATO"};
+    return (e >= 0 && e < EV_COUNT) ? nomi[e] : "?";
+}
+
+// ======================================================================================
+// BENCHMARK TELEMETRIA: raffica da ISR e saturazione della UART
+// ======================================================================================
+
+static Telemetria *benchTlm = nullptr;
+
+static void benchTlmDrain() {
+    benchTlm->drain();
+}
+
+static int benchmarkTelemetria(FILE *out) {
+    static Telemetria coda;
+    benchTlm = &coda;
+    coda.begin(hal::start_background(benchTlmDrain, TLM_ATTESA_MS));
+    int falliti = 0;
+
+    fprintf(out, "\n=== VENDING SIM: tlm (coda %u voci, STATUS scartati oltre %u) ===\n",
+            Telemetria::CODA_LEN, Telemetria::SOGLIA_PERIODICI);
+
+    // 1. Raffica: 64 record nella stessa ISR (STATUS ed eventi alternati)
+    at_isr(1 * SEC, []() {
+        for (int i = 0; i < 32; i++) {
+            benchTlm->record(TLM_STATUS, {0, 0, i, 1, 1, 40, 40, 100, 22, 45, 5, 5, 5, 5});
+            benchTlm->record(TLM_CREDITO, {i});
+        }
+    });
+    run_until(2 * SEC);
+    uint32_t statusPersi = coda.persiPeriodici(), eventiPersi = coda.persiEventi();
+    fprintf(out, "Raffica ISR 32+32 : accodati %u STATUS + %u eventi, coda max %u\n",
+            32 - statusPersi, 32 - eventiPersi, coda.occupazioneMax());
+    // Gli eventi occupano anche l'ultimo quarto riservato
+    if (32 - eventiPersi < Telemetria::CODA_LEN - Telemetria::SOGLIA_PERIODICI) falliti++;
+
+    // 2. Saturazione 10s: STATUS a 50/s (~1000 byte/s > 960 della linea) + eventi a 20/s
+    const uint64_t inizio = 2 * SEC, durata = 10 * SEC;
+    for (uint64_t t = inizio; t < inizio + durata; t += 20000) {
+        at_isr(t, [t]() { benchTlm->record(TLM_STATUS, {1, 1, (int32_t)(t / 1000), 1, 1, 40, 40, 100, 22, 45, 5, 5, 5, 5}); });
+        if ((t / 20000) % 5 == 0) at_isr(t + 7000, []() { benchTlm->record(TLM_LDR_MONETA, {80, 40, 40}); });
+    }
+    run_until(inizio + durata + 5 * SEC);
+    uint32_t statusSat = coda.persiPeriodici() - statusPersi, eventiSat = coda.persiEventi() - eventiPersi;
+    fprintf(out, "Saturazione 10s   : persi %u/500 STATUS, %u/200 eventi\n", statusSat, eventiSat);
+    if (eventiSat != 0) falliti++;
+
+    UartStats &uart = uart_stats();
+    fprintf(out, "UART              : %llu byte, %u record decodificati, %u CRC errati, %u FIFO piena\n",
+            (unsigned long long)uart.bytes, uart.records, uart.crc_errors, uart.full);
+    if (uart.crc_errors) falliti++;
+    fprintf(out, "Produttore        : nessuna attesa né sezione critica (CAS sulla testa, scarto contato)\n");
+    return falliti;
+}
+
+// ======================================================================================
+// BENCHMARK LDR: monete sintetiche a varie velocità di caduta
+// ======================================================================================
+// La moneta oscura il sensore per (diametro + fascio) / velocità; il LDR segue con
+// risposta del primo ordine (τ) in salita e in discesa. Rumore ±2% e flicker 100Hz ±1%
+// della luce ambiente. Lo stesso segnale va a due rilevatori sulla stessa timeline:
+// tick a 100ms come la v8.28 (3 campioni in 200ms) e blocchi DMA a 1kHz del firmware.
+
+static const double MONETA_MM = 23.25 + 2.0;    // 1 EUR + larghezza del fascio
+static const double LDR_TAU_US = 5000.0;
+static const float LDR_BASE = 0.40f, LDR_PICCO = 0.80f;
+
+struct MonetaBench { uint64_t inizio, fine; };
+static std::vector<MonetaBench> benchMonete;
+
+static float benchSegnale(uint64_t t) {
+    float v = LDR_BASE;
+    // Ultima moneta iniziata prima di t (monete distanziate molto più di τ)
+    size_t i = std::upper_bound(benchMonete.begin(), benchMonete.end(), t,
+                                [](uint64_t x, const MonetaBench &m) { return x < m.inizio; }) - benchMonete.begin();
+    if (i > 0) {
+        const MonetaBench &m = benchMonete[i - 1];
+        double r = (t < m.fine) ? 1.0 - exp(-(double)(t - m.inizio) / LDR_TAU_US)
+                                : (1.0 - exp(-(double)(m.fine - m.inizio) / LDR_TAU_US)) *
+                                  exp(-(double)(t - m.fine) / LDR_TAU_US);
+        v += (float)((LDR_PICCO - LDR_BASE) * r);
+    }
+    uint32_t h = (uint32_t)(t / 100) * 2654435761u;     // Rumore deterministico per istante
+    h ^= h >> 15;
+    v += ((h % 4001) / 1000.0f - 2.0f) / 100.0f;
+    v += 0.01f * (float)sin(2.0 * M_PI * 100.0 * t / 1e6);
+    return v;
+}
+
+struct RilevazioneBench { uint64_t ingresso, post; };
+static std::vector<RilevazioneBench> benchTick, benchDma;
+
+static void benchMonetaTick(const EventoLdr &ev) {
+    if (ev.moneta) benchTick.push_back({ev.t_us, hal::now_us()});
+}
+
+static void benchMonetaDma(const EventoLdr &ev) {
+    if (ev.moneta) benchDma.push_back({ev.t_us, hal::now_us()});
+}
+
+static const CoinDetectorConfig configTick = {100000, 3, LDR_PERCENTO(20), LDR_PERCENTO(5), 3, 200000};
+static const CoinDetectorConfig configDma = {1000, 10, LDR_PERCENTO(20), LDR_PERCENTO(5), 3, 2000};
+static CoinDetector rilevatoreTick(configTick, benchMonetaTick);
+static CoinDetector rilevatoreDma(configDma, benchMonetaDma);
+
+static const int BENCH_BLOCCO = 32;
+static uint16_t benchBuffer[2 * BENCH_BLOCCO];
+static const uint16_t *benchBlocco = nullptr;
+static uint64_t benchBloccoUs = 0;
+
+static void benchTickTask() {
+    uint16_t x = (uint16_t)(hal::board().ldr.read() * 65535.0f + 0.5f);
+    rilevatoreTick.processa(&x, 1, hal::now_us());
+}
+
+static void benchDmaTask() {
+    rilevatoreDma.processa(benchBlocco, BENCH_BLOCCO, benchBloccoUs);
+}
+
+static void benchDmaIsr(const uint16_t *campioni, int n) {
+    benchBlocco = campioni;
+    benchBloccoUs = hal::now_us() - (uint64_t)(n - 1) * configDma.periodo_us;
+    hal::call(benchDmaTask);
+}
+
+struct EsitoBench { int rilevate, falsi; double latenzaMedia, latenzaMax, erroreMax; };
+
+// Abbina le rilevazioni alle monete della serie [da, a): conferma entro 300ms dalla fine
+static EsitoBench abbina(const std::vector<RilevazioneBench> &ril, size_t da, size_t a) {
+    EsitoBench e = {0, 0, 0.0, 0.0, 0.0};
+    uint64_t t0 = benchMonete[da].inizio, t1 = benchMonete[a - 1].fine + 300000;
+    std::vector<bool> vista(a - da, false);
+    for (const RilevazioneBench &r : ril) {
+        if (r.post < t0 || r.post > t1) continue;
+        size_t k = da;
+        while (k < a && !(r.post >= benchMonete[k].inizio && r.post <= benchMonete[k].fine + 300000)) k++;
+        if (k == a || vista[k - da]) {
+            e.falsi++;
+            continue;
+        }
+        vista[k - da] = true;
+        e.rilevate++;
+        double lat = (r.post - benchMonete[k].inizio) / 1000.0;
+        double err = fabs((double)r.ingresso - (double)benchMonete[k].inizio) / 1000.0;
+        e.latenzaMedia += lat;
+        if (lat > e.latenzaMax) e.latenzaMax = lat;
+        if (err > e.erroreMax) e.erroreMax = err;
+    }
+    if (e.rilevate) e.latenzaMedia /= e.rilevate;
+    return e;
+}
+
+static int benchmarkMonete(FILE *out) {
+    static const double velocita[] = {0.04, 0.1, 0.25, 0.5, 1.0, 2.0, 3.0, 5.0};   // m/s
+    const int nVel = sizeof(velocita) / sizeof(velocita[0]);
+    const int perSerie = 40;
+    uint32_t seed = 7;
+    int falliti = 0;
+
+    // Serie per velocità, monete a 1.5s + fase casuale rispetto al tick
+    uint64_t t = 2 * SEC;
+    size_t inizioSerie[nVel + 1];
+    for (int v = 0; v < nVel; v++) {
+        inizioSerie[v] = benchMonete.size();
+        uint64_t transito = (uint64_t)(MONETA_MM / velocita[v] * 1000.0);
+        for (int n = 0; n < perSerie; n++) {
+            seed = seed * 1103515245u + 12345u;
+            uint64_t inizio = t + (seed >> 8) % 100000;
+            benchMonete.push_back({inizio, inizio + transito});
+            t += 1500000;
+        }
+    }
+    inizioSerie[nVel] = benchMonete.size();
+    ldr_waveform(benchSegnale);
+
+    hal::call_every_ms(100, benchTickTask);
+    hal::board().ldrStream.start(1000, benchBuffer, 2 * BENCH_BLOCCO, benchDmaIsr);
+    run_until(t + 2 * SEC);
+    ldr_waveform(nullptr);
+
+    fprintf(out, "\n=== VENDING SIM: coin (%d monete per velocità, LDR τ=%.0fms, Δ picco %.0f%%, soglia %d%%) ===\n",
+            perSerie, LDR_TAU_US / 1000.0, (LDR_PICCO - LDR_BASE) * 100, 20);
+    fprintf(out, "%-7s %-9s | %-30s | %-30s\n", "", "", "tick 100ms (v8.28)", "DMA 1kHz, blocchi 32");
+    fprintf(out, "%-7s %-9s | %5s %5s %9s %8s | %5s %5s %9s %8s\n", "m/s", "transito",
+            "rilev", "false", "lat.media", "lat.max", "rilev", "false", "lat.media", "lat.max");
+    double erroreTick = 0, erroreDma = 0;
+    for (int v = 0; v < nVel; v++) {
+        size_t da = inizioSerie[v], a = inizioSerie[v + 1];
+        EsitoBench et = abbina(benchTick, da, a), ed = abbina(benchDma, da, a);
+        double transito = (benchMonete[da].fine - benchMonete[da].inizio) / 1000.0;
+        fprintf(out, "%-7.2f %6.1f ms | %3d/%-2d %4d %7.1f ms %5.0f ms | %3d/%-2d %4d %7.1f ms %5.0f ms\n",
+                velocita[v], transito,
+                et.rilevate, perSerie, et.falsi, et.latenzaMedia, et.latenzaMax,
+                ed.rilevate, perSerie, ed.falsi, ed.latenzaMedia, ed.latenzaMax);
+        if (et.erroreMax > erroreTick) erroreTick = et.erroreMax;
+        if (ed.erroreMax > erroreDma) erroreDma = ed.erroreMax;
+        // Regressione: il DMA perde monete viste dal tick, rileva il falso o perde
+        // monete con transito >= 10ms (segnale ancora sopra soglia dopo la risposta del LDR)
+        if (ed.rilevate < et.rilevate || ed.falsi || (transito >= 10.0 && ed.rilevate < perSerie)) falliti++;
+    }
+    fprintf(out, "Istante di ingresso (primo campione sopra soglia): errore max tick %.1f ms, DMA %.1f ms\n",
+            erroreTick, erroreDma);
+    fprintf(out, "Spike scartati (più brevi del debounce, %u campioni in %.0fms col DMA): tick %u, DMA %u\n", configDma.minCampioni,
+            configDma.minUs / 1000.0, rilevatoreTick.scartati(), rilevatoreDma.scartati());
+    TaskStats st = task_stats(benchDmaTask);
+    fprintf(out, "Elaborazione DMA: %llu blocchi (%.1f interrupt/s), nessuna ISR per campione\n",
+            (unsigned long long)st.runs, st.runs * 1e6 / (t + 2 * SEC));
+    return falliti;
+}
+
+// ======================================================================================
+// BENCHMARK FILTRI: cicli per campione di ogni stadio e delle catene dei sensori
+// ======================================================================================
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static uint64_t cicli() { return __rdtsc(); }
+#else
+static uint64_t cicli() { return 0; }
+#endif
+
+static const int FILTRI_CAMPIONI = 4096;
+static const int FILTRI_GIRI = 500;
+static int32_t filtriIngresso[FILTRI_CAMPIONI];
+static volatile int32_t filtriPozzo;
+
+struct MisuraFiltro { double ns, cicli; };
+
+// Tempo per campione di f(x, t) su tutto l'ingresso (FILTRI_GIRI passate in 5 serie:
+// vale la serie più veloce, meno disturbata dal resto della macchina)
+template <typename F>
+static MisuraFiltro misuraFiltro(F f) {
+    const int serie = 5, giri = FILTRI_GIRI / serie;
+    MisuraFiltro migliore = {1e30, 1e30};
+    int32_t somma = 0;
+    uint64_t t = 0;
+    for (int s = 0; s < serie; s++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        uint64_t c0 = cicli();
+        for (int g = 0; g < giri; g++) {
+            for (int i = 0; i < FILTRI_CAMPIONI; i++, t += 1000) somma += f(filtriIngresso[i], t);
+        }
+        uint64_t c1 = cicli();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        double n = (double)giri * FILTRI_CAMPIONI;
+        if (ns / n < migliore.ns) migliore = {ns / n, (c1 - c0) / n};
+    }
+    filtriPozzo = somma;
+    return migliore;
+}
+
+static void rigaFiltro(FILE *out, const char *nome, MisuraFiltro m) {
+    if (m.cicli > 0) fprintf(out, "  %-34s %6.2f ns %7.1f cicli/campione\n", nome, m.ns, m.cicli);
+    else fprintf(out, "  %-34s %6.2f ns/campione\n", nome, m.ns);
+}
+
+static void benchMonetaVuota(const EventoLdr &) {}
+
+static int benchmarkFiltri(FILE *out) {
+    int falliti = 0;
+
+    // Verifiche di comportamento degli stadi
+    FiltroMediana<5> med;
+    const int32_t burst[] = {80, 82, 399, 79, 81};
+    for (int32_t x : burst) med.filtra(x);
+    if (med.valore() != 81) falliti++;
+    med.reset();
+    med.filtra(30);
+    med.filtra(40);
+    if (med.valore() != 35 || med.campioni() != 2) falliti++;
+
+    FiltroEma ema(4);
+    ema.filtra(1000);
+    for (int i = 0; i < 200; i++) ema.filtra(2000);
+    if (ema.valore() < 1984 || ema.valore() > 2000) falliti++;
+
+    FiltroIsteresi vicino(40, 60);
+    const int32_t distanze[] = {70, 39, 50, 61, 45};
+    const int32_t attesi[] = {0, 1, 1, 0, 0};
+    for (int i = 0; i < 5; i++) {
+        if (vicino.filtra(distanze[i]) != attesi[i]) falliti++;
+    }
+
+    FiltroLimitatore lim(10, 5);
+    lim.filtra(0);
+    if (lim.filtra(100) != 10 || lim.filtra(-100) != 5) falliti++;
+
+    FiltroAntiSpike spike(INT32_MAX, 150, 200);
+    if (spike.filtra(10) != 200 || spike.filtra(120) != 120 || spike.filtra(380) != 380) falliti++;
+    FiltroAntiSpike confermato(INT32_MAX, 150, 200, 1);     // Salto accettato alla seconda lettura coerente
+    if (confermato.filtra(10) != 200 || confermato.filtra(300) != 300 || confermato.filtra(20) != 300 ||
+        confermato.filtra(25) != 25) falliti++;
+
+    FiltroDebounce deb(3, 2000, 1, 0);
+    const int32_t ing[] = {1, 1, 0, 1, 1, 1, 0};
+    const int32_t usc[] = {0, 0, 0, 0, 0, 1, 0};
+    for (int i = 0; i < 7; i++) {
+        if (deb.filtra(ing[i], (uint64_t)i * 1000) != usc[i]) falliti++;
+    }
+
+    // Ingresso: rampa lenta + rumore + spike rari (stesso per tutti gli stadi)
+    uint32_t seed = 3;
+    for (int i = 0; i < FILTRI_CAMPIONI; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int32_t x = 20000 + (i % 1024) * 8 + (int32_t)((seed >> 8) % 2000);
+        if ((seed >> 20) % 64 == 0) x += 20000;
+        filtriIngresso[i] = x;
+    }
+
+    FiltroMediana<3> m3;
+    FiltroMediana<5> m5;
+    FiltroMediana<9> m9;
+    FiltroEma e10(10);
+    FiltroIsteresi ist(30000, 25000);
+    FiltroLimitatore lr(64, 64);
+    FiltroAntiSpike as(INT32_MAX, 5000, 20000);
+    FiltroDebounce db(3, 2000, 1, 0);
+    CatenaFiltri<FiltroMediana<5>, FiltroAntiSpike> sonarCatena(FiltroMediana<5>(),
+                                                                FiltroAntiSpike(INT32_MAX, 150, 100));
+    CatenaFiltri<FiltroIsteresi, FiltroDebounce> presenza(FiltroIsteresi(40, 60),
+                                                          FiltroDebounce(1, 600000, 1, 2100000));
+    CatenaFiltri<FiltroMediana<3>, FiltroEma, FiltroLimitatore> tutti(FiltroMediana<3>(), FiltroEma(4),
+                                                                     FiltroLimitatore(64, 64));
+    CoinDetector ldr(rilevatore.config(), benchMonetaVuota);
+
+    fprintf(out, "\n=== VENDING SIM: filtri (%d campioni x %d, SensorFilter.h, host %s) ===\n", FILTRI_CAMPIONI,
+            FILTRI_GIRI, cicli() ? "x86 TSC" : "senza contatore di cicli");
+    rigaFiltro(out, "copia (riferimento)", misuraFiltro([](int32_t x, uint64_t) { return x; }));
+    rigaFiltro(out, "FiltroMediana<3>", misuraFiltro([&](int32_t x, uint64_t t) { return m3.filtra(x, t); }));
+    rigaFiltro(out, "FiltroMediana<5>", misuraFiltro([&](int32_t x, uint64_t t) { return m5.filtra(x, t); }));
+    rigaFiltro(out, "FiltroMediana<9>", misuraFiltro([&](int32_t x, uint64_t t) { return m9.filtra(x, t); }));
+    rigaFiltro(out, "FiltroEma (α 1/1024)", misuraFiltro([&](int32_t x, uint64_t t) { return e10.filtra(x, t); }));
+    rigaFiltro(out, "FiltroIsteresi", misuraFiltro([&](int32_t x, uint64_t t) { return ist.filtra(x, t); }));
+    rigaFiltro(out, "FiltroLimitatore", misuraFiltro([&](int32_t x, uint64_t t) { return lr.filtra(x, t); }));
+    rigaFiltro(out, "FiltroAntiSpike", misuraFiltro([&](int32_t x, uint64_t t) { return as.filtra(x, t); }));
+    rigaFiltro(out, "FiltroDebounce", misuraFiltro([&](int32_t x, uint64_t t) { return db.filtra(x > 30000, t); }));
+    rigaFiltro(out, "Catena mediana3 + EMA + limitatore",
+               misuraFiltro([&](int32_t x, uint64_t t) { return tutti.filtra(x, t); }));
+    fprintf(out, "Sensori:\n");
+    rigaFiltro(out, "sonar: mediana5 + anti-spike",
+               misuraFiltro([&](int32_t x, uint64_t t) { return sonarCatena.filtra(x / 200, t); }));
+    rigaFiltro(out, "presenza: isteresi + debounce",
+               misuraFiltro([&](int32_t x, uint64_t t) { return presenza.filtra(x / 600, t); }));
+    rigaFiltro(out, "LDR: CoinDetector (EMA+ist.+deb.)", misuraFiltro([&](int32_t x, uint64_t t) {
+                   uint16_t c = (uint16_t)x;
+                   ldr.processa(&c, 1, t);
+                   return (int32_t)ldr.monetaPresente();
+               }));
+    fprintf(out, "Verifiche stadi: %s\n", falliti ? "FALLITE" : "ok");
+    return falliti;
+}
+
+// ======================================================================================
+// BENCHMARK SONAR: conversione eco → distanza, float a 20°C contro Q16 compensata
+// ======================================================================================
+
+static uint32_t sonarSeed = 5;
+
+static double sonarUniforme() {
+    sonarSeed = sonarSeed * 1103515245u + 12345u;
+    return ((sonarSeed >> 8) % 1000000) / 1000000.0;
+}
+
+// Eco di un ping: rumore gaussiano σ 15μs (~2.5mm), 4% eco spuria vicina, 2% nessuna eco
+static uint32_t sonarEco(double cm, int gradiC) {
+    double u = sonarUniforme();
+    if (u < 0.02) return 0;
+    if (u < 0.06) return (uint32_t)(300 + sonarUniforme() * 2000);
+    double cmUs = 0.03313 * sqrt(1.0 + gradiC / 273.15);
+    double g = sqrt(-2.0 * log(sonarUniforme() + 1e-9)) * cos(2.0 * M_PI * sonarUniforme());
+    return (uint32_t)(cm * 2.0 / cmUs + 15.0 * g);
+}
+
+static int sonarFloatCm(uint32_t eco) { return (int)(eco * 0.0343f / 2.0f); }
+
+struct ErroreSonar {
+    std::vector<double> mm;
+    void aggiungi(double e) { mm.push_back(fabs(e)); }
+    double media() const {
+        double s = 0;
+        for (double e : mm) s += e;
+        return mm.empty() ? 0 : s / mm.size();
+    }
+    double percentile(double p) {
+        if (mm.empty()) return 0;
+        std::sort(mm.begin(), mm.end());
+        return mm[(size_t)(p * (mm.size() - 1))];
+    }
+};
+
+static int benchmarkSonar(FILE *out) {
+    static const int temperature[] = {0, 10, 20, 30, 40};
+    static const int distanze[] = {20, 40, 60, 100, 150, 200, 300};
+    const int letture = 200;
+    const int nT = sizeof(temperature) / sizeof(temperature[0]);
+    const int nD = sizeof(distanze) / sizeof(distanze[0]);
+
+    // Percorsi: [0] float 20°C media 5 (v8.30), [1] float mediana 5 (v8.31),
+    //           [2] Q16 compensata mediana 5, [3] Q16 compensata mediana 3 (attuale)
+    static const char *nomi[] = {"float 0.0343, media 5 ping", "float 0.0343, mediana 5 ping",
+                                 "Q16 compensata, mediana 5 ping", "Q16 compensata, mediana 3 ping"};
+    ErroreSonar totale[4], perT[4][nT];
+    for (int ti = 0; ti < nT; ti++) {
+        int gradi = temperature[ti];
+        for (int d : distanze) {
+            for (int l = 0; l < letture; l++) {
+                uint32_t eco[5];
+                for (int p = 0; p < 5; p++) eco[p] = sonarEco(d, gradi);
+
+                int somma = 0, validi = 0;
+                FiltroMediana<5> medFloat, med5;
+                FiltroMediana<3> med3;
+                for (int p = 0; p < 5; p++) {
+                    if (eco[p] == 0 || eco[p] >= 30000) continue;
+                    int cm = sonarFloatCm(eco[p]);
+                    if (cm >= 2 && cm <= 400) {
+                        somma += cm;
+                        validi++;
+                        medFloat.filtra(cm * 10);
+                    }
+                    uint32_t mm = SonarRanger::echoToMm(eco[p], SonarRanger::mezzaVelocitaQ16(gradi));
+                    if (mm >= 20 && mm <= 4000) {
+                        med5.filtra((int32_t)mm);
+                        if (p < 3) med3.filtra((int32_t)mm);
+                    }
+                }
+                double vero = d * 10.0;
+                double stima[4] = {validi ? somma / validi * 10.0 : -1, medFloat.campioni() ? (double)medFloat.valore() : -1,
+                                   med5.campioni() ? (double)med5.valore() : -1, med3.campioni() ? (double)med3.valore() : -1};
+                for (int k = 0; k < 4; k++) {
+                    if (stima[k] < 0) continue;         // Nessun ping valido: il sonar tiene la lettura precedente
+                    totale[k].aggiungi(stima[k] - vero);
+                    perT[k][ti].aggiungi(stima[k] - vero);
+                }
+            }
+        }
+    }
+
+    // Costo della sola conversione per ping (echi da 10cm a 3m)
+    for (int i = 0; i < FILTRI_CAMPIONI; i++) filtriIngresso[i] = 600 + (int32_t)(sonarUniforme() * 17000);
+    // Ogni conversione dipende dalla precedente (come un ping per ISR): latenza, non throughput SIMD
+    int32_t ultimo = 0;
+    MisuraFiltro convFloat = misuraFiltro([&ultimo](int32_t x, uint64_t) {
+        return ultimo = (int32_t)sonarFloatCm((uint32_t)(x + (ultimo & 1)));
+    });
+    const uint16_t k = SonarRanger::mezzaVelocitaQ16(22);     // Calcolata solo al cambio di temperatura
+    MisuraFiltro convQ16 = misuraFiltro([&ultimo, k](int32_t x, uint64_t) {
+        return ultimo = (int32_t)SonarRanger::echoToMm((uint32_t)(x + (ultimo & 1)), k);
+    });
+
+    fprintf(out, "\n=== VENDING SIM: sonar (%d letture x %d distanze 20-300cm, eco σ 15μs, 4%% spurie, 2%% perse) ===\n",
+            letture, nD);
+    fprintf(out, "%-32s | errore mm: media   p95   max | media per T:", "");
+    for (int g : temperature) fprintf(out, " %3d°C", g);
+    fprintf(out, "\n");
+    for (int k = 0; k < 4; k++) {
+        double media = totale[k].media(), p95 = totale[k].percentile(0.95), max = totale[k].percentile(1.0);
+        fprintf(out, "%-32s |           %5.1f %5.1f %5.0f |             ", nomi[k], media, p95, max);
+        for (int ti = 0; ti < nT; ti++) fprintf(out, " %5.1f", perT[k][ti].media());
+        fprintf(out, "\n");
+    }
+    rigaFiltro(out, "conversione float (cm)", convFloat);
+    rigaFiltro(out, "conversione Q16 compensata (mm)", convQ16);
+    fprintf(out, "Burst: %d ping x %.0fms (prima 5 x 15ms)\n", SonarRanger::BURST_PINGS,
+            SonarRanger::PING_SPACING_US / 1000.0);
+
+    // Regressione: la compensata a 3 ping non deve sbagliare più della float a 5 ping
+    double attuale = totale[3].media(), prima = totale[0].media();
+    return (attuale < prima && totale[3].percentile(0.95) < totale[0].percentile(0.95)) ? 0 : 1;
+}
+
+// ======================================================================================
+// BENCHMARK STATO: MachineState pubblicato con scrittore e lettori concorrenti
+// ======================================================================================
+// Lo scrittore pubblica stati in cui ogni campo è funzione del contatore n (versione):
+// un lettore che vede campi di due n diversi ha letto una copia spezzata. Tre modi:
+// Seqlock (firmware), mutex (come il vecchio dhtMutex) e copia senza sincronizzazione
+// (le stesse parole senza contatore: controllo che la verifica veda davvero le copie
+// spezzate). I thread sono del sistema operativo: un lettore o lo scrittore sospeso a
+// metà copia riproduce il thread interrotto sul target.
+
+static const int STATO_LETTORI = 3;
+static const int STATO_MS = 300;
+static const size_t STATO_CAMPIONI = 1 << 20;   // Latenze registrate per lettore
+
+static MachineState statoVersione(uint32_t n) {
+    MachineState m;
+    memset(&m, 0, sizeof(m));
+    m.credito = (int32_t)(n * 50);
+    m.prezzo = (int32_t)(n * 50 + 100);
+    m.stato = (uint8_t)(n % 5);
+    m.prodotto = (uint8_t)(1 + n % 4);
+    for (int i = 0; i < 4; i++) m.scorte[i] = (uint8_t)(n + i);
+    m.presente = (n & 1) != 0;
+    m.bleConnesso = (n & 2) != 0;
+    m.versione = n;
+    return m;
+}
+
+static bool statoCoerente(const MachineState &m) {
+    MachineState atteso = statoVersione(m.versione);
+    return memcmp(&m, &atteso, sizeof(m)) == 0;
+}
+
+// Con try_lock prima del lock: conta le volte in cui lettore o scrittore ha dovuto attendere
+class StatoMutex {
+public:
+    void scrivi(const MachineState &v) {
+        if (!_mutex.try_lock()) {
+            attesaScrittore++;
+            _mutex.lock();
+        }
+        _valore = v;
+        _mutex.unlock();
+    }
+    MachineState leggi(uint32_t *attese) {
+        *attese = 0;
+        if (!_mutex.try_lock()) {
+            *attese = 1;
+            _mutex.lock();
+        }
+        MachineState v = _valore;
+        _mutex.unlock();
+        return v;
+    }
+    uint64_t attesaScrittore = 0;
+private:
+    hal::Mutex _mutex;
+    MachineState _valore = statoVersione(0);
+};
+
+class StatoSenzaSync {
+public:
+    void scrivi(const MachineState &v) {
+        uint32_t p[PAROLE];
+        memcpy(p, &v, sizeof(v));
+        for (int i = 0; i < PAROLE; i++) _parole[i].store(p[i], std::memory_order_relaxed);
+    }
+    MachineState leggi(uint32_t *ripetute) {
+        uint32_t p[PAROLE];
+        for (int i = 0; i < PAROLE; i++) p[i] = _parole[i].load(std::memory_order_relaxed);
+        MachineState v;
+        memcpy(&v, p, sizeof(v));
+        *ripetute = 0;
+        return v;
+    }
+    uint64_t attesaScrittore = 0;
+private:
+    static const int PAROLE = sizeof(MachineState) / 4;
+    std::atomic<uint32_t> _parole[PAROLE] = {};
+};
+
+class StatoSeqlock {
+public:
+    void scrivi(const MachineState &v) { _seqlock.scrivi(v); }
+    MachineState leggi(uint32_t *ripetute) { return _seqlock.leggi(ripetute); }
+    uint64_t attesaScrittore = 0;     // Lo scrittore non attende mai
+private:
+    Seqlock<MachineState> _seqlock;
+};
+
+struct EsitoStato {
+    uint64_t letture, spezzate, indietro, ripetute, scritture, attesaScrittore;
+    double p50_ns, p99_ns, p999_ns, max_ns;
+};
+
+// ripetute: seqlock, copie rifatte per una scrittura concorrente; mutex, letture che hanno atteso il lock
+template <typename P>
+static EsitoStato provaStato(P &pubblicato, double nsCiclo) {
+    std::atomic<bool> fine(false);
+    std::vector<uint64_t> latenze[STATO_LETTORI];
+    uint64_t spezzate[STATO_LETTORI] = {}, indietro[STATO_LETTORI] = {}, ripetute[STATO_LETTORI] = {};
+    uint64_t letture[STATO_LETTORI] = {};
+    uint64_t scritture = 0;
+
+    std::thread scrittore([&]() {
+        for (uint32_t n = 1; !fine.load(std::memory_order_relaxed); n++) {
+            pubblicato.scrivi(statoVersione(n));
+            scritture++;
+        }
+    });
+    std::vector<std::thread> lettori;
+    for (int l = 0; l < STATO_LETTORI; l++) {
+        latenze[l].reserve(STATO_CAMPIONI);
+        lettori.emplace_back([&, l]() {
+            uint32_t ultima = 0;
+            while (!fine.load(std::memory_order_relaxed)) {
+                uint32_t r;
+                uint64_t c0 = cicli();
+                MachineState m = pubblicato.leggi(&r);
+                uint64_t c = cicli() - c0;
+                if (latenze[l].size() < STATO_CAMPIONI) latenze[l].push_back(c);
+                letture[l]++;
+                ripetute[l] += r;
+                if (!statoCoerente(m)) spezzate[l]++;
+                else if (m.versione < ultima) indietro[l]++;
+                else ultima = m.versione;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(STATO_MS));
+    fine = true;
+    scrittore.join();
+    for (std::thread &t : lettori) t.join();
+
+    EsitoStato e = {};
+    std::vector<uint64_t> tutte;
+    for (int l = 0; l < STATO_LETTORI; l++) {
+        e.letture += letture[l];
+        e.spezzate += spezzate[l];
+        e.indietro += indietro[l];
+        e.ripetute += ripetute[l];
+        tutte.insert(tutte.end(), latenze[l].begin(), latenze[l].end());
+    }
+    std::sort(tutte.begin(), tutte.end());
+    e.scritture = scritture;
+    e.attesaScrittore = pubblicato.attesaScrittore;
+    if (!tutte.empty()) {
+        e.p50_ns = tutte[tutte.size() / 2] * nsCiclo;
+        e.p99_ns = tutte[tutte.size() * 99 / 100] * nsCiclo;
+        e.p999_ns = tutte[tutte.size() * 999 / 1000] * nsCiclo;
+        e.max_ns = tutte.back() * nsCiclo;
+    }
+    return e;
+}
+
+static void rigaStato(FILE *out, const char *nome, const EsitoStato &e) {
+    fprintf(out, "  %-11s %9llu %8llu %8llu %9llu %9llu %9llu %7.1f %7.1f %8.0f %8.2f\n", nome,
+            (unsigned long long)e.letture, (unsigned long long)e.spezzate, (unsigned long long)e.indietro,
+            (unsigned long long)e.ripetute, (unsigned long long)e.scritture, (unsigned long long)e.attesaScrittore,
+            e.p50_ns, e.p99_ns, e.p999_ns, e.max_ns / 1e6);
+}
+
+static int benchmarkStato(FILE *out) {
+    // ns per ciclo del contatore (le latenze sono misurate in cicli, più fini del clock)
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = cicli();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    uint64_t c1 = cicli();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    if (c1 == c0) {
+        fprintf(out, "stato: contatore di cicli non disponibile su questa architettura\n");
+        return 0;
+    }
+    double nsCiclo = ns / (double)(c1 - c0);
+
+    static StatoSeqlock seqlock;
+    static StatoMutex mutex;
+    static StatoSenzaSync senzaSync;
+    EsitoStato es = provaStato(seqlock, nsCiclo);
+    EsitoStato em = provaStato(mutex, nsCiclo);
+    EsitoStato en = provaStato(senzaSync, nsCiclo);
+
+    fprintf(out, "\n=== VENDING SIM: stato (MachineState %zu byte, 1 scrittore + %d lettori, %d ms per modo, %u CPU) ===\n",
+            sizeof(MachineState), STATO_LETTORI, STATO_MS, std::thread::hardware_concurrency());
+    fprintf(out, "  %-11s %9s %8s %8s %9s %9s %9s %7s %7s %8s %8s\n", "Modo", "letture", "spezzate", "indietro",
+            "rip/att", "scritture", "scr. att", "p50 ns", "p99 ns", "p99.9 ns", "max ms");
+    rigaStato(out, "Seqlock", es);
+    rigaStato(out, "Mutex", em);
+    rigaStato(out, "Senza sync", en);
+
+    int falliti = 0;
+    if (es.spezzate || es.indietro || em.spezzate || em.indietro) falliti++;
+    if (es.letture == 0 || es.scritture == 0) falliti++;
+    fprintf(out, "rip/att: seqlock, copie rifatte per una scrittura concorrente (nessuna attesa);"
+            " mutex, letture in attesa del lock\n");
+    fprintf(out, "scr. att: scritture in attesa di un lettore; max: thread sospeso dal sistema operativo\n");
+    fprintf(out, "Verifica: %s (seqlock e mutex senza copie spezzate o versioni all'indietro;"
+            " senza sync %llu spezzate)\n", falliti ? "FALLITA" : "ok", (unsigned long long)en.spezzate);
+    return falliti;
+}
+
+// ======================================================================================
+// BENCHMARK RING: SpscRing con produttore e consumatore su due thread
+// ======================================================================================
+// Ogni elemento è funzione del suo numero n (come le letture del sonar: istante e
+// valore): il consumatore verifica ordine, assenza di buchi e duplicati, e che nessun
+// elemento sia una copia spezzata. Due produttori: "attende" ripete il push con coda
+// piena (nessuna perdita ammessa), "ISR" non attende mai e conta i rifiutati
+// (ricevuti + rifiutati = inviati); produce a raffiche di RING_RAFFICA e poi cede la
+// CPU, come un interrupt che torna al thread interrotto. Confronto di throughput con una coda limitata
+// protetta da mutex, stessa capacità e stessi cicli.
+
+static const uint32_t RING_ELEMENTI = 1u << 21;
+static const uint32_t RING_LOTTO = 16;          // pop a lotti del consumatore
+static const uint32_t RING_RAFFICA = 64;        // Produttore ISR: elementi per interrupt
+
+struct ElementoRing {
+    uint32_t n;
+    uint32_t t;
+    int32_t a, b;
+};
+
+static ElementoRing elementoRing(uint32_t n) {
+    return {n, n * 3u + 1, (int32_t)(n * 7u), (int32_t)~n};
+}
+
+static bool elementoCoerente(const ElementoRing &e) {
+    ElementoRing atteso = elementoRing(e.n);
+    return memcmp(&e, &atteso, sizeof(e)) == 0;
+}
+
+// Stessa interfaccia di SpscRing con std::deque e un mutex
+template <uint32_t N>
+class RingMutex {
+public:
+    bool push(const ElementoRing &v) {
+        std::lock_guard<std::mutex> l(_mutex);
+        if (_coda.size() >= N) {
+            _persi++;
+            return false;
+        }
+        _coda.push_back(v);
+        return true;
+    }
+    bool pop(ElementoRing &v) {
+        std::lock_guard<std::mutex> l(_mutex);
+        if (_coda.empty()) return false;
+        v = _coda.front();
+        _coda.pop_front();
+        return true;
+    }
+    uint32_t pop(ElementoRing *v, uint32_t max) {
+        std::lock_guard<std::mutex> l(_mutex);
+        uint32_t n = 0;
+        while (n < max && !_coda.empty()) {
+            v[n++] = _coda.front();
+            _coda.pop_front();
+        }
+        return n;
+    }
+    uint32_t persi() const { return _persi; }
+private:
+    std::mutex _mutex;
+    std::deque<ElementoRing> _coda;
+    uint32_t _persi = 0;
+};
+
+struct EsitoRing {
+    uint64_t inviati, ricevuti, rifiutati, buchi, spezzati;
+    double secondi;
+};
+
+// attende: il produttore ripete finché l'elemento entra; lotto: pop(v, RING_LOTTO)
+template <typename Q>
+static EsitoRing provaRing(Q &q, bool attende, bool lotto) {
+    EsitoRing e = {};
+    std::atomic<bool> fine(false);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    std::thread produttore([&]() {
+        for (uint32_t n = 0; n < RING_ELEMENTI; n++) {
+            if (!attende && n % RING_RAFFICA == RING_RAFFICA - 1) std::this_thread::yield();
+            if (q.push(elementoRing(n))) continue;
+            e.rifiutati++;
+            if (!attende) continue;
+            std::this_thread::yield();
+            n--;
+        }
+        fine = true;
+    });
+    std::thread consumatore([&]() {
+        uint32_t atteso = 0;
+        ElementoRing v[RING_LOTTO];
+        while (true) {
+            bool finito = fine.load(std::memory_order_acquire);
+            uint32_t k = lotto ? q.pop(v, RING_LOTTO) : (q.pop(v[0]) ? 1 : 0);
+            for (uint32_t i = 0; i < k; i++) {
+                if (!elementoCoerente(v[i])) e.spezzati++;
+                else if (v[i].n < atteso || (attende && v[i].n != atteso)) e.buchi++;
+                else atteso = v[i].n + 1;
+            }
+            e.ricevuti += k;
+            if (k) continue;
+            if (finito) break;      // Coda vuota dopo la fine del produttore
+            std::this_thread::yield();
+        }
+    });
+    produttore.join();
+    consumatore.join();
+    e.secondi = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    e.inviati = RING_ELEMENTI;
+    return e;
+}
+
+static void rigaRing(FILE *out, const char *nome, const EsitoRing &e) {
+    fprintf(out, "  %-22s %9llu %9llu %9llu %6llu %8llu %8.2f %9.1f\n", nome, (unsigned long long)e.inviati,
+            (unsigned long long)e.ricevuti, (unsigned long long)e.rifiutati, (unsigned long long)e.buchi,
+            (unsigned long long)e.spezzati, e.ricevuti / e.secondi / 1e6, e.secondi * 1e9 / e.inviati);
+}
+
+// Stesso thread, coda mai piena né vuota: costo di push + pop senza contesa
+template <typename Q>
+static double nsCoppia(Q &q) {
+    const uint32_t giri = RING_ELEMENTI;
+    ElementoRing v;
+    uint32_t controllo = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < giri; n++) {
+        q.push(elementoRing(n));
+        if (q.pop(v)) controllo += v.n;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    filtriPozzo = (int32_t)controllo;
+    return ns / giri;
+}
+
+static int benchmarkRing(FILE *out) {
+    static SpscRing<ElementoRing, 8> ring8;
+    static SpscRing<ElementoRing, 256> ring256;
+    static RingMutex<256> mutex256;
+    static SpscRing<ElementoRing, 256> isr256;
+    static RingMutex<256> isrMutex256;
+
+    EsitoRing r8 = provaRing(ring8, true, false);
+    EsitoRing r256 = provaRing(ring256, true, false);
+    EsitoRing r256l = provaRing(ring256, true, true);
+    EsitoRing m256 = provaRing(mutex256, true, false);
+    EsitoRing m256l = provaRing(mutex256, true, true);
+    EsitoRing ri = provaRing(isr256, false, true);
+    EsitoRing mi = provaRing(isrMutex256, false, true);
+
+    fprintf(out, "\n=== VENDING SIM: ring (SpscRing, elementi da %zu byte, %u per prova, 1 produttore + 1 consumatore, %u CPU) ===\n",
+            sizeof(ElementoRing), RING_ELEMENTI, std::thread::hardware_concurrency());
+    fprintf(out, "  %-22s %9s %9s %9s %6s %8s %8s %9s\n", "Coda", "inviati", "ricevuti", "rifiutati", "buchi",
+            "spezzati", "M el/s", "ns/el");
+    rigaRing(out, "SpscRing 8", r8);
+    rigaRing(out, "SpscRing 256", r256);
+    rigaRing(out, "SpscRing 256 lotti", r256l);
+    rigaRing(out, "Mutex 256", m256);
+    rigaRing(out, "Mutex 256 lotti", m256l);
+    rigaRing(out, "SpscRing 256 ISR", ri);
+    rigaRing(out, "Mutex 256 ISR", mi);
+
+    static SpscRing<ElementoRing, 256> soloRing;
+    static RingMutex<256> soloMutex;
+    double nsRing = nsCoppia(soloRing), nsMutex = nsCoppia(soloMutex);
+    fprintf(out, "Push + pop stesso thread: SpscRing %.1f ns, mutex %.1f ns\n", nsRing, nsMutex);
+
+    int falliti = 0;
+    const EsitoRing *senzaPerdite[] = {&r8, &r256, &r256l, &m256, &m256l};
+    for (const EsitoRing *e : senzaPerdite) {
+        if (e->ricevuti != e->inviati || e->buchi || e->spezzati) falliti++;
+    }
+    const EsitoRing *conPerdite[] = {&ri, &mi};
+    for (const EsitoRing *e : conPerdite) {
+        if (e->ricevuti + e->rifiutati != e->inviati || e->buchi || e->spezzati) falliti++;
+    }
+    if (ring8.persi() != r8.rifiutati || isr256.persi() != ri.rifiutati || isrMutex256.persi() != mi.rifiutati) falliti++;
+    fprintf(out, "rifiutati: push con coda piena (attende: ripetuti; ISR: elementi persi, contati da persi())\n");
+    fprintf(out, "buchi: elementi fuori ordine, mancanti o duplicati; spezzati: copie di due elementi diversi\n");
+    fprintf(out, "Verifica: %s (nessun buco né copia spezzata; senza attesa ricevuti + rifiutati = inviati)\n",
+            falliti ? "FALLITA" : "ok");
+    return falliti;
+}
+
+// ======================================================================================
+// GIORNALE IN FLASH (FlashJournal su SimFlash)
+// ======================================================================================
+// Transazioni sintetiche sul giornale, senza la macchina: ogni moneta è un lotto (0.8s
+// l'una dall'altra, oltre GIORNALE_LOTTO_MS), poi pezzo erogato e resto; rifornimento
+// ogni 20 clienti, calibrazione riscritta ogni 5000. Macchina sempre occupata, mai in
+// idle profondo: il banco successivo si cancella nella pausa dopo un cliente, appena il
+// banco attivo passa GIORNALE_SOGLIA_PREPARA (come fsmDispatch). Ogni 97 transazioni un reset, metà a metà del program di un record
+// (flash_cut): il giornale nuovo sulla stessa flash deve ritrovare l'ultimo lotto integro.
+// In coda, un banco intero senza pause: l'erase sincrono al cambio banco (ultima
+// risorsa) è contato e lo stato resta integro.
+
+static const uint32_t GIORNALE_TRANSAZIONI = 40000;
+static const uint32_t GIORNALE_CICLI_ERASE = 10000;     // Settore F401RE da datasheet (minimo garantito)
+static const double GIORNALE_CICLI_BYTE = 41;           // Target: lettura + crc8 bit a bit per byte rigiocato
+static const double GIORNALE_AL_GIORNO = 500;           // Transazioni al giorno per la stima di usura
+
+static bool statiUguali(const StatoGiornale &a, const StatoGiornale &b) {
+    return !memcmp(a.scorte, b.scorte, sizeof(a.scorte)) && a.credito == b.credito && a.incassato == b.incassato;
+}
+
+static int benchmarkGiornale(FILE *out) {
+    hal::Flash &flash = hal::board().flash;
+    const StatoGiornale iniziale = {{5, 5, 5, 5}, 0, 0};
+    const int32_t prezzi[4] = {100, 200, 150, 120};
+
+    std::unique_ptr<FlashJournal> g(new FlashJournal(flash));
+    g->recupera(iniziale);
+    StatoGiornale stato = iniziale;     // Stato della macchina
+    StatoGiornale durevole = iniziale;  // Ultimo lotto scritto per intero
+    CalibrazioneMonete cal;
+    memset(&cal, 0x5A, sizeof(cal));
+    g->scriviBlob(&cal, sizeof(cal));
+
+    GiornaleStats tot = {};             // Somma sulle istanze (una per reset)
+    uint32_t lotti = 0, reset = 0, tagli = 0, persi = 0, calibrazioni = 1, anticipati = 0, verifiche = 0;
+    uint64_t stallMax = 0, stallTot = 0, busyPrepara = 0;
+    uint64_t nsRecuperoTot = 0, nsRecuperoMax = 0;
+    uint32_t byteRecuperoMax = 0, recordRecuperoMax = 0;
+    uint32_t seme = 12345;
+    auto caso = [&seme](uint32_t n) {
+        seme = seme * 1103515245u + 12345u;
+        return (seme >> 16) % n;
+    };
+    auto somma = [&tot](const GiornaleStats &s) {
+        tot.record += s.record;
+        tot.checkpoint += s.checkpoint;
+        tot.byteLogici += s.byteLogici;
+        tot.byteScritti += s.byteScritti;
+        tot.cambiBanco += s.cambiBanco;
+        tot.erase += s.erase;
+        tot.eraseSincroni += s.eraseSincroni;
+    };
+    // Un lotto: la FSM ha cambiato lo stato, il giornale lo scrive (program: CPU ferma)
+    auto lotto = [&]() {
+        g->aggiorna(stato);
+        uint64_t busy = flash_stats().busy_us;
+        bool ok = g->scrivi();
+        uint64_t stall = flash_stats().busy_us - busy;
+        lotti++;
+        stallTot += stall;
+        if (stall > stallMax) stallMax = stall;
+        if (ok) durevole = stato;
+    };
+
+    for (uint32_t n = 1; n <= GIORNALE_TRANSAZIONI; n++) {
+        if (n % 20 == 0) {
+            for (int k = 0; k < 4; k++) stato.scorte[k] = 5;
+            lotto();
+        }
+        int p = (int)caso(4);
+        while (stato.scorte[p] == 0) p = (p + 1) % 4;
+
+        int32_t inserito = 0;
+        while (inserito < prezzi[p]) {
+            int32_t moneta = caso(4) ? 100 : 50;
+            inserito += moneta;
+            stato.credito += moneta;
+            lotto();
+        }
+        // Conferma: credito → impegnato, il denaro in macchina non cambia (nessun record)
+        stato.scorte[p]--;
+        stato.credito -= prezzi[p];
+        stato.incassato += prezzi[p];
+        lotto();
+        if (stato.credito > 0) {
+            stato.credito = 0;
+            lotto();
+        }
+
+        if (g->bancoDaAnticipare()) {
+            uint64_t busy = flash_stats().busy_us;
+            uint32_t erase = g->stats().erase;
+            g->preparaBanco();
+            busyPrepara += flash_stats().busy_us - busy;
+            verifiche++;
+            anticipati += g->stats().erase - erase;
+        }
+        if (n % 5000 == 0) {
+            cal.tagli = (uint16_t)n;
+            g->scriviBlob(&cal, sizeof(cal));
+            calibrazioni++;
+        }
+
+        if (n % 97 == 0) {
+            if (caso(2)) {
+                // Reset durante il program della moneta appena inserita: la moneta è persa
+                flash_cut(caso(5));
+                stato.credito += 100;
+                lotto();
+                tagli++;
+            }
+            somma(g->stats());
+            g.reset(new FlashJournal(flash));
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            bool ok = g->recupera(iniziale);
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+            reset++;
+            nsRecuperoTot += ns;
+            if (ns > nsRecuperoMax) nsRecuperoMax = ns;
+            const GiornaleStats &s = g->stats();
+            if (s.recuperoByte > byteRecuperoMax) byteRecuperoMax = s.recuperoByte;
+            if (s.recuperoRecord > recordRecuperoMax) recordRecuperoMax = s.recuperoRecord;
+
+            CalibrazioneMonete letta;
+            bool blobOk = g->blob(&letta, sizeof(letta)) == sizeof(letta) && !memcmp(&letta, &cal, sizeof(cal));
+            if (!ok || !statiUguali(g->stato(), durevole) || !blobOk) persi++;
+            stato = durevole = g->stato();
+        }
+    }
+    somma(g->stats());
+
+    // Ultima risorsa: nessuna pausa per un banco intero, erase nel percorso di scrittura
+    uint32_t sincroniPrima = g->stats().eraseSincroni, cambiPrima = g->stats().cambiBanco;
+    uint64_t stallRisorsa = 0;
+    for (uint32_t n = 0; g->stats().cambiBanco < cambiPrima + 2 && n < 1000000; n++) {
+        stato.credito = (stato.credito + 50) % 1000;
+        g->aggiorna(stato);
+        uint64_t busy = flash_stats().busy_us;
+        if (g->scrivi()) durevole = stato;
+        uint64_t stall = flash_stats().busy_us - busy;
+        if (stall > stallRisorsa) stallRisorsa = stall;
+    }
+    uint32_t sincroni = g->stats().eraseSincroni - sincroniPrima;
+    FlashJournal rilettoRisorsa(flash);
+    bool risorsaOk = rilettoRisorsa.recupera(iniziale) && statiUguali(rilettoRisorsa.stato(), durevole);
+
+    FlashStats &fs = flash_stats();
+    uint32_t banchi = g->banchi();
+    double wa = tot.byteLogici ? (double)tot.byteScritti / tot.byteLogici : 0;
+    double perErase = tot.erase ? (double)GIORNALE_TRANSAZIONI / tot.erase : 0;
+    double giorni = perErase * GIORNALE_CICLI_ERASE * banchi / GIORNALE_AL_GIORNO;
+    double giorniSulPosto = (double)GIORNALE_CICLI_ERASE * banchi / (GIORNALE_AL_GIORNO * lotti / GIORNALE_TRANSAZIONI);
+
+    fprintf(out, "\n=== VENDING SIM: giornale (FlashJournal, %u banchi da %u KB, blocchi da %u byte) ===\n",
+            banchi, flash.eraseSize() / 1024, GIORNALE_BLOCCO);
+    fprintf(out, "Transazioni    : %u (%u lotti, %u record, %u checkpoint, %u calibrazioni)\n",
+            GIORNALE_TRANSAZIONI, lotti, tot.record, tot.checkpoint, calibrazioni);
+    fprintf(out, "Byte           : %llu logici, %llu programmati → write amplification %.2f, %.1f byte/transazione\n",
+            (unsigned long long)tot.byteLogici, (unsigned long long)tot.byteScritti, wa,
+            (double)tot.byteScritti / GIORNALE_TRANSAZIONI);
+    fprintf(out, "Program        : CPU ferma media %.1f us, max %llu us per lotto (%u erase nel percorso di scrittura)\n",
+            lotti ? (double)stallTot / lotti : 0, (unsigned long long)stallMax, tot.eraseSincroni);
+    fprintf(out, "Banchi         : %u cambi, %u erase anticipati in pausa (%u verifiche oltre il %d%% del banco,\n"
+                 "                 CPU ferma %.1f s in tutto), %.0f transazioni per erase\n",
+            tot.cambiBanco, anticipati, verifiche, GIORNALE_SOGLIA_PREPARA, busyPrepara / 1e6, perErase);
+    fprintf(out, "Senza pause    : %u erase sincroni al cambio banco (ultima risorsa, CPU ferma %.1f s), stato %s\n",
+            sincroni, stallRisorsa / 1e6, risorsaOk ? "integro" : "PERSO");
+    fprintf(out, "Usura          : %u cicli x %u settori → %.0f anni a %.0f transazioni/giorno\n",
+            GIORNALE_CICLI_ERASE, banchi, giorni / 365, GIORNALE_AL_GIORNO);
+    fprintf(out, "Sul posto      : erase + program per lotto (come la calibrazione fino alla v8.38): %u erase,\n"
+                 "                 CPU ferma ~1 s per lotto, usura in %.0f giorni\n", lotti, giorniSulPosto);
+    fprintf(out, "Reset          : %u (%u durante un program), stato ritrovato %u/%u\n", reset, tagli, reset - persi, reset);
+    fprintf(out, "Recupero       : host media %.1f us, max %.1f us; max %u byte letti, %u record rigiocati\n"
+                 "                 (target ~%.2f ms a %.0f cicli/byte e 84MHz)\n",
+            reset ? nsRecuperoTot / 1000.0 / reset : 0, nsRecuperoMax / 1000.0, byteRecuperoMax, recordRecuperoMax,
+            byteRecuperoMax * GIORNALE_CICLI_BYTE / 84e3, GIORNALE_CICLI_BYTE);
+    fprintf(out, "Flash dati     : %u erase, %llu byte programmati, %llu letti, %u violazioni NOR\n",
+            fs.erases, (unsigned long long)fs.programmed, (unsigned long long)fs.read_bytes, fs.violations);
+
+    int falliti = 0;
+    if (persi) falliti++;
+    if (fs.violations) falliti++;
+    if (tot.eraseSincroni) falliti++;
+    if (anticipati == 0 || sincroni != 2 || !risorsaOk) falliti++;
+    if (tot.cambiBanco < 2) falliti++;
+    if (stallMax >= 1000) falliti++;
+    if (byteRecuperoMax > GIORNALE_BLOCCO + 512) falliti++;
+    fprintf(out, "Verifica: %s (stato ritrovato a ogni reset, nessuna violazione NOR, nessun erase nel\n"
+                 "          percorso di scrittura con le pause tra clienti, lotto < 1ms, recupero entro un\n"
+                 "          blocco, erase sincrono contato solo senza pause)\n",
+            falliti ? "FALLITA" : "ok");
+    return falliti;
+}
+
+// App sempre connessa (es. pannello di monitoraggio) con ambiente che varia: T/H
+// cambiano ogni 12s, un acquisto ogni 45s. Confronto TEMP+HUM+STATUS contro SNAPSHOT.
+static void scenarioBle(uint64_t duration) {
+    ble_connect(1 * SEC);
+    ble_subscribe(1 * SEC + 300000, hal::BLE_CHAR_TEMP, true);
+    ble_subscribe(1 * SEC + 450000, hal::BLE_CHAR_HUM, true);
+    ble_subscribe(1 * SEC + 600000, hal::BLE_CHAR_STATUS, true);
+    ble_subscribe(1 * SEC + 750000, hal::BLE_CHAR_SNAPSHOT, true);
+    for (uint64_t t = 12 * SEC; t < duration; t += 12 * SEC) {
+        at_isr(t, []() {
+            static int passo = 0;
+            passo++;
+            world().temp_c = 22 + passo % 4;        // 22..25 °C
+            world().hum_pct = 45 + (passo / 2) % 6; // 45..50 %
+        });
+    }
+    const uint64_t ciclo = 45 * SEC;
+    int cliente = 0;
+    for (uint64_t t0 = 5 * SEC; t0 + ciclo <= duration; t0 += ciclo, cliente++) {
+        at_isr(t0 + 2 * SEC, []() { world().distance_cm = 30.0f; });
+        ble_command(t0 + 6 * SEC, (uint8_t)(1 + cliente % 4));
+        coin_pulse(t0 + 8 * SEC, 600000, 0.80f);
+        coin_pulse(t0 + 10 * SEC, 600000, 0.80f);
+        ble_command(t0 + 13 * SEC, 10);
+        if (cliente % 4 == 3) ble_command(t0 + 20 * SEC, 11);
+        at_isr(t0 + 28 * SEC, []() { world().distance_cm = 150.0f; });
+    }
+    ble_disconnect(duration - SEC);     // Chiude il conteggio del tempo connesso
+}
+
+// Client con comandi a sequenza: raffiche pipelined (più comandi nello stesso evento di
+// connessione, senza attendere l'esito) e rifiuti attesi per ogni motivo riproducibile.
+struct RichiestaAttesa {
+    uint64_t t_us;
+    uint8_t cmd;
+    uint8_t seq;
+    uint8_t esito;
+};
+
+static std::vector<RichiestaAttesa> richieste;
+
+static void richiesta(uint64_t t_us, uint8_t cmd, uint8_t esito) {
+    RichiestaAttesa r = {t_us, cmd, (uint8_t)(richieste.size() + 1), esito};
+    richieste.push_back(r);
+    ble_request(t_us, cmd, r.seq);
+}
+
+// Lotto TLV [CMD_LOTTO, seq, tlv...]: un esito atteso per comando (seq, seq + 1, ...)
+// oppure uno solo per il lotto se malformato
+static void lotto(uint64_t t_us, std::initializer_list<uint8_t> tlv, std::initializer_list<uint8_t> cmd,
+                  std::initializer_list<uint8_t> esiti) {
+    uint8_t seq = (uint8_t)(richieste.size() + 1);
+    std::vector<uint8_t> bytes = {CMD_LOTTO, seq};
+    bytes.insert(bytes.end(), tlv.begin(), tlv.end());
+    const uint8_t *c = cmd.begin();
+    for (uint8_t e : esiti) {
+        RichiestaAttesa r = {t_us, *c++, (uint8_t)(richieste.size() + 1), e};
+        richieste.push_back(r);
+    }
+    ble_request(t_us, bytes.data(), (uint16_t)bytes.size(), (int)esiti.size());
+}
+
+// Lotto fermato al primo rifiuto: scorte SNACK e credito prima e dopo
+static struct {
+    int scorte;
+    int32_t credito;
+    bool invariato;
+} lottoSaltato;
+
+static void scenarioCmd(uint64_t duration) {
+    ble_connect(1 * SEC);
+    ble_subscribe(1 * SEC + 300000, hal::BLE_CHAR_RESULT, true);
+    ble_subscribe(1 * SEC + 450000, hal::BLE_CHAR_STATUS, true);
+
+    // RIPOSO: comando sconosciuto, conferma fuori stato, selezione valida (stesso evento)
+    richiesta(2 * SEC, 7, ESITO_SCONOSCIUTO);
+    richiesta(2 * SEC, 10, ESITO_STATO);
+    richiesta(2 * SEC, 2, ESITO_ACCETTATO);
+    // Utente presente → ATTESA_MONETA: conferma senza credito, poi 2 monete e conferma
+    at_isr(3 * SEC, []() { world().distance_cm = 30.0f; });
+    richiesta(6 * SEC, 10, ESITO_CREDITO);
+    coin_pulse(7 * SEC, 600000, 0.80f);
+    coin_pulse(9 * SEC, 600000, 0.80f);
+    // Conferma + selezione + annullo pipelined: gli ultimi due trovano EROGAZIONE, dove la
+    // selezione è del cliente successivo (pipeline) e l'annullo non ha credito da rendere
+    richiesta(12 * SEC, 10, ESITO_ACCETTATO);
+    richiesta(12 * SEC, 3, ESITO_ACCETTATO);
+    richiesta(12 * SEC, 9, ESITO_STATO);
+    richiesta(20 * SEC, 11, ESITO_ACCETTATO);
+    // Raffica di 12 selezioni nello stesso evento: esiti accorpati (6 per notifica)
+    for (int i = 0; i < 12; i++) richiesta(25 * SEC, (uint8_t)(1 + i % 4), ESITO_ACCETTATO);
+    // Esaurimento: 5 acquisti di ACQUA (1 EUR), il sesto è rifiutato alla selezione
+    for (int i = 0; i < 6; i++) {
+        uint64_t t = (30 + 8 * i) * SEC;
+        richiesta(t, 1, i < 5 ? ESITO_ACCETTATO : ESITO_ESAURITO);
+        if (i < 5) {
+            coin_pulse(t + 1 * SEC, 600000, 0.80f);
+            richiesta(t + 3 * SEC, 10, ESITO_ACCETTATO);
+        }
+    }
+
+    // --- Lotti TLV (una scrittura ATT per più comandi) ---
+    // ACQUA esaurita: rifornimento +3 solo ACQUA, 3 monete, selezione + conferma di 3 pezzi
+    lotto(80 * SEC, {CMD_RIFORNIMENTO, 4, 3, 0, 0, 0}, {CMD_RIFORNIMENTO}, {ESITO_ACCETTATO});
+    for (int i = 0; i < 3; i++) coin_pulse((82 + 2 * i) * SEC, 600000, 0.80f);
+    lotto(90 * SEC, {CMD_ACQUA, 0, CMD_CONFERMA, 1, 3}, {CMD_ACQUA, CMD_CONFERMA},
+          {ESITO_ACCETTATO, ESITO_ACCETTATO});
+    // Malformati (quantità oltre SCORTE_MAX, codice sconosciuto, TLV troncato): nessun effetto
+    lotto(100 * SEC, {CMD_SNACK, 0, CMD_CONFERMA, 1, 9}, {CMD_LOTTO}, {ESITO_FORMATO});
+    lotto(100 * SEC, {CMD_SNACK, 0, 7, 0}, {CMD_LOTTO}, {ESITO_FORMATO});
+    lotto(100 * SEC, {CMD_RIFORNIMENTO, 4, 1, 1}, {CMD_LOTTO}, {ESITO_FORMATO});
+    // SNACK 2 EUR: 2 pezzi con 2 monete → credito insufficiente; con 4 monete accettato
+    lotto(102 * SEC, {CMD_SNACK, 0, CMD_CONFERMA, 1, 2}, {CMD_SNACK, CMD_CONFERMA},
+          {ESITO_ACCETTATO, ESITO_CREDITO});
+    for (int i = 0; i < 4; i++) coin_pulse((104 + 2 * i) * SEC, 600000, 0.80f);
+    lotto(112 * SEC, {CMD_CONFERMA, 1, 2}, {CMD_CONFERMA}, {ESITO_ACCETTATO});
+    // Scorte parziali: ACQUA +2, 3 pezzi richiesti → rifiuto senza restituzione del credito;
+    // il lotto si ferma al rifiuto, la conferma da 2 che segue è saltata
+    lotto(120 * SEC, {CMD_RIFORNIMENTO, 4, 2, 0, 0, 0, CMD_ACQUA, 0}, {CMD_RIFORNIMENTO, CMD_ACQUA},
+          {ESITO_ACCETTATO, ESITO_ACCETTATO});
+    for (int i = 0; i < 3; i++) coin_pulse((122 + 2 * i) * SEC, 600000, 0.80f);
+    lotto(130 * SEC, {CMD_CONFERMA, 1, 3, CMD_CONFERMA, 1, 2}, {CMD_CONFERMA, CMD_CONFERMA},
+          {ESITO_ESAURITO, ESITO_SALTATO});
+    lotto(132 * SEC, {CMD_CONFERMA, 1, 2}, {CMD_CONFERMA}, {ESITO_ACCETTATO});
+    // ACQUA di nuovo esaurita, SNACK selezionato con 2 EUR: [ACQUA, conferma] → la selezione
+    // è rifiutata e la conferma saltata, lo SNACK selezionato prima non è erogato
+    richiesta(140 * SEC, 2, ESITO_ACCETTATO);
+    coin_pulse(141 * SEC, 600000, 0.80f);
+    at_task(142 * SEC + 500000, []() {
+        lottoSaltato.scorte = scorte[2];
+        lottoSaltato.credito = credito;
+    });
+    lotto(143 * SEC, {CMD_ACQUA, 0, CMD_CONFERMA, 1, 1}, {CMD_ACQUA, CMD_CONFERMA},
+          {ESITO_ESAURITO, ESITO_SALTATO});
+    at_task(146 * SEC, []() {
+        lottoSaltato.invariato = (scorte[2] == lottoSaltato.scorte && credito == lottoSaltato.credito &&
+                                  statoCorrente == ATTESA_MONETA);
+    });
+    ble_disconnect(duration - SEC);
+}
+
+// Calibrazione dei tagli sulla macchina e clienti con monete miste: il LDR segue il
+// modello della guida (coin_model), ogni moneta è confrontata col contatore che il
+// firmware ha incrementato (matrice di confusione del riconoscimento in esercizio).
+static const int CALIB_PER_TAGLIO = 20;
+static CanaleMonete canaleCalib(MODELLO_GUIDA, 29);
+static int confusioneCalib[TAGLI][TAGLI + 2];      // Colonne: tagli, ignota, non contata
+static uint32_t contatiCalib[TAGLI + 1];
+
+static uint64_t monetaCalib(uint64_t t_us, uint8_t taglio, bool verifica) {
+    uint64_t fine = canaleCalib.aggiungi(t_us, taglio);
+    if (verifica) {
+        at_task(fine + 300000, [taglio]() {
+            int colonna = TAGLI + 1;
+            for (int c = 0; c <= TAGLI; c++) {
+                if (moneteTaglio[c] != contatiCalib[c]) colonna = c;
+                contatiCalib[c] = moneteTaglio[c];
+            }
+            confusioneCalib[taglio][colonna]++;
+        });
+    }
+    return fine;
+}
+
+static void scenarioCalib(uint64_t duration) {
+    ldr_waveform([](uint64_t t) { return canaleCalib.livello(t); });
+    ble_connect(1 * SEC);
+    ble_subscribe(1 * SEC + 300000, hal::BLE_CHAR_RESULT, true);
+
+    // Salvataggio senza raccolta, poi raccolta vuota: nessun modello da salvare
+    richiesta(2 * SEC, CMD_CALIBRA, ESITO_STATO);
+    lotto(3 * SEC, {CMD_CALIBRA, 1, 1, CMD_CALIBRA, 0}, {CMD_CALIBRA, CMD_CALIBRA},
+          {ESITO_ACCETTATO, ESITO_CALIBRAZIONE});
+    // Raccolta: CALIB_PER_TAGLIO monete per taglio (una ogni 1.5s), poi salvataggio in flash
+    uint64_t t = 4 * SEC;
+    for (int taglio = 0; taglio < TAGLI; taglio++) {
+        if (taglio) lotto(t, {CMD_CALIBRA, 1, (uint8_t)(taglio + 1)}, {CMD_CALIBRA}, {ESITO_ACCETTATO});
+        t += SEC;
+        for (int i = 0; i < CALIB_PER_TAGLIO; i++, t += 1500000) monetaCalib(t, (uint8_t)taglio, false);
+    }
+    richiesta(t, CMD_CALIBRA, ESITO_ACCETTATO);
+    t += 5 * SEC;
+
+    // Cliente: SNACK (2 EUR) con 0.50 + 0.50 + 1, poi ACQUA (1 EUR) con una sola 0.50
+    at_isr(t, []() { world().distance_cm = 30.0f; });
+    richiesta(t + 2 * SEC, 2, ESITO_ACCETTATO);
+    monetaCalib(t + 4 * SEC, TAGLIO_50C, true);
+    monetaCalib(t + 6 * SEC, TAGLIO_50C, true);
+    monetaCalib(t + 8 * SEC, TAGLIO_1E, true);
+    richiesta(t + 10 * SEC, 10, ESITO_ACCETTATO);
+    // Calibrazione con un cliente che ha credito: rifiutata
+    richiesta(t + 20 * SEC, 1, ESITO_ACCETTATO);
+    monetaCalib(t + 21 * SEC, TAGLIO_50C, true);
+    lotto(t + 23 * SEC, {CMD_CALIBRA, 1, 1}, {CMD_CALIBRA}, {ESITO_STATO});
+    richiesta(t + 24 * SEC, 10, ESITO_CREDITO);
+    monetaCalib(t + 25 * SEC, TAGLIO_50C, true);
+    richiesta(t + 27 * SEC, 10, ESITO_ACCETTATO);
+    t += 35 * SEC;
+
+    // Monete miste a caso (credito che cresce, resto al timeout): riconoscimento in esercizio
+    uint32_t seed = 7;
+    for (; t + 40 * SEC < duration; t += 1500000) {
+        seed = seed * 1103515245u + 12345u;
+        monetaCalib(t, (uint8_t)((seed >> 16) % TAGLI), true);
+    }
+    at_isr(t, []() { world().distance_cm = 150.0f; });
+    ble_disconnect(duration - SEC);
+}
+
+// Monete dei clienti: taglio vero contro taglio accreditato; ritorna il numero di errori
+static int verificaCalib(FILE *out) {
+    // Riletta come al boot: giornale nuovo sulla stessa flash
+    CalibrazioneMonete letta;
+    FlashJournal riletto(hal::board().flash);
+    bool inFlash = riletto.recupera(giornale.stato()) && riletto.blob(&letta, sizeof(letta)) == sizeof(letta) &&
+                   calibrazioneValida(letta) && !memcmp(&letta, &calibrazione, sizeof(letta));
+    int corrette = 0, totale = 0;
+    fprintf(out, "Riconoscimento : (riga = vero; 0.50 / 1 / 2 / ignota / non contata)\n");
+    for (int t = 0; t < TAGLI; t++) {
+        fprintf(out, "                 %-4s", (t == TAGLIO_50C) ? "0.50" : (t == TAGLIO_1E) ? "1" : "2");
+        for (int c = 0; c < TAGLI + 2; c++) {
+            fprintf(out, " %5d", confusioneCalib[t][c]);
+            totale += confusioneCalib[t][c];
+        }
+        corrette += confusioneCalib[t][t];
+        fprintf(out, "\n");
+    }
+    fprintf(out, "                 %d/%d corrette, calibrazione in flash %s\n", corrette, totale,
+            inFlash ? "riletta uguale" : "NON valida");
+    return (calibrazione.tagli == (1u << TAGLI) - 1 && inFlash && corrette * 10 >= totale * 9) ? 0 : 1;
+}
+
+static const char *nomeEsito(int e) {
+    static const char *nomi[ESITO_COUNT] = {"ACCETTATO", "SCONOSCIUTO", "CODA_PIENA", "STATO",
+                                            "CREDITO", "ESAURITO", "FORMATO", "CALIBRAZIONE", "SALTATO"};
+    return (e >= 0 && e < ESITO_COUNT) ? nomi[e] : "-";
+}
+
+// Esiti ricevuti dal client contro quelli attesi; ritorna il numero di discrepanze
+static int verificaComandi(FILE *out) {
+    CmdStats &c = cmd_stats();
+    int errori = 0;
+    uint64_t raffica = 0;
+    for (size_t i = 0; i < richieste.size(); i++) {
+        const RichiestaAttesa &r = richieste[i];
+        if (c.esito[r.seq] != r.esito) {
+            fprintf(out, "  seq %3u cmd %2u: atteso %s, ricevuto %s\n", r.seq, r.cmd,
+                    nomeEsito(r.esito), nomeEsito(c.esito[r.seq]));
+            errori++;
+        }
+        if (r.t_us == 25 * SEC && c.rtt_us[r.seq] > raffica) raffica = c.rtt_us[r.seq];
+    }
+    fprintf(out, "Esiti comandi  : %u/%zu attesi, %u duplicati", (unsigned)(richieste.size() - errori),
+            richieste.size(), c.duplicates);
+    if (raffica) fprintf(out, ", raffica di 12 completata in %.0f ms", raffica / 1000.0);
+    fprintf(out, "\n");
+    if (fsm.saltati()) {
+        fprintf(out, "Lotti fermati  : %u comandi saltati dopo un rifiuto, SNACK selezionato %s\n",
+                fsm.saltati(), lottoSaltato.invariato ? "non erogato" : "EROGATO");
+        if (!lottoSaltato.invariato) errori++;
+    }
+    return errori;
+}
+
+// ======================================================================================
+// TRAFFICO (cadenza adattiva del sonar)
+// ======================================================================================
+// Giornata compressa: prima metà "giorno" (un passaggio ogni 30-90s: passanti a 120-200cm,
+// clienti che comprano o guardano e vanno via), seconda metà "notte" (un passaggio ogni
+// 10-20 minuti, idle profondo). Il cliente cammina tra la parete (250cm) e il banco
+// (30cm) a 1 m/s, posizione aggiornata ogni 50ms. Latenza di rilevamento: dall'istante
+// in cui attraversa la soglia a utentePresente (debounce di ingresso/uscita compreso).
+
+static const float TRAFFICO_PARETE_CM = 250.0f;
+static const float TRAFFICO_BANCO_CM = 30.0f;
+static const float TRAFFICO_SOGLIA_CM = 40.0f;     // DISTANZA_ATTIVA di main.cpp
+static const float TRAFFICO_USCITA_CM = 60.0f;     // DISTANZA_ATTIVA + isteresi
+static const uint64_t TRAFFICO_PASSO_US = 50000;
+
+struct Attraversamento {
+    uint64_t t_us;
+    bool notte;
+    bool uscita;            // false: arrivo (atteso utentePresente), true: uscita (atteso assente)
+    int64_t latenza_us;     // -1: non rilevato entro 15s
+};
+
+static std::vector<Attraversamento> attraversamenti;
+static uint32_t trafficoSeed = 17;
+static uint32_t pingGiorno = 0;
+static bool sonarFisso = false;
+
+static uint32_t trafficoCaso(uint32_t n) {
+    trafficoSeed = trafficoSeed * 1103515245u + 12345u;
+    return (trafficoSeed >> 8) % n;
+}
+
+static void sondaTraffico(size_t i) {
+    Attraversamento &a = attraversamenti[i];
+    uint64_t ora = hal::now_us();
+    if (utentePresente != a.uscita) {
+        a.latenza_us = (int64_t)(ora - a.t_us);
+        return;
+    }
+    if (ora - a.t_us < 15 * SEC) at_isr(ora + 10000, [i]() { sondaTraffico(i); });
+}
+
+// Camminata a 1 m/s da da a a (cm); ritorna l'istante di arrivo
+static uint64_t camminata(uint64_t t, float da, float a, bool notte) {
+    const float passo = 100.0f * TRAFFICO_PASSO_US / SEC;
+    bool soglia = false;
+    for (float d = da; d != a; ) {
+        d = (a < da) ? std::max(a, d - passo) : std::min(a, d + passo);
+        t += TRAFFICO_PASSO_US;
+        at_isr(t, [d]() { world().distance_cm = d; });
+        if (!soglia && ((a < da) ? d < TRAFFICO_SOGLIA_CM : d > TRAFFICO_USCITA_CM)) {
+            soglia = true;
+            attraversamenti.push_back({t, notte, a > da, -1});
+            size_t i = attraversamenti.size() - 1;
+            at_isr(t, [i]() { sondaTraffico(i); });
+        }
+    }
+    return t;
+}
+
+static uint64_t clienteTraffico(uint64_t t, bool notte, bool compra, int n) {
+    t = camminata(t, TRAFFICO_PARETE_CM, TRAFFICO_BANCO_CM, notte);
+    uint64_t permanenza = (4 + trafficoCaso(7)) * SEC;
+    if (compra) {
+        ble_connect(t + 1 * SEC);
+        ble_command(t + 3 * SEC, (n & 1) ? 3 : 1);  // Prodotti da 1 EUR
+        coin_pulse(t + 5 * SEC, 600000, 0.80f);
+        ble_command(t + 8 * SEC, 10);
+        if (n % 4 == 3) ble_command(t + 12 * SEC, 11);
+        ble_disconnect(t + 14 * SEC);
+        permanenza = 16 * SEC;
+    }
+    return camminata(t + permanenza, TRAFFICO_BANCO_CM, TRAFFICO_PARETE_CM, notte);
+}
+
+static void scenarioTraffico(uint64_t duration) {
+    at_isr(0, []() { world().distance_cm = TRAFFICO_PARETE_CM; });
+    at_isr(duration / 2, []() { pingGiorno = outputs().trig_pulses; });
+    int clienti = 0;
+    for (uint64_t t = 10 * SEC; t + 60 * SEC < duration; ) {
+        bool notte = t >= duration / 2;
+        if (trafficoCaso(100) < (notte ? 50u : 40u)) {
+            t = clienteTraffico(t, notte, trafficoCaso(2) == 0, clienti++);
+        } else {
+            float d = 120.0f + trafficoCaso(81);
+            uint64_t durata = (2 + trafficoCaso(3)) * SEC;
+            at_isr(t, [d]() { world().distance_cm = d; });
+            at_isr(t + durata, []() { world().distance_cm = TRAFFICO_PARETE_CM; });
+            t += durata;
+        }
+        t += (notte ? 600 + trafficoCaso(600) : 30 + trafficoCaso(60)) * SEC;
+    }
+}
+
+static int verificaTraffico(FILE *out, uint64_t duration) {
+    int falliti = 0;
+    fprintf(out, "Traffico       : cadenza sonar %s (rumore %ucm, %ucm/s)\n", sonarFisso ? "fissa" : "adattiva",
+            (sonarFisso ? CADENZA_FISSA : CADENZA_ADATTIVA).rumoreCm,
+            (sonarFisso ? CADENZA_FISSA : CADENZA_ADATTIVA).velocitaCmS);
+    for (int notte = 0; notte < 2; notte++) {
+        for (int uscita = 0; uscita < 2; uscita++) {
+            int n = 0, persi = 0;
+            int64_t somma = 0, massimo = 0;
+            for (const Attraversamento &a : attraversamenti) {
+                if (a.notte != (notte != 0) || a.uscita != (uscita != 0)) continue;
+                n++;
+                if (a.latenza_us < 0) {
+                    persi++;
+                    continue;
+                }
+                somma += a.latenza_us;
+                massimo = std::max(massimo, a.latenza_us);
+            }
+            falliti += persi;
+            fprintf(out, "  %-6s %-7s: %3d, latenza media %6.0f ms, max %6.0f ms, %d non rilevati\n",
+                    notte ? "notte" : "giorno", uscita ? "uscite" : "arrivi", n,
+                    (n > persi) ? somma / 1000.0 / (n - persi) : 0.0, massimo / 1000.0, persi);
+        }
+    }
+    double ore = duration / 2 / 3.6e9;
+    uint32_t ping = outputs().trig_pulses;
+    fprintf(out, "Sonar ping/ora : giorno %.0f, notte %.0f (%u letture, %u a cadenza minima)\n",
+            pingGiorno / ore, (ping - pingGiorno) / ore, sonar.readings(), sonar.cadenza().rapide());
+    return falliti;
+}
+
+// Cliente che inserisce una moneta e annulla col pulsante, poi preme a vuoto (senza
+// credito e in RIPOSO). Ogni pressione ha rimbalzi (0-6 fronti in 0.05-0.8ms) alla
+// pressione e al rilascio; una su tre è un tocco più breve della finestra di debounce.
+// Verifica: una pressione = un EV_ANNULLA, latenza fronte → transizione limitata.
+
+static const uint64_t TASTO_CICLO = 40 * SEC;
+static const uint64_t TASTO_LATENZA_MAX_US = 2000;  // Pressione → fine transizione
+static uint32_t tastoSeed = 23;
+static int tastoPressioni = 0, tastoConCredito = 0;
+
+static uint32_t tastoCaso(uint32_t n) {
+    tastoSeed = tastoSeed * 1103515245u + 12345u;
+    return (tastoSeed >> 8) % n;
+}
+
+// Fronti di un cambio di livello con rimbalzi; ritorna l'istante dell'ultimo fronte
+static uint64_t rimbalzi(uint64_t t, bool premuto) {
+    button_edge(t, premuto);
+    int n = (int)tastoCaso(4) * 2;      // Coppie di fronti: il livello finale è quello giusto
+    for (int i = 0; i < n; i++) {
+        t += 50 + tastoCaso(750);
+        button_edge(t, (i & 1) ? premuto : !premuto);
+    }
+    return t;
+}
+
+static void pressione(uint64_t t, bool credito) {
+    uint64_t tenuta = (tastoPressioni % 3 == 2) ? 15000 : (120 + tastoCaso(280)) * 1000;
+    rimbalzi(t, true);
+    rimbalzi(t + tenuta, false);
+    tastoPressioni++;
+    if (credito) tastoConCredito++;
+}
+
+static void scenarioTasto(uint64_t duration) {
+    for (uint64_t t0 = 2 * SEC; t0 + TASTO_CICLO <= duration; t0 += TASTO_CICLO) {
+        at_isr(t0, []() { world().distance_cm = 30.0f; });
+        coin_pulse(t0 + 3 * SEC, 600000, 0.80f);
+        pressione(t0 + 7 * SEC + tastoCaso(100000), true);      // Annulla: resto della moneta
+        pressione(t0 + 14 * SEC + tastoCaso(100000), false);    // Nessun credito: ignorata
+        at_isr(t0 + 20 * SEC, []() { world().distance_cm = 150.0f; });
+        pressione(t0 + 32 * SEC + tastoCaso(100000), false);    // RIPOSO: ignorata
+    }
+}
+
+static int verificaTasto(FILE *out) {
+    const FsmLatenza &lat = fsm.latenza(EV_ANNULLA);
+    int falliti = 0;
+    if ((int)tastoAnnulla.pressioni() != tastoPressioni) falliti++;
+    if ((int)lat.eventi != tastoConCredito || (int)(lat.eventi + lat.ignorati) != tastoPressioni) falliti++;
+    if (lat.max_us > TASTO_LATENZA_MAX_US) falliti++;
+    fprintf(out, "Pulsante       : %d pressioni (%d con credito), %u viste, %u fronti scartati come rimbalzi\n",
+            tastoPressioni, tastoConCredito, tastoAnnulla.pressioni(), tastoAnnulla.rimbalzi());
+    fprintf(out, "                 EV_ANNULLA %u gestiti + %u ignorati, fronte → transizione media %.3f ms,"
+            " max %.3f ms (limite %.1f ms; polling a 100ms: 0-100ms)\n", lat.eventi, lat.ignorati,
+            lat.eventi ? lat.somma_us / 1000.0 / lat.eventi : 0.0, lat.max_us / 1000.0,
+            TASTO_LATENZA_MAX_US / 1000.0);
+    fprintf(out, "Verifica       : %s\n", falliti ? "FALLITA" : "ok");
+    return falliti;
+}
+
+// Clienti che comprano 5 ACQUA con una sola conferma (lotto TLV), poi rifornimento via
+// app: prima metà col profilo a scatti delle versioni fino alla v8.36 (1s aperto + 1s
+// di caduta), seconda metà col profilo in rampa. Una sonda a 5ms misura conferma →
+// ritorno in ATTESA_MONETA (5 pezzi); il modello del servo registra il salto massimo.
+// Verifica: tutti i pezzi erogati, esiti dei lotti attesi, rampa più veloce a pezzo.
+// Ultimo ciclo: sovratemperatura a metà erogazione, il cliente va via, la temperatura
+// rientra; il denaro tornato a credito dev'essere reso dopo TIMEOUT_RESTO_AUTO.
+
+static const uint64_t EROGAZIONE_CICLO = 40 * SEC;
+static const int EROGAZIONE_PEZZI = 5;
+static const uint64_t EROGAZIONE_ALLARME = 60 * SEC;
+
+struct SessioneErogazione {
+    uint64_t t_us;          // Conferma
+    bool rampa;
+    bool iniziata;          // EROGAZIONE vista dalla sonda
+    int64_t durata_us;      // -1: non tornata in ATTESA_MONETA entro il ciclo
+};
+
+static std::vector<SessioneErogazione> sessioniErogazione;
+static int saltoServo[2];   // Salto massimo per profilo (0 scatto, 1 rampa)
+
+// Ciclo con allarme: EV_EROGATO prima dell'allarme, credito in ERRORE, reso dopo il rientro
+static struct {
+    uint32_t erogati, ignorati;
+    int32_t restituitoPrima;
+    int32_t credito;
+    int32_t reso;
+    bool iniziato;
+} allarmeErogazione;
+
+static void sondaErogazione(size_t i) {
+    SessioneErogazione &s = sessioniErogazione[i];
+    uint64_t ora = hal::now_us();
+    if (statoCorrente == EROGAZIONE) s.iniziata = true;
+    else if (s.iniziata && statoCorrente == ATTESA_MONETA) {
+        s.durata_us = (int64_t)(ora - s.t_us);
+        saltoServo[s.rampa] = std::max(saltoServo[s.rampa], outputs().servo_salto_us);
+        return;
+    }
+    if (ora - s.t_us < EROGAZIONE_CICLO / 2) at_isr(ora + 5000, [i]() { sondaErogazione(i); });
+}
+
+static void scenarioErogazione(uint64_t duration) {
+    ble_connect(1 * SEC);
+    ble_subscribe(1 * SEC + 300000, hal::BLE_CHAR_RESULT, true);
+    uint64_t t0 = 2 * SEC;
+    int cicli = (int)((duration - std::min(duration, t0 + EROGAZIONE_ALLARME)) / EROGAZIONE_CICLO);
+    for (int c = 0; c < cicli; c++, t0 += EROGAZIONE_CICLO) {
+        bool rampa = c >= cicli / 2;
+        at_isr(t0, []() { world().distance_cm = 30.0f; });
+        for (int i = 0; i < EROGAZIONE_PEZZI; i++) coin_pulse(t0 + (3 + 2 * i) * SEC, 600000, 0.80f);
+        at_isr(t0 + 13 * SEC, [rampa]() {
+            profiloErogazione = rampa ? &PROFILO_RAMPA : &PROFILO_SCATTO;
+            outputs().servo_salto_us = 0;
+        });
+        uint64_t conferma = t0 + 14 * SEC;
+        lotto(conferma, {CMD_ACQUA, 0, CMD_CONFERMA, 1, EROGAZIONE_PEZZI}, {CMD_ACQUA, CMD_CONFERMA},
+              {ESITO_ACCETTATO, ESITO_ACCETTATO});
+        sessioniErogazione.push_back({conferma, rampa, false, -1});
+        size_t i = sessioniErogazione.size() - 1;
+        at_isr(conferma, [i]() { sondaErogazione(i); });
+        lotto(t0 + 28 * SEC, {CMD_RIFORNIMENTO, 4, EROGAZIONE_PEZZI, 0, 0, 0}, {CMD_RIFORNIMENTO},
+              {ESITO_ACCETTATO});
+        at_isr(t0 + 30 * SEC, []() { world().distance_cm = 150.0f; });
+    }
+
+    at_isr(t0, []() { world().distance_cm = 30.0f; });
+    for (int i = 0; i < EROGAZIONE_PEZZI; i++) coin_pulse(t0 + (3 + 2 * i) * SEC, 600000, 0.80f);
+    at_task(t0 + 13 * SEC, []() {
+        const FsmLatenza &lat = fsm.latenza(EV_EROGATO);
+        allarmeErogazione.erogati = lat.eventi;
+        allarmeErogazione.ignorati = lat.ignorati;
+        allarmeErogazione.restituitoPrima = cassa.restituito();
+    });
+    lotto(t0 + 14 * SEC, {CMD_ACQUA, 0, CMD_CONFERMA, 1, EROGAZIONE_PEZZI}, {CMD_ACQUA, CMD_CONFERMA},
+          {ESITO_ACCETTATO, ESITO_ACCETTATO});
+    at_isr(t0 + 15 * SEC, []() { world().temp_c = 35; });
+    at_isr(t0 + 18 * SEC, []() { world().distance_cm = 150.0f; });
+    at_task(t0 + 19 * SEC, []() {
+        allarmeErogazione.iniziato = statoCorrente == ERRORE;
+        allarmeErogazione.credito = credito;
+    });
+    at_isr(t0 + 20 * SEC, []() { world().temp_c = 22; });
+    at_task(t0 + 58 * SEC, []() {     // Rientro + TIMEOUT_RESTO_AUTO (30s) + RESTO (3s)
+        allarmeErogazione.reso = (credito == 0) ? cassa.restituito() - allarmeErogazione.restituitoPrima : -1;
+    });
+    ble_disconnect(duration - SEC);
+}
+
+static int verificaErogazione(FILE *out) {
+    int falliti = 0;
+    double media[2] = {0, 0};
+    for (int rampa = 0; rampa < 2; rampa++) {
+        const ProfiloServo &p = rampa ? PROFILO_RAMPA : PROFILO_SCATTO;
+        int n = 0, persi = 0;
+        int64_t somma = 0, massimo = 0;
+        for (const SessioneErogazione &s : sessioniErogazione) {
+            if (s.rampa != (rampa != 0)) continue;
+            n++;
+            if (s.durata_us < 0) {
+                persi++;
+                continue;
+            }
+            somma += s.durata_us;
+            massimo = std::max(massimo, s.durata_us);
+        }
+        falliti += persi + (n == 0);
+        media[rampa] = (n > persi) ? somma / 1e6 / (n - persi) : 0.0;
+        fprintf(out, "  %-6s       : %d acquisti x %d pezzi, conferma → fine media %.3f s, max %.3f s"
+                " (profilo %u ms a pezzo), %.1f pezzi/min, salto servo max %d us, %d non finiti\n",
+                rampa ? "rampa" : "scatto", n, EROGAZIONE_PEZZI, media[rampa], massimo / 1e6,
+                DispenseSequencer::durataMs(p), media[rampa] > 0 ? EROGAZIONE_PEZZI * 60.0 / media[rampa] : 0.0,
+                saltoServo[rampa], persi);
+    }
+    const uint32_t erogati = allarmeErogazione.erogati, ignorati = allarmeErogazione.ignorati;
+    if ((int)erogati != (int)sessioniErogazione.size() * EROGAZIONE_PEZZI || ignorati) falliti++;
+    if (media[1] <= 0 || media[1] >= media[0]) falliti++;
+    if (saltoServo[1] >= saltoServo[0]) falliti++;
+    fprintf(out, "                 EV_EROGATO %u gestiti + %u ignorati, %u avvii del profilo\n",
+            erogati, ignorati, erogatore.avvii());
+    char eu[2][12];
+    bool reso = allarmeErogazione.iniziato && allarmeErogazione.credito > 0 &&
+                allarmeErogazione.reso == allarmeErogazione.credito;
+    if (!reso) falliti++;
+    fprintf(out, "  allarme      : %s, credito in ERRORE %s EUR, ",
+            allarmeErogazione.iniziato ? "a metà erogazione" : "NON SCATTATO",
+            formatoEuro(allarmeErogazione.credito, eu[0]));
+    if (allarmeErogazione.reso < 0) fprintf(out, "NON reso dopo il rientro\n");
+    else fprintf(out, "reso dopo il rientro %s EUR\n", formatoEuro(allarmeErogazione.reso, eu[1]));
+    fprintf(out, "Verifica       : %s\n", falliti ? "FALLITA" : "ok");
+    return falliti;
+}
+
+// Sito affollato: coda di clienti sempre piena, app del chiosco sempre connessa. Ogni
+// cliente sceglie prodotto e pezzi (1-2), inserisce le monete (1 EUR, una ogni 0.8s),
+// seleziona e conferma in un lotto TLV; uno su quattro mette una moneta in più e alla
+// fine chiede il resto (annullo). Prima metà "seriale": il cliente successivo inizia
+// solo a erogazione e resto finiti, in macchina pronta (versioni fino alla v8.37);
+// seconda metà in pipeline: inizia appena il precedente ha confermato e non ha credito
+// in macchina (le monete dei due clienti non si mescolano mai). Rifornimento ogni 30s.
+// Una sonda a 50ms guida i clienti e controlla la cassa (VendLedger::coerente()).
+// Verifica: conti della cassa a fine prova, pipeline con più clienti all'ora.
+
+static const uint64_t PIPELINE_SONDA_US = 50000;
+static const uint64_t PIPELINE_MONETA_US = 800000;
+static const uint64_t PIPELINE_AVVIO_US = 500000;     // Dal turno libero alla prima moneta
+static const uint64_t PIPELINE_RIPROVA_US = 1000000;   // Conferma non accettata: nuovo lotto
+static const int PIPELINE_PREZZI[5] = {0, 100, 200, 100, 200};     // Prezzi di main.cpp (centesimi)
+
+enum FaseCliente { CLIENTE_IN_CODA, CLIENTE_MONETE, CLIENTE_CONFERMA, CLIENTE_EROGAZIONE,
+                   CLIENTE_RESTO, CLIENTE_SERVITO };
+
+struct ClientePipeline {
+    uint8_t prodotto;
+    uint8_t pezzi;
+    uint8_t monete;
+    bool resto;             // Una moneta in più, resto chiesto dopo l'erogazione
+    bool pipeline;          // Modo della macchina all'inizio del cliente
+    FaseCliente fase;
+    uint64_t t_azione;      // Prossimo invio (lotto, annullo)
+    uint64_t inizio, fine;
+    uint32_t ordine;        // Numero d'ordine atteso (VendLedger::ordiniAccettati())
+    int32_t restituitoPrima;
+};
+
+static std::vector<ClientePipeline> clientiPipeline;
+static size_t pipelineProssimo = 0;     // Primo cliente ancora in coda
+static uint32_t pipelineSeed = 31;
+static uint8_t pipelineSeq = 0;
+static int pipelineMonete = 0, pipelineRipetute = 0, pipelineIncoerenze = 0;
+static uint64_t pipelineFineArrivi = 0;
+
+static uint32_t pipelineCaso(uint32_t n) {
+    pipelineSeed = pipelineSeed * 1103515245u + 12345u;
+    return (pipelineSeed >> 8) % n;
+}
+
+// Il cliente legge le scorte sul display: sceglie tra i prodotti con abbastanza pezzi
+// non prenotati (il precedente ha già confermato); false se deve attendere il rifornimento
+static bool nuovoCliente(ClientePipeline &c) {
+    c = ClientePipeline();
+    c.pezzi = (uint8_t)(1 + pipelineCaso(2));
+    c.prodotto = (uint8_t)(1 + pipelineCaso(4));
+    for (int k = 0; scorte[c.prodotto] - cassa.pezziImpegnati(c.prodotto) < c.pezzi; k++) {
+        if (k == 4) return false;
+        c.prodotto = (uint8_t)(1 + c.prodotto % 4);
+    }
+    c.resto = pipelineCaso(4) == 0;
+    c.monete = (uint8_t)(PIPELINE_PREZZI[c.prodotto] * c.pezzi / 100 + (c.resto ? 1 : 0));
+    c.fase = CLIENTE_IN_CODA;
+    return true;
+}
+
+static void lottoCliente(ClientePipeline &c, uint64_t ora) {
+    uint8_t bytes[] = {CMD_LOTTO, ++pipelineSeq, c.prodotto, 0, CMD_CONFERMA, 1, c.pezzi};
+    ble_command(ora, bytes, sizeof(bytes));
+    c.ordine = cassa.ordiniAccettati() + 1;
+    c.t_azione = ora + PIPELINE_RIPROVA_US;
+}
+
+// Il cliente in coda può iniziare? Seriale: macchina pronta e precedente servito;
+// pipeline: precedente confermato e nessun credito in macchina
+static bool turnoLibero(const ClientePipeline *prec) {
+    if (statoCorrente == ERRORE || credito != 0) return false;
+    if (!erogazioneInPipeline) {
+        return (!prec || prec->fase == CLIENTE_SERVITO) &&
+               (statoCorrente == ATTESA_MONETA || statoCorrente == RIPOSO);
+    }
+    return !prec || prec->fase >= CLIENTE_EROGAZIONE;
+}
+
+static void sondaPipeline() {
+    uint64_t ora = hal::now_us();
+    if (!cassa.coerente()) pipelineIncoerenze++;
+
+    for (size_t i = 0; i < clientiPipeline.size(); i++) {
+        ClientePipeline &c = clientiPipeline[i];
+        switch (c.fase) {
+            case CLIENTE_MONETE:
+                if (ora >= c.t_azione) {
+                    lottoCliente(c, ora);
+                    c.fase = CLIENTE_CONFERMA;
+                }
+                break;
+            case CLIENTE_CONFERMA:
+                if (cassa.ordiniAccettati() >= c.ordine) {
+                    c.fase = CLIENTE_EROGAZIONE;
+                } else if (ora >= c.t_azione) {
+                    lottoCliente(c, ora);       // Coda ordini piena, RESTO o scorte: riprova
+                    pipelineRipetute++;
+                }
+                break;
+            case CLIENTE_EROGAZIONE:
+                if (cassa.ordiniCompletati() < c.ordine) break;
+                if (!c.resto) {
+                    c.fase = CLIENTE_SERVITO;
+                    c.fine = ora;
+                } else if (statoCorrente == ATTESA_MONETA && credito > 0) {
+                    c.restituitoPrima = cassa.restituito();
+                    ble_command(ora, CMD_ANNULLA);
+                    c.fase = CLIENTE_RESTO;
+                }
+                break;
+            case CLIENTE_RESTO:
+                if (cassa.restituito() > c.restituitoPrima) {
+                    c.fase = CLIENTE_SERVITO;
+                    c.fine = ora;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (ora < pipelineFineArrivi) {
+        const ClientePipeline *prec = pipelineProssimo ? &clientiPipeline[pipelineProssimo - 1] : nullptr;
+        ClientePipeline c;
+        if (turnoLibero(prec) && nuovoCliente(c)) {
+            c.pipeline = erogazioneInPipeline;
+            c.inizio = ora;
+            for (int k = 0; k < c.monete; k++) coin_pulse(ora + PIPELINE_AVVIO_US + k * PIPELINE_MONETA_US, 600000, 0.80f);
+            pipelineMonete += c.monete;
+            c.t_azione = ora + PIPELINE_AVVIO_US + c.monete * PIPELINE_MONETA_US;
+            c.fase = CLIENTE_MONETE;
+            clientiPipeline.push_back(c);
+            pipelineProssimo++;
+        }
+    }
+    at_isr(ora + PIPELINE_SONDA_US, []() { sondaPipeline(); });
+}
+
+static void scenarioPipeline(uint64_t duration) {
+    pipelineFineArrivi = duration - 30 * SEC;   // Ultimi 30s: solo completamento dei clienti in corso
+    at_isr(0, []() {
+        world().distance_cm = 30.0f;
+        erogazioneInPipeline = false;
+    });
+    at_isr(duration / 2, []() { erogazioneInPipeline = true; });
+    ble_connect(SEC / 2);
+    for (uint64_t t = 30 * SEC; t < duration; t += 30 * SEC) ble_command(t, CMD_RIFORNIMENTO);
+    at_isr(2 * SEC, []() { sondaPipeline(); });
+    // Pool eventi esaurito per una chiamata, in fasi sempre diverse: nessun task resta
+    // bloccato in attesa di un hal::call() mai schedulato
+    for (uint64_t t = SEC; t < pipelineFineArrivi; t += 20 * SEC + 123457) at_isr(t, []() { call_rifiuta(1); });
+}
+
+static int verificaPipeline(FILE *out, uint64_t duration) {
+    int falliti = 0;
+    double clientiOra[2] = {0, 0};
+    int32_t incassoAtteso = 0, restoAtteso = 0;
+    int inCorso = 0;
+    for (const ClientePipeline &c : clientiPipeline) {
+        if (c.fase != CLIENTE_SERVITO) {
+            inCorso++;
+            continue;
+        }
+        incassoAtteso += PIPELINE_PREZZI[c.prodotto] * c.pezzi;
+        if (c.resto) restoAtteso += 100;
+    }
+    for (int pipeline = 0; pipeline < 2; pipeline++) {
+        uint64_t da = pipeline ? duration / 2 : 0;
+        uint64_t a = pipeline ? pipelineFineArrivi : duration / 2;
+        int n = 0, pezzi = 0, conResto = 0;
+        uint64_t somma = 0;
+        for (const ClientePipeline &c : clientiPipeline) {
+            if (c.fase != CLIENTE_SERVITO || c.fine < da || c.fine >= a) continue;
+            n++;
+            pezzi += c.pezzi;
+            conResto += c.resto;
+            somma += c.fine - c.inizio;
+        }
+        clientiOra[pipeline] = n * 3600.0 * SEC / (a - da);
+        fprintf(out, "  %-8s     : %3d clienti in %.0f s (%d pezzi, %d con resto), %.0f clienti/ora,"
+                " inizio → servito medio %.1f s\n", pipeline ? "pipeline" : "seriale", n, (a - da) / 1e6,
+                pezzi, conResto, clientiOra[pipeline], n ? somma / 1e6 / n : 0.0);
+    }
+
+    bool conti = cassa.inserito() == pipelineMonete * 100 && cassa.incassato() == incassoAtteso &&
+                 cassa.restituito() == restoAtteso && credito == 0 && cassa.impegnato() == 0 &&
+                 cassa.resto() == 0;
+    falliti += !conti + (pipelineIncoerenze > 0) + (inCorso > 0);
+    char eu[6][EURO_LEN];
+    if (clientiOra[1] <= clientiOra[0]) falliti++;
+    fprintf(out, "Cassa          : inserito %s, incassato %s (atteso %s), restituito %s (atteso %s),"
+            " credito %s, %d controlli incoerenti\n",
+            formatoEuro(cassa.inserito(), eu[0]), formatoEuro(cassa.incassato(), eu[1]),
+            formatoEuro(incassoAtteso, eu[2]), formatoEuro(cassa.restituito(), eu[3]),
+            formatoEuro(restoAtteso, eu[4]), formatoEuro(credito, eu[5]), pipelineIncoerenze);
+    fprintf(out, "                 %u ordini (%u completati), %d conferme ripetute, %d clienti non serviti,"
+            " pipeline %+.0f%% clienti/ora\n", cassa.ordiniAccettati(), cassa.ordiniCompletati(),
+            pipelineRipetute, inCorso, clientiOra[0] > 0 ? (clientiOra[1] / clientiOra[0] - 1) * 100 : 0.0);
+    fprintf(out, "Coda piena     : %u hal::call() rifiutate, nessun task rimasto in attesa\n", call_rifiutate());
+    if (call_rifiutate() == 0) falliti++;
+    fprintf(out, "Verifica       : %s\n", falliti ? "FALLITA" : "ok");
+    return falliti;
+}
+
+// Consumo per ora simulata (ultima ora eventualmente parziale)
+static const uint64_t ORA = 3600 * SEC;
+static std::vector<PowerStats> powerOre;
+
+static void report(FILE *out, const char *scenario, uint64_t duration, double wall_s) {
+    TaskStats tick = task_stats(updateMachine);
+    I2CStats &i2c = i2c_stats();
+    GattStats &gatt = gatt_stats();
+    Outputs &o = outputs();
+
+    fprintf(out, "\n=== VENDING SIM: %s ===\n", scenario);
+    fprintf(out, "Tempo simulato : %.1f s  (wall %.3f s)\n", duration / 1e6, wall_s);
+    fprintf(out, "updateMachine  : %llu tick, %.0f tick/s wall\n",
+            (unsigned long long)tick.runs, wall_s > 0 ? tick.runs / wall_s : 0.0);
+    fprintf(out, "Durata tick    : media %.2f ms, max %.2f ms, ritardo max %.2f ms\n",
+            tick.runs ? tick.busy_us / 1000.0 / tick.runs : 0.0,
+            tick.max_us / 1000.0, tick.late_us / 1000.0);
+    fprintf(out, "Tick fuori budget (>= periodo): %llu\n", (unsigned long long)tick.overruns);
+    fprintf(out, "I2C LCD        : %llu transazioni, %llu byte, %.1f ms di bus\n",
+            (unsigned long long)i2c.transactions, (unsigned long long)i2c.bytes,
+            i2c.bus_us / 1000.0);
+    fprintf(out, "I2C per tick   : %.1f byte/tick, %.2f ms di bus/tick\n",
+            tick.runs ? (double)i2c.bytes / tick.runs : 0.0,
+            tick.runs ? i2c.bus_us / 1000.0 / tick.runs : 0.0);
+    fprintf(out, "BLE write      : TEMP %u  STATUS %u  HUM %u  (notifiche %u/%u/%u)\n",
+            gatt.writes[hal::BLE_CHAR_TEMP], gatt.writes[hal::BLE_CHAR_STATUS],
+            gatt.writes[hal::BLE_CHAR_HUM], gatt.notifications[hal::BLE_CHAR_TEMP],
+            gatt.notifications[hal::BLE_CHAR_STATUS], gatt.notifications[hal::BLE_CHAR_HUM]);
+    // Byte in aria per minuto di connessione: TEMP+HUM+STATUS contro il solo SNAPSHOT
+    uint64_t ariaLegacy = gatt.air_bytes[hal::BLE_CHAR_TEMP] + gatt.air_bytes[hal::BLE_CHAR_HUM] +
+                          gatt.air_bytes[hal::BLE_CHAR_STATUS];
+    uint32_t notLegacy = gatt.notifications[hal::BLE_CHAR_TEMP] + gatt.notifications[hal::BLE_CHAR_HUM] +
+                         gatt.notifications[hal::BLE_CHAR_STATUS];
+    double minuti = gatt.connected_us / 60e6;
+    fprintf(out, "BLE in aria    : legacy %.0f B/min (%u notifiche), snapshot %.0f B/min (%u notifiche)"
+            " su %.1f min connessi\n",
+            minuti > 0 ? ariaLegacy / minuti : 0.0, notLegacy,
+            minuti > 0 ? gatt.air_bytes[hal::BLE_CHAR_SNAPSHOT] / minuti : 0.0,
+            gatt.notifications[hal::BLE_CHAR_SNAPSHOT], minuti);
+    CmdStats &cmd = cmd_stats();
+    if (cmd.sent) {
+        fprintf(out, "BLE comandi    : %u inviati, %u esiti, round-trip medio %.1f ms, max %.1f ms"
+                " (evento di connessione ogni %.1f ms)\n", cmd.sent, cmd.acked,
+                cmd.acked ? cmd.rtt_sum_us / 1000.0 / cmd.acked : 0.0, cmd.rtt_max_us / 1000.0,
+                BLE_CONN_INTERVAL_US / 1000.0);
+    }
+    Snapshot snap;
+    if (snapshotDecodifica(gatt.value[hal::BLE_CHAR_SNAPSHOT], gatt.length[hal::BLE_CHAR_SNAPSHOT], snap)) {
+        char euro[EURO_LEN];
+        fprintf(out, "Ultimo SNAPSHOT: seq %u, t %u ms, credito %s EUR, stato %u, prodotto %u, scorte %u/%u/%u/%u,"
+                " %d°C %u%%, flag 0x%02X\n", snap.seq, snap.t_ms, formatoEuro(snap.centesimi, euro), snap.stato, snap.prodotto,
+                snap.scorte[0], snap.scorte[1], snap.scorte[2], snap.scorte[3], snap.temp, snap.hum, snap.flag);
+    }
+    fprintf(out, "BLE callback   : %u eseguite, max %.2f ms\n",
+            gatt.callbacks, gatt.callback_max_us / 1000.0);
+    static const char *nomiChar[hal::BLE_CHAR_COUNT] = {"TEMP", "STATUS", "HUM", "SNAPSHOT", "RESULT"};
+    for (int c = 0; c < hal::BLE_CHAR_COUNT; c++) {
+        const BleNotificaStats &n = notifiche.stats((hal::BleCharId)c);
+        fprintf(out, "  %-13s: %5u update -> %4u scritture (%u alla sottoscrizione) | soppressi: "
+                "%u invariati, %u senza client, %u accorpati\n",
+                nomiChar[c], n.richieste, n.scritture, n.sottoscrizioni,
+                n.invariati, n.nonSottoscritti, n.accorpati);
+    }
+    fprintf(out, "FSM            : %u transizioni, %u eventi persi (coda piena)\n",
+            fsm.transizioni(), fsm.persi());
+    for (int e = 0; e < EV_COUNT; e++) {
+        const FsmLatenza &lat = fsm.latenza(e);
+        if (lat.eventi == 0 && lat.ignorati == 0) continue;
+        fprintf(out, "  %-13s: %6u gestiti %6u ignorati | latenza media %.3f ms, max %.3f ms\n",
+                nomeEvento(e), lat.eventi, lat.ignorati,
+                lat.eventi ? lat.somma_us / 1000.0 / lat.eventi : 0.0, lat.max_us / 1000.0);
+    }
+    fprintf(out, "LDR DMA        : %u blocchi, %u persi, %u monete, %u spike scartati\n",
+            ldrBlocchi, (unsigned)ldrBlocchiPersi, rilevatore.monete(), rilevatore.scartati());
+    fprintf(out, "Monete         : 0.50 x%u, 1 x%u, 2 x%u, non riconosciute %u | calibrazione tagli 0x%X\n",
+            moneteTaglio[TAGLIO_50C], moneteTaglio[TAGLIO_1E], moneteTaglio[TAGLIO_2E], moneteTaglio[TAGLI],
+            calibrazione.tagli);
+    FlashStats &flash = flash_stats();
+    if (flash.erases || flash.programmed) {
+        fprintf(out, "Flash dati     : %u erase, %llu byte programmati, CPU ferma %.0f ms, %u violazioni NOR\n",
+                flash.erases, (unsigned long long)flash.programmed, flash.busy_us / 1000.0, flash.violations);
+    }
+    fprintf(out, "Sonar          : %u trigger, %u fronti echo\n", o.trig_pulses, o.echo_edges);
+    fprintf(out, "Servo          : %u scritture PWM, salto max %d us\n", o.servo_writes, o.servo_salto_us);
+    fprintf(out, "DHT11          : %u letture, %u scartate, %u fronti in ISR, %u sezioni critiche,"
+            " IRQ off %.3f ms/lettura (max %.3f ms; bit-bang: vending_sim dht)\n",
+            o.dht_reads, o.dht_errors, o.dht_edges, o.dht_irq_sezioni,
+            o.dht_reads ? o.dht_irq_off_us / 1000.0 / o.dht_reads : 0.0, o.dht_irq_off_max_us / 1000.0);
+    fprintf(out, "Watchdog reset : %u\n", o.watchdog_resets);
+    UartStats &uart = uart_stats();
+    fprintf(out, "UART %d baud : %llu byte (%.1f%% della linea), testo equivalente %llu byte (%.1fx)\n",
+            UART_BAUD, (unsigned long long)uart.bytes,
+            duration ? 100.0 * uart.bytes * 10 / UART_BAUD * 1e6 / duration : 0.0,
+            (unsigned long long)uart.text_bytes, uart.bytes ? (double)uart.text_bytes / uart.bytes : 0.0);
+    fprintf(out, "Telemetria     : %u record, persi %u STATUS + %u eventi, coda max %u/%u, %u FIFO piena, %u CRC errati\n",
+            uart.records, tlm.persiPeriodici(), tlm.persiEventi(), tlm.occupazioneMax(),
+            Telemetria::CODA_LEN, uart.full, uart.crc_errors);
+    PowerStats power = power_stats();
+    fprintf(out, "CPU sveglia    : %.3f%% (%llu risvegli, %.1f/s, modello %dus/task %dus/ISR)\n",
+            duration ? 100.0 * power.awake_us / duration : 0.0,
+            (unsigned long long)power.wakeups, duration ? power.wakeups * 1e6 / duration : 0.0,
+            POWER_TASK_US, POWER_ISR_US);
+    PowerStats prec = {0, 0};
+    for (size_t h = 0; h < powerOre.size(); h++) {
+        uint64_t inizio = h * ORA;
+        uint64_t durata = (duration - inizio < ORA) ? duration - inizio : ORA;
+        fprintf(out, "  ora %-3zu      : %.3f%% sveglia, %llu risvegli\n", h + 1,
+                100.0 * (powerOre[h].awake_us - prec.awake_us) / durata,
+                (unsigned long long)(powerOre[h].wakeups - prec.wakeups));
+        prec = powerOre[h];
+    }
+    char euro[EURO_LEN];
+    fprintf(out, "Stato finale   : %s | credito %s EUR | scorte A%d S%d C%d T%d\n",
+            nomeStato(statoCorrente), formatoEuro(credito, euro), scorte[1], scorte[2], scorte[3], scorte[4]);
+    fprintf(out, "LCD            : [%s]\n                 [%s]\n",
+            lcd_line(0).c_str(), lcd_line(1).c_str());
+}
+
+int main(int argc, char **argv) {
+    const char *scenario = "purchase";
+    uint64_t duration = 600 * SEC;
+    bool quiet = false;
+    FILE *capture = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            duration = (uint64_t)atoll(argv[++i]) * SEC;
+        } else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+            capture = fopen(argv[++i], "wb");
+            if (!capture) {
+                perror(argv[i]);
+                return 2;
+            }
+            serial_capture(capture);
+        } else if (!strcmp(argv[i], "--quiet")) {
+            quiet = true;
+        } else if (!strcmp(argv[i], "--sonar-fisso")) {
+            sonarFisso = true;
+        } else if (!strcmp(argv[i], "idle") || !strcmp(argv[i], "purchase") ||
+                   !strcmp(argv[i], "lcd") || !strcmp(argv[i], "dht") || !strcmp(argv[i], "tlm") ||
+                   !strcmp(argv[i], "coin") || !strcmp(argv[i], "filtri") || !strcmp(argv[i], "sonar") ||
+                   !strcmp(argv[i], "ble") || !strcmp(argv[i], "cmd") || !strcmp(argv[i], "calib") ||
+                   !strcmp(argv[i], "traffico") || !strcmp(argv[i], "stato") || !strcmp(argv[i], "ring") ||
+                   !strcmp(argv[i], "tasto") || !strcmp(argv[i], "erogazione") ||
+                   !strcmp(argv[i], "pipeline") || !strcmp(argv[i], "giornale")) {
+            scenario = argv[i];
+        } else {
+            fprintf(stderr, "Uso: %s [idle|purchase|lcd|dht|tlm|coin|filtri|sonar|stato|ring|ble|cmd|calib|traffico|tasto|erogazione|pipeline|giornale]"
+                    " [--seconds N] [--quiet]"
+                    " [--capture FILE] [--sonar-fisso]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Il report resta su stdout anche quando il log seriale del firmware è soppresso
+    FILE *out = fdopen(dup(fileno(stdout)), "w");
+    if (quiet) freopen("/dev/null", "w", stdout);
+
+    if (!strcmp(scenario, "lcd")) {
+        benchmarkLcd(out);
+        fclose(out);
+        return 0;
+    }
+    if (!strcmp(scenario, "dht")) {
+        int falliti = benchmarkDht(out);
+        fclose(out);
+        return falliti ? 1 : 0;
+    }
+    if (!strcmp(scenario, "coin")) {
+        int falliti = benchmarkMonete(out);
+        fclose(out);
+        return falliti ? 1 : 0;
+    }
+    if (!strcmp(scenario, "filtri")) {
+        int falliti = benchmarkFiltri(out);
+        fclose(out);
+        return falliti ? 1 : 0;
+    }
+    if (!strcmp(scenario, "sonar")) {
+        int falliti = benchmarkSonar(out);
+        fclose(out);
+        return falliti ? 1 : 0;
+    }
+    if (!strcmp(scenario, "stato")) {
+        int falliti = benchmarkStato(out);
+        fclose(out);
+        return falliti ? 1 : 0;
+    }
+    if (!strcmp(scenario, "ring")) {
+        int falliti = benchmarkRing(out);
+        fclose(out);
+        return falliti ? 1 : 0;
+    }
+    if (!strcmp(scenario, "giornale")) {
+        int falliti = benchmarkGiornale(out);
+        fclose(out);
+        return falliti ? 1 : 0;
+    }
+    if (!strcmp(scenario, "tlm")) {
+        int falliti = benchmarkTelemetria(out);
+        fclose(out);
+        if (capture) fclose(capture);
+        return falliti ? 1 : 0;
+    }
+
+    if (!strcmp(scenario, "purchase")) scenarioPurchase(duration);
+    if (!strcmp(scenario, "ble")) scenarioBle(duration);
+    if (!strcmp(scenario, "cmd")) scenarioCmd(duration);
+    if (!strcmp(scenario, "calib")) scenarioCalib(duration);
+    if (!strcmp(scenario, "traffico")) scenarioTraffico(duration);
+    if (!strcmp(scenario, "tasto")) scenarioTasto(duration);
+    if (!strcmp(scenario, "erogazione")) scenarioErogazione(duration);
+    if (!strcmp(scenario, "pipeline")) scenarioPipeline(duration);
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if (sonarFisso) sonar.setCadenza(CADENZA_FISSA);
+    setupMachine();
+    for (uint64_t t = 0; t < duration; ) {
+        t = (duration - t > ORA) ? t + ORA : duration;
+        run_until(t);
+        powerOre.push_back(power_stats());
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    fflush(stdout);
+    report(out, scenario, duration, wall);
+    int falliti = 0;
+    if (!strcmp(scenario, "cmd") || !strcmp(scenario, "calib") || !strcmp(scenario, "erogazione"))
+        falliti += verificaComandi(out);
+    if (!strcmp(scenario, "calib")) falliti += verificaCalib(out);
+    if (!strcmp(scenario, "traffico")) falliti += verificaTraffico(out, duration);
+    if (!strcmp(scenario, "tasto")) falliti += verificaTasto(out);
+    if (!strcmp(scenario, "erogazione")) falliti += verificaErogazione(out);
+    if (!strcmp(scenario, "pipeline")) falliti += verificaPipeline(out, duration);
+    fclose(out);
+    if (capture) fclose(capture);
+    return falliti ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * ======================================================================================
+ * TLM_DECODE - Decoder della telemetria seriale binaria (vedi Telemetry.h)
+ * ======================================================================================
+ * Converte il flusso della porta USB (o una cattura di vending_sim --capture) nelle
+ * righe di log leggibili del firmware. I byte fuori frame passano invariati.
+ *
+ * Uso: tlm_decode [-t] [FILE]       (senza FILE legge stdin, es. da /dev/ttyACM0)
+ *   -t   prefisso [secondi.millisecondi] ricostruito dai Δt dei record
+ *
+ * Exit code 1 se almeno un frame ha CRC errato.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "Telemetry.h"
+
+int main(int argc, char **argv) {
+    bool tempi = false;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t")) {
+            tempi = true;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Uso: %s [-t] [FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    FILE *in = path ? fopen(path, "rb") : stdin;
+    if (!in) {
+        perror(path);
+        return 2;
+    }
+
+    TelemetriaDecoder decoder;
+    char riga[TLM_MAX_TESTO];
+    uint32_t record = 0;
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        switch (decoder.feed((uint8_t)c)) {
+            case TelemetriaDecoder::RECORD: {
+                record++;
+                int n = telemetriaTesto(decoder.tipo, decoder.args, decoder.nArgs, riga, sizeof(riga));
+                if (n == 0) break;
+                if (tempi) {
+                    printf("[%llu.%03llu] ", (unsigned long long)(decoder.t_ms / 1000),
+                           (unsigned long long)(decoder.t_ms % 1000));
+                }
+                fwrite(riga, 1, n, stdout);
+                break;
+            }
+            case TelemetriaDecoder::TESTO:
+                putchar(decoder.testo);
+                break;
+            case TelemetriaDecoder::CRC_ERRATO:
+                fprintf(stderr, "[TLM] frame scartato (CRC errato)\n");
+                break;
+            default:
+                break;
+        }
+    }
+    if (path) fclose(in);
+
+    fprintf(stderr, "[TLM] %u record, %u frame scartati\n", record, decoder.errori);
+    return decoder.errori ? 1 : 0;
+}
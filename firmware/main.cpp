@@ -2,9 +2,296 @@
  * ======================================================================================
  * PROGETTO: Vending Machine IoT (BLE + RTOS + Kotlin Interface)
  * TARGET: ST Nucleo F401RE + Shield BLE IDB05A2
- * VERSIONE: v8.14 LCD-REFILL (Display Feedback for Stock Refill)
+ * VERSIONE: v8.39 GIORNALE (scorte, denaro e calibrazione persistenti in flash)
  * ======================================================================================
  *
+ * CHANGELOG v8.39 (2026-10-16):
+ * - [FEATURE] FlashJournal: scorte, denaro dei clienti in macchina (credito + impegnato +
+ *             resto) e incassato sopravvivono al reset. Al boot il denaro torna a credito
+ *             (ordini non erogati, resto non reso) e, se nessuno lo usa, è reso dopo
+ *             TIMEOUT_RESTO_AUTO anche da RIPOSO
+ * - [ARCH] Giornale append-only su due banchi (settori 6-7): record DELTA dei soli campi
+ *          cambiati con CRC-8, accorpati ogni GIORNALE_LOTTO_MS (200ms) dopo il dispatch;
+ *          checkpoint in testa a ogni blocco da 2KB, banco pieno → l'altro, erase del
+ *          vecchio entrando in idle profondo o, oltre il 75% del banco attivo, al primo
+ *          RIPOSO senza app BLE connessa, con il DMA del LDR fermo (macchina sempre
+ *          occupata); erase sincrono solo come ultima risorsa. Boot: bisezione sui blocchi e un blocco
+ *          rigiocato (~1ms); record interrotto dal reset scartato
+ * - [CHANGE] Calibrazione monete nel giornale (record BLOB): salvataggio senza erase del
+ *            settore; calibrazioneCarica/Salva/Cancella → calibrazioneSigilla()
+ * - [HAL] hal::Flash: area dati sugli ultimi due settori (firmware sotto i 256KB),
+ *         eraseSize() = un settore
+ * - [HOST] "vending_sim giornale": 40000 transazioni con reset anche a metà di un program,
+ *          write amplification 1.3 (~25 byte/transazione), ~4400 transazioni per erase,
+ *          stato ritrovato a ogni reset leggendo al massimo ~2.3KB
+ * - [FIX] Rientro da ERRORE con credito (allarme durante EROGAZIONE, v8.38): TIMER_CREDITO
+ *         riarmato, il denaro è reso dopo TIMEOUT_RESTO_AUTO anche senza altre monete
+ * - [FIX] Area del giornale protetta dall'immagine: target.mbed_rom_size = 0x40000
+ *         (link fallito oltre i 256KB) e hal::Flash vuota se l'immagine linkata arriva
+ *         ai settori 6-7 (prima il primo recupera() ne cancellava la coda)
+ * - [FIX] [HOST] IRQ off del DHT11 (v8.22) misurato invece che dichiarato: i fronti della
+ *         traccia scattano come ISR di un EdgeIn sulla timeline e le sezioni critiche host
+ *         contano il tempo virtuale; il riferimento è il pulseIn() della v7.1 eseguito sulla
+ *         stessa linea (3.67ms per lettura contro 0, nessuna sezione critica nel percorso
+ *         ISR + decoder). La tabella delle latenze conta anche i frame errati accettati
+ * - [FIX] Lotto TLV (v8.28) atomico anche in esecuzione: al primo comando rifiutato gli
+ *         altri del lotto non sono eseguiti (esito SALTATO, EventFsm FSM_SALTATO). Prima
+ *         [selezione esaurita, conferma] confermava il prodotto selezionato in precedenza
+ *
+ * CHANGELOG v8.38 (2026-10-16):
+ * - [FEATURE] Transazioni in pipeline: in EROGAZIONE e RESTO monete e selezione del
+ *             cliente successivo sono accettate (prima il LDR le saltava); in EROGAZIONE
+ *             la conferma accoda l'ordine, servito dopo quello in corso (ORDINI_MAX = 2)
+ * - [ARCH] VendLedger: ogni centesimo in un solo conto (credito, impegnato, incassato,
+ *          resto, restituito); la conferma impegna l'importo e prenota le scorte
+ *          (disponibili()), il resto è fissato all'ingresso in RESTO, l'allarme rende a
+ *          credito pezzi non erogati e resto non reso. Cassa verificata dopo ogni dispatch
+ * - [CHANGE] credito (STATUS, SNAPSHOT, LCD) è il disponibile: cala alla conferma e non
+ *            più a ogni pezzo; in RESTO il display mostra l'importo in restituzione
+ * - [CONFIG] erogazioneInPipeline = false: comportamento seriale fino alla v8.37
+ * - [HOST] "vending_sim pipeline": coda di clienti sempre piena, ~750 clienti/ora in
+ *          seriale contro ~1100 in pipeline (+47%), conti della cassa esatti
+ *
+ * CHANGELOG v8.37 (2026-10-16):
+ * - [FEATURE] DispenseSequencer: profili di movimento del servo (rampa lineare a passi di
+ *             20ms, sosta, ritorno) eseguiti su hal::Timeout; PROFILO_RAMPA (default,
+ *             ~1.06s a pezzo) e PROFILO_SCATTO (1s aperto + 1s di caduta, fino alla v8.36)
+ * - [ARCH] EV_EROGATO: fine del profilo accodata dall'ISR col numero dell'avvio; la FSM
+ *          passa al pezzo successivo o ad ATTESA_MONETA (gErogato scarta i completamenti di
+ *          un'erogazione interrotta). Rimossi faseErogazione e i timer di EROGAZIONE
+ * - [HAL] PwmOut::pulsewidth_us(); Board: servoTimeout per i passi del profilo
+ * - [HOST] "vending_sim erogazione": acquisti da 5 pezzi, 30 pezzi/min a scatti contro
+ *          ~56 in rampa; salto massimo del servo tra due scritture 1000us → 167us
+ *
+ * CHANGELOG v8.36 (2026-10-16):
+ * - [FEATURE] ButtonInput: pulsante annulla su InterruptIn (hal::EdgeIn) al posto della
+ *             lettura a 100ms; EV_ANNULLA accodato dall'ISR del primo fronte, rimbalzi
+ *             scartati per 30ms, cambio coperto dai rimbalzi recuperato a fine finestra
+ * - [ARCH] EventFsm::postIngresso(): pulsante, moneta e presenza entrano nella coda
+ *          eventi con l'istante in μs del fronte, del rientro della moneta o della
+ *          lettura sonar; la latenza per evento è ingresso fisico → fine transizione
+ * - [POWER] updateMachine() resta solo per il watchdog: kick ogni WATCHDOG_KICK_MS (1s)
+ * - [HAL] Board: tastoAnnulla è un EdgeIn (con read()) più tastoTimeout; rimosso DigitalIn
+ * - [HOST] "vending_sim tasto": 42 pressioni con rimbalzi e tocchi da 15ms, tutte viste
+ *          una volta sola (272 fronti scartati); pressione → transizione < 2ms contro
+ *          0-100ms del polling
+ *
+ * CHANGELOG v8.35 (2026-10-16):
+ * - [ARCH] SpscRing.h: coda circolare lock-free a un produttore e un consumatore, N
+ *          potenza di 2, push/pop wait-free con acquire/release sugli indici (DMB su
+ *          Cortex-M4), pop a lotti e contatore degli elementi rifiutati a coda piena
+ * - [FIX] Letture del sonar accodate dall'ISR con il loro istante: con la coda eventi
+ *         occupata due letture ravvicinate non si sovrascrivono più e il debounce della
+ *         presenza conta dal momento della misura (presenzaFiltra)
+ * - [REFACTOR] LcdRenderer usa SpscRing al posto della sua coda con _head/_tail
+ * - [HOST] "vending_sim ring": produttore e consumatore su due thread, 2M elementi per
+ *          prova senza buchi né copie spezzate; ~52M elementi/s contro ~16-26M della coda
+ *          con mutex, push + pop 4ns contro 49ns
+ *
+ * CHANGELOG v8.34 (2026-10-16):
+ * - [ARCH] MachineState.h: Seqlock<T> a doppia copia (latch), scrittore mai bloccato,
+ *          lettori sempre su una copia coerente; ripetono solo se lo scrittore li
+ *          interrompe completando una scrittura, mai per uno scrittore sospeso a metà
+ * - [ARCH] pubblicaStato(): credito, prezzo, stato, prodotto, scorte, presenza e BLE in
+ *          statoMacchina dopo ogni giro della FSM e prima di ogni notifica; STATUS,
+ *          SNAPSHOT e log [STATUS] leggono la stessa copia
+ * - [FIX] Rimosso dhtMutex: il thread DHT (bassa priorità) pubblica in ambiente, la coda
+ *         eventi non attende più un thread che tiene il lock (inversione di priorità)
+ * - [HOST] "vending_sim stato": 1 scrittore + 3 lettori su thread, nessuna copia spezzata
+ *          (senza sincronizzazione ~1.2M su 4.5M); lettura p50 25ns contro 50-56ns del
+ *          mutex, scrittore 2.5x più veloce e mai in attesa
+ *
+ * CHANGELOG v8.33 (2026-10-16):
+ * - [POWER] SonarScheduler: intervallo tra le burst deciso a ogni lettura; a scena ferma
+ *           raddoppia fino a 2s, chi si avvicina (in RIPOSO/idle) o si allontana (cliente
+ *           davanti) lo porta a 150-250ms, qualsiasi altro movimento alla base del modo
+ * - [FSM] Modo sonar per stato al posto di 500ms/5s fissi: nessun ping in EROGAZIONE e
+ *         RESTO (burst subito all'uscita), idle profondo base 1s invece di IDLE_SONAR_MS
+ * - [ALGORITHM] Anti-spike del sonar con conferma: un avvicinamento > 150cm ripetuto dalla
+ *               lettura successiva è accettato (con letture a 2s un cliente vero lo fa)
+ * - [HOST] "vending_sim traffico" (4h, metà giorno e metà notte): ping/ora 12042 → 6794
+ *          di giorno e 10884 → 5522 di notte; latenza di arrivo media 1252 → 721ms (max
+ *          1600 → 780ms), di uscita 5042 → 3044ms; --sonar-fisso per il confronto
+ *
+ * CHANGELOG v8.32 (2026-10-16):
+ * - [ALGORITHM] Eco → distanza in mm con una moltiplicazione Q16 e uno shift: velocità
+ *               del suono 331.3·√(1 + T/273.15) per grado da -20 a 60°C in una tabella
+ *               constexpr (in flash), scelta a ogni lettura valida del DHT11
+ * - [FIX] Il vecchio 0.0343 cm/μs vale solo a ~20°C: -3.5% a 0°C, +3% a 40°C
+ * - [PERFORMANCE] Nessun float nell'ISR del ping (niente salvataggio del contesto FPU);
+ *                 su host ~5 cicli per conversione contro ~19 del percorso float
+ * - [PERFORMANCE] Burst da 3 ping invece di 5 (45ms invece di 75ms): mediana a 3 ping
+ *                 compensata 8mm di errore medio contro 68mm della media float a 5
+ * - [HOST] Eco simulata con la velocità del suono alla temperatura del mondo;
+ *          "vending_sim sonar": errore per temperatura e cicli per ping dei due percorsi
+ *
+ * CHANGELOG v8.31 (2026-10-16):
+ * - [ARCH] SensorFilter.h: stadi di filtro in un solo header (mediana di N, EMA, isteresi,
+ *          limitatore di pendenza, anti-spike, debounce) e CatenaFiltri<...> per comporli;
+ *          interi/virgola fissa, nessuna allocazione, parametri da costruttori constexpr
+ * - [REFACTOR] I tre filtri scritti a mano usano gli stadi: sonar (mediana dei ping della
+ *              burst + anti-spike asimmetrico 150cm), LDR (EMA + isteresi + debounce in
+ *              CoinDetector), presenza (isteresi 40/60cm + debounce 600ms/2.1s)
+ * - [ALGORITHM] Sonar: mediana invece della media dei ping validi (un'eco spuria nella
+ *               burst non sposta più la lettura)
+ * - [ALGORITHM] LDR: i campioni nella fascia di isteresi contano per il debounce; a 5 m/s
+ *               il DMA rileva 40/40 monete (prima 26/40), nessun falso; coin_train 98.2%
+ * - [HOST] "vending_sim filtri": ns e cicli per campione per stadio e per sensore
+ *          (x86: mediana5 ~45 cicli, EMA/isteresi/debounce 2-3, CoinDetector ~14)
+ * - [NOTE] Presenza invariata: alla scadenza del debounce l'ultima lettura del sonar è
+ *          ripresentata da un timer (stessi istanti di conferma di prima)
+ *
+ * CHANGELOG v8.30 (2026-10-16):
+ * - [FEATURE] Monete da 0.50, 1 e 2 EUR: CoinDetector misura durata, Δ massimo e area
+ *             dell'impulso all'uscita, CoinClassifier sceglie il centroide più vicino
+ *             (z in Q8, solo interi, ~20ns su host); oltre 5σ la moneta non dà credito
+ * - [FEATURE] Credito e prezzi in centesimi; LCD e log in EUR ("1.50"), STATUS byte 0 in
+ *             EUR interi, SNAPSHOT v2 con i centesimi in coda (byte 18-19)
+ * - [BLE] CMD 12 CALIBRA (solo senza credito): raccolta per taglio, salvataggio in flash
+ *         (esito CALIBRAZIONE con meno di 8 monete), annullo, cancellazione
+ * - [HAL] hal::Flash: settore dati della flash interna (FlashIAP, ultimo settore 128KB);
+ *         la cancellazione ferma la CPU per ~1s, fatta solo al salvataggio
+ * - [HOST] coin_train: matrice di confusione a 5 fold su 600 monete dal modello della guida,
+ *          98.5% a 0.25 m/s (0.50 ↔ 1 EUR: 7 errori, 2 EUR 200/200); "vending_sim calib"
+ * - [NOTE] Senza calibrazione ogni moneta vale 1 EUR; con un solo LDR la durata dipende
+ *          dalla velocità: serve una guida a velocità costante
+ *
+ * CHANGELOG v8.29 (2026-10-16):
+ * - [PERFORMANCE] LDR campionato a 1kHz da TIM2 → ADC1 → DMA2 circolare (hal::AdcStream):
+ *                 nessuna ISR per campione, un interrupt per metà del doppio buffer (32ms)
+ * - [ALGORITHM] CoinDetector: baseline EMA in virgola fissa (α = 1/1024, costante ~1s) e
+ *               spike detection campione per campione sul blocco; debounce 3 campioni in
+ *               2ms invece di 200ms; moneta con l'istante del primo campione sopra soglia
+ * - [ARCH] updateMachine() resta per pulsante e watchdog; in idle profondo il DMA è fermo
+ *          e la soglia a 200ms lo riavvia (moneta lenta ancora davanti al sensore)
+ * - [HAL] Target non STM32F4: stessi blocchi da un Ticker (una ISR per campione)
+ * - [HOST] "vending_sim coin": 40 monete per velocità (risposta LDR τ=5ms, rumore, flicker);
+ *          tick 100ms: 40/40 a 0.04 m/s, 15/40 a 0.1 m/s, 0 da 0.25 m/s; DMA: 40/40 fino a
+ *          3 m/s (8.4ms di transito), 26/40 a 5 m/s, latenza ~21ms contro ~250ms
+ * - [NOTE] Costo: ~31 risvegli/s in più a macchina sveglia (purchase 0.53% → 0.78% CPU)
+ *
+ * CHANGELOG v8.28 (2026-10-16):
+ * - [BLE] Lotto TLV su CMD: [0x80, seq, tipo, len, valore...] fino a 20 byte; validato
+ *         per intero (BleComandi.h) e accodato con EventFsm::postLotto() in un blocco
+ *         contiguo; eseguito in ordine fino al primo comando rifiutato, i successivi
+ *         hanno esito SALTATO; esito per comando con seq + i, FORMATO se malformato
+ * - [FEATURE] Conferma con quantità (1-5 pezzi, credito e scorte verificati per tutti):
+ *             EROGAZIONE ripetuta per ogni pezzo; scorte insufficienti → rifiuto senza resto
+ * - [FEATURE] Rifornimento per prodotto (pezzi da aggiungere, max SCORTE_MAX)
+ * - [BLE] Seleziona + conferma in una sola scrittura ATT invece di due
+ * - [HOST] Scenario "cmd": 44 esiti attesi, lotti validi, malformati e quantità
+ *
+ * CHANGELOG v8.27 (2026-10-16):
+ * - [BLE] Comandi [cmd, seq] su 0xA004 (il formato a 1 byte resta valido): la callback
+ *         accoda l'evento con la sequenza e ritorna; dopo la transizione l'esito
+ *         [seq, cmd, esito] è notificato su RESULT 0xA006 (accettato, sconosciuto,
+ *         coda piena, stato, credito, esaurito), fino a 6 esiti per notifica
+ * - [FSM] EventFsm: riferimento nell'evento, rifiuta(motivo) dalle azioni, onEsito()
+ * - [BLE] BleNotifier::accoda(): caratteristiche a eventi (record mai soppressi)
+ * - [HOST] Scenario "cmd": 31 comandi, esiti tutti come attesi; round-trip medio 42ms,
+ *          max 50ms con eventi di connessione a 30ms; raffica di 12 comandi in 50ms
+ *
+ * CHANGELOG v8.26 (2026-10-16):
+ * - [BLE] Caratteristica SNAPSHOT 0xA005 (BleSnapshot.h): 18 byte versionati con credito
+ *         a 16 bit, stato, prodotto, scorte, T/H, flag, numero di sequenza e istante di
+ *         invio in una sola notifica; TEMP/HUM/STATUS invariate per le app esistenti
+ * - [BLE] BleNotifier::timbro(): seq/istante scritti all'invio, esclusi dal confronto
+ *         con l'ultimo valore (nessuna notifica solo perché il timestamp è cambiato)
+ * - [HOST] Scenario "ble" e byte in aria/min nel report: legacy 356 B/min contro
+ *          snapshot 534 B/min (app sempre connessa), 443 contro 587 in purchase; lo
+ *          snapshot conviene in byte solo quando 2+ campi cambiano insieme
+ *
+ * CHANGELOG v8.25 (2026-10-16):
+ * - [PERFORMANCE] BleNotifier: scrittura GATT solo con client sottoscritto (CCCD) e valore
+ *                 cambiato; update dello stesso tick accorpati in una sola scrittura
+ * - [PERFORMANCE] Intervallo minimo per caratteristica: STATUS 100ms, TEMP/HUM 10s
+ *                 (cambi ravvicinati rimandati, inviato solo l'ultimo)
+ * - [HAL] BleListener::onSubscription() da onUpdatesEnabled/onUpdatesDisabled
+ * - [HOST] Purchase 600s: 696 → 94 scritture GATT (TEMP/HUM 300 → 13, STATUS 96 → 68)
+ *
+ * CHANGELOG v8.24 (2026-10-16):
+ * - [PERFORMANCE] Log differito: record() copia solo tipo, istante e argomenti grezzi in
+ *                 una coda lock-free (CAS, sequenza per slot) utilizzabile anche da ISR;
+ *                 codifica e invio seriale nel thread di drain a bassa priorità
+ * - [ROBUSTNESS] Politica di scarto: STATUS scartato oltre 3/4 di coda, eventi solo a coda
+ *                piena; contatori separati e occupazione massima, TLM_SYNC con i persi
+ * - [HAL] background_wake(): il thread di drain dorme finché non arriva un record
+ * - [HOST] "vending_sim tlm": raffica da ISR e UART satura, 0 eventi persi
+ *
+ * CHANGELOG v8.23 (2026-10-16):
+ * - [PERFORMANCE] Log seriale binario (Telemetry.h): record tipo + Δt + argomenti varint
+ *                 con CRC-8 invece di righe printf; STATUS ~20 byte invece di ~110
+ * - [PERFORMANCE] Nessuna printf bloccante a 9600 baud: ring buffer 1KB svuotato sulla coda
+ *                 eventi con scritture non bloccanti (hal::serial_write), record persi contati
+ * - [TOOL] host/tlm_decode ricostruisce le righe di testo identiche alle precedenti
+ * - [CONFIG] TELEMETRIA_BINARIA=0: stesse righe di testo, sempre asincrone
+ * - [HOST] UART 9600 simulata con FIFO 256 byte: purchase 600s 46236 → 7967 byte (5.8x)
+ *
+ * CHANGELOG v8.22 (2026-10-16):
+ * - [PERFORMANCE] DHT11 decodificato dai timestamp dei fronti (InterruptIn) con interrupt
+ *                 abilitati: niente più __disable_irq() per ~4ms ogni 2s (BLE, sonar, tick)
+ * - [ALGORITHM] DhtDecoder: ultimi 40 impulsi alti, soglia 48μs (margine ±20μs di latenza ISR)
+ * - [HOST] "vending_sim dht": tracce di fronti con latenza ISR, fronti persi, frame troncato;
+ *          IRQ disabilitati per lettura: 3.75ms (bit-bang) → 0
+ *
+ * CHANGELOG v8.21 (2026-10-16):
+ * - [POWER] Idle profondo dopo 30s di RIPOSO senza eventi: tick 100ms sospeso,
+ *           retroilluminazione LCD spenta, sonar 1s, DHT/log 10s, thread display 500ms
+ * - [POWER] Risveglio da presenza sonar, connessione BLE o soglia LDR (controllo ogni 200ms,
+ *           moneta contata anche a macchina in idle)
+ * - [HAL] start_background() ritorna un id, background_period_ms() cambia la cadenza
+ * - [NOTE] Sleep, non deep sleep: il Timer μs della misura echo blocca lo stop mode
+ * - [HOST] Report CPU sveglia per ora simulata: idle da 0.550% (81.8 risvegli/s) a 0.087% (22.2/s)
+ *
+ * CHANGELOG v8.20 (2026-10-16):
+ * - [ARCH] EventFsm: transizioni in tabella (stato, evento, guardia, azione, destinazione)
+ * - [ARCH] Eventi da un'unica coda: moneta, prodotto, conferma, annulla, timeout, presenza,
+ *          sovratemperatura, rifornimento. Callback BLE e thread DHT non toccano più lo stato
+ * - [ARCH] Timer FSM con hal::call_in_ms (erogazione, resto, credito, countdown, lampeggio)
+ * - [ARCH] Presenza: filtro a timer su ogni lettura sonar (stesse soglie/durate dei contatori)
+ * - [LOGIC] Selezione prodotto solo in RIPOSO/ATTESA_MONETA, annullo app solo da ATTESA_MONETA
+ * - [SAFETY] Servo chiuso all'uscita da EROGAZIONE (anche su allarme temperatura)
+ * - [NOTE] LDR e pulsante ancora campionati ogni 100ms (ADC senza interrupt)
+ * - [HOST] Report latenza per tipo di evento (post → fine transizione)
+ *
+ * CHANGELOG v8.19 (2026-10-16):
+ * - [ARCH] LcdRenderer: thread display a bassa priorità, unico utilizzatore di TextLCD
+ * - [ARCH] Coda lock-free di schermate: FSM (schermata base) e callback BLE (messaggi a durata)
+ * - [PERFORMANCE] Nessuna sleep per tenere messaggi a schermo: cmd 11 (2.8s),
+ *                 connect/disconnect (1.5s), annullo/timeout (1s), erogato (1.5s), esaurito (2s)
+ * - [UX] Prodotto esaurito: segnalazione buzzer affidata al lampeggio dello stato RESTO
+ * - [HOST] Report durata callback BLE; purchase 3600s: tick max 1500ms → 0, fuori budget 79 → 0
+ *
+ * CHANGELOG v8.18 (2026-10-16):
+ * - [PERFORMANCE] TextLCD accoda le sequenze nibble: una transazione I2C per flush
+ *                 invece di 6 START/indirizzo/STOP per carattere
+ * - [PERFORMANCE] Trasferimento I2C asincrono (hal::I2CBus::write_async, doppio buffer)
+ * - [CONFIG] LCD_I2C_HZ: 100kHz default, 400kHz Fast-mode opzionale
+ * - [HAL] write_async: mbed::I2C::transfer se DEVICE_I2CASYNCH, altrimenti bloccante
+ * - [HOST] Benchmark "vending_sim lcd": 723 car/s (originale) → 1733 (100kHz) / 6930 (400kHz)
+ *
+ * CHANGELOG v8.17 (2026-10-16):
+ * - [PERFORMANCE] TextLCD con framebuffer 2x16: printf/setCursor/clear scrivono in RAM
+ * - [PERFORMANCE] lcd.flush() a fine tick invia solo le celle cambiate (cursore coalescente)
+ * - [CLEANUP] Rimossi wait_us(500) tra setCursor/printf e wait_us(20000) dopo clear()
+ * - [LCD] LCD_CLEARDISPLAY solo in begin(): clear() non genera più traffico I2C
+ * - [HOST] Report byte I2C/tick: idle da 384.0 a 0.0, purchase da 397.8 a 9.9
+ *
+ * CHANGELOG v8.16 (2026-10-16):
+ * - [PERFORMANCE] Eliminato leggiDistanza() bloccante (5 x 15ms di wait_us nel tick)
+ * - [ARCH] SonarRanger: burst di 5 ping schedulata da hal::Timeout, fronti echo in ISR
+ * - [ARCH] updateMachine() legge l'ultima distanza filtrata senza attese
+ * - [ALGORITHM] Invariati media, range 2-400cm e filtro anti-spike asimmetrico
+ * - [HAL] Aggiunto hal::Timeout (mbed::Timeout su target, evento ISR su host)
+ * - [HOST] Report: tick fuori budget (>= 100ms); idle 3600s da 7197 a 0, max tick 118 → 66ms
+ *
+ * CHANGELOG v8.15 (2026-10-16):
+ * - [ARCH] Introdotta HAL (hal/hal.h): la logica non usa più oggetti Mbed globali
+ * - [ARCH] Pin map, servizio GATT 0xA000, bit-bang DHT11 spostati in hal/hal_mbed.cpp
+ * - [ARCH] Boot in setupMachine(), main() solo su target (dispatch coda eventi)
+ * - [HOST] Simulatore Linux (host/): sensori/attuatori simulati, GATT finto, orologio virtuale
+ * - [HOST] updateMachine() eseguibile a centinaia di migliaia di tick/s per profiling
+ *
  * CHANGELOG v8.14 (2026-01-06):
  * - [UX] Aggiunto feedback LCD per comando rifornimento scorte (cmd 11)
  * - [DISPLAY] Mostra "RIFORNIMENTO..." → "RIFORNIMENTO OK!" → "Scorte: 5/5/5/5"
@@ -115,36 +402,27 @@
  * - [FEATURE] Comando BLE 11 per rifornimento scorte
  */
 
-#include "mbed.h"
-#include "ble/BLE.h"
-#include "ble/Gap.h"
-#include "ble/GattServer.h"
+#include <cstdio>
+#include <cstring>
+#include "hal/hal.h"
 #include "TextLCD.h"
+#include "LcdRenderer.h"
+#include "SonarRanger.h"
+#include "ButtonInput.h"
+#include "SensorFilter.h"
+#include "MachineState.h"
+#include "VendingApp.h"
+#include "BleSnapshot.h"
+#include "BleComandi.h"
+#include "CoinDetector.h"
+#include "CoinClassifier.h"
+#include "FlashJournal.h"
 
 // ======================================================================================
 // CONFIGURAZIONE PIN HARDWARE
 // ======================================================================================
-// Mappa tutti i pin utilizzati sul microcontrollore STM32 Nucleo F401RE
-// Questa configurazione è ottimizzata per raggruppare i dispositivi vicini fisicamente
-
-// --- Sensore Ultrasuoni HC-SR04 (rilevamento presenza utente) ---
-#define PIN_TRIG    A1          // Trigger: invia impulso ultrasuoni
-#define PIN_ECHO    D9          // Echo: riceve risposta ultrasuoni (InterruptIn per precisione timing)
-
-// --- Sensore Fotoresistenza LDR (rilevamento monete) ---
-#define PIN_LDR     A2          // Ingresso analogico: valore aumenta quando moneta blocca luce
-
-// --- Sensore Temperatura/Umidità DHT11 ---
-#define PIN_DHT     D4          // Pin bidirezionale: lettura temp/hum tramite protocollo proprietario DHT
-
-// --- Attuatori ---
-#define PIN_SERVO   D5          // Servomotore SG90: dispensa prodotti (PWM 1-2ms)
-#define PIN_BUZZER  D2          // Buzzer piezoelettrico: feedback sonoro
-
-// --- Display LCD 16x2 I2C (interfaccia utente) ---
-#define PIN_LCD_SDA D14         // I2C Data (pin hardware fisso)
-#define PIN_LCD_SCL D15         // I2C Clock (pin hardware fisso)
-                                // Indirizzo I2C: 0x4E (adapter PCF8574)
+// La mappa pin della Nucleo F401RE è nell'implementazione HAL (hal/hal_mbed.cpp).
+// La logica applicativa accede alle periferiche solo tramite hal::Board.
 
 // ======================================================================================
 // PARAMETRI DI CONFIGURAZIONE SISTEMA
@@ -155,7 +433,12 @@
 // ALGORITMO SPIKE DETECTION: rileva variazioni improvvise rispetto al baseline
 #define SOGLIA_LDR_DELTA_SCATTO 20  // Delta % sopra baseline per rilevare moneta (spike +20%)
 #define SOGLIA_LDR_DELTA_RESET   5  // Delta % sotto baseline per resettare (spike < +5%)
-#define LDR_BASELINE_ALPHA      10  // Coefficiente media mobile (1-10, più alto = più reattivo)
+#define LDR_BASELINE_SHIFT      10  // Media mobile α = 1/1024 per campione: costante ~1s
+                                    // (come α = 10% a 100ms della v8.28)
+
+// --- Campionamento LDR (TIM → ADC → DMA in doppio buffer, vedi hal::AdcStream) ---
+#define LDR_CAMPIONI_HZ   1000  // Moneta in caduta (~10-25ms davanti al sensore): 10+ campioni
+#define LDR_BLOCCO        32    // Campioni per metà buffer: un interrupt ogni 32ms
 
 // --- Soglie Sensore Ultrasuoni (rilevamento presenza utente) ---
 #define DISTANZA_ATTIVA   40    // Distanza in cm sotto la quale utente è considerato presente
@@ -173,64 +456,91 @@
 
 // --- Debouncing LDR (anti-rimbalzo lettura monete) ---
 #define LDR_DEBOUNCE_SAMPLES 3      // Campioni consecutivi richiesti (ridotto da 5 a 3)
-#define LDR_DEBOUNCE_TIME_US 200000 // Tempo minimo 200ms (ridotto da 300ms)
-                                    // Ottimizzato per compensare oscillazioni valore LDR
-
-// --- Prezzi Prodotti (in EUR) ---
-#define PREZZO_ACQUA      1     // Bottiglia acqua: 1 EUR
-#define PREZZO_SNACK      2     // Snack confezionato: 2 EUR
-#define PREZZO_CAFFE      1     // Caffè: 1 EUR
-#define PREZZO_THE        2     // The: 2 EUR
+#define LDR_DEBOUNCE_TIME_US 2000   // Tempo minimo 2ms (200ms col campionamento a 100ms)
+                                    // Scarta disturbi di un campione (flicker, rumore ADC)
+
+// --- Prezzi Prodotti (in centesimi, come il credito) ---
+#define PREZZO_ACQUA      100   // Bottiglia acqua: 1 EUR
+#define PREZZO_SNACK      200   // Snack confezionato: 2 EUR
+#define PREZZO_CAFFE      100   // Caffè: 1 EUR
+#define PREZZO_THE        200   // The: 2 EUR
 int prezzoSelezionato = PREZZO_ACQUA;  // Prodotto selezionato correntemente
 int idProdotto = 1;                    // ID prodotto: 1=ACQUA, 2=SNACK, 3=CAFFE, 4=THE
 
 // --- Filtri FSM (stabilità transizioni stati) ---
-#define FILTRO_INGRESSO   5     // Cicli consecutivi < 40cm richiesti per RIPOSO → ATTESA_MONETA
-#define FILTRO_USCITA     20    // Cicli consecutivi > 60cm richiesti per ATTESA_MONETA → RIPOSO
+#define FILTRO_INGRESSO   5     // (N+1) x 100ms con utente < 40cm per RIPOSO → ATTESA_MONETA
+#define FILTRO_USCITA     20    // (N+1) x 100ms con utente > 60cm per ATTESA_MONETA → RIPOSO
 
-// ======================================================================================
-// CONFIGURAZIONE BLUETOOTH LOW ENERGY (BLE)
-// ======================================================================================
-// UUID identificativi univoci per servizio e caratteristiche GATT
-// Permette comunicazione wireless con app Android/iOS
+// --- Display LCD I2C ---
+// PCF8574 da datasheet: 100kHz. 400000 (Fast-mode) solo con expander compatibili (es. PCA8574)
+#define LCD_I2C_HZ        100000
+
+// --- Servo di erogazione (SG90, impulso in μs; profili in DispenseSequencer.cpp) ---
+#define SERVO_CHIUSO_US   1000  // Riposo: sportello chiuso
+
+// --- Giornale in flash (FlashJournal: scorte e denaro persistenti) ---
+#define GIORNALE_LOTTO_MS 200   // Modifiche accorpate in un record: al reset si perde al più questa finestra
+
+// --- Watchdog (timeout 10s) ---
+#define WATCHDOG_KICK_MS  1000  // updateMachine; in idle profondo lo fa ldrSveglia (IDLE_LDR_MS)
+
+// --- Idle profondo (RIPOSO senza attività, tick del watchdog sospeso) ---
+#define IDLE_PROFONDO_MS  30000 // RIPOSO senza eventi per 30s → idle profondo
+#define IDLE_LDR_MS       200   // Soglia LDR in idle (DMA fermo): moneta lenta (~600ms) vista
+                                // ancora davanti al sensore quando il DMA riparte
+#define IDLE_STATUS_MS    10000 // Log STATUS e BLE temperatura/umidità in idle (normale: 2s)
+#define IDLE_DHT_MS       10000 // Thread DHT11 in idle (normale: 2s)
+#define IDLE_DISPLAY_MS   500   // Thread display in idle (normale: 20ms)
 
-const UUID VENDING_SERVICE_UUID((uint16_t)0xA000);  // Servizio principale distributore
-const UUID TEMP_CHAR_UUID((uint16_t)0xA001);        // Caratteristica temperatura (notify)
-const UUID STATUS_CHAR_UUID((uint16_t)0xA002);      // Caratteristica stato (6 byte): [credito, stato, scorte[4]]
-const UUID HUM_CHAR_UUID((uint16_t)0xA003);         // Caratteristica umidità (notify)
-const UUID CMD_CHAR_UUID((uint16_t)0xA004);         // Caratteristica comandi (write):
-                                                    // 1-4=selezione prodotto, 9=annulla, 10=conferma, 11=rifornimento
+// --- Notifiche BLE (intervallo minimo tra due notifiche della stessa caratteristica) ---
+#define BLE_MIN_STATUS_MS   100     // Stato/credito/scorte: reattivo, raffiche accorpate
+#define BLE_MIN_AMBIENTE_MS 10000   // Temperatura/umidità: variano lentamente
+#define BLE_MIN_SNAPSHOT_MS 100     // Snapshot: segue lo stato (T/H viaggiano con esso)
 
 // ======================================================================================
 // MACCHINA A STATI FINITI (FSM - Finite State Machine)
 // ======================================================================================
-// Gestisce il flusso operativo del distributore automatico
-// Transizioni: RIPOSO ↔ ATTESA_MONETA → EROGAZIONE → RESTO → RIPOSO
-//              └─────────────────────→ ERRORE (temperatura alta)
-
-enum Stato {
-    RIPOSO,         // Utente lontano, distributore in idle (verde)
-    ATTESA_MONETA,  // Utente vicino, attende inserimento monete (ciano/magenta/giallo)
-    EROGAZIONE,     // Dispensing prodotto in corso (servo attivo)
-    RESTO,          // Restituzione resto/credito residuo
-    ERRORE          // Errore sistema (temperatura > soglia, blocco operazioni)
-};
+// Stati ed eventi dichiarati in VendingApp.h (condivisi con il simulatore host).
+// Transizioni: tabella fsmTabella (sezione FSM A EVENTI).
+
 Stato statoCorrente = RIPOSO;       // Stato attuale FSM
-Stato statoPrecedente = ERRORE;     // Stato precedente (per rilevare cambi stato)
 
 // ======================================================================================
 // OGGETTI DRIVER HARDWARE (Mbed OS)
 // ======================================================================================
-// Istanze delle classi Mbed per interfacciamento con periferiche hardware
+// Periferiche fornite dalla HAL (Mbed su target, simulate su host)
+
+hal::Board &board = hal::board();
+TextLCD lcd(board.i2c, 0x4E);                     // Display LCD 16x2 I2C (addr 0x4E = 0x27 << 1)
+LcdRenderer display(lcd);                         // Schermate accodate al thread display (mai attese)
+hal::DigitalOut &trig = board.trig;               // HC-SR04: trigger ultrasuoni (impulso 10μs)
+hal::EdgeIn &echo = board.echo;                   // HC-SR04: echo risposta (interrupt driven per timing preciso)
+hal::DhtSensor &dht = board.dht;                  // DHT11: lettura frame 40 bit
+hal::PwmOut &servo = board.servo;                 // SG90: servomotore PWM 50Hz (impulso 1-2ms)
+DispenseSequencer erogatore(servo, board.servoTimeout, SERVO_CHIUSO_US);  // Profili del servo in background
+const ProfiloServo *profiloErogazione = &PROFILO_RAMPA;
+hal::AnalogIn &ldr = board.ldr;                   // LDR: fotoresistenza (ADC 0-3.3V → 0-100%), solo in idle
+hal::AdcStream &ldrStream = board.ldrStream;      // LDR a LDR_CAMPIONI_HZ via DMA (rilevamento monete)
+hal::DigitalOut &buzzer = board.buzzer;           // Buzzer: feedback sonoro (HIGH=suona)
+ButtonInput tastoAnnulla(board.tastoAnnulla, board.tastoTimeout); // Pulsante onboard Nucleo (interrupt, debounce sui fronti)
+
+// Fine trasferimento I2C asincrono del display (ISR)
+void lcdTxDone() {
+    lcd.onTxDone();
+}
+
+// Thread display (bassa priorità): unico utilizzatore di lcd dopo il boot
+void lcd_render_thread() {
+    display.render();
+}
+
+// Log seriale: record grezzi accodati senza attese, codificati e inviati dal thread
+// di drain (bassa priorità, svegliato dal primo record; vedi Telemetry.h)
+Telemetria tlm;
 
-TextLCD lcd(PIN_LCD_SDA, PIN_LCD_SCL, 0x4E);  // Display LCD 16x2 I2C (addr 0x4E = 0x27 << 1)
-DigitalOut trig(PIN_TRIG);                    // HC-SR04: trigger ultrasuoni (impulso 10μs)
-InterruptIn echo(PIN_ECHO);                   // HC-SR04: echo risposta (interrupt driven per timing preciso)
-DigitalInOut dht(PIN_DHT);                    // DHT11: pin bidirezionale (input/output switching)
-PwmOut servo(PIN_SERVO);                      // SG90: servomotore PWM 50Hz (duty 1-2ms)
-AnalogIn ldr(PIN_LDR);                        // LDR: fotoresistenza (ADC 0-3.3V → 0-100%)
-DigitalOut buzzer(PIN_BUZZER);                // Buzzer: feedback sonoro (HIGH=suona)
-DigitalIn tastoAnnulla(PC_13);                // Pulsante onboard Nucleo (pull-up interno)
+void telemetria_drain_thread() {
+    tlm.drain();
+}
 
 // ======================================================================================
 // LED RGB (feedback visivo stato sistema)
@@ -241,9 +551,9 @@ DigitalIn tastoAnnulla(PC_13);                // Pulsante onboard Nucleo (pull-u
                             // 0 = Common Cathode (catodo comune a GND, anodi ai pin)
                             // 1 = Common Anode (anodo comune a VCC, catodi ai pin - logica invertita)
 
-DigitalOut ledR(D6);  // LED rosso
-DigitalOut ledG(D8);  // LED verde
-DigitalOut ledB(A3);  // LED blu
+hal::DigitalOut &ledR = board.ledR;  // LED rosso
+hal::DigitalOut &ledG = board.ledG;  // LED verde
+hal::DigitalOut &ledB = board.ledB;  // LED blu
 
 /**
  * @brief Imposta colore LED RGB con supporto common cathode/anode
@@ -261,47 +571,44 @@ void setRGB(int r, int g, int b) {
 #endif
 }
 
-// ======================================================================================
-// SERIALE USB (debug e logging)
-// ======================================================================================
-BufferedSerial pc(USBTX, USBRX, 9600);  // Comunicazione seriale USB @ 9600 baud
-FileHandle *mbed::mbed_override_console(int fd) { return &pc; }  // Redirige printf() su USB
-
 // ======================================================================================
 // VARIABILI GLOBALI DI STATO
 // ======================================================================================
 // Mantengono lo stato corrente del sistema, sensori, timer
 
 // --- Timer (misurazione tempi) ---
-Timer sonarTimer;           // Misura durata impulso echo HC-SR04 (interrupt driven)
-Timer timerUltimaMoneta;    // Tempo trascorso da ultima moneta inserita (timeout resto)
-Timer timerStato;           // Durata permanenza nello stato corrente
-Timer ldrDebounceTimer;     // Timer debouncing LDR (anti-rimbalzo)
-
-// --- Sensore Ultrasuoni HC-SR04 ---
-volatile uint64_t echoDuration = 0;  // Durata impulso echo in microsecondi (volatile: modificato da ISR)
-int ultimaDistanzaValida = 100;      // Cache ultima distanza valida (filtro anti-spike)
-                                     // Inizializzato a 100cm (distanza media ragionevole)
-
-// --- Sensore LDR (rilevamento monete) ---
-bool monetaInLettura = false;   // TRUE se moneta attualmente presente davanti a LDR
-int ldrSampleCount = 0;         // Contatore campioni consecutivi sopra soglia (debouncing)
-int ldrBaseline = 50;           // Baseline mobile LDR (inizializzato a 50%, si adatta automaticamente)
-bool ldrBaselineInit = false;   // TRUE dopo prima inizializzazione baseline
+uint64_t scadenzaCredito = 0;    // Istante del resto automatico (countdown LCD)
+
+// --- Sensore LDR (rilevamento monete, vedi CAMPIONAMENTO LDR) ---
+int ldrBaseline = 50;           // Baseline mobile LDR in % (log e soglia in idle)
 
 // --- Sistema Credito e Pagamento ---
-int credito = 0;                // Credito accumulato in EUR (somma monete inserite)
+int credito = 0;                // Credito disponibile in centesimi (monete non ancora impegnate)
 bool creditoResiduo = false;    // TRUE se c'è credito residuo da restituire
+VendLedger cassa(credito);      // Conti del denaro e ordini confermati (pipeline)
+bool erogazioneInPipeline = true;   // false: ingressi ignorati in EROGAZIONE e RESTO (fino alla v8.37)
+
+// --- Tagli delle monete (CoinClassifier, calibrazione con BLE cmd 12) ---
+CalibrazioneMonete calibrazione;            // Dal giornale in flash al boot (tagli == 0: non calibrata)
+AddestramentoMonete addestramento;          // Monete raccolte dalla calibrazione in corso
+uint8_t taglioInCalibrazione = TAGLIO_IGNOTO;   // Taglio in raccolta (TAGLIO_IGNOTO: nessuna)
+uint32_t moneteTaglio[TAGLI + 1];           // Accreditate per taglio, [TAGLI] = non riconosciute
+
+// --- Giornale in flash: scorte, denaro dei clienti e calibrazione sopravvivono al reset ---
+FlashJournal giornale(board.flash);
+int giornaleId = 0;             // Scrittura del lotto in attesa (0: nessuna)
+int giornaleBancoId = 0;        // Erase anticipato del banco successivo in attesa (0: nessuno)
+static_assert(sizeof(CalibrazioneMonete) <= GIORNALE_BLOB_MAX, "calibrazione oltre il blob del giornale");
 
 // --- Sensore DHT11 (temperatura/umidità) ---
-int temp_int = 0;       // Temperatura in gradi Celsius (int)
-int hum_int = 0;        // Umidità relativa percentuale (int)
-bool dht_valid = false; // TRUE se ultima lettura DHT11 è valida (checksum OK)
-Mutex dhtMutex;         // Mutex protezione accesso concorrente (thread DHT vs loop principale)
+// Scritto solo dal thread DHT, letto da coda eventi e LCD senza mutex (vedi MachineState.h)
+Seqlock<Ambiente> ambiente;
+
+// --- Stato pubblicato (copia coerente per log, BLE, LCD; vedi pubblicaStato) ---
+Seqlock<MachineState> statoMacchina;
 
-// --- Filtri FSM (stabilizzazione transizioni) ---
-int contatorePresenza = 0;  // Contatore cicli consecutivi con utente presente (dist < 40cm)
-int contatoreAssenza = 0;   // Contatore cicli consecutivi con utente assente (dist > 60cm)
+// --- Presenza utente (sonar filtrato, vedi presenzaLettura) ---
+bool utentePresente = false;
 
 // ======================================================================================
 // GESTIONE SCORTE PRODOTTI
@@ -310,556 +617,540 @@ int contatoreAssenza = 0;   // Contatore cicli consecutivi con utente assente (d
 int scorte[5] = {0, 5, 5, 5, 5};  // Inizializzazione: 5 pezzi per prodotto (stock pieno)
 const int SCORTE_MAX = 5;         // Capacità massima magazzino per prodotto
 
-// ======================================================================================
-// WATCHDOG TIMER (sicurezza anti-hang)
-// ======================================================================================
-// Resetta microcontrollore se loop principale non esegue kick() entro 10 secondi
-// Protezione contro blocchi software critici
-Watchdog &watchdog = Watchdog::get_instance();
-
 // ======================================================================================
 // CLASSE BLE SERVICE
 // ======================================================================================
+// Le update*() non scrivono direttamente il GATT: BleNotifier sopprime valori invariati
+// e caratteristiche senza client sottoscritto, accorpa gli update dello stesso tick.
+BleNotifier notifiche(board.ble);
+
+void bleFlush() {
+    notifiche.flush();
+}
+
+/**
+ * @brief Esito di un comando con sequenza: record [seq, cmd, esito] su RESULT
+ * rif = (cmd << 8) | seq, come passato a fsm.post() da onCommand().
+ */
+void notificaEsito(uint16_t rif, uint8_t esito) {
+    uint8_t record[ESITO_LEN] = {(uint8_t)rif, (uint8_t)(rif >> 8), esito};
+    notifiche.accoda(hal::BLE_CHAR_RESULT, record, ESITO_LEN);
+}
+
+// Fine elaborazione di un evento con riferimento (comando BLE con sequenza)
+void esitoEvento(const Evento &ev, uint8_t motivo) {
+    if (motivo == FSM_IGNORATO) motivo = ESITO_STATO;
+    else if (motivo == FSM_SALTATO) motivo = ESITO_SALTATO;
+    notificaEsito(ev.rif, motivo);
+}
+
+// Numero di sequenza e istante di invio dello SNAPSHOT (vedi BleSnapshot.h)
+uint16_t snapshotSeq = 0;
+
+void snapshotTimbro(uint8_t *valore, uint16_t len) {
+    if (len >= SNAPSHOT_LEN) snapshotTimbra(valore, snapshotSeq++, (uint32_t)(hal::now_us() / 1000));
+}
+
 class VendingService {
 public:
-    VendingService(BLE &_ble, int initial_temp, int initial_hum, int initial_credit) :
-        ble(_ble),
-        tempChar(TEMP_CHAR_UUID, &initial_temp, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
-        humChar(HUM_CHAR_UUID, &initial_hum, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
-        cmdChar(CMD_CHAR_UUID, &initial_credit, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE),
-        statusChar(STATUS_CHAR_UUID, statusData, 6, 6, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY)
+    VendingService(BleNotifier &_notifiche, int initial_temp, int initial_hum) :
+        notifiche(_notifiche), temp(initial_temp), hum(initial_hum), ambienteValido(false)
     {
-        statusData[0] = 0;
-        statusData[1] = 0;
-        statusData[2] = (uint8_t)scorte[1];
-        statusData[3] = (uint8_t)scorte[2];
-        statusData[4] = (uint8_t)scorte[3];
-        statusData[5] = (uint8_t)scorte[4];
-
-        GattCharacteristic *charTable[] = {&tempChar, &humChar, &statusChar, &cmdChar};
-        GattService vendingService(VENDING_SERVICE_UUID, charTable, 4);
-        ble.gattServer().addService(vendingService);
+        notifiche.begin(bleFlush);
+        notifiche.intervalloMin(hal::BLE_CHAR_STATUS, BLE_MIN_STATUS_MS);
+        notifiche.intervalloMin(hal::BLE_CHAR_TEMP, BLE_MIN_AMBIENTE_MS);
+        notifiche.intervalloMin(hal::BLE_CHAR_HUM, BLE_MIN_AMBIENTE_MS);
+        notifiche.intervalloMin(hal::BLE_CHAR_SNAPSHOT, BLE_MIN_SNAPSHOT_MS);
+        notifiche.timbro(hal::BLE_CHAR_SNAPSHOT, snapshotTimbro);
+        notifiche.set(hal::BLE_CHAR_TEMP, &temp, sizeof(temp));
+        notifiche.set(hal::BLE_CHAR_HUM, &hum, sizeof(hum));
+        updateStatus(statoMacchina.leggi());
     }
 
     void updateTemp(int newTemp) {
-        ble.gattServer().write(tempChar.getValueHandle(), (uint8_t *)&newTemp, sizeof(newTemp));
+        temp = newTemp;
+        ambienteValido = true;
+        notifiche.set(hal::BLE_CHAR_TEMP, &newTemp, sizeof(newTemp));
+        aggiornaSnapshot();
     }
 
     void updateHum(int newHum) {
-        ble.gattServer().write(humChar.getValueHandle(), (uint8_t *)&newHum, sizeof(newHum));
+        hum = newHum;
+        ambienteValido = true;
+        notifiche.set(hal::BLE_CHAR_HUM, &newHum, sizeof(newHum));
+        aggiornaSnapshot();
     }
 
-    void updateStatus(int credit, int state) {
-        statusData[0] = (uint8_t)credit;
-        statusData[1] = (uint8_t)state;
-        statusData[2] = (uint8_t)scorte[1];
-        statusData[3] = (uint8_t)scorte[2];
-        statusData[4] = (uint8_t)scorte[3];
-        statusData[5] = (uint8_t)scorte[4];
-        ble.gattServer().write(statusChar.getValueHandle(), statusData, 6);
+    void updateStatus(const MachineState &m) {
+        statusData[0] = (uint8_t)(m.credito / 100);   // EUR interi: formato delle app esistenti
+        statusData[1] = m.stato;
+        for (int i = 0; i < 4; i++) statusData[2 + i] = m.scorte[i];
+        notifiche.set(hal::BLE_CHAR_STATUS, statusData, 6);
+        aggiornaSnapshot(m);
     }
 
-    GattAttribute::Handle_t getCmdHandle() { return cmdChar.getValueHandle(); }
+    /**
+     * @brief Ricostruisce lo SNAPSHOT dallo stato pubblicato (seq/t_ms al momento dell'invio)
+     * Gli update dello stesso tick sono accorpati da BleNotifier in una sola notifica.
+     */
+    void aggiornaSnapshot() { aggiornaSnapshot(statoMacchina.leggi()); }
+
+    void aggiornaSnapshot(const MachineState &m) {
+        Snapshot s;
+        s.seq = 0;
+        s.t_ms = 0;
+        int euro = m.credito / 100;
+        s.credito = (uint16_t)((euro < 0) ? 0 : (euro > 0xFFFF) ? 0xFFFF : euro);
+        s.centesimi = (uint16_t)((m.credito < 0) ? 0 : (m.credito > 0xFFFF) ? 0xFFFF : m.credito);
+        s.stato = m.stato;
+        s.prodotto = m.prodotto;
+        for (int i = 0; i < 4; i++) s.scorte[i] = m.scorte[i];
+        s.temp = (int8_t)temp;
+        s.hum = (uint8_t)hum;
+        s.flag = (ambienteValido ? SNAPSHOT_FLAG_DHT : 0) | (m.presente ? SNAPSHOT_FLAG_PRESENZA : 0);
+
+        uint8_t buf[SNAPSHOT_LEN];
+        snapshotCodifica(s, buf);
+        notifiche.set(hal::BLE_CHAR_SNAPSHOT, buf, SNAPSHOT_LEN);
+    }
 
 private:
-    BLE &ble;
+    BleNotifier &notifiche;
     uint8_t statusData[6];
-    ReadOnlyGattCharacteristic<int> tempChar;
-    ReadOnlyGattCharacteristic<int> humChar;
-    WriteOnlyGattCharacteristic<int> cmdChar;
-    GattCharacteristic statusChar;
+    int temp;
+    int hum;
+    bool ambienteValido;    // false fino alla prima lettura DHT11 valida
 };
 
 VendingService *vendingServicePtr = nullptr;
-static EventQueue event_queue(16 * EVENTS_EVENT_SIZE);
 
 // ======================================================================================
-// GESTORE EVENTI GATT SERVER
+// GESTORE EVENTI BLE (comandi GATT, connessione/disconnessione)
 // ======================================================================================
-class VendingServerEventHandler : public ble::GattServer::EventHandler {
-    void onDataWritten(const GattWriteCallbackParams &params) override {
-        if (vendingServicePtr && params.handle == vendingServicePtr->getCmdHandle()) {
-            if (params.len > 0) {
-                uint8_t cmd = params.data[0];
-
-                if (cmd < 1 || (cmd > 4 && cmd != 9 && cmd != 10 && cmd != 11)) {
-                    printf("[SECURITY] Comando BLE invalido: 0x%02X\n", cmd);
+bool bleConnesso = false;  // Flag stato connessione BLE
+
+/**
+ * @brief Pubblica lo stato corrente in statoMacchina (solo dalla coda eventi, unico scrittore)
+ * Dopo ogni giro della FSM e prima di ogni notifica: i lettori vedono sempre credito,
+ * stato e scorte dello stesso istante.
+ */
+void pubblicaStato() {
+    MachineState m;
+    m.credito = credito;
+    m.prezzo = prezzoSelezionato;
+    m.stato = (uint8_t)statoCorrente;
+    m.prodotto = (uint8_t)idProdotto;
+    for (int i = 0; i < 4; i++) m.scorte[i] = (uint8_t)scorte[i + 1];
+    m.presente = utentePresente;
+    m.bleConnesso = bleConnesso;
+    m.versione = statoMacchina.pubblicazioni() + 1;
+    statoMacchina.scrivi(m);
+}
+
+void bleReady();
+void aggiornaLed();
+void segnalaAttivita();
+
+class VendingBleListener : public hal::BleListener {
+public:
+    void onReady() override { bleReady(); }
+
+    // --- Comandi: scrittura su caratteristica CMD (0xA004) ---
+    // [cmd] dalle app esistenti, [cmd, seq] con esito notificato su RESULT (0xA006),
+    // [CMD_LOTTO, seq, TLV...] più comandi in una scrittura (vedi BleComandi.h).
+    // La callback accoda soltanto: l'esito arriva dopo l'elaborazione nella FSM.
+    void onCommand(const uint8_t *data, uint16_t len) override {
+        if (vendingServicePtr) {
+            if (len > 0) {
+                uint8_t cmd = data[0];
+                if (cmd == CMD_LOTTO) {
+                    eseguiLotto(data, len);
                     return;
                 }
+                uint16_t rif = (len >= 2) ? (uint16_t)((cmd << 8) | data[1]) : 0;
 
-                if (cmd == 1) {
-                    if (scorte[1] <= 0) {
-                        printf("[STOCK] ACQUA esaurita\n");
-                        return;
-                    }
-                    idProdotto = 1; prezzoSelezionato = PREZZO_ACQUA;
-                    setRGB(0, 1, 1);
-                    timerUltimaMoneta.reset();
-                    printf("[BLE] ACQUA selezionata (scorte=%d)\n", scorte[1]);
-                }
-                else if (cmd == 2) {
-                    if (scorte[2] <= 0) {
-                        printf("[STOCK] SNACK esaurito\n");
-                        return;
-                    }
-                    idProdotto = 2; prezzoSelezionato = PREZZO_SNACK;
-                    setRGB(1, 0, 1);
-                    timerUltimaMoneta.reset();
-                    printf("[BLE] SNACK selezionato (scorte=%d)\n", scorte[2]);
-                }
-                else if (cmd == 3) {
-                    if (scorte[3] <= 0) {
-                        printf("[STOCK] CAFFE esaurito\n");
-                        return;
-                    }
-                    idProdotto = 3; prezzoSelezionato = PREZZO_CAFFE;
-                    setRGB(1, 1, 0);
-                    timerUltimaMoneta.reset();
-                    printf("[BLE] CAFFE selezionato (scorte=%d)\n", scorte[3]);
-                }
-                else if (cmd == 4) {
-                    if (scorte[4] <= 0) {
-                        printf("[STOCK] THE esaurito\n");
-                        return;
-                    }
-                    idProdotto = 4; prezzoSelezionato = PREZZO_THE;
-                    setRGB(0, 1, 0);
-                    timerUltimaMoneta.reset();
-                    printf("[BLE] THE selezionato (scorte=%d)\n", scorte[4]);
-                }
-                else if (cmd == 9) {
-                    if (credito > 0) {
-                        printf("[ANNULLA] App - Resto: %dE\n", credito);
-                        setRGB(1, 0, 1);
-                        statoCorrente = RESTO;
-                        timerStato.reset();
-                        timerStato.start();
-                        vendingServicePtr->updateStatus(credito, statoCorrente);
-                    }
-                }
-                else if (cmd == 10) {
-                    printf("[BLE] CONFERMA: credito=%d, prezzo=%d, stato=%d\n",
-                           credito, prezzoSelezionato, statoCorrente);
-
-                    if (statoCorrente != ATTESA_MONETA) {
-                        printf("[BLE] Rifiutata: stato invalido\n");
-                    } else if (credito < prezzoSelezionato) {
-                        printf("[BLE] Rifiutata: credito insufficiente\n");
-                    } else {
-                        printf("[BLE] Accettata: avvio erogazione\n");
-                        statoCorrente = EROGAZIONE;
-                        timerStato.reset();
-                        timerStato.start();
-                        vendingServicePtr->updateStatus(credito, statoCorrente);
-                    }
+                if (!comandoValido(cmd)) {
+                    tlm.record(TLM_BLE_INVALIDO, {cmd});
+                    if (rif) notificaEsito(rif, ESITO_SCONOSCIUTO);
+                    return;
                 }
-                else if (cmd == 11) {
-                    // Feedback LCD: notifica rifornimento in corso
-                    lcd.clear();
-                    wait_us(20000);
-                    lcd.setCursor(0, 0);
-                    lcd.printf("RIFORNIMENTO... ");
-                    wait_us(500);
-                    lcd.setCursor(0, 1);
-                    lcd.printf("Attendere       ");
-
-                    // Aggiorna scorte a valore massimo
-                    scorte[1] = SCORTE_MAX;
-                    scorte[2] = SCORTE_MAX;
-                    scorte[3] = SCORTE_MAX;
-                    scorte[4] = SCORTE_MAX;
-                    printf("[STOCK] Rifornimento completato: %d pezzi/prodotto\n", SCORTE_MAX);
-
-                    // Feedback LCD: rifornimento completato
-                    thread_sleep_for(800);  // Pausa per leggibilità
-                    lcd.clear();
-                    wait_us(20000);
-                    lcd.setCursor(0, 0);
-                    lcd.printf("RIFORNIMENTO OK!");
-                    wait_us(500);
-                    lcd.setCursor(0, 1);
-                    lcd.printf("Scorte: 5/5/5/5 ");
-                    thread_sleep_for(2000);  // Mostra messaggio per 2 secondi
-
-                    // Torna a display normale
-                    lcd.clear();
-                    wait_us(20000);
-
-                    // Notifica BLE scorte aggiornate
-                    if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
+
+                // Il comando diventa un evento: validità per stato decisa dalla tabella FSM
+                ComandoBle c = {cmd, 0, {0}};
+                Evento eventi[4];
+                int n = eventiComando(c, rif, eventi);
+                if (!fsm.postLotto(eventi, n) && rif) notificaEsito(rif, ESITO_CODA_PIENA);
+            }
+        }
+    }
+
+private:
+    /**
+     * @brief Eventi FSM di un comando; rif solo sull'ultimo (esito unico per comando)
+     * Rifornimento con quantità: un evento per prodotto, arg = (prodotto << 4) | pezzi.
+     */
+    static int eventiComando(const ComandoBle &c, uint16_t rif, Evento *eventi) {
+        Evento ev = {EV_PRODOTTO, c.cmd, 0, rif, 0, 0};
+        if (c.cmd == CMD_ANNULLA) {
+            ev.tipo = EV_ANNULLA;
+            ev.arg = ANNULLA_APP;
+        } else if (c.cmd == CMD_CONFERMA) {
+            ev.tipo = EV_CONFERMA;
+            ev.arg = c.nArgs ? c.args[0] : 0;
+        } else if (c.cmd == CMD_RIFORNIMENTO) {
+            ev.tipo = EV_RIFORNIMENTO;
+            ev.arg = 0;
+            if (c.nArgs) {
+                int n = 0;
+                for (int p = 1; p <= 4; p++) {
+                    if (c.args[p - 1] == 0) continue;
+                    Evento r = {EV_RIFORNIMENTO, (uint8_t)((p << 4) | c.args[p - 1]), 0, 0, 0, 0};
+                    eventi[n++] = r;
                 }
+                eventi[n - 1].rif = rif;
+                return n;
             }
+        } else if (c.cmd == CMD_CALIBRA) {
+            ev.tipo = EV_CALIBRA;
+            ev.arg = c.nArgs ? c.args[0] : CALIBRA_SALVA;
         }
+        eventi[0] = ev;
+        return 1;
     }
-};
 
-// ======================================================================================
-// GESTORE EVENTI GAP (Connessione/Disconnessione BLE)
-// ======================================================================================
-bool bleConnesso = false;  // Flag stato connessione BLE
+    /**
+     * @brief Lotto TLV: validato per intero, poi tutti gli eventi accodati insieme
+     * Il comando i-esimo ha esito con sequenza seq + i.
+     */
+    static void eseguiLotto(const uint8_t *data, uint16_t len) {
+        uint8_t seq = (len >= 2) ? data[1] : 0;
+        uint16_t rifLotto = (uint16_t)((CMD_LOTTO << 8) | seq);
+        ComandoBle comandi[LOTTO_MAX_COMANDI];
+        int n = (len > 2) ? lottoDecodifica(data + 2, len - 2, comandi, SCORTE_MAX) : 0;
+        if (n == 0) {
+            tlm.record(TLM_BLE_INVALIDO, {CMD_LOTTO});
+            notificaEsito(rifLotto, ESITO_FORMATO);
+            return;
+        }
 
-class VendingGapEventHandler : public ble::Gap::EventHandler {
-public:
-    void onConnectionComplete(const ble::ConnectionCompleteEvent &event) override {
-        if (event.getStatus() == BLE_ERROR_NONE) {
-            bleConnesso = true;
-            printf("[BLE] ✓ Dispositivo CONNESSO\n");
-
-            // Feedback visivo: lampeggio LED blu
-            setRGB(0, 0, 1);  // Blu
-
-            // Notifica connessione su LCD
-            lcd.clear();
-            wait_us(20000);
-            lcd.setCursor(0, 0);
-            lcd.printf("BLE CONNESSO!   ");
-            wait_us(500);
-            lcd.setCursor(0, 1);
-            lcd.printf("App collegata   ");
-            thread_sleep_for(1500);  // Mostra messaggio per 1.5 secondi
-
-            setRGB(0, 1, 0);  // Torna verde
-            lcd.clear();
-            wait_us(20000);
+        Evento eventi[LOTTO_MAX_COMANDI * 4];
+        int ne = 0;
+        for (int i = 0; i < n; i++) {
+            uint16_t rif = (uint16_t)((comandi[i].cmd << 8) | (uint8_t)(seq + i));
+            ne += eventiComando(comandi[i], rif, eventi + ne);
         }
+        tlm.record(TLM_LOTTO, {seq, n, ne});
+        if (!fsm.postLotto(eventi, ne)) notificaEsito(rifLotto, ESITO_CODA_PIENA);
     }
 
-    void onDisconnectionComplete(const ble::DisconnectionCompleteEvent &event) override {
+public:
+
+    // --- GAP: connessione/disconnessione ---
+    void onConnect() override {
+        bleConnesso = true;
+        pubblicaStato();
+        tlm.record(TLM_BLE_CONNESSO);
+
+        segnalaAttivita();
+
+        // Feedback visivo: lampeggio LED blu
+        setRGB(0, 0, 1);  // Blu
+
+        // Notifica connessione su LCD per 1.5 secondi, poi torna il colore dello stato
+        hal::call_in_ms(1500, aggiornaLed);
+        display.message("BLE CONNESSO!   ", "App collegata   ", 1500);
+    }
+
+    void onDisconnect() override {
         bleConnesso = false;
-        printf("[BLE] ✗ Dispositivo DISCONNESSO\n");
-
-        // Notifica disconnessione su LCD
-        lcd.clear();
-        wait_us(20000);
-        lcd.setCursor(0, 0);
-        lcd.printf("BLE DISCONNESSO ");
-        wait_us(500);
-        lcd.setCursor(0, 1);
-        lcd.printf("App scollegata  ");
-        thread_sleep_for(1500);  // Mostra messaggio per 1.5 secondi
-        lcd.clear();
-        wait_us(20000);
+        pubblicaStato();
+        notifiche.disconnessione();
+        tlm.record(TLM_BLE_DISCONNESSO);
+
+        // Notifica disconnessione su LCD per 1.5 secondi
+        display.message("BLE DISCONNESSO ", "App scollegata  ", 1500);
 
         // Se c'è credito residuo, restituiscilo immediatamente
-        if (credito > 0) {
-            printf("[BLE] Resto automatico per disconnessione: %dE\n", credito);
-            statoCorrente = RESTO;
-            timerStato.reset();
-            timerStato.start();
-            if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
-        }
+        fsm.post(EV_ANNULLA, ANNULLA_DISCONNESSIONE);
 
         // Riavvia advertising per nuove connessioni
-        BLE::Instance().gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+        board.ble.startAdvertising();
+    }
+
+    // --- CCCD: l'app abilita le notifiche una caratteristica alla volta ---
+    void onSubscription(hal::BleCharId id, bool enabled) override {
+        notifiche.sottoscrizione(id, enabled);
     }
 };
 
-static VendingGapEventHandler gap_handler;
-static VendingServerEventHandler server_handler;
+static VendingBleListener ble_listener;
 
 // ======================================================================================
 // SENSORI - HC-SR04 ULTRASUONI (rilevamento presenza utente)
 // ======================================================================================
 
+// Ping in background (hal::Timeout), ogni lettura pubblicata è inoltrata al filtro presenza.
+// FISICA HC-SR04: velocità suono 343 m/s = 0.0343 cm/μs, distanza = (tempo * velocità) / 2
+SonarRanger sonar(trig, board.sonarTimeout, 100);  // Inizializzato a 100cm (distanza media ragionevole)
+
 /**
  * @brief Interrupt Service Routine - fronte di salita echo
  * Chiamata automaticamente quando pin ECHO passa da LOW a HIGH
- * Avvia timer per misurare durata impulso echo
  */
 void echoRise() {
-    sonarTimer.reset();  // Reset timer
-    sonarTimer.start();  // Avvia conteggio microsecondi
+    sonar.onEchoRise();
 }
 
 /**
  * @brief Interrupt Service Routine - fronte di discesa echo
  * Chiamata automaticamente quando pin ECHO passa da HIGH a LOW
- * Stoppa timer e salva durata impulso in variabile volatile
  */
 void echoFall() {
-    sonarTimer.stop();  // Ferma timer
-    echoDuration = sonarTimer.elapsed_time().count();  // Leggi durata in μs (volatile)
+    sonar.onEchoFall();
 }
 
 /**
- * @brief Legge distanza da sensore ultrasuoni HC-SR04 con filtri anti-spike avanzati
- * @return Distanza in centimetri (range 2-400cm)
- *
- * ALGORITMO MULTI-STAGE:
- * 1. Campionamento multiplo: 5 letture consecutive con media
- * 2. Filtro range valido: scarta letture < 2cm o > 400cm (fuori specifiche sensore)
- * 3. Filtro anti-spike ASIMMETRICO:
- *    - Permette allontanamenti rapidi (es: 20cm → 200cm OK)
- *    - Blocca solo avvicinamenti impossibili > 150cm (es: 200cm → 10cm BLOCCATO)
- * 4. Fallback: se nessuna lettura valida, mantiene ultima distanza nota
- *
- * FISICA HC-SR04:
- * - Velocità suono: 343 m/s = 0.0343 cm/μs
- * - Distanza = (tempo_andata_ritorno * velocità) / 2
- * - Timeout 50ms = 850cm max teorico (in pratica max affidabile ~400cm)
+ * @brief Interrupt Service Routine - slot burst sonar (hal::Timeout)
+ * Chiude il ping precedente e lancia il successivo
  */
-int leggiDistanza() {
-    int somma = 0;    // Somma campioni validi per calcolo media
-    int validi = 0;   // Contatore campioni validi
-
-    // FASE 1: CAMPIONAMENTO MULTIPLO (5 letture)
-    // Riduce errori casuali, migliora precisione
-    for(int i=0; i<5; i++) {
-        // CRITICAL FIX: Azzera echoDuration prima di ogni misura
-        // Previene uso di valori obsoleti se sensore non risponde
-        echoDuration = 0;
-
-        // Genera impulso trigger 15μs (spec HC-SR04: min 10μs)
-        trig = 0;
-        wait_us(2);        // Assicura fronte di discesa pulito
-        trig = 1;
-        wait_us(10);       // Impulso HIGH 10μs
-        trig = 0;
-
-        // Attende risposta echo (max 15ms = ~250cm range attesa)
-        wait_us(15000);
-
-        // FASE 2: VALIDAZIONE TIMEOUT E RANGE
-        // echoDuration scritto da ISR interrupt (echoFall)
-        // Timeout 30000μs = ~500cm max
-        if (echoDuration > 0 && echoDuration < 30000) {
-            // Formula fisica: distanza = (tempo_μs * velocità_suono_cm/μs) / 2
-            int distanza = (int)(echoDuration * 0.0343f / 2.0f);
-
-            // Filtro range sensore: HC-SR04 affidabile solo 2-400cm
-            if (distanza >= 2 && distanza <= 400) {
-                somma += distanza;  // Accumula per media
-                validi++;
-            }
-        }
-    }
+void sonarSlot() {
+    sonar.onSlot();
+}
 
-    // FASE 3: GESTIONE NESSUNA LETTURA VALIDA
-    // Se tutti e 5 i campioni sono invalidi (timeout/fuori range),
-    // mantieni ultima distanza nota per evitare salti a zero
-    if (validi == 0) {
-        return ultimaDistanzaValida;  // Failsafe: usa cache
+/**
+ * @brief Modo della cadenza sonar per lo stato della FSM (idle profondo a parte)
+ * Nessun ping durante erogazione e resto: il cliente è davanti, servo e buzzer lavorano.
+ */
+ModoSonar modoSonar(Stato s) {
+    switch (s) {
+        case RIPOSO:        return SONAR_RIPOSO;
+        case EROGAZIONE:
+        case RESTO:         return SONAR_PAUSA;
+        default:            return SONAR_CLIENTE;
     }
+}
 
-    // Calcola media aritmetica campioni validi
-    int media = somma / validi;
-
-    // FASE 4: FILTRO ANTI-SPIKE ASIMMETRICO (v8.7 Final)
-    // PROBLEMA RISOLTO: filtro simmetrico bloccava allontanamenti rapidi
-    // SOLUZIONE: filtro asimmetrico distingue avvicinamenti da allontanamenti
-    //
-    // FISICA: utente può allontanarsi rapidamente (es: 20cm → 200cm in 500ms)
-    //         ma avvicinamenti > 150cm in 500ms sono impossibili (spike sensore)
-    //
-    // ESEMPI:
-    // ✓ 17cm → 150cm: media(150) > ultimaDist(17) - 150 = -133 → ACCETTATO
-    // ✓ 20cm → 200cm: media(200) > ultimaDist(20) - 150 = -130 → ACCETTATO
-    // ✓ 150cm → 80cm: differenza 70cm < 150cm → ACCETTATO (avvicinamento normale)
-    // ✗ 200cm → 10cm: media(10) < ultimaDist(200) - 150 = 50 → BLOCCATO (spike!)
-    if (media < ultimaDistanzaValida - 150) {
-        // Spike negativo eccessivo: probabile errore sensore
-        // Mantieni valore precedente per stabilità
-        return ultimaDistanzaValida;
+// --- Filtro presenza ---
+// Isteresi sulla distanza (presente sotto DISTANZA_ATTIVA, assente sopra +20cm), poi
+// debounce: il cambio è confermato solo se nessuna lettura lo smentisce per
+// (FILTRO_INGRESSO+1) o (FILTRO_USCITA+1) x 100ms (stessa durata dei vecchi contatori
+// a 100ms). Letture nella fascia di isteresi 40-60cm annullano la conferma in corso.
+// Il sonar legge ogni 0.5-5s: alla scadenza del debounce l'ultima lettura è
+// ripresentata al filtro da un timer, senza attendere la lettura successiva.
+CatenaFiltri<FiltroIsteresi, FiltroDebounce> filtroPresenza(
+    FiltroIsteresi(DISTANZA_ATTIVA, DISTANZA_ATTIVA + 20),
+    FiltroDebounce(1, (FILTRO_INGRESSO + 1) * 100000, 1, (FILTRO_USCITA + 1) * 100000));
+int presenzaTimerId = 0;
+
+void presenzaScadenza();
+
+/**
+ * @brief Una lettura al filtro presenza (t: istante della lettura, non dell'elaborazione)
+ * Il debounce conta dal momento in cui il sonar ha misurato, anche se la coda eventi
+ * era occupata (BLE, LCD) e ne elabora più d'una insieme.
+ */
+void presenzaFiltra(int cm, uint64_t t) {
+    bool presente = filtroPresenza.filtra(cm, t);
+
+    if (presente != utentePresente) {
+        utentePresente = presente;
+        pubblicaStato();
+        fsm.postIngresso(EV_PRESENZA, utentePresente ? 1 : 0, t);
+    }
+    FiltroDebounce &conferma = filtroPresenza.stadio<1>();
+    if (!conferma.inAttesa()) {
+        if (presenzaTimerId) hal::cancel(presenzaTimerId);
+        presenzaTimerId = 0;
+        return;
     }
+    if (presenzaTimerId == 0) {
+        uint64_t ora = hal::now_us();
+        uint32_t ms = (conferma.scadenza() > ora) ? (uint32_t)((conferma.scadenza() - ora + 999) / 1000) : 1;
+        presenzaTimerId = hal::call_in_ms(ms, presenzaScadenza);
+    }
+}
+
+// Svuota la coda delle letture del sonar (in ordine, ognuna col suo istante)
+void presenzaLettura() {
+    LetturaSonar l;
+    while (sonar.lettura(l)) presenzaFiltra(l.cm, l.t_us);
+}
+
+// Scadenza del debounce: l'ultima lettura ripresentata adesso
+void presenzaScadenza() {
+    presenzaTimerId = 0;
+    presenzaLettura();
+    if (presenzaTimerId == 0) presenzaFiltra(sonar.distance(), hal::now_us());
+}
 
-    // FASE 5: AGGIORNA CACHE E RITORNA
-    ultimaDistanzaValida = media;  // Salva per prossima chiamata
-    return media;
+/**
+ * @brief Interrupt Service Routine - lettura sonar pubblicata (fine burst)
+ * La lettura è già nella coda del sonar; il filtro presenza gira sulla coda eventi
+ */
+void sonarLettura() {
+    hal::call(presenzaLettura);
 }
 
 // ======================================================================================
 // DHT11 - THREAD SEPARATO
 // ======================================================================================
-int pulseIn(int level) {
-    int count = 0;
-    while (dht == level) {
-        if (count++ > 200) return -1;
-        wait_us(1);
-    }
-    return count;
-}
-
+/**
+ * @brief Lettura periodica DHT11 (thread bassa priorità, ogni 2s)
+ * La decodifica del protocollo (fronti in ISR) è nella HAL; qui solo checksum e pubblicazione.
+ */
 void dht_reader_thread() {
-    while(true) {
-        dht.output();
-        dht = 0;
-        thread_sleep_for(18);
-        dht = 1;
-        wait_us(30);
-        dht.input();
-
-        __disable_irq();
-        bool error = false;
-        if (pulseIn(1) == -1 || pulseIn(0) == -1 || pulseIn(1) == -1) error = true;
-
-        uint8_t data[5] = {0};
-        if (!error) {
-            for (int i = 0; i < 40; i++) {
-                if (pulseIn(0) == -1) { error = true; break; }
-                int width = pulseIn(1);
-                if (width == -1) { error = true; break; }
-                if (width > 45) data[i/8] |= (1 << (7 - (i%8)));
-            }
-        }
-        __enable_irq();
-
-        if (!error) {
-            uint8_t calc = (data[0] + data[1] + data[2] + data[3]) & 0xFF;
-            if (data[4] == calc && (data[0] != 0 || data[2] != 0)) {
-                dhtMutex.lock();
-                hum_int = data[0];
-                temp_int = data[2];
-                dht_valid = true;
-                dhtMutex.unlock();
+    uint8_t data[5];
+    if (dht.read(data)) {
+        uint8_t calc = (data[0] + data[1] + data[2] + data[3]) & 0xFF;
+        if (data[4] == calc && (data[0] != 0 || data[2] != 0)) {
+            ambiente.scrivi({(int16_t)data[2], data[0], true});   // Mai bloccante
+            sonar.setTemperatura(data[2]);     // Velocità del suono per la conversione dell'eco
+
+            // Soglia con isteresi 2°C: un evento solo al cambio di condizione
+            static bool sovratemp = false;
+            if (!sovratemp && data[2] >= SOGLIA_TEMP) {
+                sovratemp = true;
+                fsm.post(EV_SOVRATEMP, 1);
+            } else if (sovratemp && data[2] <= SOGLIA_TEMP - 2) {
+                sovratemp = false;
+                fsm.post(EV_SOVRATEMP, 0);
             }
         }
-
-        ThisThread::sleep_for(2000ms);
     }
 }
 
 // ======================================================================================
-// LOOP PRINCIPALE
+// FSM A EVENTI
 // ======================================================================================
-void updateMachine() {
-    static int counterTemp = 0;
-    static int counterDist = 0;
-    static int blinkTimer = 0;
-    static int logCounter = 0;
-    static int dist = 100;  // Cache distanza
+// Transizioni in tabella (fsmTabella), eventi da un'unica coda (EventFsm). La coda
+// eventi è svegliata solo da: moneta (LDR), comando BLE, timer della FSM, presenza
+// (sonar), temperatura (DHT11). Nessuno stato è più modificato fuori dalla FSM.
+
+// --- Timer della FSM (hal::call_in_ms) ---
+enum TimerFsm {
+    TIMER_STATO = 0,    // Fasi a tempo: RESTO (3s); EROGAZIONE finisce con EV_EROGATO
+    TIMER_ANIM,         // Animazione: countdown credito, buzzer RESTO, lampeggio ERRORE
+    TIMER_CREDITO,      // Resto automatico (TIMEOUT_RESTO_AUTO dall'ultima moneta)
+    TIMER_PRESENZA,     // Conferma presenza/assenza all'ingresso in RIPOSO/ATTESA_MONETA
+    TIMER_COUNT
+};
 
-    watchdog.kick();
+int timerId[TIMER_COUNT];           // Id hal::call_in_ms (0 = non armato)
+uint16_t timerGen[TIMER_COUNT];     // Generazione: timeout già accodato ma superato → scartato
 
-    int ldr_val = (int)(ldr.read() * 100);
+void timerScaduto(int t) {
+    timerId[t] = 0;
+    fsm.post(EV_TIMEOUT, (uint8_t)t, timerGen[t]);
+}
+void timerStatoScaduto()    { timerScaduto(TIMER_STATO); }
+void timerAnimScaduto()     { timerScaduto(TIMER_ANIM); }
+void timerCreditoScaduto()  { timerScaduto(TIMER_CREDITO); }
+void timerPresenzaScaduto() { timerScaduto(TIMER_PRESENZA); }
 
-    // Campiona distanza con frequenza variabile in base allo stato
-    int sogliaDistanza = (statoCorrente == RIPOSO) ? 5 : 50;  // RIPOSO: ogni 500ms, altri stati: ogni 5s
-    if (++counterDist >= sogliaDistanza) {
-        counterDist = 0;
-        dist = leggiDistanza();
-    }
+const hal::Task timerTask[TIMER_COUNT] = {
+    timerStatoScaduto, timerAnimScaduto, timerCreditoScaduto, timerPresenzaScaduto
+};
 
-    // LOG COMPATTO: Stampa variabili su singola riga ogni 2 secondi (20 cicli @ 100ms)
-    if (++logCounter >= 20) {
-        logCounter = 0;
-        dhtMutex.lock();
-        int temp_copy = temp_int;
-        int hum_copy = hum_int;
-        dhtMutex.unlock();
-
-        const char* nomiStati[] = {"RIPOSO", "ATTESA_MONETA", "EROGAZIONE", "RESTO", "ERRORE"};
-        int ldrDelta = ldr_val - ldrBaseline;
-        printf("[STATUS] %s | %-14s | €%-2d | P%d@%dEUR | LDR:%2d%%(B:%2d Δ:%+3d) | DIST:%3dcm | T:%2d°C H:%2d%% | A%d S%d C%d T%d\n",
-               bleConnesso ? "BLE:ON " : "BLE:OFF",
-               nomiStati[statoCorrente], credito, idProdotto, prezzoSelezionato,
-               ldr_val, ldrBaseline, ldrDelta, dist, temp_copy, hum_copy,
-               scorte[1], scorte[2], scorte[3], scorte[4]);
-    }
+void fermaTimer(int t) {
+    if (timerId[t]) hal::cancel(timerId[t]);
+    timerId[t] = 0;
+    timerGen[t]++;
+}
 
-    // Aggiorna sensori ogni 2s
-    if (++counterTemp > 20) {
-        counterTemp = 0;
-        if (vendingServicePtr) {
-            dhtMutex.lock();
-            int temp_copy = temp_int;
-            int hum_copy = hum_int;
-            bool valid = dht_valid;
-            dhtMutex.unlock();
-
-            if (valid) {
-                vendingServicePtr->updateTemp(temp_copy);
-                vendingServicePtr->updateHum(hum_copy);
-            }
-        }
+void armaTimer(int t, uint32_t ms) {
+    fermaTimer(t);
+    timerId[t] = hal::call_in_ms(ms, timerTask[t]);
+}
 
-        dhtMutex.lock();
-        int temp_check = temp_int;
-        dhtMutex.unlock();
+// --- Dati di lavoro della FSM ---
+int blinkTimer = 0;         // Passo animazione (buzzer RESTO, lampeggio ERRORE)
 
-        if (temp_check >= SOGLIA_TEMP && statoCorrente != ERRORE) {
-            printf("[ALLARME] Temperatura: %d°C (soglia: %d°C)\n", temp_check, SOGLIA_TEMP);
-            statoCorrente = ERRORE;
-            lcd.clear();
-            wait_us(20000);
-        }
-    }
+const char* nomiProdotti[] = {"", "ACQUA", "SNACK", "CAFFE", "THE"};
+const int prezzi[] = {0, PREZZO_ACQUA, PREZZO_SNACK, PREZZO_CAFFE, PREZZO_THE};
 
-    // SPIKE DETECTION LDR (algoritmo adattivo anti-luce ambiente)
-    if (statoCorrente != ERRORE && statoCorrente != EROGAZIONE && statoCorrente != RESTO) {
-        // FASE 1: Inizializza/aggiorna baseline mobile (media esponenziale mobile - EMA)
-        // Baseline si adatta automaticamente alla luce ambiente
-        if (!ldrBaselineInit) {
-            ldrBaseline = ldr_val;  // Prima lettura: imposta baseline immediato
-            ldrBaselineInit = true;
-        } else if (!monetaInLettura) {
-            // Aggiorna baseline SOLO quando non c'è moneta (evita distorsione)
-            // EMA: baseline = baseline * (1 - α) + ldr_val * α, con α = LDR_BASELINE_ALPHA/100
-            ldrBaseline = ((100 - LDR_BASELINE_ALPHA) * ldrBaseline + LDR_BASELINE_ALPHA * ldr_val) / 100;
-        }
+void notificaStato() {
+    pubblicaStato();
+    if (vendingServicePtr) vendingServicePtr->updateStatus(statoMacchina.leggi());
+}
 
-        // FASE 2: Calcola spike (differenza rispetto al baseline)
-        int ldrDelta = ldr_val - ldrBaseline;
+// Secondi al resto automatico (countdown LCD)
+int secondiMancanti() {
+    uint64_t now = hal::now_us();
+    return (now < scadenzaCredito) ? (int)((scadenzaCredito - now) / 1000000) : 0;
+}
 
-        // FASE 3: Rilevamento spike positivo (moneta blocca luce → LDR aumenta)
-        if (ldrDelta > SOGLIA_LDR_DELTA_SCATTO && !monetaInLettura) {
-            if (ldrSampleCount == 0) {
-                ldrDebounceTimer.start();
-            }
-            ldrSampleCount++;
-
-            uint64_t elapsed = ldrDebounceTimer.elapsed_time().count();
-            if (ldrSampleCount >= LDR_DEBOUNCE_SAMPLES && elapsed > LDR_DEBOUNCE_TIME_US) {
-                monetaInLettura = true;
-                credito++;
-                timerUltimaMoneta.reset();
-                creditoResiduo = false;
-                ldrSampleCount = 0;
-                ldrDebounceTimer.reset();
-
-                if (statoCorrente == RIPOSO) statoCorrente = ATTESA_MONETA;
-                if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
-
-                printf("[LDR] Moneta rilevata! Credito=%d EUR (val=%d%%, base=%d%%, Δ=+%d%%)\n",
-                       credito, ldr_val, ldrBaseline, ldrDelta);
-            }
-        }
-        // FASE 4: Reset quando spike rientra sotto soglia minima
-        else if (ldrDelta < SOGLIA_LDR_DELTA_RESET) {
-            if (monetaInLettura) {
-                monetaInLettura = false;
-                ldrDebounceTimer.stop();
-                printf("[LDR] Reset moneta (val=%d%%, base=%d%%, Δ=%+d%%)\n",
-                       ldr_val, ldrBaseline, ldrDelta);
-            }
-            ldrSampleCount = 0;
-        }
-    }
+void avviaTimerCredito() {
+    scadenzaCredito = hal::now_us() + TIMEOUT_RESTO_AUTO;
+    armaTimer(TIMER_CREDITO, TIMEOUT_RESTO_AUTO / 1000);
+}
 
-    if (statoCorrente != statoPrecedente) {
-        lcd.clear();
-        wait_us(20000);
-        buzzer = 0;
+/**
+ * @brief Colore LED dello stato corrente
+ */
+void aggiornaLed() {
+    switch (statoCorrente) {
+        case RIPOSO:
+            setRGB(0, 1, 0);
+            break;
+        case ATTESA_MONETA:
+            if (idProdotto == 1) setRGB(0, 1, 1);
+            else if (idProdotto == 2) setRGB(1, 0, 1);
+            else if (idProdotto == 3) setRGB(1, 1, 0);
+            else setRGB(0, 1, 0);
+            break;
+        case EROGAZIONE:
+            setRGB(1, 1, 0);
+            break;
+        case RESTO:
+            setRGB(1, 0, 1);
+            break;
+        case ERRORE:
+            if (blinkTimer % 2 == 0) setRGB(1, 0, 0);
+            else setRGB(0, 0, 0);
+            break;
+    }
+}
 
-        const char* nomiStati[] = {"RIPOSO", "ATTESA_MONETA", "EROGAZIONE", "RESTO", "ERRORE"};
-        printf("[FSM] %s -> %s | Credito: %dE | Prodotto: %d\n",
-               nomiStati[statoPrecedente], nomiStati[statoCorrente], credito, idProdotto);
+/**
+ * @brief (Ri)arma il timer di animazione dello stato corrente
+ * ATTESA_MONETA con credito: al prossimo cambio del countdown (1 risveglio/s)
+ * RESTO: buzzer intermittente 200ms; ERRORE: lampeggio 100ms. Altri stati: nessun risveglio.
+ */
+void armaAnimazione() {
+    uint64_t now = hal::now_us();
+    if (statoCorrente == ATTESA_MONETA && credito > 0 && now < scadenzaCredito) {
+        uint32_t msAlCambio = (uint32_t)(((scadenzaCredito - now) % 1000000) / 1000) + 1;
+        armaTimer(TIMER_ANIM, msAlCambio);
+    }
+    else if (statoCorrente == RESTO)  armaTimer(TIMER_ANIM, 200);
+    else if (statoCorrente == ERRORE) armaTimer(TIMER_ANIM, 100);
+    else fermaTimer(TIMER_ANIM);
+}
 
-        statoPrecedente = statoCorrente;
-        contatorePresenza = 0;
-        contatoreAssenza = 0;
-        if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
+/**
+ * @brief Schermata base dello stato corrente (accodata al thread display se cambiata)
+ */
+void disegnaSchermata() {
+    char e1[EURO_LEN], e2[EURO_LEN];
+
+    // Calibrazione in corso (solo RIPOSO/ATTESA_MONETA senza credito): taglio e monete raccolte
+    if (taglioInCalibrazione != TAGLIO_IGNOTO && (statoCorrente == RIPOSO || statoCorrente == ATTESA_MONETA)) {
+        char riga[17];
+        display.setCursor(0, 0);
+        snprintf(riga, sizeof(riga), "CALIBRA %sE", formatoEuro(centesimiTaglio[taglioInCalibrazione], e1));
+        display.printf("%-16s", riga);
+        display.setCursor(0, 1);
+        snprintf(riga, sizeof(riga), "Monete: %d/%d", addestramento.monete[taglioInCalibrazione], CALIB_MIN_MONETE);
+        display.printf("%-16s", riga);
+        display.commit();
+        return;
     }
 
     switch (statoCorrente) {
-        case RIPOSO:
-            setRGB(0, 1, 0);
-            buzzer = 0;
-            lcd.setCursor(0, 0);
-            wait_us(500);
-            lcd.printf("  VENDING IoT   ");
-            wait_us(500);
-            lcd.setCursor(0, 1);
-            wait_us(500);
+        case RIPOSO: {
+            display.setCursor(0, 0);
+            display.printf("  VENDING IoT   ");
+            display.setCursor(0, 1);
 
             // Mostra prodotto selezionato e scorte
             char buffer[17];
@@ -867,41 +1158,25 @@ void updateMachine() {
             else if(idProdotto==2) snprintf(buffer, 17, "SNACK  Rim:%d/5", scorte[2]);
             else if(idProdotto==3) snprintf(buffer, 17, "CAFFE  Rim:%d/5", scorte[3]);
             else                   snprintf(buffer, 17, "THE    Rim:%d/5", scorte[4]);
-            lcd.printf("%s", buffer);
-
-            if (dist < DISTANZA_ATTIVA) {
-                if (++contatorePresenza > FILTRO_INGRESSO) statoCorrente = ATTESA_MONETA;
-            } else contatorePresenza = 0;
+            display.printf("%s", buffer);
             break;
+        }
 
         case ATTESA_MONETA: {
-            if (idProdotto == 1) setRGB(0, 1, 1);
-            else if (idProdotto == 2) setRGB(1, 0, 1);
-            else if (idProdotto == 3) setRGB(1, 1, 0);
-            else setRGB(0, 1, 0);
-
-            buzzer = 0;
-            lcd.setCursor(0, 0);
-            wait_us(500);
-            uint64_t tempoPassato = timerUltimaMoneta.elapsed_time().count();
-
-            int secondiMancanti = 0;
-            if (tempoPassato < TIMEOUT_RESTO_AUTO) {
-                secondiMancanti = (TIMEOUT_RESTO_AUTO - tempoPassato) / 1000000;
-            }
+            display.setCursor(0, 0);
+            int secondi = secondiMancanti();
 
             // Mostra stato credito e richiesta conferma (padding 16 caratteri)
             char buf[17];  // 16 caratteri + \0
             if (credito >= prezzoSelezionato) {
                 // Credito sufficiente: mostra conferma con nome prodotto
                 // Padding esplicito con spazi per evitare residui LCD
-                const char* nomiProdotti[] = {"", "ACQUA", "SNACK", "CAFFE", "THE"};
                 snprintf(buf, sizeof(buf), "Conf. x %s!      ", nomiProdotti[idProdotto]);
                 buf[16] = '\0';  // Tronca esattamente a 16 caratteri
             } else if (credito > 0 && credito < prezzoSelezionato) {
                 // Credito parziale: mostra quanto manca
                 char temp[17];
-                snprintf(temp, sizeof(temp), "Cr:%dE T:%02ds", credito, secondiMancanti);
+                snprintf(temp, sizeof(temp), "Cr:%sE T:%02ds", formatoEuro(credito, e1), secondi);
                 snprintf(buf, sizeof(buf), "%-16s", temp);
             } else {
                 // Credito zero: mostra prodotto selezionato
@@ -911,249 +1186,855 @@ void updateMachine() {
                 else if(idProdotto==3) { snprintf(buf, sizeof(buf), "Ins.Mon x CAFFE "); buf[16] = '\0'; }
                 else                   { snprintf(buf, sizeof(buf), "Ins.Mon x THE   "); buf[16] = '\0'; }
             }
-            lcd.printf("%s", buf);
+            display.printf("%s", buf);
 
-            wait_us(500);
-            lcd.setCursor(0, 1);
-            wait_us(500);
+            display.setCursor(0, 1);
 
             // Riga 2: credito/timeout o prezzo/scorte (padding 16 caratteri)
             char buf2[17];
             if(credito > 0) {
                 // Mostra credito e timeout resto
                 char temp[17];
-                snprintf(temp, sizeof(temp), "Cr:%d/%d T:%02ds", credito, prezzoSelezionato, secondiMancanti);
+                snprintf(temp, sizeof(temp), "Cr:%s/%s T:%02ds", formatoEuro(credito, e1),
+                         formatoEuro(prezzoSelezionato, e2), secondi);
                 snprintf(buf2, sizeof(buf2), "%-16s", temp);
             } else {
                 // Mostra prezzo e scorte prodotto selezionato
-                const char* nomi[] = {"", "ACQUA", "SNACK", "CAFFE", "THE"};
                 char temp[17];
-                snprintf(temp, sizeof(temp), "%s:%dE Rim:%d", nomi[idProdotto], prezzoSelezionato, scorte[idProdotto]);
+                snprintf(temp, sizeof(temp), "%s:%sE Rim:%d", nomiProdotti[idProdotto], formatoEuro(prezzoSelezionato, e1),
+                         scorte[idProdotto]);
                 snprintf(buf2, sizeof(buf2), "%-16s", temp);
             }
-            lcd.printf("%s", buf2);
-
-            // Gestione eventi
-            if (tastoAnnulla == 0 && credito > 0) {
-                // Annullamento manuale con pulsante
-                lcd.clear();
-                wait_us(20000);
-                lcd.printf("Annullato Manual");
-                printf("[ANNULLA] Pulsante - Resto: %dE\n", credito);
-                thread_sleep_for(1000);
-                statoCorrente = RESTO;
-                timerStato.reset();
-                timerStato.start();
-                if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
-            }
-            else if (credito > 0 && tempoPassato > TIMEOUT_RESTO_AUTO) {
-                // Timeout 30s: restituisci qualsiasi credito (parziale o completo)
-                lcd.clear();
-                wait_us(20000);
-                lcd.printf("Tempo Scaduto!");
-                printf("[TIMEOUT] Resto automatico - Credito: %dE\n", credito);
-                thread_sleep_for(1000);
-                statoCorrente = RESTO;
-                timerStato.reset();
-                timerStato.start();
-                if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
-            }
-            else if (dist > (DISTANZA_ATTIVA + 20) && credito == 0) {
-                // Ritorno a RIPOSO se utente si allontana senza credito
-                if (++contatoreAssenza > FILTRO_USCITA) statoCorrente = RIPOSO;
-            } else contatoreAssenza = 0;
+            display.printf("%s", buf2);
             break;
         }
 
-        case EROGAZIONE:
-            // CRITICAL: Verifica scorte PRIMA di erogare
-            if (idProdotto < 1 || idProdotto > 4 || scorte[idProdotto] <= 0) {
-                printf("[ERRORE] Tentativo erogazione con scorte=0 (prodotto %d)\n", idProdotto);
-                setRGB(1, 0, 0);
-                lcd.clear();
-                wait_us(20000);
-                lcd.setCursor(0, 0);
-                lcd.printf("PRODOTTO");
-                lcd.setCursor(0, 1);
-                lcd.printf("ESAURITO!");
-                buzzer = 1;
-                thread_sleep_for(2000);
-                buzzer = 0;
-
-                // Vai a RESTO per restituire il credito
-                statoCorrente = RESTO;
-                timerStato.reset();
-                timerStato.start();
-                if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
-                break;
-            }
-
-            // Scorte disponibili: procedi con erogazione
-            setRGB(1, 1, 0);
-            lcd.setCursor(0, 0);
-            wait_us(500);
-
-            // Mostra nome prodotto erogato
-            if(idProdotto==1)      lcd.printf("Erogando ACQUA  ");
-            else if(idProdotto==2) lcd.printf("Erogando SNACK  ");
-            else if(idProdotto==3) lcd.printf("Erogando CAFFE  ");
-            else                   lcd.printf("Erogando THE    ");
-
-            wait_us(500);
-            lcd.setCursor(0, 1);
-            wait_us(500);
-            lcd.printf("Attendere       ");
-            if (timerStato.elapsed_time().count() < 2000000) {
-                buzzer = 1;
-                if (timerStato.elapsed_time().count() < 1000000) servo.write(0.10f);
-                else servo.write(0.05f);
+        case EROGAZIONE: {
+            display.setCursor(0, 0);
+
+            // Mostra nome prodotto erogato (ordine in corso, non la selezione successiva)
+            const Ordine *o = cassa.ordineInCorso();
+            int p = o ? o->prodotto : idProdotto;
+            if(p==1)      display.printf("Erogando ACQUA  ");
+            else if(p==2) display.printf("Erogando SNACK  ");
+            else if(p==3) display.printf("Erogando CAFFE  ");
+            else          display.printf("Erogando THE    ");
+
+            // Pipeline: credito del cliente successivo, già utilizzabile
+            display.setCursor(0, 1);
+            if (credito > 0) {
+                char bufCred[17];
+                snprintf(bufCred, sizeof(bufCred), "Credito: %sE", formatoEuro(credito, e1));
+                display.printf("%-16s", bufCred);
             } else {
-                buzzer = 0;
-
-                // Decrementa scorte dopo erogazione riuscita
-                scorte[idProdotto]--;
-                printf("[EROGAZIONE] Prodotto %d erogato. Scorte rimanenti: %d\n", idProdotto, scorte[idProdotto]);
-
-                credito -= prezzoSelezionato;
-
-                // Mostra prodotto erogato e scorte aggiornate
-                lcd.clear();
-                wait_us(20000);
-                lcd.setCursor(0, 0);
-                const char* nomi[] = {"", "ACQUA", "SNACK", "CAFFE", "THE"};
-                char bufErog[17];
-                snprintf(bufErog, 17, "%s erogato!", nomi[idProdotto]);
-                lcd.printf("%s", bufErog);
-
-                lcd.setCursor(0, 1);
-                if (credito > 0) {
-                    char bufCred[17];
-                    snprintf(bufCred, 17, "Rim:%d Cred:%dE", scorte[idProdotto], credito);
-                    lcd.printf("%s", bufCred);
-                } else {
-                    char bufRim[17];
-                    snprintf(bufRim, 17, "Rimanenti: %d", scorte[idProdotto]);
-                    lcd.printf("%s", bufRim);
-                }
-                thread_sleep_for(1500);
-
-                if (credito > 0) {
-                    statoCorrente = ATTESA_MONETA;
-                    timerUltimaMoneta.reset();
-                    timerUltimaMoneta.start();
-                    creditoResiduo = true;
-                } else {
-                    statoCorrente = ATTESA_MONETA;
-                    creditoResiduo = false;
-                }
-
-                if (vendingServicePtr) vendingServicePtr->updateStatus(credito, statoCorrente);
+                display.printf("Attendere       ");
             }
             break;
+        }
 
-        case RESTO:
-            setRGB(1, 0, 1);
-            lcd.setCursor(0, 0);
-            wait_us(500);
-            lcd.printf("Ritira Resto    ");
-            wait_us(500);
-            lcd.setCursor(0, 1);
-            wait_us(500);
+        case RESTO: {
+            display.setCursor(0, 0);
+            display.printf("Ritira Resto    ");
+            display.setCursor(0, 1);
             char bufResto[17];
-            snprintf(bufResto, sizeof(bufResto), "Monete: %d", credito);
-            lcd.printf("%s", bufResto);
-
-            if ((timerStato.elapsed_time().count() % 400000) < 200000) buzzer = 1;
-            else buzzer = 0;
-
-            if (timerStato.elapsed_time().count() > 3000000) {
-                printf("[RESTO] Restituito: %dE\n", credito);
-                buzzer = 0;
-                credito = 0;
-                statoCorrente = ATTESA_MONETA;
-            }
+            snprintf(bufResto, sizeof(bufResto), "Resto: %sE", formatoEuro(cassa.resto(), e1));
+            display.printf("%s", bufResto);
             break;
+        }
 
-        case ERRORE:
-            blinkTimer++;
-            if (blinkTimer % 2 == 0) { setRGB(1, 0, 0); buzzer = 1; }
-            else { setRGB(0, 0, 0); buzzer = 0; }
-
-            lcd.setCursor(0, 0);
-            wait_us(500);
-            lcd.printf("! ALLARME TEMP !");
-            wait_us(500);
-            lcd.setCursor(0, 1);
-            wait_us(500);
+        case ERRORE: {
+            display.setCursor(0, 0);
+            display.printf("! ALLARME TEMP !");
+            display.setCursor(0, 1);
             char bufErr[17];
-            dhtMutex.lock();
-            snprintf(bufErr, sizeof(bufErr), "T:%dC > %dC", temp_int, SOGLIA_TEMP);
-            dhtMutex.unlock();
-            lcd.printf("%s", bufErr);
-
-            dhtMutex.lock();
-            int temp_check = temp_int;
-            dhtMutex.unlock();
-            if (temp_check <= (SOGLIA_TEMP - 2)) statoCorrente = RIPOSO;
+            snprintf(bufErr, sizeof(bufErr), "T:%dC > %dC", ambiente.leggi().temp, SOGLIA_TEMP);
+            display.printf("%s", bufErr);
             break;
+        }
+    }
+
+    display.commit();
+}
+
+// --- Guardie ---
+bool timerValido(const Evento &ev, int t) { return ev.arg == t && ev.gen == timerGen[t]; }
+// Pezzi della conferma (arg 0: comando singolo → 1)
+int pezziRichiesti(const Evento &ev) { return ev.arg ? ev.arg : 1; }
+// Scorte non prenotate da ordini confermati ancora da erogare
+int disponibili(int p) { return scorte[p] - cassa.pezziImpegnati(p); }
+
+bool gPresente(const Evento &ev)             { return ev.arg == 1; }
+bool gAssenteSenzaCredito(const Evento &ev)  { return ev.arg == 0 && credito == 0; }
+bool gPresenzaConfermata(const Evento &ev)   { return timerValido(ev, TIMER_PRESENZA) && utentePresente; }
+bool gAssenzaConfermata(const Evento &ev)    { return timerValido(ev, TIMER_PRESENZA) && !utentePresente && credito == 0; }
+bool gScorteEsaurite(const Evento &ev)       { return ev.arg < 1 || ev.arg > 4 || disponibili(ev.arg) <= 0; }
+bool gCreditoInsufficiente(const Evento &ev) { return credito < prezzoSelezionato * pezziRichiesti(ev); }
+bool gScorteInsufficienti(const Evento &ev)  { return idProdotto >= 1 && idProdotto <= 4 && disponibili(idProdotto) > 0 &&
+                                                      disponibili(idProdotto) < pezziRichiesti(ev); }
+bool gProdottoEsaurito(const Evento &ev)     { return idProdotto < 1 || idProdotto > 4 || disponibili(idProdotto) <= 0; }
+bool gScorteNonDisponibili(const Evento &ev) { return gProdottoEsaurito(ev) || disponibili(idProdotto) < pezziRichiesti(ev); }
+bool gPipeline(const Evento &ev)             { return erogazioneInPipeline; }
+bool gCodaOrdiniPiena(const Evento &ev)      { return !erogazioneInPipeline || cassa.codaPiena(); }
+bool gCreditoPositivo(const Evento &ev)      { return credito > 0; }
+bool gCreditoScaduto(const Evento &ev)       { return timerValido(ev, TIMER_CREDITO) && credito > 0; }
+bool gErogato(const Evento &ev)              { return ev.gen == erogatore.avvii(); }     // Non di un avvio interrotto
+bool gAltroPezzo(const Evento &ev)           { return gErogato(ev) && cassa.pezziDaErogare() > 1; }
+bool gTimerStato(const Evento &ev)           { return timerValido(ev, TIMER_STATO); }
+bool gTimerAnim(const Evento &ev)            { return timerValido(ev, TIMER_ANIM); }
+bool gSovratemp(const Evento &ev)            { return ev.arg == 1; }
+bool gTempRientrata(const Evento &ev)        { return ev.arg == 0; }
+
+// --- Azioni ---
+void aMoneta(const Evento &ev) {
+    cassa.moneta(centesimiTaglio[(ev.arg < TAGLI) ? ev.arg : TAGLIO_NON_CALIBRATO]);
+    creditoResiduo = false;
+    avviaTimerCredito();
+    tlm.record(TLM_CREDITO, {credito});
+    notificaStato();
+    armaAnimazione();
+}
+
+void aProdottoEsaurito(const Evento &ev) {
+    fsm.rifiuta(ESITO_ESAURITO);
+    tlm.record(TLM_STOCK_ESAURITO, {ev.arg});
+}
+
+void aSelezione(const Evento &ev) {
+    idProdotto = ev.arg;
+    prezzoSelezionato = prezzi[ev.arg];
+    if (credito > 0) avviaTimerCredito();   // La selezione riavvia il timeout resto
+    aggiornaLed();
+    armaAnimazione();
+    tlm.record(TLM_SELEZIONE, {ev.arg, disponibili(ev.arg)});
+}
+
+void aRifiutaCredito(const Evento &ev) {
+    fsm.rifiuta(ESITO_CREDITO);
+    tlm.record(TLM_RIFIUTO_CREDITO, {credito, prezzoSelezionato * pezziRichiesti(ev)});
+}
+
+void aRifiutaStato(const Evento &ev) {
+    fsm.rifiuta(ESITO_STATO);
+    tlm.record(TLM_RIFIUTO_STATO, {statoCorrente});
+}
+
+void aRifiutaPezzi(const Evento &ev) {
+    fsm.rifiuta(ESITO_ESAURITO);
+    tlm.record(TLM_RIFIUTO_PEZZI, {pezziRichiesti(ev), disponibili(idProdotto)});
+}
+
+/**
+ * @brief Conferma accettata: l'importo passa dal credito all'ordine (VendLedger)
+ * In EROGAZIONE (pipeline) l'ordine aspetta il servo; il credito che resta è del
+ * cliente successivo o va in resto.
+ */
+void aAccetta(const Evento &ev) {
+    int pezzi = pezziRichiesti(ev);
+    int32_t importo = prezzoSelezionato * pezzi;
+    if (statoCorrente == EROGAZIONE) tlm.record(TLM_ORDINE_CODA, {credito, importo, cassa.ordini() + 1});
+    else tlm.record(TLM_ACCETTA, {credito, importo});
+    cassa.accetta((uint8_t)idProdotto, (uint8_t)pezzi, prezzoSelezionato);
+    if (statoCorrente == EROGAZIONE) {
+        if (credito > 0) avviaTimerCredito();
+        notificaStato();
+    }
+}
+
+void aEsaurito(const Evento &ev) {
+    // CRITICAL: scorte verificate PRIMA di erogare → restituzione credito
+    fsm.rifiuta(ESITO_ESAURITO);
+    tlm.record(TLM_ERRORE_SCORTE, {idProdotto});
+    display.message("PRODOTTO", "ESAURITO!", 2000);
+}
+
+void aAnnulla(const Evento &ev) {
+    if (ev.arg == ANNULLA_PULSANTE) display.message("Annullato Manual", "", 1000);
+    tlm.record(TLM_ANNULLA, {ev.arg, credito});
+}
+
+void aCreditoScaduto(const Evento &ev) {
+    // Timeout 30s: restituisci qualsiasi credito (parziale o completo)
+    display.message("Tempo Scaduto!", "", 1000);
+    tlm.record(TLM_TIMEOUT_RESTO, {credito});
+}
+
+void aFineErogazione(const Evento &ev) {
+    buzzer = 0;
+
+    // Decrementa scorte dopo erogazione riuscita; il pezzo passa da impegnato a incassato
+    int p = cassa.ordineInCorso()->prodotto;
+    scorte[p]--;
+    tlm.record(TLM_EROGATO, {p, scorte[p]});
+    cassa.pezzoErogato();
+
+    // Mostra prodotto erogato e scorte aggiornate (1.5s)
+    char bufErog[17];
+    snprintf(bufErog, 17, "%s erogato!", nomiProdotti[p]);
+    char bufRiga2[17];
+    if (credito > 0) {
+        char e1[EURO_LEN];
+        snprintf(bufRiga2, 17, "Rim:%d Cred:%sE", scorte[p], formatoEuro(credito, e1));
+    } else {
+        snprintf(bufRiga2, 17, "Rimanenti: %d", scorte[p]);
+    }
+    display.message(bufErog, bufRiga2, 1500);
+
+    if (credito > 0) {
+        avviaTimerCredito();
+        creditoResiduo = true;
+    } else {
+        creditoResiduo = false;
+    }
+}
+
+void aRestituisci(const Evento &ev) {
+    tlm.record(TLM_RESTO, {cassa.resto()});
+    buzzer = 0;
+    cassa.restoReso();
+    // Monete del cliente successivo inserite durante il resto (pipeline)
+    if (credito > 0) avviaTimerCredito();
+}
+
+void aAnimazione(const Evento &ev) {
+    blinkTimer++;
+    if (statoCorrente == RESTO) {
+        buzzer = (blinkTimer % 2 == 0) ? 1 : 0;
+    } else if (statoCorrente == ERRORE) {
+        buzzer = (blinkTimer % 2 == 0) ? 1 : 0;
+        aggiornaLed();
+    }
+    armaAnimazione();
+}
+
+void aAllarme(const Evento &ev) {
+    tlm.record(TLM_ALLARME, {ambiente.leggi().temp, SOGLIA_TEMP});
+    cassa.interrompi();     // Pezzi non erogati e resto non reso tornano a credito
+}
+
+void aFineAllarme(const Evento &ev) {
+    // Credito dell'allarme (o lasciato in ATTESA_MONETA): reso se nessuno lo usa
+    if (credito > 0) avviaTimerCredito();
+}
+
+/**
+ * @brief Calibrazione dei tagli (BLE cmd 12), solo senza cliente con credito
+ * Taglio 1-3: le monete seguenti sono raccolte per quel taglio e non danno credito.
+ * SALVA: modello dai tagli con almeno CALIB_MIN_MONETE monete, record BLOB nel giornale
+ * in flash (~100 byte di program, nessun erase).
+ */
+void aCalibra(const Evento &ev) {
+    if (ev.arg >= 1 && ev.arg <= TAGLI) {
+        if (taglioInCalibrazione == TAGLIO_IGNOTO) addestramentoAzzera(addestramento);
+        taglioInCalibrazione = ev.arg - 1;
+        tlm.record(TLM_CALIBRA, {ev.arg, addestramento.monete[taglioInCalibrazione]});
+        return;
+    }
+    if (ev.arg == CALIBRA_CANCELLA) {
+        taglioInCalibrazione = TAGLIO_IGNOTO;
+        if (!giornale.scriviBlob(nullptr, 0)) {
+            fsm.rifiuta(ESITO_CALIBRAZIONE);
+            return;
+        }
+        memset(&calibrazione, 0, sizeof(calibrazione));
+        tlm.record(TLM_CALIBRA, {CALIBRA_CANCELLA, 0});
+        return;
+    }
+    if (taglioInCalibrazione == TAGLIO_IGNOTO) {
+        fsm.rifiuta(ESITO_STATO);      // Salva/annulla senza raccolta in corso
+        tlm.record(TLM_RIFIUTO_STATO, {statoCorrente});
+        return;
+    }
+    if (ev.arg == CALIBRA_ANNULLA) {
+        taglioInCalibrazione = TAGLIO_IGNOTO;
+        tlm.record(TLM_CALIBRA, {CALIBRA_ANNULLA, 0});
+        return;
     }
+
+    CalibrazioneMonete nuova;
+    if (!addestramentoCalcola(addestramento, CALIB_MIN_MONETE, nuova)) {
+        fsm.rifiuta(ESITO_CALIBRAZIONE);   // Raccolta ancora aperta: si possono aggiungere monete
+        return;
+    }
+    calibrazioneSigilla(nuova);
+    if (!giornale.scriviBlob(&nuova, sizeof(nuova))) {
+        fsm.rifiuta(ESITO_CALIBRAZIONE);
+        return;
+    }
+    calibrazione = nuova;
+    taglioInCalibrazione = TAGLIO_IGNOTO;
+    tlm.record(TLM_CALIBRA, {CALIBRA_SALVA, calibrazione.tagli});
+    display.message("CALIBRAZIONE OK ", "Salvata in flash", 2000);
+}
+
+void aRifornimento(const Evento &ev) {
+    if (ev.arg) {
+        // Rifornimento parziale (lotto BLE): pezzi aggiunti a un prodotto, fino a SCORTE_MAX
+        int p = ev.arg >> 4;
+        int pezzi = ev.arg & 0x0F;
+        scorte[p] = (scorte[p] + pezzi > SCORTE_MAX) ? SCORTE_MAX : scorte[p] + pezzi;
+        tlm.record(TLM_RIFORNIMENTO_PRODOTTO, {p, pezzi, scorte[p]});
+
+        char riga2[17];
+        snprintf(riga2, 17, "Scorte: %d/%d/%d/%d", scorte[1], scorte[2], scorte[3], scorte[4]);
+        display.message("RIFORNIMENTO OK!", riga2, 2000);
+        notificaStato();
+        return;
+    }
+
+    // Feedback LCD: notifica rifornimento in corso (0.8s)
+    display.message("RIFORNIMENTO... ", "Attendere       ", 800);
+
+    // Aggiorna scorte a valore massimo
+    scorte[1] = SCORTE_MAX;
+    scorte[2] = SCORTE_MAX;
+    scorte[3] = SCORTE_MAX;
+    scorte[4] = SCORTE_MAX;
+    tlm.record(TLM_RIFORNIMENTO, {SCORTE_MAX});
+
+    // Feedback LCD: rifornimento completato (2s), poi display normale
+    display.message("RIFORNIMENTO OK!", "Scorte: 5/5/5/5 ", 2000);
+
+    // Notifica BLE scorte aggiornate
+    notificaStato();
+}
+
+// --- Ingresso/uscita stati ---
+void inRiposo(const Evento &ev) {
+    // Utente già presente (es. rientro da ERRORE): conferma dopo il filtro di ingresso
+    if (utentePresente) armaTimer(TIMER_PRESENZA, (FILTRO_INGRESSO + 1) * 100);
+    aggiornaLed();
+    armaAnimazione();
+}
+
+void inAttesaMoneta(const Evento &ev) {
+    // Utente già andato via senza credito: ritorno a RIPOSO dopo il filtro di uscita
+    if (!utentePresente && credito == 0) armaTimer(TIMER_PRESENZA, (FILTRO_USCITA + 1) * 100);
+    aggiornaLed();
+    armaAnimazione();
+}
+
+void fuoriAttesaMoneta(const Evento &ev) {
+    fermaTimer(TIMER_CREDITO);
+}
+
+void inErogazione(const Evento &ev) {
+    buzzer = 1;
+    erogatore.avvia(*profiloErogazione);    // Un pezzo; la fine arriva come EV_EROGATO
+    aggiornaLed();
+}
+
+void fuoriErogazione(const Evento &ev) {
+    erogatore.ferma();      // Servo sempre chiuso all'uscita (anche su allarme temperatura)
+}
+
+void inResto(const Evento &ev) {
+    cassa.avviaResto();     // Importo fissato ora: le monete seguenti sono nuovo credito
+    buzzer = 1;
+    armaTimer(TIMER_STATO, 3000);
+    aggiornaLed();
+    armaAnimazione();
 }
 
+void inErrore(const Evento &ev) {
+    buzzer = 1;
+    aggiornaLed();
+    armaAnimazione();
+}
+
+/**
+ * @brief Operazioni comuni a ogni cambio di stato (prima dell'ingresso nel nuovo stato)
+ */
+void cambioStato(int da, int a) {
+    statoCorrente = (Stato)a;
+    fermaTimer(TIMER_STATO);
+    fermaTimer(TIMER_ANIM);
+    fermaTimer(TIMER_PRESENZA);
+    blinkTimer = 0;
+    display.clear();
+    buzzer = 0;
+
+    tlm.record(TLM_FSM, {da, a, credito, idProdotto});
+
+    // Cadenza sonar in base allo stato (burst in background, intervallo da SonarScheduler)
+    sonar.setModo(modoSonar((Stato)a));
+    notificaStato();
+}
+
+// --- Tabella ---
+const FsmStato fsmStati[] = {
+    // nome              ingresso         uscita
+    {"RIPOSO",          inRiposo,        nullptr},
+    {"ATTESA_MONETA",   inAttesaMoneta,  fuoriAttesaMoneta},
+    {"EROGAZIONE",      inErogazione,    fuoriErogazione},
+    {"RESTO",           inResto,         nullptr},
+    {"ERRORE",          inErrore,        nullptr},
+};
+
+const FsmTransizione fsmTabella[] = {
+    // da              evento           guardia                 azione             a
+    // --- Temperatura: prevale su ogni altro stato ---
+    {ERRORE,          EV_SOVRATEMP,    gTempRientrata,         aFineAllarme,      RIPOSO},
+    {ERRORE,          EV_SOVRATEMP,    nullptr,                nullptr,           FSM_INTERNA},
+    {FSM_QUALSIASI,   EV_SOVRATEMP,    gSovratemp,             aAllarme,          ERRORE},
+
+    // --- Presenza utente (sonar filtrato) ---
+    {RIPOSO,          EV_PRESENZA,     gPresente,              nullptr,           ATTESA_MONETA},
+    {ATTESA_MONETA,   EV_PRESENZA,     gAssenteSenzaCredito,   nullptr,           RIPOSO},
+    {RIPOSO,          EV_TIMEOUT,      gPresenzaConfermata,    nullptr,           ATTESA_MONETA},
+    {ATTESA_MONETA,   EV_TIMEOUT,      gAssenzaConfermata,     nullptr,           RIPOSO},
+
+    // --- Monete (LDR) ---
+    {RIPOSO,          EV_MONETA,       nullptr,                aMoneta,           ATTESA_MONETA},
+    {ATTESA_MONETA,   EV_MONETA,       nullptr,                aMoneta,           FSM_INTERNA},
+    {EROGAZIONE,      EV_MONETA,       nullptr,                aMoneta,           FSM_INTERNA},   // Pipeline
+    {RESTO,           EV_MONETA,       nullptr,                aMoneta,           FSM_INTERNA},
+
+    // --- Selezione prodotto (BLE cmd 1-4) ---
+    {FSM_QUALSIASI,   EV_PRODOTTO,     gScorteEsaurite,        aProdottoEsaurito, FSM_INTERNA},
+    {RIPOSO,          EV_PRODOTTO,     nullptr,                aSelezione,        FSM_INTERNA},
+    {ATTESA_MONETA,   EV_PRODOTTO,     nullptr,                aSelezione,        FSM_INTERNA},
+    {EROGAZIONE,      EV_PRODOTTO,     gPipeline,              aSelezione,        FSM_INTERNA},
+    {RESTO,           EV_PRODOTTO,     gPipeline,              aSelezione,        FSM_INTERNA},
+
+    // --- Conferma acquisto (BLE cmd 10) ---
+    {ATTESA_MONETA,   EV_CONFERMA,     gCreditoInsufficiente,  aRifiutaCredito,   FSM_INTERNA},
+    {ATTESA_MONETA,   EV_CONFERMA,     gScorteInsufficienti,   aRifiutaPezzi,     FSM_INTERNA},
+    {ATTESA_MONETA,   EV_CONFERMA,     gProdottoEsaurito,      aEsaurito,         RESTO},
+    {ATTESA_MONETA,   EV_CONFERMA,     nullptr,                aAccetta,          EROGAZIONE},
+    {EROGAZIONE,      EV_CONFERMA,     gCodaOrdiniPiena,       aRifiutaStato,     FSM_INTERNA},
+    {EROGAZIONE,      EV_CONFERMA,     gCreditoInsufficiente,  aRifiutaCredito,   FSM_INTERNA},
+    {EROGAZIONE,      EV_CONFERMA,     gScorteNonDisponibili,  aRifiutaPezzi,     FSM_INTERNA},
+    {EROGAZIONE,      EV_CONFERMA,     nullptr,                aAccetta,          FSM_INTERNA},   // In coda
+    {FSM_QUALSIASI,   EV_CONFERMA,     nullptr,                aRifiutaStato,     FSM_INTERNA},
+
+    // --- Fine profilo servo (DispenseSequencer): pezzo successivo (anche di un ordine in
+    //     coda) o fine erogazione ---
+    {EROGAZIONE,      EV_EROGATO,      gAltroPezzo,            aFineErogazione,   EROGAZIONE},
+    {EROGAZIONE,      EV_EROGATO,      gErogato,               aFineErogazione,   ATTESA_MONETA},
+
+    // --- Annullo: pulsante, app (cmd 9), disconnessione BLE ---
+    {ATTESA_MONETA,   EV_ANNULLA,      gCreditoPositivo,       aAnnulla,          RESTO},
+
+    // --- Timer ---
+    {ATTESA_MONETA,   EV_TIMEOUT,      gCreditoScaduto,        aCreditoScaduto,   RESTO},
+    {RIPOSO,          EV_TIMEOUT,      gCreditoScaduto,        aCreditoScaduto,   RESTO},   // Credito dal giornale
+    {RESTO,           EV_TIMEOUT,      gTimerStato,            aRestituisci,      ATTESA_MONETA},
+    {FSM_QUALSIASI,   EV_TIMEOUT,      gTimerAnim,             aAnimazione,       FSM_INTERNA},
+
+    // --- Rifornimento scorte (BLE cmd 11) ---
+    {FSM_QUALSIASI,   EV_RIFORNIMENTO, nullptr,                aRifornimento,     FSM_INTERNA},
+
+    // --- Calibrazione tagli (BLE cmd 12): macchina libera, nessun credito in gioco ---
+    {RIPOSO,          EV_CALIBRA,      nullptr,                aCalibra,          FSM_INTERNA},
+    {ATTESA_MONETA,   EV_CALIBRA,      gCreditoPositivo,       aRifiutaStato,     FSM_INTERNA},
+    {ATTESA_MONETA,   EV_CALIBRA,      nullptr,                aCalibra,          FSM_INTERNA},
+    {FSM_QUALSIASI,   EV_CALIBRA,      nullptr,                aRifiutaStato,     FSM_INTERNA},
+};
+
+EventFsm fsm(fsmStati, sizeof(fsmStati) / sizeof(fsmStati[0]),
+             fsmTabella, sizeof(fsmTabella) / sizeof(fsmTabella[0]), RIPOSO);
+
 // ======================================================================================
-// BLE INIT
+// GIORNALE IN FLASH (FlashJournal)
 // ======================================================================================
-void onBleInitError(BLE &ble, ble_error_t error) { }
+// Dopo ogni dispatch lo stato da conservare è confrontato con l'ultimo passato al
+// giornale (solo RAM); i campi cambiati vanno in flash in un solo record al più
+// GIORNALE_LOTTO_MS dopo la prima modifica: una moneta, la conferma e il pezzo
+// erogato costano decine di μs di program ciascuno, mai un erase. Il banco pieno
+// lasciato dal giornale si cancella entrando in idle profondo (macchina ferma) o, se la
+// macchina non ci arriva mai, appena il banco attivo passa GIORNALE_SOGLIA_PREPARA e la
+// FSM torna in RIPOSO senza app connessa (giornaleAnticipaBanco()): con la flash dati
+// sullo stesso bus del codice la CPU si ferma comunque 1-2s, un thread a bassa priorità
+// non eviterebbe lo stallo.
+// Denaro: credito disponibile + impegnato + resto non ancora reso. Al boot torna tutto
+// a credito: un ordine interrotto dal reset non è stato erogato, il resto non è uscito.
+
+StatoGiornale statoGiornale() {
+    StatoGiornale s;
+    for (int p = 1; p <= GIORNALE_PRODOTTI; p++) s.scorte[p - 1] = (uint8_t)scorte[p];
+    s.credito = credito + cassa.impegnato() + cassa.resto();
+    s.incassato = cassa.incassato();
+    return s;
+}
+
+void giornaleScrivi() {
+    giornaleId = 0;
+    if (!giornale.scrivi()) tlm.record(TLM_GIORNALE_ERRORE, {(int32_t)giornale.posizione(), (int32_t)giornale.stats().errori});
+}
 
-void bleInitComplete(BLE::InitializationCompleteCallbackContext *params) {
-    BLE& ble = params->ble;
-    if (params->error != BLE_ERROR_NONE) return;
+void giornaleAggiorna() {
+    giornale.aggiorna(statoGiornale());
+    if (giornale.inAttesa() && !giornaleId) {
+        giornaleId = hal::call_in_ms(GIORNALE_LOTTO_MS, giornaleScrivi);
+        if (!giornaleId) giornaleScrivi();      // Coda piena: subito
+    }
+}
 
-    vendingServicePtr = new VendingService(ble, 23, 50, 0);
+// Boot: stato dell'ultimo record integro (o formattazione con lo stato iniziale)
+void giornaleRecupera() {
+    bool recuperato = giornale.recupera(statoGiornale());
+    if (recuperato) {
+        const StatoGiornale &s = giornale.stato();
+        for (int p = 1; p <= GIORNALE_PRODOTTI; p++) scorte[p] = s.scorte[p - 1] <= SCORTE_MAX ? s.scorte[p - 1] : SCORTE_MAX;
+        cassa.ripristina(s.credito, s.incassato);
+        creditoResiduo = credito > 0;
+        giornale.aggiorna(statoGiornale());     // Scorte limitate a SCORTE_MAX: corrette al primo lotto
+    }
+    const StatoGiornale &s = giornale.stato();
+    const GiornaleStats &st = giornale.stats();
+    tlm.record(TLM_GIORNALE, {recuperato, s.credito, s.incassato, s.scorte[0], s.scorte[1], s.scorte[2], s.scorte[3],
+                              (int32_t)st.recuperoRecord, (int32_t)st.recuperoByte, giornale.banco(),
+                              (int32_t)giornale.generazione()});
+
+    // Tagli delle monete: senza calibrazione valida ogni moneta vale 1 EUR
+    if (giornale.blob(&calibrazione, sizeof(calibrazione)) == sizeof(calibrazione) && calibrazioneValida(calibrazione)) {
+        tlm.record(TLM_CALIBRA, {CALIBRA_CARICATA, calibrazione.tagli});
+    } else {
+        memset(&calibrazione, 0, sizeof(calibrazione));
+    }
+    pubblicaStato();
+}
 
-    ble.gap().setEventHandler(&gap_handler);
-    ble.gattServer().setEventHandler(&server_handler);
+// Banco successivo del giornale: lettura (~128KB) e, se già usato, erase da 1-2s
+void giornalePreparaBanco() {
+    if (!giornale.bancoDaPreparare() || !giornale.banchi()) return;
+    uint32_t erase = giornale.stats().erase;
+    uint64_t t0 = hal::now_us();
+    giornale.preparaBanco();
+    tlm.record(TLM_GIORNALE_BANCO, {(giornale.banco() + 1) % giornale.banchi(), (int32_t)(giornale.stats().erase - erase),
+                                    (int32_t)((hal::now_us() - t0) / 1000)});
+}
 
-    static uint8_t _adv_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
-    ble::AdvertisingDataBuilder _adv_data_builder(_adv_buffer);
-    _adv_data_builder.setFlags();
-    _adv_data_builder.setName("VendingM");
-    ble.gap().setAdvertisingPayload(ble::LEGACY_ADVERTISING_HANDLE, _adv_data_builder.getAdvertisingData());
-    ble::AdvertisingParameters adv_parameters(ble::advertising_type_t::CONNECTABLE_UNDIRECTED, ble::adv_interval_t(ble::millisecond_t(1000)));
-    ble.gap().setAdvertisingParameters(ble::LEGACY_ADVERTISING_HANDLE, adv_parameters);
-    ble.gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+void giornaleAnticipaBanco();
 
-    event_queue.call_every(100ms, updateMachine);
+// Dispatch sulla coda eventi principale: transizioni, poi schermata aggiornata
+void fsmDispatch() {
+    fsm.dispatch();
+    if (!cassa.coerente()) {
+        tlm.record(TLM_CASSA_ERRATA, {cassa.inserito(), credito, cassa.impegnato(), cassa.incassato(),
+                                      cassa.resto(), cassa.restituito()});
+    }
+    giornaleAggiorna();
+    if (statoCorrente == RIPOSO && !giornaleBancoId && giornale.bancoDaAnticipare()) {
+        giornaleBancoId = hal::call_in_ms(2 * GIORNALE_LOTTO_MS, giornaleAnticipaBanco);
+    }
+    pubblicaStato();
+    segnalaAttivita();
+    disegnaSchermata();
 }
 
-void scheduleBleEventsProcessing(BLE::OnEventsToProcessCallbackContext *context) {
-    event_queue.call(Callback<void()>(&context->ble, &BLE::processEvents));
+// ======================================================================================
+// CAMPIONAMENTO LDR (DMA, blocchi da LDR_BLOCCO campioni)
+// ======================================================================================
+// Il LDR è campionato a LDR_CAMPIONI_HZ da timer + ADC + DMA senza intervento della CPU;
+// a ogni metà del doppio buffer l'ISR passa il blocco alla coda eventi, dove
+// CoinDetector applica baseline e spike detection campione per campione. Anche una
+// moneta in caduta, davanti al sensore per pochi ms, è vista da più campioni; la
+// moneta porta l'istante del primo campione sopra soglia (latenza nel log).
+int ldrUltimo = 0;  // Ultima lettura LDR in % (log di stato)
+
+void monetaLdr(const EventoLdr &ev);
+void ldrBloccoTask();
+
+const CoinDetectorConfig ldrConfig = {
+    1000000 / LDR_CAMPIONI_HZ, LDR_BASELINE_SHIFT,
+    LDR_PERCENTO(SOGLIA_LDR_DELTA_SCATTO), LDR_PERCENTO(SOGLIA_LDR_DELTA_RESET),
+    LDR_DEBOUNCE_SAMPLES, LDR_DEBOUNCE_TIME_US
+};
+CoinDetector rilevatore(ldrConfig, monetaLdr);
+
+uint16_t ldrBuffer[2 * LDR_BLOCCO];             // Doppio buffer scritto dal DMA
+const uint16_t *volatile ldrBloccoPronto = nullptr;  // Metà da elaborare (nullptr = nessuna)
+volatile uint64_t ldrBloccoUs = 0;              // Istante del primo campione della metà
+uint32_t ldrBlocchi = 0;
+volatile uint32_t ldrBlocchiPersi = 0;          // Metà sovrascritte prima dell'elaborazione
+bool monetaContata = false;                     // Moneta davanti al LDR già inviata alla FSM
+
+/**
+ * @brief Metà buffer piena (ISR del DMA): l'elaborazione va sulla coda eventi
+ * L'ultimo campione è appena stato convertito: da lì l'istante del primo.
+ */
+void ldrBloccoIsr(const uint16_t *campioni, int n) {
+    uint64_t t0 = hal::now_us() - (uint64_t)(n - 1) * ldrConfig.periodo_us;
+    bool pendente = (ldrBloccoPronto != nullptr);
+    ldrBloccoPronto = campioni;
+    ldrBloccoUs = t0;
+    if (pendente) {
+        ldrBlocchiPersi = ldrBlocchiPersi + 1;  // La coda eventi non ha ancora letto la precedente
+    } else if (!hal::call(ldrBloccoTask)) {
+        // Coda piena: metà persa, la prossima riprova (altrimenti pendente per sempre)
+        ldrBloccoPronto = nullptr;
+        ldrBlocchiPersi = ldrBlocchiPersi + 1;
+    }
 }
 
-int main() {
-    thread_sleep_for(200);
+void ldrBloccoTask() {
+    hal::critical_enter();
+    const uint16_t *campioni = ldrBloccoPronto;
+    uint64_t t0 = ldrBloccoUs;
+    ldrBloccoPronto = nullptr;
+    hal::critical_exit();
+    if (!campioni) return;
+
+    rilevatore.processa(campioni, LDR_BLOCCO, t0);
+    ldrBlocchi++;
+    ldrUltimo = (int)(rilevatore.ultimo() * 100 / LDR_SCALA);
+    ldrBaseline = (int)(rilevatore.baseline() * 100 / LDR_SCALA);
+}
+
+/**
+ * @brief Moneta confermata o uscita dal sensore (da CoinDetector, coda eventi)
+ * In ERRORE le monete non sono contate; in EROGAZIONE e RESTO solo con la pipeline
+ * (sono credito del cliente successivo, VendLedger).
+ * Il taglio si riconosce solo dall'impulso completo: la moneta va alla FSM all'uscita.
+ */
+void monetaLdr(const EventoLdr &ev) {
+    int val = (int)(ev.valore * 100 / LDR_SCALA);
+    int base = (int)(ev.base * 100 / LDR_SCALA);
+
+    if (ev.moneta) {
+        if (statoCorrente == ERRORE) return;
+        if (!erogazioneInPipeline && (statoCorrente == EROGAZIONE || statoCorrente == RESTO)) return;
+        monetaContata = true;
+        tlm.record(TLM_LDR_MONETA, {val, base, val - base, (int32_t)((hal::now_us() - ev.t_us) / 1000)});
+        return;
+    }
+    if (!monetaContata) return;
+    monetaContata = false;
+    tlm.record(TLM_LDR_RESET, {val, base, val - base});
+
+    int32_t f[MONETA_CARATTERISTICHE];
+    caratteristicheMoneta(ev, f);
+    int32_t durataMs = f[0] / 1000;
+    int32_t picco = (int32_t)(ev.profondita * 100 / LDR_SCALA);
+    int32_t area = (int32_t)((uint64_t)ev.area * 100 / LDR_SCALA);
+
+    if (taglioInCalibrazione != TAGLIO_IGNOTO) {
+        addestramentoAggiungi(addestramento, taglioInCalibrazione, f);
+        tlm.record(TLM_CALIBRA_MONETA, {centesimiTaglio[taglioInCalibrazione],
+                                        addestramento.monete[taglioInCalibrazione], durataMs, picco, area});
+        segnalaAttivita();
+        disegnaSchermata();
+        return;
+    }
+    if (calibrazione.tagli == 0) {
+        moneteTaglio[TAGLIO_NON_CALIBRATO]++;
+        fsm.postIngresso(EV_MONETA, TAGLIO_NON_CALIBRATO, ev.t_us);
+        return;
+    }
+
+    uint32_t distanza;
+    uint8_t taglio = classificaMoneta(calibrazione, f, &distanza);
+    moneteTaglio[(taglio < TAGLI) ? taglio : TAGLI]++;
+    tlm.record(TLM_MONETA_TAGLIO, {(taglio < TAGLI) ? centesimiTaglio[taglio] : 0, durataMs, picco, area,
+                                   (int32_t)distanzaSigma10(distanza)});
+    if (taglio < TAGLI) fsm.postIngresso(EV_MONETA, taglio, ev.t_us);
+    else display.message("MONETA IGNOTA   ", "Nessun credito  ", 1500);
+}
+
+// ======================================================================================
+// PULSANTE E WATCHDOG
+// ======================================================================================
+// Pulsante annulla su interrupt (ButtonInput): EV_ANNULLA accodato dall'ISR del primo
+// fronte con il suo istante, la latenza pressione → azione è quella di EV_ANNULLA
+// nelle statistiche della FSM (prima fino a 100ms di polling più il dispatch).
+
+void tastoFronte() {
+    tastoAnnulla.onFronte();
+}
+
+void tastoFinestra() {
+    tastoAnnulla.onFinestra();
+}
+
+// Pressione accettata (ISR)
+void tastoPremuto(uint64_t t_us) {
+    fsm.postIngresso(EV_ANNULLA, ANNULLA_PULSANTE, t_us);
+}
+
+// Passo del profilo servo (ISR): rampa o fine sosta
+void servoPasso() {
+    erogatore.onPasso();
+}
+
+// Profilo completato (ISR): la FSM controlla il numero dell'avvio (gErogato)
+void erogazioneFinita(uint16_t avvio) {
+    fsm.post(EV_EROGATO, 0, avvio);
+}
+
+// Unico task periodico: watchdog (10s di timeout, kick ogni WATCHDOG_KICK_MS)
+void updateMachine() {
+    hal::watchdog_kick();
+}
+
+/**
+ * @brief Log di stato e aggiornamento BLE temperatura/umidità (ogni 2s)
+ */
+void statusTask() {
+    MachineState m = statoMacchina.leggi();
+    Ambiente a = ambiente.leggi();
+
+    // LOG COMPATTO: record binario (~20 byte invece di ~110 di testo, vedi Telemetry.h)
+    tlm.record(TLM_STATUS, {m.bleConnesso, m.stato, m.credito, m.prodotto, m.prezzo,
+                            ldrUltimo, ldrBaseline, sonar.distance(), a.temp, a.hum,
+                            m.scorte[0], m.scorte[1], m.scorte[2], m.scorte[3]});
+
+    if (vendingServicePtr && a.valido) {
+        vendingServicePtr->updateTemp(a.temp);
+        vendingServicePtr->updateHum(a.hum);
+    } else if (vendingServicePtr) {
+        vendingServicePtr->aggiornaSnapshot(m);    // Presenza/prodotto senza cambio di stato
+    }
+}
+
+// ======================================================================================
+// IDLE PROFONDO
+// ======================================================================================
+// In RIPOSO senza eventi per IDLE_PROFONDO_MS (e app non connessa): tick del watchdog sospeso,
+// retroilluminazione spenta, sonar/DHT/log/display a cadenza ridotta. La CPU dorme tra
+// un'ISR e l'altra (sleep della coda eventi, LOWPOWERTIMER in mbed_app.json).
+// Risveglio: presenza dal sonar (evento FSM), connessione BLE o soglia LDR superata.
+
+int tickId = 0;             // updateMachine (watchdog)
+int statusId = 0;           // statusTask
+int dhtThreadId = 0;
+int displayThreadId = 0;
+int idleTimerId = 0;        // Ingresso in idle profondo
+int ldrIdleId = 0;          // Soglia LDR durante l'idle
+bool idleProfondo = false;
+
+void ldrSveglia();
+
+void entraIdleProfondo() {
+    idleTimerId = 0;
+    // Non durante la calibrazione: il DMA fermo perderebbe le monete veloci
+    if (idleProfondo || statoCorrente != RIPOSO || bleConnesso || taglioInCalibrazione != TAGLIO_IGNOTO) return;
+    idleProfondo = true;
+
+    hal::cancel(tickId);
+    tickId = 0;
+    ldrStream.stop();
+    hal::cancel(statusId);
+    statusId = hal::call_every_ms(IDLE_STATUS_MS, statusTask);
+    ldrIdleId = hal::call_every_ms(IDLE_LDR_MS, ldrSveglia);
+    sonar.setModo(SONAR_IDLE);
+    hal::background_period_ms(dhtThreadId, IDLE_DHT_MS);
+    hal::background_period_ms(displayThreadId, IDLE_DISPLAY_MS);
+    display.backlight(false);
+    tlm.record(TLM_IDLE_ON);
+    giornalePreparaBanco();     // Macchina ferma da IDLE_PROFONDO_MS: l'erase non ruba nulla
+}
+
+void esciIdleProfondo() {
+    if (!idleProfondo) return;
+    idleProfondo = false;
+
+    hal::cancel(ldrIdleId);
+    ldrIdleId = 0;
+    hal::cancel(statusId);
+    statusId = hal::call_every_ms(2000, statusTask);
+    tickId = hal::call_every_ms(WATCHDOG_KICK_MS, updateMachine);
+    ldrStream.start(LDR_CAMPIONI_HZ, ldrBuffer, 2 * LDR_BLOCCO, ldrBloccoIsr);
+    sonar.setModo(modoSonar(statoCorrente));
+    hal::background_period_ms(dhtThreadId, 2000);
+    hal::background_period_ms(displayThreadId, 20);
+    display.backlight(true);
+    tlm.record(TLM_IDLE_OFF);
+}
+
+/**
+ * @brief Pausa tra due clienti con il banco attivo del giornale quasi pieno
+ * Erase dopo il lotto in attesa alle condizioni dell'idle profondo: RIPOSO, nessuna
+ * connessione BLE (la CPU ferma 1-2s sul bus flash bloccherebbe lo stack) né
+ * calibrazione, DMA del LDR fermo per tutto l'erase come in idle (nessun blocco perso
+ * a metà). Con un'app sempre connessa resta l'idle profondo o l'erase sincrono al cambio
+ * banco (eraseSincroni).
+ */
+void giornaleAnticipaBanco() {
+    giornaleBancoId = 0;
+    if (idleProfondo || statoCorrente != RIPOSO || bleConnesso || taglioInCalibrazione != TAGLIO_IGNOTO) return;
+    ldrStream.stop();
+    giornalePreparaBanco();
+    ldrStream.start(LDR_CAMPIONI_HZ, ldrBuffer, 2 * LDR_BLOCCO, ldrBloccoIsr);
+}
+
+/**
+ * @brief Attività (evento FSM, connessione BLE): esce dall'idle profondo e,
+ *        in RIPOSO, riavvia il conteggio verso il prossimo idle
+ */
+void segnalaAttivita() {
+    esciIdleProfondo();
+    if (idleTimerId) hal::cancel(idleTimerId);
+    idleTimerId = (statoCorrente == RIPOSO) ? hal::call_in_ms(IDLE_PROFONDO_MS, entraIdleProfondo) : 0;
+}
+
+/**
+ * @brief Soglia LDR durante l'idle (comparatore software: la F401RE non ha COMP)
+ * Lettura singola con il DMA fermo, solo confronto con la baseline; al superamento
+ * riparte il DMA, che vede la moneta ancora davanti al sensore e la conta come a
+ * macchina sveglia.
+ */
+void ldrSveglia() {
+    hal::watchdog_kick();
+    int ldr_val = (int)(ldr.read() * 100);
+    ldrUltimo = ldr_val;
+    if (ldr_val - ldrBaseline > SOGLIA_LDR_DELTA_SCATTO) {
+        tlm.record(TLM_IDLE_LDR, {ldr_val, ldrBaseline});
+        segnalaAttivita();
+    }
+}
+
+// ======================================================================================
+// BLE INIT
+// ======================================================================================
+void bleReady() {
+    vendingServicePtr = new VendingService(notifiche, 23, 50);
+    fsm.onCambio(cambioStato);
+    fsm.onEsito(esitoEvento);
+    fsm.begin(fsmDispatch);
+    if (credito > 0) avviaTimerCredito();   // Credito dal giornale: reso se nessuno lo usa
+    disegnaSchermata();
+    tickId = hal::call_every_ms(WATCHDOG_KICK_MS, updateMachine);
+    statusId = hal::call_every_ms(2000, statusTask);
+    ldrStream.start(LDR_CAMPIONI_HZ, ldrBuffer, 2 * LDR_BLOCCO, ldrBloccoIsr);
+    segnalaAttivita();
+}
+
+void setupMachine() {
+    pubblicaStato();
+    tlm.begin(hal::start_background(telemetria_drain_thread, TLM_ATTESA_MS));
+    hal::sleep_ms(200);
     servo.period_ms(20);
-    servo.write(0.05f);
+    erogatore.start(servoPasso, erogazioneFinita);
     echo.rise(&echoRise);
     echo.fall(&echoFall);
+    sonar.start(sonarSlot, sonarLettura);
+    tastoAnnulla.start(tastoFronte, tastoFinestra, tastoPremuto);
     lcd.begin();
+    lcd.setTransport(LCD_TX_ASYNC, LCD_I2C_HZ, lcdTxDone);
     lcd.backlight();
     lcd.clear();
-    wait_us(20000);
     lcd.setCursor(0,0);
-    lcd.printf("BOOT v8.14");
+    lcd.printf("BOOT v8.39");
+    lcd.flush();
     buzzer = 1;
-    thread_sleep_for(100);
+    hal::sleep_ms(100);
     buzzer = 0;
-    timerUltimaMoneta.start();
-    ldrDebounceTimer.reset();
 
-    Thread dhtThread(osPriorityLow);
-    dhtThread.start(callback(dht_reader_thread));
+    dhtThreadId = hal::start_background(dht_reader_thread, 2000);
+    displayThreadId = hal::start_background(lcd_render_thread, 20);
+
+    // Scorte, denaro in macchina e calibrazione dal giornale in flash (ms: un blocco da rigiocare)
+    giornaleRecupera();
+
+    hal::watchdog_start(10000);
 
-    watchdog.start(10000);
+    board.ble.begin(ble_listener);
+}
 
-    BLE &ble = BLE::Instance();
-    ble.onEventsToProcess(scheduleBleEventsProcessing);
-    ble.init(bleInitComplete);
-    event_queue.dispatch_forever();
+#if !defined(VENDING_HOST)
+int main() {
+    setupMachine();
+    hal::dispatch_forever();
 }
+#endif